@@ -73,6 +73,8 @@ enum attr_format {
 #define AF_UNPAVED		(1<<12)
 #define AF_FORD			(1<<13)
 #define AF_UNDERGROUND		(1<<14)
+#define AF_SPEED_PROFILE	(1<<15)
+#define AF_SCORE		(1<<16)
 #define AF_HIGH_OCCUPANCY_CAR_ONLY	(1<<18)
 #define AF_DANGEROUS_GOODS	(1<<19)
 #define AF_EMERGENCY_VEHICLES	(1<<20)
@@ -203,6 +203,11 @@ ATTR(nav_status)
 ATTR(virtual_dpi)
 ATTR(real_dpi)
 ATTR(underground_alpha)
+ATTR(alternatives)
+ATTR(alternative)
+ATTR(speed_profile)
+ATTR(departure_time)
+ATTR(score)
 ATTR2(0x00027500,type_rel_abs_begin)
 /* These attributes are int that can either hold relative or absolute values. See the
  * documentation of ATTR_REL_RELSHIFT for details.
@@ -264,6 +269,16 @@ ATTR(no_warning_if_map_file_missing)
 ATTR(duplicate)
 ATTR(has_menu_button)
 ATTR(oneway)
+ATTR(ch_routing)
+ATTR(thread_safe)
+ATTR(graph_thread)
+ATTR(graph_cache)
+ATTR(heuristic)
+ATTR(time_dependent)
+ATTR(cache_hits)
+ATTR(cache_misses)
+ATTR(cache_evictions)
+ATTR(tile_cache_size)
 ATTR2(0x0002ffff,type_int_end)
 ATTR2(0x00030000,type_string_begin)
 ATTR(type)
@@ -404,6 +419,7 @@ ATTR(street_destination)
 ATTR(exit_to)
 ATTR(street_destination_forward)
 ATTR(street_destination_backward)
+ATTR(data_version)
 ATTR2(0x0003ffff,type_string_end)
 ATTR2(0x00040000,type_special_begin)
 ATTR(order)
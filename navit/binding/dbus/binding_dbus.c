@@ -1023,6 +1023,146 @@ static DBusHandlerResult request_route_dup(DBusConnection *connection, DBusMessa
     return request_dup(connection, message, "route", NULL, (void *(*)(void *)) route_dup);
 }
 
+/**
+ * Reads an array of coordinate strings from a DBus message
+ *
+ * @param iter Iterator pointing to the array
+ * @param count Receives the number of coordinates
+ * @returns The coordinates, to be freed with g_free(), or NULL if the array is empty or holds an invalid coordinate
+ */
+static struct pcoord *pcoord_array_get_from_message(DBusMessageIter *iter, int *count) {
+    DBusMessageIter iter2;
+    struct pcoord *ret=NULL;
+    char *coordstring;
+
+    *count=0;
+    dbus_message_iter_recurse(iter, &iter2);
+    while (dbus_message_iter_get_arg_type(&iter2) == DBUS_TYPE_STRING) {
+        ret=g_renew(struct pcoord, ret, *count+1);
+        dbus_message_iter_get_basic(&iter2, &coordstring);
+        if (!pcoord_parse(coordstring, projection_mg, &ret[*count])) {
+            g_free(ret);
+            return NULL;
+        }
+        (*count)++;
+        dbus_message_iter_next(&iter2);
+    }
+    return ret;
+}
+
+static DBusHandlerResult request_route_get_matrix(DBusConnection *connection, DBusMessage *message) {
+    struct route *route;
+    struct pcoord *sources=NULL,*targets=NULL;
+    int source_count=0,target_count=0,*times,*distances;
+    DBusMessageIter iter,iter2;
+    DBusMessage *reply;
+
+    route=object_get_from_message(message, "route");
+    if (! route)
+        return dbus_error_invalid_object_path(connection, message);
+    dbus_message_iter_init(message, &iter);
+    if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY)
+        sources=pcoord_array_get_from_message(&iter, &source_count);
+    if (dbus_message_iter_next(&iter) && dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY)
+        targets=pcoord_array_get_from_message(&iter, &target_count);
+    if (!sources || !targets) {
+        g_free(sources);
+        g_free(targets);
+        return dbus_error_invalid_parameter(connection, message);
+    }
+    times=g_new(int, source_count*target_count);
+    distances=g_new(int, source_count*target_count);
+    if (!route_get_matrix(route, sources, source_count, targets, target_count, times, distances)) {
+        g_free(sources);
+        g_free(targets);
+        g_free(times);
+        g_free(distances);
+        return dbus_error_no_data_available(connection, message);
+    }
+    reply = dbus_message_new_method_return(message);
+    dbus_message_iter_init_append(reply, &iter);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_INT32_AS_STRING, &iter2);
+    dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &times, source_count*target_count);
+    dbus_message_iter_close_container(&iter, &iter2);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_INT32_AS_STRING, &iter2);
+    dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &distances, source_count*target_count);
+    dbus_message_iter_close_container(&iter, &iter2);
+    dbus_connection_send (connection, reply, NULL);
+    dbus_message_unref (reply);
+    g_free(sources);
+    g_free(targets);
+    g_free(times);
+    g_free(distances);
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/**
+ * Calculates an isochrone, see route_set_isochrone()
+ *
+ * The arguments are the starting point as a coordinate string (empty for the vehicle position) and the travel times
+ * of the bands in seconds. The reply holds the travel time of the band of each polygon in tenths of seconds, the
+ * number of coordinates of each polygon, and the coordinates of all polygons as x and y in the mg projection.
+ */
+static DBusHandlerResult request_route_set_isochrone(DBusConnection *connection, DBusMessage *message) {
+    struct route *route;
+    struct pcoord center;
+    struct coord *c;
+    char *centerstring;
+    dbus_int32_t *bands,*times,*counts,*coords;
+    int i,j,k,count,coord_count=0,polygon_count;
+    DBusMessageIter iter,iter2;
+    DBusMessage *reply;
+
+    route=object_get_from_message(message, "route");
+    if (! route)
+        return dbus_error_invalid_object_path(connection, message);
+    dbus_message_iter_init(message, &iter);
+    if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING)
+        return dbus_error_invalid_parameter(connection, message);
+    dbus_message_iter_get_basic(&iter, &centerstring);
+    if (*centerstring && !pcoord_parse(centerstring, projection_mg, &center))
+        return dbus_error_invalid_parameter(connection, message);
+    if (!dbus_message_iter_next(&iter) || dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY
+            || dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_INT32)
+        return dbus_error_invalid_parameter(connection, message);
+    dbus_message_iter_recurse(&iter, &iter2);
+    dbus_message_iter_get_fixed_array(&iter2, &bands, &count);
+    polygon_count=route_set_isochrone(route, *centerstring ? &center : NULL, bands, count);
+    if (polygon_count < 0)
+        return dbus_error_no_data_available(connection, message);
+    for (i = 0 ; i < polygon_count ; i++) {
+        route_get_isochrone_polygon(route, i, NULL, &count);
+        coord_count+=count;
+    }
+    times=g_new(dbus_int32_t, polygon_count);
+    counts=g_new(dbus_int32_t, polygon_count);
+    coords=g_new(dbus_int32_t, 2*coord_count);
+    for (i = 0, k = 0 ; i < polygon_count ; i++) {
+        c=route_get_isochrone_polygon(route, i, &times[i], &counts[i]);
+        for (j = 0 ; j < counts[i] ; j++) {
+            coords[k++]=c[j].x;
+            coords[k++]=c[j].y;
+        }
+    }
+    reply = dbus_message_new_method_return(message);
+    dbus_message_iter_init_append(reply, &iter);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_INT32_AS_STRING, &iter2);
+    dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &times, polygon_count);
+    dbus_message_iter_close_container(&iter, &iter2);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_INT32_AS_STRING, &iter2);
+    dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &counts, polygon_count);
+    dbus_message_iter_close_container(&iter, &iter2);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_INT32_AS_STRING, &iter2);
+    dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &coords, 2*coord_count);
+    dbus_message_iter_close_container(&iter, &iter2);
+    dbus_connection_send (connection, reply, NULL);
+    dbus_message_unref (reply);
+    g_free(times);
+    g_free(counts);
+    g_free(coords);
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 
 /* navit */
 
@@ -2038,6 +2178,8 @@ struct dbus_method {
     {".route",    "set_attr",          "sv",      "attribute,value",                         "",    "",  request_route_set_attr},
     {".route",    "add_attr",          "sv",      "attribute,value",                         "",    "",  request_route_add_attr},
     {".route",    "remove_attr",       "sv",      "attribute,value",                         "",    "",  request_route_remove_attr},
+    {".route",    "get_matrix",        "asas",    "sources,targets",                         "aiai","times,distances",  request_route_get_matrix},
+    {".route",    "set_isochrone",     "sai",     "center,times",                            "aiaiai","times,counts,coordinates",  request_route_set_isochrone},
     {".route",    "destroy",           "",        "",                                        "",    "",  request_route_destroy},
     {".route",    "dup",               "",        "",                                        "",    "",  request_route_dup},
     {".search_list","destroy",         "",        "",                                        "",   "",      request_search_list_destroy},
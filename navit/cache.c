@@ -4,8 +4,15 @@
 #endif
 #include <string.h>
 #include "debug.h"
+#include "thread.h"
 #include "cache.h"
 
+/** Maximum number of shards of a cache */
+#define CACHE_SHARDS 16
+
+/** Minimum size of a shard in bytes, smaller caches get fewer shards */
+#define CACHE_SHARD_MIN_SIZE (256*1024)
+
 struct cache_entry {
     int usage;
     unsigned int size;
@@ -20,16 +27,32 @@ struct cache_entry_list {
     int size;
 };
 
-struct cache {
+struct cache_shard {
     struct cache_entry_list t1,b1,t2,b2,*insert;
     int size,id_size,entry_size;
     int t1_target;
     unsigned int misses;
     unsigned int hits;
     GHashTable *hash;
+    struct cache_stats stats;   /**< Counters for `cache_get_stats()`, unlike `hits` and `misses` never reset */
+    struct thread_lock *lock;   /**< Serializes all access to the shard */
+};
+
+/**
+ * @brief A cache whose entries are spread over several independently locked shards by the hash of their id
+ *
+ * Each shard is an ARC cache of its own, with an equal part of the size of the cache. All functions may be called
+ * from any thread; threads only wait for each other when they access the same shard.
+ */
+struct cache {
+    int id_size;                                /**< Size of the ids in ints */
+    int entry_size;                             /**< Size of an entry without its data */
+    GHashFunc hash;                             /**< Hash function for ids, also selects the shard */
+    int count;                                  /**< Number of shards */
+    struct cache_shard *shards[CACHE_SHARDS];   /**< The shards */
 };
 
-static void cache_entry_dump(struct cache *cache, struct cache_entry *entry) {
+static void cache_entry_dump(struct cache_shard *cache, struct cache_entry *entry) {
     int i,size;
     dbg(lvl_debug,"Usage: %d size %d",entry->usage, entry->size);
     if (cache)
@@ -41,7 +64,7 @@ static void cache_entry_dump(struct cache *cache, struct cache_entry *entry) {
     }
 }
 
-static void cache_list_dump(char *str, struct cache *cache, struct cache_entry_list *list) {
+static void cache_list_dump(char *str, struct cache_shard *cache, struct cache_entry_list *list) {
     struct cache_entry *first=list->first;
     dbg(lvl_debug,"dump %s %d",str, list->size);
     while (first) {
@@ -78,9 +101,8 @@ static gboolean cache_equal20(gconstpointer a, gconstpointer b) {
            ida[4] == idb[4]);
 }
 
-struct cache *
-cache_new(int id_size, int size) {
-    struct cache *cache=g_new0(struct cache, 1);
+static struct cache_shard *cache_shard_new(int id_size, int size) {
+    struct cache_shard *cache=g_new0(struct cache_shard, 1);
 
     cache->id_size=id_size/4;
     cache->entry_size=cache->id_size*sizeof(int)+sizeof(struct cache_entry);
@@ -95,16 +117,35 @@ cache_new(int id_size, int size) {
     default:
         dbg(lvl_error,"cache with id_size of %d not supported", id_size);
         g_free(cache);
-        cache=NULL;
+        return NULL;
     }
+    cache->lock=thread_lock_new();
     return cache;
 }
 
-void cache_resize(struct cache *cache, int size) {
+static void cache_list_destroy(struct cache_entry_list *list) {
+    struct cache_entry *entry,*next;
+    for (entry = list->first ; entry ; entry = next) {
+        next=entry->next;
+        g_slice_free1(entry->size, entry);
+    }
+}
+
+static void cache_shard_destroy(struct cache_shard *cache) {
+    cache_list_destroy(&cache->t1);
+    cache_list_destroy(&cache->b1);
+    cache_list_destroy(&cache->t2);
+    cache_list_destroy(&cache->b2);
+    g_hash_table_destroy(cache->hash);
+    thread_lock_destroy(cache->lock);
+    g_free(cache);
+}
+
+static void cache_shard_resize(struct cache_shard *cache, int size) {
     cache->size=size;
 }
 
-static void cache_insert_mru(struct cache *cache, struct cache_entry_list *list, struct cache_entry *entry) {
+static void cache_insert_mru(struct cache_shard *cache, struct cache_entry_list *list, struct cache_entry *entry) {
     entry->prev=NULL;
     entry->next=list->first;
     entry->where=list;
@@ -130,7 +171,7 @@ static void cache_remove_from_list(struct cache_entry_list *list, struct cache_e
     list->size-=entry->size;
 }
 
-static void cache_remove(struct cache *cache, struct cache_entry *entry) {
+static void cache_remove(struct cache_shard *cache, struct cache_entry *entry) {
     dbg(lvl_debug,"remove 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
     g_hash_table_remove(cache->hash, (gpointer)(entry->id));
     g_slice_free1(entry->size, entry);
@@ -149,7 +190,7 @@ static struct cache_entry *cache_remove_lru_helper(struct cache_entry_list *list
     return last;
 }
 
-static struct cache_entry *cache_remove_lru(struct cache *cache, struct cache_entry_list *list) {
+static struct cache_entry *cache_remove_lru(struct cache_shard *cache, struct cache_entry_list *list) {
     struct cache_entry *last;
     int seen=0;
     while (list->last && list->last->usage && seen < list->size) {
@@ -163,13 +204,15 @@ static struct cache_entry *cache_remove_lru(struct cache *cache, struct cache_en
     dbg(lvl_debug,"removing %d", last->id[0]);
     cache_remove_lru_helper(list);
     if (cache) {
+        if (list == &cache->t1 || list == &cache->t2)
+            cache->stats.evictions++;
         cache_remove(cache, last);
         return NULL;
     }
     return last;
 }
 
-void *cache_entry_new(struct cache *cache, void *id, int size) {
+static void *cache_shard_entry_new(struct cache_shard *cache, void *id, int size) {
     struct cache_entry *ret;
     size+=cache->entry_size;
     cache->misses+=size;
@@ -180,13 +223,13 @@ void *cache_entry_new(struct cache *cache, void *id, int size) {
     return &ret->id[cache->id_size];
 }
 
-void cache_entry_destroy(struct cache *cache, void *data) {
+static void cache_shard_entry_destroy(struct cache_shard *cache, void *data) {
     struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
     dbg(lvl_debug,"destroy 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
     entry->usage--;
 }
 
-static struct cache_entry *cache_trim(struct cache *cache, struct cache_entry *entry) {
+static struct cache_entry *cache_trim(struct cache_shard *cache, struct cache_entry *entry) {
     struct cache_entry *new_entry;
     dbg(lvl_debug,"trim 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
     dbg(lvl_debug,"Trim %x from %d -> %d", entry->id[0], entry->size, cache->size);
@@ -206,17 +249,19 @@ static struct cache_entry *cache_trim(struct cache *cache, struct cache_entry *e
     return new_entry;
 }
 
-static struct cache_entry *cache_move(struct cache *cache, struct cache_entry_list *old, struct cache_entry_list *new) {
+static struct cache_entry *cache_move(struct cache_shard *cache, struct cache_entry_list *old,
+                                      struct cache_entry_list *new) {
     struct cache_entry *entry;
     entry=cache_remove_lru(NULL, old);
     if (! entry)
         return NULL;
     entry=cache_trim(cache, entry);
     cache_insert_mru(NULL, new, entry);
+    cache->stats.evictions++;
     return entry;
 }
 
-static int cache_replace(struct cache *cache) {
+static int cache_replace(struct cache_shard *cache) {
     if (cache->t1.size >= MAX(1,cache->t1_target)) {
         dbg(lvl_debug,"replace 12");
         if (!cache_move(cache, &cache->t1, &cache->b1))
@@ -228,14 +273,14 @@ static int cache_replace(struct cache *cache) {
     }
 #if 0
     if (! entry) {
-        cache_dump(cache);
+        cache_shard_dump(cache);
         exit(0);
     }
 #endif
     return 1;
 }
 
-void cache_flush(struct cache *cache, void *id) {
+static void cache_shard_flush(struct cache_shard *cache, void *id) {
     struct cache_entry *entry=g_hash_table_lookup(cache->hash, id);
     if (entry) {
         cache_remove_from_list(entry->where, entry);
@@ -243,7 +288,7 @@ void cache_flush(struct cache *cache, void *id) {
     }
 }
 
-void cache_flush_data(struct cache *cache, void *data) {
+static void cache_shard_flush_data(struct cache_shard *cache, void *data) {
     struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
     if (entry) {
         cache_remove_from_list(entry->where, entry);
@@ -252,12 +297,13 @@ void cache_flush_data(struct cache *cache, void *data) {
 }
 
 
-void *cache_lookup(struct cache *cache, void *id) {
+static void *cache_shard_lookup(struct cache_shard *cache, void *id) {
     struct cache_entry *entry;
 
     dbg(lvl_debug,"get %d", ((int *)id)[0]);
     entry=g_hash_table_lookup(cache->hash, id);
     if (entry == NULL) {
+        cache->stats.misses++;
         cache->insert=&cache->t1;
 #ifdef DEBUG_CACHE
         fprintf(stderr,"-");
@@ -267,6 +313,7 @@ void *cache_lookup(struct cache *cache, void *id) {
     }
     dbg(lvl_debug,"found 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
     if (entry->where == &cache->t1 || entry->where == &cache->t2) {
+        cache->stats.hits++;
         cache->hits+=entry->size;
 #ifdef DEBUG_CACHE
         if (entry->where == &cache->t1)
@@ -280,6 +327,7 @@ void *cache_lookup(struct cache *cache, void *id) {
         entry->usage++;
         return &entry->id[cache->id_size];
     } else {
+        cache->stats.misses++;
         if (entry->where == &cache->b1) {
 #ifdef DEBUG_CACHE
             fprintf(stderr,"m");
@@ -304,7 +352,7 @@ void *cache_lookup(struct cache *cache, void *id) {
     }
 }
 
-void cache_insert(struct cache *cache, void *data) {
+static void cache_shard_insert(struct cache_shard *cache, void *data) {
     struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
     dbg(lvl_debug,"insert 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
     if (cache->insert == &cache->t1) {
@@ -326,13 +374,13 @@ void cache_insert(struct cache *cache, void *data) {
     cache_insert_mru(cache, cache->insert, entry);
 }
 
-void *cache_insert_new(struct cache *cache, void *id, int size) {
-    void *data=cache_entry_new(cache, id, size);
-    cache_insert(cache, data);
+static void *cache_shard_insert_new(struct cache_shard *cache, void *id, int size) {
+    void *data=cache_shard_entry_new(cache, id, size);
+    cache_shard_insert(cache, data);
     return data;
 }
 
-static void cache_stats(struct cache *cache) {
+static void cache_stats(struct cache_shard *cache) {
     dbg(lvl_debug,"hits %d misses %d hitratio %d size %d entry_size %d id_size %d T1 target %d", cache->hits, cache->misses,
         cache->hits*100/(cache->hits+cache->misses), cache->size, cache->entry_size, cache->id_size, cache->t1_target);
     dbg(lvl_debug,"T1:%d B1:%d T2:%d B2:%d", cache->t1.size, cache->b1.size, cache->t2.size, cache->b2.size);
@@ -340,7 +388,7 @@ static void cache_stats(struct cache *cache) {
     cache->misses=0;
 }
 
-void cache_dump(struct cache *cache) {
+static void cache_shard_dump(struct cache_shard *cache) {
     cache_stats(cache);
     cache_list_dump("T1", cache, &cache->t1);
     cache_list_dump("B1", cache, &cache->b1);
@@ -349,3 +397,196 @@ void cache_dump(struct cache *cache) {
     dbg(lvl_debug,"dump end");
 }
 
+
+/**
+ * @brief Creates a new cache
+ *
+ * @param id_size The size of the ids in bytes, 4 or 20
+ * @param size The size of the cache in bytes, which also determines the number of shards
+ *
+ * @return The cache, or NULL if `id_size` is not supported
+ */
+struct cache *cache_new(int id_size, int size) {
+    struct cache *cache=g_new0(struct cache, 1);
+    int i;
+
+    cache->count=MAX(1, MIN(size/CACHE_SHARD_MIN_SIZE, CACHE_SHARDS));
+    for (i = 0 ; i < cache->count ; i++) {
+        cache->shards[i]=cache_shard_new(id_size, size/cache->count);
+        if (!cache->shards[i]) {
+            cache->count=i;
+            cache_destroy(cache);
+            return NULL;
+        }
+    }
+    cache->id_size=cache->shards[0]->id_size;
+    cache->entry_size=cache->shards[0]->entry_size;
+    cache->hash=id_size == 4 ? cache_hash4 : cache_hash20;
+    return cache;
+}
+
+/**
+ * @brief Destroys a cache and all its entries
+ *
+ * No data of the cache may be in use any more.
+ */
+void cache_destroy(struct cache *cache) {
+    int i;
+    for (i = 0 ; i < cache->count ; i++)
+        cache_shard_destroy(cache->shards[i]);
+    g_free(cache);
+}
+
+static struct cache_shard *cache_get_shard(struct cache *cache, void *id) {
+    return cache->shards[cache->hash(id) % cache->count];
+}
+
+static struct cache_shard *cache_get_shard_data(struct cache *cache, void *data) {
+    return cache_get_shard(cache, (int *)data-cache->id_size);
+}
+
+/**
+ * @brief Changes the size of a cache
+ *
+ * The number of shards stays the same, only their sizes change.
+ */
+void cache_resize(struct cache *cache, int size) {
+    int i;
+    for (i = 0 ; i < cache->count ; i++) {
+        thread_lock_acquire(cache->shards[i]->lock);
+        cache_shard_resize(cache->shards[i], size/cache->count);
+        thread_lock_release(cache->shards[i]->lock);
+    }
+}
+
+void *cache_entry_new(struct cache *cache, void *id, int size) {
+    struct cache_shard *shard=cache_get_shard(cache, id);
+    void *ret;
+    thread_lock_acquire(shard->lock);
+    ret=cache_shard_entry_new(shard, id, size);
+    thread_lock_release(shard->lock);
+    return ret;
+}
+
+void cache_entry_destroy(struct cache *cache, void *data) {
+    struct cache_shard *shard=cache_get_shard_data(cache, data);
+    thread_lock_acquire(shard->lock);
+    cache_shard_entry_destroy(shard, data);
+    thread_lock_release(shard->lock);
+}
+
+/**
+ * @brief Looks up an entry
+ *
+ * On a miss, the shard remembers whether the id was seen recently, which decides where the next `cache_insert()`
+ * into the shard puts its entry. With several threads, another miss in the same shard may come in between, which
+ * only affects the replacement policy.
+ *
+ * @return The data of the entry, to be released with `cache_entry_destroy()`, or NULL if it is not in the cache
+ */
+void *cache_lookup(struct cache *cache, void *id) {
+    struct cache_shard *shard=cache_get_shard(cache, id);
+    void *ret;
+    thread_lock_acquire(shard->lock);
+    ret=cache_shard_lookup(shard, id);
+    thread_lock_release(shard->lock);
+    return ret;
+}
+
+void cache_insert(struct cache *cache, void *data) {
+    struct cache_shard *shard=cache_get_shard_data(cache, data);
+    thread_lock_acquire(shard->lock);
+    cache_shard_insert(shard, data);
+    thread_lock_release(shard->lock);
+}
+
+void *cache_insert_new(struct cache *cache, void *id, int size) {
+    struct cache_shard *shard=cache_get_shard(cache, id);
+    void *ret;
+    thread_lock_acquire(shard->lock);
+    ret=cache_shard_insert_new(shard, id, size);
+    thread_lock_release(shard->lock);
+    return ret;
+}
+
+/**
+ * @brief Inserts a copy of some data into a cache, unless another thread has inserted the same id in the meantime
+ *
+ * This is meant to be called after a `cache_lookup()` missed and the data was produced without holding any lock, so
+ * other threads never see a partially filled entry.
+ *
+ * @param cache The cache
+ * @param id The id of the entry
+ * @param data The data to copy
+ * @param size The size of `data`
+ *
+ * @return The data of the entry, to be released with `cache_entry_destroy()`
+ */
+void *cache_insert_copy(struct cache *cache, void *id, void *data, int size) {
+    struct cache_shard *shard=cache_get_shard(cache, id);
+    struct cache_entry *entry;
+    void *ret;
+    thread_lock_acquire(shard->lock);
+    entry=g_hash_table_lookup(shard->hash, id);
+    if (entry && (entry->where == &shard->t1 || entry->where == &shard->t2)) {
+        cache_remove_from_list(entry->where, entry);
+        cache_insert_mru(NULL, &shard->t2, entry);
+        entry->usage++;
+        ret=&entry->id[shard->id_size];
+    } else {
+        if (entry) {
+            /* the id became a ghost entry again after the lookup of this thread */
+            cache_remove_from_list(entry->where, entry);
+            cache_remove(shard, entry);
+        }
+        ret=cache_shard_insert_new(shard, id, size);
+        memcpy(ret, data, size);
+    }
+    thread_lock_release(shard->lock);
+    return ret;
+}
+
+void cache_flush(struct cache *cache, void *id) {
+    struct cache_shard *shard=cache_get_shard(cache, id);
+    thread_lock_acquire(shard->lock);
+    cache_shard_flush(shard, id);
+    thread_lock_release(shard->lock);
+}
+
+void cache_flush_data(struct cache *cache, void *data) {
+    struct cache_shard *shard=cache_get_shard_data(cache, data);
+    thread_lock_acquire(shard->lock);
+    cache_shard_flush_data(shard, data);
+    thread_lock_release(shard->lock);
+}
+
+/**
+ * @brief Returns the statistics of a cache, summed up over all shards
+ *
+ * @param cache The cache
+ * @param stats Receives the statistics
+ */
+void cache_get_stats(struct cache *cache, struct cache_stats *stats) {
+    struct cache_shard *shard;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0 ; i < cache->count ; i++) {
+        shard=cache->shards[i];
+        thread_lock_acquire(shard->lock);
+        stats->hits+=shard->stats.hits;
+        stats->misses+=shard->stats.misses;
+        stats->evictions+=shard->stats.evictions;
+        stats->size+=shard->t1.size+shard->t2.size;
+        thread_lock_release(shard->lock);
+    }
+}
+
+void cache_dump(struct cache *cache) {
+    int i;
+    for (i = 0 ; i < cache->count ; i++) {
+        thread_lock_acquire(cache->shards[i]->lock);
+        cache_shard_dump(cache->shards[i]);
+        thread_lock_release(cache->shards[i]->lock);
+    }
+}
@@ -1,14 +1,28 @@
 struct cache_entry;
 struct cache;
+
+/**
+ * @brief Statistics of a cache
+ */
+struct cache_stats {
+    long hits;          /**< Number of lookups which found the entry */
+    long misses;        /**< Number of lookups which did not find the entry */
+    long evictions;     /**< Number of entries dropped to stay within the size of the cache */
+    long size;          /**< Number of bytes held by the cache */
+};
+
 /* prototypes */
 struct cache *cache_new(int id_size, int size);
+void cache_destroy(struct cache *cache);
 void cache_resize(struct cache *cache, int size);
 void *cache_entry_new(struct cache *cache, void *id, int size);
 void cache_entry_destroy(struct cache *cache, void *data);
 void *cache_lookup(struct cache *cache, void *id);
 void cache_insert(struct cache *cache, void *data);
 void *cache_insert_new(struct cache *cache, void *id, int size);
+void *cache_insert_copy(struct cache *cache, void *id, void *data, int size);
 void cache_flush(struct cache *cache, void *id);
 void cache_dump(struct cache *cache);
 void cache_flush_data(struct cache *cache, void *data);
+void cache_get_stats(struct cache *cache, struct cache_stats *stats);
 /* end of prototypes */
@@ -74,7 +74,14 @@ static void config_new_int(void) {
 }
 
 int config_get_attr(struct config *this_, enum attr_type type, struct attr *attr, struct attr_iter *iter) {
-    return attr_generic_get_attr(this_->attrs, NULL, type, attr, iter);
+    switch (type) {
+    case attr_cache_hits:
+    case attr_cache_misses:
+    case attr_cache_evictions:
+        return file_get_cache_attr(NULL, type, attr);
+    default:
+        return attr_generic_get_attr(this_->attrs, NULL, type, attr, iter);
+    }
 }
 
 static int config_set_attr_int(struct config *this_, struct attr *attr) {
@@ -0,0 +1,272 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief An indexed d-ary min-heap with integer keys
+ *
+ * This is the priority queue used by the routing code. Compared to a Fibonacci heap, it keeps all elements in a
+ * single array, which is only ever grown and is reused when the heap is cleared. Keys and data pointers are stored
+ * next to each other, so that sifting touches only a few cache lines, and keys can be raised as well as lowered
+ * in place.
+ */
+
+#include <limits.h>
+#include <glib.h>
+#include "dheap.h"
+
+/** Number of children of each node */
+#define DHEAP_ARITY 4
+
+/** Initial number of elements for which memory is allocated */
+#define DHEAP_INITIAL_SIZE 256
+
+/** The index slot of a data object, which holds its position in the heap plus one */
+#define DHEAP_INDEX(heap, data) (*(int *)((char *)(data) + (heap)->index_offset))
+
+/**
+ * @brief An element of the heap
+ */
+struct dheap_el {
+    int key;                    /**< The key by which elements are ordered */
+    void *data;                 /**< The data object */
+};
+
+/**
+ * @brief A heap
+ */
+struct dheap {
+    struct dheap_el *el;        /**< Elements of the heap, `el[0]` is the element with the lowest key */
+    int count;                  /**< Number of elements on the heap */
+    int size;                   /**< Number of elements for which memory is allocated */
+    int index_offset;           /**< Offset of the index slot within the data objects */
+};
+
+/**
+ * @brief Creates a new, empty heap
+ *
+ * @param index_offset Offset of an `int` member in the data objects which will be placed on this heap. The heap
+ * uses it to keep track of the position of each object. It can be obtained with `offsetof()`.
+ *
+ * @return The new heap
+ */
+struct dheap *dheap_new(int index_offset) {
+    struct dheap *ret=g_new0(struct dheap, 1);
+    ret->index_offset=index_offset;
+    return ret;
+}
+
+/**
+ * @brief Destroys a heap
+ *
+ * Objects remaining on the heap are removed from it first, i.e. their index slots are reset. The objects
+ * themselves are not freed.
+ *
+ * @param heap The heap, can be NULL
+ */
+void dheap_destroy(struct dheap *heap) {
+    if (!heap)
+        return;
+    dheap_clear(heap);
+    g_free(heap->el);
+    g_free(heap);
+}
+
+/**
+ * @brief Removes all objects from a heap
+ *
+ * Memory allocated by the heap is kept for reuse.
+ *
+ * @param heap The heap
+ */
+void dheap_clear(struct dheap *heap) {
+    int i;
+    for (i = 0 ; i < heap->count ; i++)
+        DHEAP_INDEX(heap, heap->el[i].data)=0;
+    heap->count=0;
+}
+
+/**
+ * @brief Returns the number of objects on a heap
+ *
+ * @param heap The heap
+ */
+int dheap_size(struct dheap *heap) {
+    return heap->count;
+}
+
+/**
+ * @brief Whether an object is a member of a heap
+ *
+ * @param heap The heap
+ * @param data The object
+ */
+int dheap_contains(struct dheap *heap, void *data) {
+    return DHEAP_INDEX(heap, data) != 0;
+}
+
+/**
+ * @brief Places an element at a given position and updates the index slot of its object
+ */
+static inline void dheap_set(struct dheap *heap, int pos, struct dheap_el el) {
+    heap->el[pos]=el;
+    DHEAP_INDEX(heap, el.data)=pos+1;
+}
+
+/**
+ * @brief Moves the element at a given position towards the root until the heap property is restored
+ */
+static void dheap_sift_up(struct dheap *heap, int pos) {
+    struct dheap_el el=heap->el[pos];
+    int parent;
+
+    while (pos > 0) {
+        parent=(pos-1)/DHEAP_ARITY;
+        if (heap->el[parent].key <= el.key)
+            break;
+        dheap_set(heap, pos, heap->el[parent]);
+        pos=parent;
+    }
+    dheap_set(heap, pos, el);
+}
+
+/**
+ * @brief Moves the element at a given position away from the root until the heap property is restored
+ */
+static void dheap_sift_down(struct dheap *heap, int pos) {
+    struct dheap_el el=heap->el[pos];
+    int child, last, min;
+
+    for (;;) {
+        child=pos*DHEAP_ARITY+1;
+        if (child >= heap->count)
+            break;
+        last=MIN(child+DHEAP_ARITY, heap->count);
+        min=child;
+        for (child++ ; child < last ; child++)
+            if (heap->el[child].key < heap->el[min].key)
+                min=child;
+        if (heap->el[min].key >= el.key)
+            break;
+        dheap_set(heap, pos, heap->el[min]);
+        pos=min;
+    }
+    dheap_set(heap, pos, el);
+}
+
+/**
+ * @brief Inserts an object into a heap or changes its key
+ *
+ * If the object is not a member of the heap, it is added with the given key. Otherwise its key is changed, which
+ * may be higher or lower than the previous one.
+ *
+ * @param heap The heap
+ * @param data The object
+ * @param key The key
+ */
+void dheap_update(struct dheap *heap, void *data, int key) {
+    int pos=DHEAP_INDEX(heap, data)-1;
+    int old;
+
+    if (pos < 0) {
+        if (heap->count == heap->size) {
+            heap->size=heap->size ? heap->size*2 : DHEAP_INITIAL_SIZE;
+            heap->el=g_renew(struct dheap_el, heap->el, heap->size);
+        }
+        pos=heap->count++;
+        heap->el[pos].key=key;
+        heap->el[pos].data=data;
+        dheap_sift_up(heap, pos);
+        return;
+    }
+    old=heap->el[pos].key;
+    heap->el[pos].key=key;
+    if (key < old)
+        dheap_sift_up(heap, pos);
+    else if (key > old)
+        dheap_sift_down(heap, pos);
+}
+
+/**
+ * @brief Removes an object from a heap
+ *
+ * Nothing happens if the object is not a member of the heap.
+ *
+ * @param heap The heap
+ * @param data The object
+ */
+void dheap_remove(struct dheap *heap, void *data) {
+    int pos=DHEAP_INDEX(heap, data)-1;
+    int key;
+
+    if (pos < 0)
+        return;
+    DHEAP_INDEX(heap, data)=0;
+    if (pos == --heap->count)
+        return;
+    key=heap->el[pos].key;
+    dheap_set(heap, pos, heap->el[heap->count]);
+    if (heap->el[pos].key < key)
+        dheap_sift_up(heap, pos);
+    else
+        dheap_sift_down(heap, pos);
+}
+
+/**
+ * @brief Returns the object with the lowest key without removing it
+ *
+ * @param heap The heap
+ *
+ * @return The object, or NULL if the heap is empty
+ */
+void *dheap_min(struct dheap *heap) {
+    return heap->count ? heap->el[0].data : NULL;
+}
+
+/**
+ * @brief Returns the lowest key on a heap
+ *
+ * @param heap The heap
+ *
+ * @return The key, or `INT_MAX` if the heap is empty
+ */
+int dheap_minkey(struct dheap *heap) {
+    return heap->count ? heap->el[0].key : INT_MAX;
+}
+
+/**
+ * @brief Removes the object with the lowest key from a heap and returns it
+ *
+ * @param heap The heap
+ *
+ * @return The object, or NULL if the heap is empty
+ */
+void *dheap_extractmin(struct dheap *heap) {
+    void *ret;
+
+    if (!heap->count)
+        return NULL;
+    ret=heap->el[0].data;
+    DHEAP_INDEX(heap, ret)=0;
+    if (--heap->count) {
+        dheap_set(heap, 0, heap->el[heap->count]);
+        dheap_sift_down(heap, 0);
+    }
+    return ret;
+}
@@ -0,0 +1,58 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief An indexed d-ary min-heap with integer keys
+ *
+ * The heap stores pointers to arbitrary data objects. Each object must reserve an `int` member (the index slot),
+ * in which the heap keeps track of the object's position. This allows the key of any object on the heap to be
+ * changed in place, in either direction, without searching the heap and without allocating memory. An index slot
+ * of 0 means the object is not on the heap; objects should therefore be zero-initialized.
+ *
+ * An object can only be a member of one heap per index slot at any time.
+ */
+
+#ifndef NAVIT_DHEAP_H
+#define NAVIT_DHEAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct dheap;
+
+/* prototypes */
+struct dheap *dheap_new(int index_offset);
+void dheap_destroy(struct dheap *heap);
+void dheap_clear(struct dheap *heap);
+int dheap_size(struct dheap *heap);
+int dheap_contains(struct dheap *heap, void *data);
+void dheap_update(struct dheap *heap, void *data, int key);
+void dheap_remove(struct dheap *heap, void *data);
+void *dheap_min(struct dheap *heap);
+int dheap_minkey(struct dheap *heap);
+void *dheap_extractmin(struct dheap *heap);
+/* end of prototypes */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Compares the performance of the d-ary heap with the Fibonacci heap from fib-1.1
+ *
+ * Both heaps are fed the same sequence of operations, modeled after the LPA* loop in route.c: points are inserted,
+ * their keys are repeatedly raised or lowered, some are removed, and eventually the heap is drained. Since fib-1.1
+ * cannot raise keys, a raised key is emulated by removing and re-inserting the element, as route.c used to do.
+ *
+ * Usage: dheap_benchmark [elements [rounds]]
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "fib.h"
+#include "dheap.h"
+
+struct bench_node {
+    int heap_idx;
+    struct fibheap_el *el;
+    int key;
+};
+
+enum bench_op {
+    bench_op_update,
+    bench_op_remove,
+    bench_op_extract
+};
+
+struct bench_step {
+    enum bench_op op;
+    int node;
+    int key;
+};
+
+static unsigned int bench_seed=1;
+
+static int bench_rand(void) {
+    bench_seed=bench_seed*1103515245+12345;
+    return (bench_seed >> 1) & 0x3fffffff;
+}
+
+static struct bench_step *bench_steps_new(int elements, int rounds, int *count) {
+    struct bench_step *ret=malloc(sizeof(struct bench_step)*elements*(rounds+2));
+    int i,n=0;
+
+    for (i = 0 ; i < elements ; i++) {
+        ret[n].op=bench_op_update;
+        ret[n].node=i;
+        ret[n++].key=bench_rand() % 1000000;
+    }
+    for (i = 0 ; i < elements*rounds ; i++) {
+        int r=bench_rand() % 16;
+        ret[n].node=bench_rand() % elements;
+        ret[n].key=bench_rand() % 1000000;
+        if (r == 0)
+            ret[n].op=bench_op_remove;
+        else if (r < 4)
+            ret[n].op=bench_op_extract;
+        else
+            ret[n].op=bench_op_update;
+        n++;
+    }
+    ret[n].op=bench_op_extract;
+    ret[n++].node=-1;
+    *count=n;
+    return ret;
+}
+
+static long bench_dheap(struct bench_node *nodes, struct bench_step *steps, int count) {
+    struct dheap *heap=dheap_new(offsetof(struct bench_node, heap_idx));
+    long sum=0;
+    int i;
+
+    for (i = 0 ; i < count ; i++) {
+        struct bench_step *s=&steps[i];
+        struct bench_node *n;
+        switch (s->op) {
+        case bench_op_update:
+            dheap_update(heap, &nodes[s->node], s->key);
+            break;
+        case bench_op_remove:
+            dheap_remove(heap, &nodes[s->node]);
+            break;
+        case bench_op_extract:
+            do {
+                n=dheap_extractmin(heap);
+                if (n)
+                    sum+=n-nodes;
+            } while (n && s->node == -1);
+            break;
+        }
+    }
+    dheap_destroy(heap);
+    return sum;
+}
+
+static long bench_fib(struct bench_node *nodes, struct bench_step *steps, int count) {
+    struct fibheap *heap=fh_makekeyheap();
+    long sum=0;
+    int i;
+
+    for (i = 0 ; i < count ; i++) {
+        struct bench_step *s=&steps[i];
+        struct bench_node *n;
+        switch (s->op) {
+        case bench_op_update:
+            n=&nodes[s->node];
+            if (n->el && s->key <= n->key) {
+                fh_replacekey(heap, n->el, s->key);
+            } else {
+                if (n->el)
+                    fh_delete(heap, n->el);
+                n->el=fh_insertkey(heap, s->key, n);
+            }
+            n->key=s->key;
+            break;
+        case bench_op_remove:
+            n=&nodes[s->node];
+            if (n->el) {
+                fh_delete(heap, n->el);
+                n->el=NULL;
+            }
+            break;
+        case bench_op_extract:
+            do {
+                n=fh_extractmin(heap);
+                if (n) {
+                    n->el=NULL;
+                    sum+=n-nodes;
+                }
+            } while (n && s->node == -1);
+            break;
+        }
+    }
+    fh_deleteheap(heap);
+    return sum;
+}
+
+int main(int argc, char **argv) {
+    int elements=argc > 1 ? atoi(argv[1]) : 100000;
+    int rounds=argc > 2 ? atoi(argv[2]) : 10;
+    struct bench_node *nodes;
+    struct bench_step *steps;
+    int count;
+    long sum_fib, sum_dheap;
+    clock_t start;
+    double time_fib, time_dheap;
+
+    if (elements <= 0 || rounds < 0) {
+        fprintf(stderr, "Usage: %s [elements [rounds]]\n", argv[0]);
+        return 1;
+    }
+    steps=bench_steps_new(elements, rounds, &count);
+    nodes=calloc(elements, sizeof(struct bench_node));
+
+    start=clock();
+    sum_fib=bench_fib(nodes, steps, count);
+    time_fib=(double)(clock()-start)/CLOCKS_PER_SEC;
+
+    start=clock();
+    sum_dheap=bench_dheap(nodes, steps, count);
+    time_dheap=(double)(clock()-start)/CLOCKS_PER_SEC;
+
+    printf("%d elements, %d operations\n", elements, count);
+    printf("fib-1.1: %.3f s\n", time_fib);
+    printf("dheap:   %.3f s\n", time_dheap);
+    if (sum_fib != sum_dheap)
+        printf("Warning: heaps returned different elements (%ld vs %ld), keys are probably not unique\n", sum_fib,
+               sum_dheap);
+    free(steps);
+    free(nodes);
+    return 0;
+}
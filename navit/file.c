@@ -31,6 +31,9 @@
 #include <wordexp.h>
 #include <glib.h>
 #include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include "debug.h"
 #include "cache.h"
 #include "file.h"
@@ -39,6 +42,7 @@
 #include "util.h"
 #include "types.h"
 #include "zipfile.h"
+#include "thread.h"
 #ifdef HAVE_SOCKET
 #include <sys/socket.h>
 #include <netdb.h>
@@ -48,8 +52,44 @@
 static GHashTable *file_name_hash;
 #endif
 
+/** The cache shared by all files which have no cache of their own, see `file_set_own_cache_size()` */
 static struct cache *file_cache;
 
+/**
+ * Serializes access to the mapped windows of all files, and, without `pread()`, to the file position of all files
+ * when reading from a worker thread
+ */
+static struct thread_lock *file_lock;
+
+/** Size of a window mapped by `file_mmap_windows()`, a multiple of the page size */
+#define FILE_MMAP_WINDOW_SIZE (16*1024*1024)
+
+/** Distance between the starts of two consecutive windows, so any read of up to this size fits into one window */
+#define FILE_MMAP_WINDOW_STEP (FILE_MMAP_WINDOW_SIZE/2)
+
+/** Maximum number of windows of one file which are mapped at the same time */
+#define FILE_MMAP_WINDOWS 8
+
+/**
+ * @brief A part of a file which is mapped into memory
+ */
+struct file_window {
+    unsigned char *begin;   /**< Start of the mapping, NULL if the slot is unused */
+    long long offset;       /**< Offset of the mapping within the file */
+    int size;               /**< Size of the mapping */
+    int refcount;           /**< Number of buffers within the mapping which have not been freed yet */
+    unsigned int used;      /**< Value of `file_windows.clock` when the window was used last */
+};
+
+/**
+ * @brief The mapped windows of a file, see `file_mmap_windows()`
+ */
+struct file_windows {
+    unsigned int clock;                             /**< Incremented on every use of a window */
+    long pagesize;                                  /**< Page size of the system */
+    struct file_window window[FILE_MMAP_WINDOWS];   /**< The windows */
+};
+
 #ifdef HAVE_PRAGMA_PACK
 #pragma pack(push)
 #pragma pack(1)
@@ -295,17 +335,22 @@ int file_mkdir(char *name, int pflag) {
 
 int file_mmap(struct file *file) {
 #if 0
-    int mmap_size=file->size+1024*1024;
+    size_t mmap_size=file->size+1024*1024;
 #else
-    int mmap_size=file->size;
+    size_t mmap_size=file->size;
 #endif
+    if ((long long)mmap_size != file->size) {
+        dbg(lvl_warning,"%s is too large to be mapped as a whole", file->name);
+        return 0;
+    }
 #ifdef HAVE_API_WIN32_BASE
     file->begin = (unsigned char*)mmap_readonly_win32( file->name, &file->map_handle, &file->map_file );
 #else
     file->begin=mmap(NULL, mmap_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, file->fd, 0);
     dbg_assert(file->begin != NULL);
-    if (file->begin == (void *)0xffffffff) {
+    if (file->begin == MAP_FAILED) {
         perror("mmap");
+        file->begin=NULL;
         return 0;
     }
 #endif
@@ -316,27 +361,214 @@ int file_mmap(struct file *file) {
     return 1;
 }
 
+/**
+ * @brief Maps a file into memory in windows of a fixed size
+ *
+ * This is an alternative to `file_mmap()` for files which are too large to be mapped as a whole, e.g. on 32-bit
+ * systems. Afterwards, `file_data_read()` returns pointers into a mapped window instead of copies for reads of up to
+ * `FILE_MMAP_WINDOW_STEP` bytes. At most `FILE_MMAP_WINDOWS` windows are mapped at the same time; the least recently
+ * used window which is not referenced by any buffer is unmapped to make room for a new one. Reads which cannot be
+ * served from a window fall back to reading a copy.
+ *
+ * The file must not be written to while windows are mapped.
+ *
+ * @param file The file
+ *
+ * @return True if windowed mapping is supported and enabled for the file
+ */
+int file_mmap_windows(struct file *file) {
+#if defined(_WIN32) || defined(__CEGCC__)
+    return 0;
+#else
+    if (file->special || file->begin)
+        return 0;
+    if (!file->windows) {
+        file->windows=g_new0(struct file_windows, 1);
+        file->windows->pagesize=sysconf(_SC_PAGESIZE);
+        if (file->windows->pagesize <= 0)
+            file->windows->pagesize=4096;
+    }
+    return 1;
+#endif
+}
+
+#if !defined(_WIN32) && !defined(__CEGCC__)
+/**
+ * @brief Returns a pointer to a block of a file within a mapped window, mapping a new window if needed
+ *
+ * The window is referenced until the pointer is passed to `file_window_put()`.
+ *
+ * @param file The file, windowed mapping must be enabled with `file_mmap_windows()`
+ * @param offset The offset of the block
+ * @param size The size of the block
+ *
+ * @return The pointer, or NULL if the block cannot be served from a window
+ */
+static unsigned char *file_window_get(struct file *file, long long offset, int size) {
+    struct file_windows *windows=file->windows;
+    struct file_window *w,*lru=NULL;
+    long long woffset;
+    unsigned char *ret,*start;
+    int i,wsize;
+
+    if (offset < 0 || size <= 0 || size > FILE_MMAP_WINDOW_STEP || offset+size > file->size)
+        return NULL;
+    woffset=offset/FILE_MMAP_WINDOW_STEP*FILE_MMAP_WINDOW_STEP;
+    thread_lock_acquire(file_lock);
+    for (i = 0 ; i < FILE_MMAP_WINDOWS ; i++) {
+        w=&windows->window[i];
+        if (w->begin && w->offset == woffset)
+            break;
+        if (!w->refcount && (!lru || !w->begin || (lru->begin && w->used < lru->used)))
+            lru=w;
+    }
+    if (i == FILE_MMAP_WINDOWS) {
+        if (!lru) {
+            thread_lock_release(file_lock);
+            return NULL;
+        }
+        w=lru;
+        if (w->begin)
+            munmap(w->begin, w->size);
+        wsize=MIN(FILE_MMAP_WINDOW_SIZE, file->size-woffset);
+        w->begin=mmap(NULL, wsize, PROT_READ|PROT_WRITE, MAP_PRIVATE, file->fd, woffset);
+        if (w->begin == MAP_FAILED) {
+            dbg(lvl_error,"unable to map "LONGLONG_FMT" bytes of %s at "LONGLONG_FMT"", (long long)wsize, file->name,
+                woffset);
+            w->begin=NULL;
+            thread_lock_release(file_lock);
+            return NULL;
+        }
+        w->offset=woffset;
+        w->size=wsize;
+#ifdef MADV_RANDOM
+        /* map data is read in small, scattered blocks, so read-ahead of the whole window would be wasted */
+        madvise(w->begin, w->size, MADV_RANDOM);
+#endif
+    }
+    w->refcount++;
+    w->used=++windows->clock;
+    thread_lock_release(file_lock);
+    ret=w->begin+(offset-woffset);
+#ifdef MADV_WILLNEED
+    start=w->begin+(ret-w->begin)/windows->pagesize*windows->pagesize;
+    madvise(start, ret+size-start, MADV_WILLNEED);
+#else
+    (void)start;
+#endif
+    return ret;
+}
+
+/**
+ * @brief Releases a pointer returned by `file_window_get()`
+ *
+ * @param file The file
+ * @param data The pointer
+ *
+ * @return True if `data` points into a window of `file`
+ */
+static int file_window_put(struct file *file, unsigned char *data) {
+    struct file_window *w;
+    int i,ret=0;
+
+    if (!file->windows || !data)
+        return 0;
+    thread_lock_acquire(file_lock);
+    for (i = 0 ; i < FILE_MMAP_WINDOWS ; i++) {
+        w=&file->windows->window[i];
+        if (w->begin && data >= w->begin && data < w->begin+w->size) {
+            dbg_assert(w->refcount > 0);
+            w->refcount--;
+            ret=1;
+            break;
+        }
+    }
+    thread_lock_release(file_lock);
+    return ret;
+}
+
+/**
+ * @brief Unmaps all windows of a file
+ */
+static void file_windows_destroy(struct file *file) {
+    int i;
+
+    if (!file->windows)
+        return;
+    for (i = 0 ; i < FILE_MMAP_WINDOWS ; i++) {
+        if (file->windows->window[i].begin)
+            munmap(file->windows->window[i].begin, file->windows->window[i].size);
+    }
+    g_free(file->windows);
+    file->windows=NULL;
+}
+#else
+#define file_window_get(file, offset, size) NULL
+#define file_window_put(file, data) 0
+#define file_windows_destroy(file)
+#endif
+
+/**
+ * @brief Returns the cache of a file, its own one or the shared one
+ */
+static struct cache *file_get_cache(struct file *file) {
+    return file->own_cache ? file->own_cache : file_cache;
+}
+
+/**
+ * @brief Reads a block of a file into a buffer
+ *
+ * With `pread()`, the file position is not used, so several threads can read from the same file at once.
+ *
+ * @return True if the whole block was read
+ */
+static int file_read_at(struct file *file, void *buffer, int size, long long offset) {
+#ifdef HAVE_PREAD
+    return pread(file->fd, buffer, size, offset) == size;
+#else
+    int ret;
+    thread_lock_acquire(file_lock);
+    lseek(file->fd, offset, SEEK_SET);
+    ret=read(file->fd, buffer, size) == size;
+    thread_lock_release(file_lock);
+    return ret;
+#endif
+}
+
+/**
+ * @brief Reads a block of a file
+ *
+ * If the file is mapped, the block is not copied. Otherwise, it is read with the file lock only held for the lookup
+ * in and the insertion into the cache.
+ *
+ * @param file The file
+ * @param offset The offset of the block
+ * @param size The size of the block
+ *
+ * @return The block, to be freed with `file_data_free()`, or NULL on failure
+ */
 unsigned char *file_data_read(struct file *file, long long offset, int size) {
-    void *ret;
+    void *ret,*cached;
+    struct file_cache_id id= {offset,size,file->name_id,0};
     if (file->special)
         return NULL;
     if (file->begin)
         return file->begin+offset;
+    if (file->windows && (ret=file_window_get(file, offset, size)))
+        return ret;
+    if (file->cache && (ret=cache_lookup(file_get_cache(file),&id)))
+        return ret;
+    ret=g_malloc(size);
+    if (!file_read_at(file, ret, size, offset)) {
+        g_free(ret);
+        return NULL;
+    }
     if (file->cache) {
-        struct file_cache_id id= {offset,size,file->name_id,0};
-        ret=cache_lookup(file_cache,&id);
-        if (ret)
-            return ret;
-        ret=cache_insert_new(file_cache,&id,size);
-    } else
-        ret=g_malloc(size);
-    lseek(file->fd, offset, SEEK_SET);
-    if (read(file->fd, ret, size) != size) {
-        file_data_free(file, ret);
-        ret=NULL;
+        cached=cache_insert_copy(file_get_cache(file),&id,ret,size);
+        g_free(ret);
+        ret=cached;
     }
     return ret;
-
 }
 
 static void file_process_headers(struct file *file, unsigned char *headers) {
@@ -431,7 +663,7 @@ unsigned char *file_data_read_all(struct file *file) {
 void file_data_flush(struct file *file, long long offset, int size) {
     if (file->cache) {
         struct file_cache_id id= {offset,size,file->name_id,0};
-        cache_flush(file_cache,&id);
+        cache_flush(file_get_cache(file),&id);
         dbg(lvl_debug,"Flushing "LONGLONG_FMT" %d bytes",offset,size);
     }
 }
@@ -487,33 +719,107 @@ static int uncompress_int(Bytef *dest, uLongf *destLen, const Bytef *source, uLo
     return err;
 }
 
-unsigned char *file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp) {
-    void *ret;
+/**
+ * @brief Uncompresses a block of data
+ *
+ * @param dest Receives the uncompressed data
+ * @param dest_size The size of the uncompressed data
+ * @param source The compressed data
+ * @param source_size The size of the compressed data
+ * @param method The compression method, as in a zip file: 8 for raw deflate or `zip_method_zstd`
+ *
+ * @return True if exactly `dest_size` bytes were uncompressed
+ */
+static int file_uncompress(unsigned char *dest, int dest_size, const unsigned char *source, int source_size,
+                           int method) {
+    uLongf destLen=dest_size;
+    switch (method) {
+    case 8:
+        return uncompress_int(dest, &destLen, source, source_size) == Z_OK;
+#ifdef HAVE_ZSTD
+    case zip_method_zstd: {
+        size_t ret=ZSTD_decompress(dest, dest_size, source, source_size);
+        if (ZSTD_isError(ret)) {
+            dbg(lvl_error,"zstd: %s", ZSTD_getErrorName(ret));
+            return 0;
+        }
+        return ret == (size_t)dest_size;
+    }
+#endif
+    default:
+        dbg(lvl_error,"compression method %d not supported by this binary", method);
+        return 0;
+    }
+}
+
+/**
+ * @brief Reads and uncompresses a block of compressed data, bypassing the cache
+ *
+ * The compressed data is uncompressed directly from the mapping if the file is mapped, and read into a temporary
+ * buffer otherwise. Several threads can read and uncompress at the same time.
+ *
+ * @param file The file
+ * @param offset The offset of the compressed data
+ * @param size The size of the compressed data
+ * @param size_uncomp The size of the uncompressed data
+ * @param method The compression method, as in a zip file: 8 for raw deflate or `zip_method_zstd`
+ *
+ * @return The uncompressed data, owned by the caller and to be freed with `g_free()`, or NULL on failure
+ */
+unsigned char *file_data_read_compressed_uncached(struct file *file, long long offset, int size, int size_uncomp,
+        int method) {
+    unsigned char *ret;
     char *buffer = 0;
-    uLongf destLen=size_uncomp;
 
-    if (file->cache) {
-        struct file_cache_id id= {offset,size,file->name_id,1};
-        ret=cache_lookup(file_cache,&id);
-        if (ret)
-            return ret;
-        ret=cache_insert_new(file_cache,&id,size_uncomp);
-    } else
-        ret=g_malloc(size_uncomp);
-    lseek(file->fd, offset, SEEK_SET);
+    if (file->begin)
+        buffer=(char *)file->begin+offset;
+    else if (!file->windows || !(buffer=(char *)file_window_get(file, offset, size))) {
+        buffer = (char *)g_malloc(size);
+        if (!file_read_at(file, buffer, size, offset)) {
+            g_free(buffer);
+            return NULL;
+        }
+    }
 
-    buffer = (char *)g_malloc(size);
-    if (read(file->fd, buffer, size) != size) {
+    ret=g_malloc(size_uncomp);
+    if (!file_uncompress(ret, size_uncomp, (unsigned char *)buffer, size, method)) {
+        dbg(lvl_error,"uncompress failed");
         g_free(ret);
         ret=NULL;
-    } else {
-        if (uncompress_int(ret, &destLen, (Bytef *)buffer, size) != Z_OK) {
-            dbg(lvl_error,"uncompress failed");
-            g_free(ret);
-            ret=NULL;
-        }
     }
-    g_free(buffer);
+    if (!file->begin && !file_window_put(file, (unsigned char *)buffer))
+        g_free(buffer);
+    return ret;
+}
+
+/**
+ * @brief Reads and uncompresses a block of compressed data
+ *
+ * See `file_data_read_compressed_uncached()`, the result is kept in the cache of the file.
+ *
+ * @param file The file
+ * @param offset The offset of the compressed data
+ * @param size The size of the compressed data
+ * @param size_uncomp The size of the uncompressed data
+ * @param method The compression method, as in a zip file: 8 for raw deflate or `zip_method_zstd`
+ *
+ * @return The uncompressed data, to be freed with `file_data_free()`, or NULL on failure
+ */
+unsigned char *file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp, int method) {
+    void *ret,*cached;
+    struct file_cache_id id= {offset,size,file->name_id,method};
+
+    if (file->cache && (ret=cache_lookup(file_get_cache(file),&id)))
+        return ret;
+
+    ret=file_data_read_compressed_uncached(file, offset, size, size_uncomp, method);
+
+    if (ret && file->cache) {
+        /* the cache entry is only created now, so other threads never find it half-filled */
+        cached=cache_insert_copy(file_get_cache(file),&id,ret,size_uncomp);
+        g_free(ret);
+        ret=cached;
+    }
 
     return ret;
 }
@@ -525,9 +831,11 @@ void file_data_free(struct file *file, unsigned char *data) {
         if (data >= file->begin && data < file->end)
             return;
     }
-    if (file->cache && data) {
-        cache_entry_destroy(file_cache, data);
-    } else
+    if (file_window_put(file, data))
+        return;
+    if (file->cache && data)
+        cache_entry_destroy(file_get_cache(file), data);
+    else
         g_free(data);
 }
 
@@ -538,9 +846,11 @@ void file_data_remove(struct file *file, unsigned char *data) {
         if (data >= file->begin && data < file->end)
             return;
     }
-    if (file->cache && data) {
-        cache_flush_data(file_cache, data);
-    } else
+    if (file_window_put(file, data))
+        return;
+    if (file->cache && data)
+        cache_flush_data(file_get_cache(file), data);
+    else
         g_free(data);
 }
 
@@ -672,7 +982,10 @@ void file_destroy(struct file *f) {
     if ( f->begin != NULL ) {
         file_unmap( f );
     }
+    file_windows_destroy(f);
 
+    if (f->own_cache)
+        cache_destroy(f->own_cache);
     g_free(f->buffer);
     g_free(f->name);
     g_free(f);
@@ -750,20 +1063,95 @@ void *file_get_os_handle(struct file *file) {
     return GINT_TO_POINTER(file->fd);
 }
 
+/**
+ * @brief Changes the size of the cache shared by all files
+ *
+ * As long as the cache has not been used yet, e.g. while the configuration is read, it is created anew, so the number
+ * of its shards fits the new size.
+ *
+ * @param cache_size The new size in bytes
+ *
+ * @return True on success
+ */
 int file_set_cache_size(int cache_size) {
 #ifdef CACHE_SIZE
-    cache_resize(file_cache, cache_size);
+    struct cache_stats stats;
+    struct cache *cache;
+    cache_get_stats(file_cache, &stats);
+    if (!stats.hits && !stats.misses && !stats.size && (cache=cache_new(sizeof(struct file_cache_id), cache_size))) {
+        cache_destroy(file_cache);
+        file_cache=cache;
+    } else
+        cache_resize(file_cache, cache_size);
     return 1;
 #else
     return 0;
 #endif
 }
 
+/**
+ * @brief Gives a file a cache of its own, or changes its size
+ *
+ * Data read from the file is then kept separately from the cache shared by all other files, within a budget of its
+ * own. This must be done before any data is read from the file.
+ *
+ * @param file The file
+ * @param cache_size The size of the cache in bytes
+ *
+ * @return True on success
+ */
+int file_set_own_cache_size(struct file *file, int cache_size) {
+    if (cache_size <= 0)
+        return 0;
+    if (file->own_cache) {
+        cache_resize(file->own_cache, cache_size);
+        return 1;
+    }
+    file->own_cache=cache_new(sizeof(struct file_cache_id), cache_size);
+    if (!file->own_cache)
+        return 0;
+    file->cache=1;
+    return 1;
+}
+
+/**
+ * @brief Returns a statistic of the cache used by a file as an attribute
+ *
+ * @param file The file, or NULL for the cache shared by all files
+ * @param type `attr_cache_hits`, `attr_cache_misses` or `attr_cache_evictions`
+ * @param attr Receives the attribute
+ *
+ * @return True on success, false if there is no cache or the type is not supported
+ */
+int file_get_cache_attr(struct file *file, enum attr_type type, struct attr *attr) {
+    struct cache *cache=file ? file_get_cache(file) : file_cache;
+    struct cache_stats stats;
+
+    if (!cache || (file && !file->cache))
+        return 0;
+    cache_get_stats(cache, &stats);
+    attr->type=type;
+    switch (type) {
+    case attr_cache_hits:
+        attr->u.num=stats.hits;
+        return 1;
+    case attr_cache_misses:
+        attr->u.num=stats.misses;
+        return 1;
+    case attr_cache_evictions:
+        attr->u.num=stats.evictions;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 void file_init(void) {
 #ifdef CACHE_SIZE
     file_name_hash=g_hash_table_new(g_str_hash, g_str_equal);
     file_cache=cache_new(sizeof(struct file_cache_id), CACHE_SIZE);
 #endif
+    file_lock=thread_lock_new();
     if(sizeof(off_t)<8)
         dbg(lvl_error,"Maps larger than 2GB are not supported by this binary, sizeof(off_t)=%zu",sizeof(off_t));
 }
@@ -57,8 +57,11 @@ struct file {
 	unsigned char *buffer;
 	int buffer_len;
 	GHashTable *headers;
+	struct file_windows *windows;
+	struct cache *own_cache;
 };
 
+enum attr_type;
 struct attr;
 
 /* prototypes */
@@ -70,13 +73,16 @@ int file_is_reg(const char *name);
 long long file_size(struct file *file);
 int file_mkdir(char *name, int pflag);
 int file_mmap(struct file *file);
+int file_mmap_windows(struct file *file);
 unsigned char *file_data_read(struct file *file, long long offset, int size);
 unsigned char *file_data_read_special(struct file *file, int size, int *size_ret);
 unsigned char *file_data_read_all(struct file *file);
 void file_data_flush(struct file *file, long long offset, int size);
 int file_data_write(struct file *file, long long offset, int size, const void *data);
 int file_get_contents(char *name, unsigned char **buffer, int *size);
-unsigned char *file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp);
+unsigned char *file_data_read_compressed_uncached(struct file *file, long long offset, int size, int size_uncomp,
+        int method);
+unsigned char *file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp, int method);
 void file_data_free(struct file *file, unsigned char *data);
 int file_exists(char const *name);
 void file_remap_readonly(struct file *f);
@@ -95,6 +101,8 @@ int file_get_param(struct file *file, struct param_list *param, int count);
 int file_version(struct file *file, int byname);
 void *file_get_os_handle(struct file *file);
 int file_set_cache_size(int cache_size);
+int file_set_own_cache_size(struct file *file, int cache_size);
+int file_get_cache_attr(struct file *file, enum attr_type type, struct attr *attr);
 void file_init(void);
 void file_data_remove(struct file *file, unsigned char *data);
 /* end of prototypes */
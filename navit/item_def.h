@@ -529,6 +529,7 @@ ITEM(former_itinerary_part)
 ITEM(cliff)
 ITEM(sports_track)
 ITEM(archaeological_site)
+ITEM(street_route_alternative)
 /* Area */
 ITEM2(0xc0000000,area)
 ITEM2(0xc0000001,area_unspecified)
@@ -642,4 +643,5 @@ ITEM(poly_port)
 ITEM(poly_saltpond)
 ITEM(poly_dam)
 ITEM(poly_swimming_pool)
+ITEM(poly_isochrone)
 ITEM2(0xffffffff,last)
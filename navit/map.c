@@ -196,6 +196,27 @@ int map_requires_conversion(struct map *this_) {
     return (this_->meth.charset != NULL && strcmp(this_->meth.charset, "utf-8"));
 }
 
+/**
+ * @brief Checks if items may be read from a map on a worker thread
+ *
+ * A map is considered thread-safe if map rects can be opened and read on a worker thread while the main thread
+ * keeps using the map, e.g. for drawing. A `thread_safe` attribute in the map configuration takes precedence,
+ * which allows users to opt out a map explicitly. Otherwise the map driver is asked; drivers which do not report
+ * the attribute are assumed not to be thread-safe.
+ *
+ * @param this_ The map
+ * @return True if the map is thread-safe, false otherwise
+ */
+int map_is_thread_safe(struct map *this_) {
+    struct attr attr;
+
+    if (attr_generic_get_attr(this_->attrs, NULL, attr_thread_safe, &attr, NULL))
+        return attr.u.num != 0;
+    if (this_->meth.map_get_attr && this_->meth.map_get_attr(this_->priv, attr_thread_safe, &attr))
+        return attr.u.num != 0;
+    return 0;
+}
+
 char *map_converted_string_tmp=NULL;
 
 /**
@@ -250,6 +250,7 @@ int map_set_attr(struct map *this_, struct attr *attr);
 void map_add_callback(struct map *this_, struct callback *cb);
 void map_remove_callback(struct map *this_, struct callback *cb);
 int map_requires_conversion(struct map *this_);
+int map_is_thread_safe(struct map *this_);
 char *map_convert_string_tmp(struct map *this_, char *str);
 char *map_convert_string(struct map *this_, char *str);
 char *map_convert_dup(char *str);
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <sys/stat.h>
 #include "config.h"
 #include "debug.h"
 #include "plugin.h"
@@ -39,6 +40,19 @@
 #include "callback.h"
 #include "types.h"
 #include "geom.h"
+#include "thread.h"
+
+/** Number of threads reading tiles ahead of the map rects of a map */
+#define BINFILE_PREFETCH_THREADS 4
+
+/** Number of tiles a map rect must have queued before they are read ahead, smaller selections are read directly */
+#define BINFILE_PREFETCH_MIN_TILES 8
+
+/** Size of the tiles a map rect may have read ahead, in bytes, above which no more tiles are read ahead */
+#define BINFILE_PREFETCH_MAX_SIZE (4*1024*1024)
+
+/** Default size of the cache of inflated tiles of a map in bytes, see `struct binfile_tile_cache` */
+#define BINFILE_TILE_CACHE_SIZE (4*1024*1024)
 
 static int map_id;
 
@@ -82,6 +96,7 @@ struct tile {
     struct file *fi;        //!< The file from which this tile was loaded.
     int zipfile_num;
     int mode;
+    struct binfile_tile_cache_entry *cached; //!< Entry of the tile cache holding the data, NULL if not cached
 };
 
 
@@ -132,6 +147,11 @@ struct map_priv {
     long download_enabled;
     int last_searched_town_id_hi;
     int last_searched_town_id_lo;
+    char *data_version;
+    int cache_size;     //!< Size of the cache of the map files in bytes, 0 to use the cache shared by all files
+    int tile_cache_size; //!< Size of the cache of inflated tiles in bytes, 0 to disable it
+    struct binfile_tile_cache *tile_cache; //!< Cache of inflated tiles, NULL if not used
+    struct binfile_prefetch_pool *prefetch_pool; //!< Threads reading tiles ahead of map rects, NULL if not used
 };
 
 struct map_rect_priv {
@@ -151,6 +171,7 @@ struct map_rect_priv {
     struct attr attrs[8];
     int status;
     struct map_search_priv *msp;
+    struct binfile_prefetch *prefetch;  //!< Reads tiles ahead of time, NULL if not used
 #ifdef DEBUG_SIZE
     int size;
 #endif
@@ -178,6 +199,7 @@ struct map_search_priv {
 
 
 static void push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int length);
+static int selection_contains(struct map_selection *sel, struct coord_rect *r, struct range *mima);
 static void setup_pos(struct map_rect_priv *mr);
 static void map_binfile_close(struct map_priv *m);
 static int map_binfile_open(struct map_priv *m);
@@ -356,8 +378,9 @@ static unsigned char *binfile_read_content(struct map_priv *m, struct file *fi,
         ret=file_data_read(fi,offset, lfh->zipuncmp);
         break;
     case 8:
+    case zip_method_zstd:
         offset+=lfh->zipxtraln;
-        ret=file_data_read_compressed(fi,offset, lfh->zipsize, lfh->zipuncmp);
+        ret=file_data_read_compressed(fi,offset, lfh->zipsize, lfh->zipuncmp, lfh->zipmthd);
         break;
     default:
         dbg(lvl_error,"map file %s: unknown compression method %d", fi->name, lfh->zipmthd);
@@ -842,6 +865,205 @@ static struct item_methods methods_binfile = {
     binfile_coords_left,
 };
 
+/**
+ * @brief An inflated tile in the tile cache
+ */
+struct binfile_tile_cache_entry {
+    int zipfile;            //!< Number of the zip member holding the tile
+    int *start;             //!< The tile data, owned by the cache
+    int size;               //!< Size of the tile data in bytes
+    int refcount;           //!< Number of tiles of map rects using the data
+    struct binfile_tile_cache_entry *prev; //!< More recently used entry
+    struct binfile_tile_cache_entry *next; //!< Less recently used entry
+};
+
+/**
+ * @brief Cache of inflated tiles of a map
+ *
+ * The file cache keeps the raw data of zip members, and a member evicted from it has to be inflated again when a map
+ * rect enters its tile the next time. This cache sits above it and keeps inflated tiles by their member number, within
+ * a budget of its own, so redraws of the same area neither read the file nor inflate anything. Stored members are not
+ * kept, they are read without copying them anyway. Tiles in use by a map rect are never evicted, so the cache may
+ * temporarily exceed its budget.
+ */
+struct binfile_tile_cache {
+    struct thread_lock *lock; //!< Protects all members
+    GHashTable *entries;    //!< `struct binfile_tile_cache_entry` by member number
+    struct binfile_tile_cache_entry *first; //!< Most recently used entry
+    struct binfile_tile_cache_entry *last;  //!< Least recently used entry
+    int size;               //!< Size of all entries in bytes
+    int max_size;           //!< Budget of the cache in bytes
+    int hits;               //!< Number of tiles found in the cache
+    int misses;             //!< Number of tiles not found in the cache
+    int evictions;          //!< Number of tiles dropped to stay within the budget
+};
+
+static struct binfile_tile_cache *binfile_tile_cache_new(int max_size) {
+    struct binfile_tile_cache *this_=g_new0(struct binfile_tile_cache, 1);
+    this_->lock=thread_lock_new();
+    this_->entries=g_hash_table_new(NULL, NULL);
+    this_->max_size=max_size;
+    return this_;
+}
+
+static void binfile_tile_cache_unlink(struct binfile_tile_cache *this_, struct binfile_tile_cache_entry *entry) {
+    if (entry->prev)
+        entry->prev->next=entry->next;
+    else
+        this_->first=entry->next;
+    if (entry->next)
+        entry->next->prev=entry->prev;
+    else
+        this_->last=entry->prev;
+}
+
+static void binfile_tile_cache_link(struct binfile_tile_cache *this_, struct binfile_tile_cache_entry *entry) {
+    entry->prev=NULL;
+    entry->next=this_->first;
+    if (entry->next)
+        entry->next->prev=entry;
+    else
+        this_->last=entry;
+    this_->first=entry;
+}
+
+static void binfile_tile_cache_remove(struct binfile_tile_cache *this_, struct binfile_tile_cache_entry *entry) {
+    binfile_tile_cache_unlink(this_, entry);
+    g_hash_table_remove(this_->entries, GINT_TO_POINTER(entry->zipfile));
+    this_->size-=entry->size;
+    g_free(entry->start);
+    g_free(entry);
+}
+
+/**
+ * @brief Evicts unused tiles, least recently used first, until the cache fits into its budget
+ *
+ * Must be called with the lock held.
+ */
+static void binfile_tile_cache_trim(struct binfile_tile_cache *this_) {
+    struct binfile_tile_cache_entry *entry=this_->last,*prev;
+    while (entry && this_->size > this_->max_size) {
+        prev=entry->prev;
+        if (!entry->refcount) {
+            binfile_tile_cache_remove(this_, entry);
+            this_->evictions++;
+        }
+        entry=prev;
+    }
+}
+
+static void binfile_tile_cache_destroy(struct binfile_tile_cache *this_) {
+    if (!this_)
+        return;
+    dbg(lvl_debug,"tile cache: %d hits, %d misses, %d evictions, %d bytes", this_->hits, this_->misses,
+        this_->evictions, this_->size);
+    while (this_->first) {
+        dbg_assert(!this_->first->refcount);
+        binfile_tile_cache_remove(this_, this_->first);
+    }
+    g_hash_table_destroy(this_->entries);
+    thread_lock_destroy(this_->lock);
+    g_free(this_);
+}
+
+/**
+ * @brief Changes the budget of the cache
+ */
+static void binfile_tile_cache_resize(struct binfile_tile_cache *this_, int max_size) {
+    thread_lock_acquire(this_->lock);
+    this_->max_size=max_size;
+    binfile_tile_cache_trim(this_);
+    thread_lock_release(this_->lock);
+}
+
+/**
+ * @brief Looks up a tile in the cache
+ *
+ * @param this_ The cache
+ * @param zipfile The number of the zip member holding the tile
+ * @param t Receives the tile data if it is in the cache
+ *
+ * @return True if the tile was found, it must be released with `binfile_tile_cache_release()`
+ */
+static int binfile_tile_cache_get(struct binfile_tile_cache *this_, int zipfile, struct tile *t) {
+    struct binfile_tile_cache_entry *entry;
+    thread_lock_acquire(this_->lock);
+    entry=g_hash_table_lookup(this_->entries, GINT_TO_POINTER(zipfile));
+    if (entry) {
+        entry->refcount++;
+        binfile_tile_cache_unlink(this_, entry);
+        binfile_tile_cache_link(this_, entry);
+        this_->hits++;
+        t->start=entry->start;
+        t->end=entry->start+entry->size/4;
+        t->cached=entry;
+    } else
+        this_->misses++;
+    thread_lock_release(this_->lock);
+    return entry != NULL;
+}
+
+/**
+ * @brief Adds an inflated tile to the cache
+ *
+ * If another thread has added the same tile in the meantime, `data` is freed and the data of that thread is used.
+ *
+ * @param this_ The cache
+ * @param zipfile The number of the zip member holding the tile
+ * @param data The tile data, allocated with `g_malloc()`, the cache takes ownership
+ * @param size The size of `data` in bytes
+ * @param t Receives the tile data, which must be released with `binfile_tile_cache_release()`
+ */
+static void binfile_tile_cache_add(struct binfile_tile_cache *this_, int zipfile, unsigned char *data, int size,
+                                   struct tile *t) {
+    struct binfile_tile_cache_entry *entry;
+    thread_lock_acquire(this_->lock);
+    entry=g_hash_table_lookup(this_->entries, GINT_TO_POINTER(zipfile));
+    if (entry) {
+        g_free(data);
+        binfile_tile_cache_unlink(this_, entry);
+    } else {
+        entry=g_new0(struct binfile_tile_cache_entry, 1);
+        entry->zipfile=zipfile;
+        entry->start=(int *)data;
+        entry->size=size;
+        g_hash_table_insert(this_->entries, GINT_TO_POINTER(zipfile), entry);
+        this_->size+=size;
+    }
+    entry->refcount++;
+    binfile_tile_cache_link(this_, entry);
+    binfile_tile_cache_trim(this_);
+    thread_lock_release(this_->lock);
+    t->start=entry->start;
+    t->end=entry->start+entry->size/4;
+    t->cached=entry;
+}
+
+/**
+ * @brief Releases a tile obtained from the cache
+ */
+static void binfile_tile_cache_release(struct binfile_tile_cache *this_, struct binfile_tile_cache_entry *entry) {
+    thread_lock_acquire(this_->lock);
+    entry->refcount--;
+    binfile_tile_cache_trim(this_);
+    thread_lock_release(this_->lock);
+}
+
+/**
+ * @brief Frees the data of a tile read from the map file
+ *
+ * @param m The map
+ * @param t The tile
+ */
+static void binfile_tile_free(struct map_priv *m, struct tile *t) {
+    if (t->cached)
+        binfile_tile_cache_release(m->tile_cache, t->cached);
+    else
+        file_data_free(t->fi, (unsigned char *)t->start);
+    t->start=NULL;
+    t->cached=NULL;
+}
+
 static void push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int length) {
     dbg_assert(mr->tile_depth < 8);
     mr->t=&mr->tiles[mr->tile_depth++];
@@ -857,7 +1079,7 @@ static int pop_tile(struct map_rect_priv *mr) {
     if (mr->tile_depth <= 1)
         return 0;
     if (mr->t->mode < 2)
-        file_data_free(mr->m->fi, (unsigned char *)(mr->t->start));
+        binfile_tile_free(mr->m, mr->t);
 #ifdef DEBUG_SIZE
 #if DEBUG_SIZE > 0
     dbg(lvl_debug,"leave %d",mr->t->zipfile_num);
@@ -868,31 +1090,365 @@ static int pop_tile(struct map_rect_priv *mr) {
 }
 
 
-static int zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, struct tile *t) {
-    char buffer[1024];
+/**
+ * @brief Reads a tile from a zip member
+ *
+ * Compressed members are taken from or added to the tile cache of the map if it has one.
+ *
+ * @param m The map
+ * @param cd The central directory entry of the member
+ * @param zipfile The number of the member
+ * @param t Receives the tile, whose data must be freed with `binfile_tile_free()`
+ *
+ * @return True on success
+ */
+static int zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, int zipfile, struct tile *t) {
     struct zip_lfh *lfh;
-    char *zipfn;
     struct file *fi;
+    long long offset;
+    unsigned char *data;
     dbg(lvl_debug,"enter %p %p %p", m, cd, t);
     dbg(lvl_debug,"cd->zipofst=0x"LONGLONG_HEX_FMT "", binfile_cd_offset(cd));
     t->start=NULL;
+    t->cached=NULL;
     t->mode=1;
     if (m->fis)
         fi=m->fis[cd->zipdsk];
     else
         fi=m->fi;
-    lfh=binfile_read_lfh(fi, binfile_cd_offset(cd));
-    zipfn=(char *)(file_data_read(fi,binfile_cd_offset(cd)+sizeof(struct zip_lfh), lfh->zipfnln));
-    strncpy(buffer, zipfn, lfh->zipfnln);
-    buffer[lfh->zipfnln]='\0';
-    t->start=(int *)binfile_read_content(m, fi, binfile_cd_offset(cd), lfh);
-    t->end=t->start+lfh->zipuncmp/4;
     t->fi=fi;
-    file_data_free(fi, (unsigned char *)zipfn);
+    if (m->tile_cache && cd->zipcmthd && binfile_tile_cache_get(m->tile_cache, zipfile, t))
+        return 1;
+    lfh=binfile_read_lfh(fi, binfile_cd_offset(cd));
+    if (!lfh)
+        return 0;
+    if (m->tile_cache && (lfh->zipmthd == 8 || lfh->zipmthd == zip_method_zstd)) {
+        offset=binfile_cd_offset(cd)+sizeof(struct zip_lfh)+lfh->zipfnln+lfh->zipxtraln;
+        data=file_data_read_compressed_uncached(fi, offset, lfh->zipsize, lfh->zipuncmp, lfh->zipmthd);
+        if (data)
+            binfile_tile_cache_add(m->tile_cache, zipfile, data, lfh->zipuncmp, t);
+    } else {
+        t->start=(int *)binfile_read_content(m, fi, binfile_cd_offset(cd), lfh);
+        t->end=t->start+lfh->zipuncmp/4;
+    }
     file_data_free(fi, (unsigned char *)lfh);
     return t->start != NULL;
 }
 
+/**
+ * @brief A tile which is read ahead of a map rect reaching it
+ */
+struct binfile_prefetch_tile {
+    int zipfile;            //!< Number of the zip member holding the tile
+    int state;              //!< 0 if queued, 1 while being read, 2 when read
+    struct tile t;          //!< The tile once it has been read, `t.start` is NULL on failure
+};
+
+/**
+ * @brief Worker threads reading tiles ahead of the map rects of a map
+ *
+ * There is one pool per map, created when the map is opened and destroyed when it is closed. Its workers are
+ * started when the first map rect hands tiles to the pool, and serve all prefetchers of the map.
+ */
+struct binfile_prefetch_pool {
+    struct map_priv *m;     //!< The map
+    struct thread_lock *lock; //!< Protects all members, and those of the prefetchers using the pool
+    struct thread_cond *cond; //!< Signaled when tiles are queued, read or taken, and when workers are to stop
+    GList *prefetchers;     //!< `struct binfile_prefetch` whose tiles the workers read
+    int stop;               //!< Set to make workers return
+    int thread_count;       //!< Number of workers started
+    struct thread *threads[BINFILE_PREFETCH_THREADS]; //!< The workers
+};
+
+/**
+ * @brief Reads the tiles of a map rect ahead of time on worker threads
+ *
+ * When a map rect enters a tile, the submaps of that tile which match the selection of the map rect are queued, in
+ * front of those queued before, so the queue always holds the tiles in the order in which the map rect will enter
+ * them. Once `BINFILE_PREFETCH_MIN_TILES` tiles have been queued, the prefetcher is handed to the pool of the map,
+ * whose workers read and inflate tiles from the front of the queue as long as less than
+ * `BINFILE_PREFETCH_MAX_SIZE` bytes of tiles have been read but not yet entered. Map rects with smaller selections
+ * never involve the pool. When the map rect enters a tile, it takes it from the queue, waiting for a worker to finish
+ * reading it if needed. Tiles which have not been started yet are read by the map rect itself.
+ */
+struct binfile_prefetch {
+    struct map_priv *m;     //!< The map
+    struct binfile_prefetch_pool *pool; //!< The pool of the map, whose lock protects all members
+    GList *queue;           //!< `struct binfile_prefetch_tile`, in the order in which the map rect will enter them
+    int size;               //!< Size of the tiles which have been read but not yet taken, in bytes
+    int count;              //!< Number of tiles queued so far
+    int busy;               //!< Number of tiles being read by workers
+    int active;             //!< Whether the prefetcher has been handed to the pool
+};
+
+/**
+ * @brief Returns the memory used by a prefetched tile, in bytes
+ */
+static int binfile_prefetch_tile_size(struct binfile_prefetch_tile *pt) {
+    if (pt->state != 2 || !pt->t.start)
+        return 0;
+    return (pt->t.end-pt->t.start)*sizeof(int);
+}
+
+/**
+ * @brief Frees a prefetched tile
+ *
+ * @param m The map
+ * @param pt The tile, which must not be in the state of being read
+ */
+static void binfile_prefetch_tile_destroy(struct map_priv *m, struct binfile_prefetch_tile *pt) {
+    if (pt->state == 2 && pt->t.start)
+        binfile_tile_free(m, &pt->t);
+    g_free(pt);
+}
+
+/**
+ * @brief Reads queued tiles of the prefetchers of a map until the pool is stopped
+ *
+ * @param pool The pool
+ */
+static void binfile_prefetch_worker(struct binfile_prefetch_pool *pool) {
+    struct binfile_prefetch *this_=NULL;
+    struct binfile_prefetch_tile *pt;
+    struct zip_cd *cd;
+    GList *p,*l;
+
+    thread_lock_acquire(pool->lock);
+    while (!pool->stop) {
+        pt=NULL;
+        for (p = pool->prefetchers ; p && !pt ; p = g_list_next(p)) {
+            this_=p->data;
+            if (this_->size >= BINFILE_PREFETCH_MAX_SIZE)
+                continue;
+            for (l = this_->queue ; l && !pt ; l = g_list_next(l))
+                if (((struct binfile_prefetch_tile *)l->data)->state == 0)
+                    pt=l->data;
+        }
+        if (!pt) {
+            thread_cond_wait(pool->cond, pool->lock);
+            continue;
+        }
+        pt->state=1;
+        this_->busy++;
+        thread_lock_release(pool->lock);
+        pt->t.start=NULL;
+        cd=binfile_read_cd(pool->m, pool->m->cde_size*pt->zipfile, pool->m->cde_size-sizeof(struct zip_cd));
+        if (cd) {
+            zipfile_to_tile(pool->m, cd, pt->zipfile, &pt->t);
+            file_data_free(pool->m->fi, (unsigned char *)cd);
+        }
+        thread_lock_acquire(pool->lock);
+        pt->state=2;
+        this_->busy--;
+        this_->size+=binfile_prefetch_tile_size(pt);
+        thread_cond_broadcast(pool->cond);
+    }
+    thread_lock_release(pool->lock);
+}
+
+/**
+ * @brief Creates the prefetch pool of a map
+ *
+ * @param m The map
+ *
+ * @return The pool, without any workers yet
+ */
+static struct binfile_prefetch_pool *binfile_prefetch_pool_new(struct map_priv *m) {
+    struct binfile_prefetch_pool *ret=g_new0(struct binfile_prefetch_pool, 1);
+
+    ret->m=m;
+    ret->lock=thread_lock_new();
+    ret->cond=thread_cond_new();
+    return ret;
+}
+
+/**
+ * @brief Stops the workers of a prefetch pool and frees it
+ *
+ * All prefetchers using the pool must have been destroyed before.
+ *
+ * @param this_ The pool, can be NULL
+ */
+static void binfile_prefetch_pool_destroy(struct binfile_prefetch_pool *this_) {
+    int i;
+
+    if (!this_)
+        return;
+    thread_lock_acquire(this_->lock);
+    this_->stop=1;
+    thread_cond_broadcast(this_->cond);
+    thread_lock_release(this_->lock);
+    for (i = 0 ; i < this_->thread_count ; i++)
+        thread_join(this_->threads[i]);
+    thread_cond_destroy(this_->cond);
+    thread_lock_destroy(this_->lock);
+    g_free(this_);
+}
+
+/**
+ * @brief Creates a prefetcher for a map rect
+ *
+ * @param m The map
+ *
+ * @return The prefetcher, or NULL if tiles of the map cannot be read ahead of time
+ */
+static struct binfile_prefetch *binfile_prefetch_new(struct map_priv *m) {
+    struct binfile_prefetch *ret;
+
+    if (!m->prefetch_pool)
+        return NULL;
+    ret=g_new0(struct binfile_prefetch, 1);
+    ret->m=m;
+    ret->pool=m->prefetch_pool;
+    return ret;
+}
+
+/**
+ * @brief Withdraws a prefetcher from its pool and frees it, along with all tiles which have not been taken
+ *
+ * @param this_ The prefetcher, can be NULL
+ */
+static void binfile_prefetch_destroy(struct binfile_prefetch *this_) {
+    GList *l;
+
+    if (!this_)
+        return;
+    if (this_->active) {
+        thread_lock_acquire(this_->pool->lock);
+        this_->pool->prefetchers=g_list_remove(this_->pool->prefetchers, this_);
+        while (this_->busy)
+            thread_cond_wait(this_->pool->cond, this_->pool->lock);
+        thread_lock_release(this_->pool->lock);
+    }
+    for (l = this_->queue ; l ; l = g_list_next(l))
+        binfile_prefetch_tile_destroy(this_->m, l->data);
+    g_list_free(this_->queue);
+    g_free(this_);
+}
+
+/**
+ * @brief Queues the submaps of the current tile of a map rect which match its selection
+ *
+ * This parses the submap items in the same way as `map_parse_submap()`, without changing the state of the map rect.
+ *
+ * @param mr The map rect, which has just entered a tile
+ */
+static void binfile_prefetch_schedule(struct map_rect_priv *mr) {
+    struct binfile_prefetch *this_=mr->prefetch;
+    struct binfile_prefetch_pool *pool=this_->pool;
+    struct binfile_prefetch_tile *pt;
+    struct coord_rect r;
+    struct range mima;
+    struct attr at;
+    GList *queue=NULL;
+    int *pos,*attr,*next,zipfile,count=0;
+
+    if (mr->country_id)
+        return;
+    for (pos = mr->t->pos ; pos < mr->t->end ; pos = next) {
+        next=pos+le32_to_cpu(pos[0])+1;
+        if (le32_to_cpu(pos[1]) != type_submap || le32_to_cpu(pos[2]) < 4)
+            continue;
+        r.lu.x=le32_to_cpu(pos[3]);
+        r.rl.y=le32_to_cpu(pos[4]);
+        r.rl.x=le32_to_cpu(pos[5]);
+        r.lu.y=le32_to_cpu(pos[6]);
+        mima.min=mima.max=0;
+        zipfile=-1;
+        for (attr = pos+3+le32_to_cpu(pos[2]) ; attr < next ; attr += le32_to_cpu(attr[0])+1) {
+            at.type=le32_to_cpu(attr[1]);
+            if (at.type != attr_order && at.type != attr_zipfile_ref)
+                continue;
+            attr_data_set_le(&at, attr+2);
+            if (at.type == attr_zipfile_ref)
+                zipfile=at.u.num;
+            else {
+#if __BYTE_ORDER == __BIG_ENDIAN
+                mima.min=le16_to_cpu(at.u.range.max);
+                mima.max=le16_to_cpu(at.u.range.min);
+#else
+                mima=at.u.range;
+#endif
+            }
+        }
+        if (zipfile < 0 || zipfile >= mr->m->zip_members || !selection_contains(mr->sel, &r, &mima))
+            continue;
+        pt=g_new0(struct binfile_prefetch_tile, 1);
+        pt->zipfile=zipfile;
+        queue=g_list_append(queue, pt);
+        count++;
+    }
+    if (!queue)
+        return;
+    this_->count+=count;
+    if (!this_->active && this_->count < BINFILE_PREFETCH_MIN_TILES) {
+        /* not worth involving the pool (yet), the map rect reads these tiles itself */
+        this_->queue=g_list_concat(queue, this_->queue);
+        return;
+    }
+    thread_lock_acquire(pool->lock);
+    this_->queue=g_list_concat(queue, this_->queue);
+    if (!this_->active) {
+        pool->prefetchers=g_list_append(pool->prefetchers, this_);
+        this_->active=1;
+    }
+    for (; pool->thread_count < BINFILE_PREFETCH_THREADS ; pool->thread_count++)
+        if (!(pool->threads[pool->thread_count]=thread_new((void (*)(void *))binfile_prefetch_worker, pool)))
+            break;
+    thread_cond_broadcast(pool->cond);
+    thread_lock_release(pool->lock);
+}
+
+/**
+ * @brief Takes a tile from the prefetcher of a map rect
+ *
+ * Tiles queued before the requested one will not be entered by the map rect any more and are dropped, unless a
+ * worker is still reading them.
+ *
+ * @param this_ The prefetcher
+ * @param zipfile The number of the zip member holding the tile
+ * @param t Receives the tile, with `t->start` set to NULL if it could not be read
+ *
+ * @return True if the tile has been taken, false if it has to be read by the caller
+ */
+static int binfile_prefetch_take(struct binfile_prefetch *this_, int zipfile, struct tile *t) {
+    struct binfile_prefetch_tile *pt=NULL,*dropped;
+    struct thread_lock *lock=this_->active ? this_->pool->lock : NULL;
+    GList *l,*next;
+    int ret=0;
+
+    thread_lock_acquire(lock);
+    for (l = this_->queue ; l ; l = g_list_next(l))
+        if (((struct binfile_prefetch_tile *)l->data)->zipfile == zipfile) {
+            pt=l->data;
+            break;
+        }
+    if (pt) {
+        for (l = this_->queue ; l->data != pt ; l = next) {
+            next=g_list_next(l);
+            dropped=l->data;
+            if (dropped->state == 1)
+                continue;
+            this_->size-=binfile_prefetch_tile_size(dropped);
+            binfile_prefetch_tile_destroy(this_->m, dropped);
+            this_->queue=g_list_delete_link(this_->queue, l);
+        }
+        while (pt->state == 1)
+            thread_cond_wait(this_->pool->cond, lock);
+        this_->queue=g_list_remove(this_->queue, pt);
+        if (pt->state == 2) {
+            this_->size-=binfile_prefetch_tile_size(pt);
+            *t=pt->t;
+            ret=1;
+        }
+        g_free(pt);
+        if (lock)
+            thread_cond_broadcast(this_->pool->cond);
+    }
+    thread_lock_release(lock);
+    return ret;
+}
+
 
 static int map_binfile_handle_redirect(struct map_priv *m) {
     char *location=file_http_header(m->http, "location");
@@ -1226,9 +1782,14 @@ static void push_zipfile_tile_do(struct map_rect_priv *mr, struct zip_cd *cd, in
 #endif
     mr->size+=cd->zipcunc;
 #endif
+    if (!mr->prefetch || !binfile_prefetch_take(mr->prefetch, zipfile, &t))
+        zipfile_to_tile(m, cd, zipfile, &t);
     t.zipfile_num=zipfile;
-    if (zipfile_to_tile(m, cd, &t))
+    if (t.start) {
         push_tile(mr, &t, offset, length);
+        if (mr->prefetch && !offset && !length)
+            binfile_prefetch_schedule(mr);
+    }
     file_data_free(f, (unsigned char *)cd);
 }
 
@@ -1476,9 +2037,11 @@ static struct map_rect_priv *map_rect_new_binfile(struct map_priv *map, struct m
     if (map->url && map->fi && sel && sel->order == 255) {
         map_download_selection(map, mr, sel);
     }
-    if (map->eoc)
+    if (map->eoc) {
         mr->status=1;
-    else {
+        if (sel)
+            mr->prefetch=binfile_prefetch_new(map);
+    } else {
         unsigned char *d;
         if (map->fi) {
             d=file_data_read(map->fi, 0, map->fi->size);
@@ -1487,6 +2050,7 @@ static struct map_rect_priv *map_rect_new_binfile(struct map_priv *map, struct m
             t.fi=map->fi;
             t.zipfile_num=0;
             t.mode=0;
+            t.cached=NULL;
             push_tile(mr, &t, 0, 0);
         } else if (map->url && !map->download) {
             download(map, NULL, NULL, 0, 0, 0, 1);
@@ -1547,12 +2111,13 @@ static void load_changes(struct map_priv *m) {
 
 static void map_rect_destroy_binfile(struct map_rect_priv *mr) {
     write_changes(mr->m);
+    binfile_prefetch_destroy(mr->prefetch);
     while (pop_tile(mr));
 #ifdef DEBUG_SIZE
     dbg(lvl_debug,"size=%d kb",mr->size/1024);
 #endif
     if (mr->tiles[0].fi && mr->tiles[0].start)
-        file_data_free(mr->tiles[0].fi, (unsigned char *)(mr->tiles[0].start));
+        binfile_tile_free(mr->m, &mr->tiles[0]);
     g_free(mr->url);
     map_binfile_http_close(mr->m);
     g_free(mr);
@@ -2346,6 +2911,34 @@ static int binmap_get_attr(struct map_priv *m, enum attr_type type, struct attr
             attr->u.str=m->progress;
             return 1;
         }
+        break;
+    case attr_thread_safe:
+        /* Downloading, reopening on version changes and writing changes all modify the map itself */
+        attr->u.num=!m->url && !m->download_enabled && !m->check_version && !m->changes;
+        return 1;
+    case attr_data_version: {
+        struct stat st;
+        /* Maps which are downloaded or edited have no stable version */
+        if (m->url || m->changes || !m->fi || stat(m->filename, &st))
+            break;
+        g_free(m->data_version);
+        m->data_version=g_strdup_printf("%s:"LONGLONG_FMT":%ld", m->filename, (long long)st.st_size, (long)st.st_mtime);
+        attr->u.str=m->data_version;
+        return 1;
+    }
+    case attr_cache_size:
+        if (!m->cache_size)
+            break;
+        attr->u.num=m->cache_size;
+        return 1;
+    case attr_tile_cache_size:
+        attr->u.num=m->tile_cache_size;
+        return 1;
+    case attr_cache_hits:
+    case attr_cache_misses:
+    case attr_cache_evictions:
+        /* only the main file is counted, which holds all tiles unless the map is split */
+        return m->fi && file_get_cache_attr(m->fi, type, attr);
     default:
         break;
     }
@@ -2357,6 +2950,28 @@ static int binmap_set_attr(struct map_priv *map, struct attr *attr) {
     case attr_update:
         map->download_enabled = attr->u.num;
         return 1;
+    case attr_cache_size:
+        /* the cache can only be resized, switching caches while tiles are in use would free them in the wrong one */
+        if (!map->cache_size || attr->u.num <= 0)
+            return 0;
+        map->cache_size=attr->u.num;
+        if (map->fi)
+            file_set_own_cache_size(map->fi, map->cache_size);
+        if (map->fis && map->eoc) {
+            int i;
+            for (i = 0 ; i < map->eoc->zipedsk-1 ; i++)
+                if (map->fis[i])
+                    file_set_own_cache_size(map->fis[i], map->cache_size);
+        }
+        return 1;
+    case attr_tile_cache_size:
+        /* a disabled cache is not enabled later, tiles in use were read without it */
+        if (!map->tile_cache_size || attr->u.num <= 0)
+            return 0;
+        map->tile_cache_size=attr->u.num;
+        if (map->tile_cache)
+            binfile_tile_cache_resize(map->tile_cache, map->tile_cache_size);
+        return 1;
     default:
         return 0;
     }
@@ -2419,6 +3034,24 @@ static int binfile_get_index(struct map_priv *m) {
     return 1;
 }
 
+/**
+ * @brief Maps a file of a map into memory
+ *
+ * With `mmap` set, the whole file is mapped. Otherwise, or if that fails, e.g. for a planet map on a 32-bit system,
+ * the file is mapped in windows, so stored members are returned without copying them. Files which a download may
+ * write to are not mapped in windows.
+ *
+ * @param m The map
+ * @param fi The file
+ * @param mmap Whether to map the whole file
+ */
+static void map_binfile_mmap(struct map_priv *m, struct file *fi, int mmap) {
+    if (mmap && file_mmap(fi))
+        return;
+    if (!m->url && !m->download_enabled)
+        file_mmap_windows(fi);
+}
+
 static int map_binfile_zip_setup(struct map_priv *m, char *filename, int mmap) {
     struct zip_cd *first_cd;
     int i;
@@ -2433,8 +3066,11 @@ static int map_binfile_zip_setup(struct map_priv *m, char *filename, int mmap) {
         for (i = 0 ; i < m->eoc->zipedsk-1 ; i++) {
             sprintf(ext,"b%02d",i+1);
             m->fis[i]=file_create(tmpfilename, 0);
-            if (mmap)
-                file_mmap(m->fis[i]);
+            if (m->fis[i]) {
+                if (m->cache_size)
+                    file_set_own_cache_size(m->fis[i], m->cache_size);
+                map_binfile_mmap(m, m->fis[i], mmap);
+            }
         }
         m->fis[m->eoc->zipedsk-1]=m->fi;
         g_free(tmpfilename);
@@ -2454,8 +3090,7 @@ static int map_binfile_zip_setup(struct map_priv *m, char *filename, int mmap) {
     dbg(lvl_debug,"cde_size %d", m->cde_size);
     dbg(lvl_debug,"members %d",m->zip_members);
     file_data_free(m->fi, (unsigned char *)first_cd);
-    if (mmap)
-        file_mmap(m->fi);
+    map_binfile_mmap(m, m->fi, mmap);
     return 1;
 }
 
@@ -2555,6 +3190,8 @@ static int map_binfile_open(struct map_priv *m) {
         dbg(lvl_error,"Failed to load '%s'", m->filename);
         return 0;
     }
+    if (m->cache_size)
+        file_set_own_cache_size(m->fi, m->cache_size);
     if (m->check_version)
         m->version=file_version(m->fi, m->check_version);
     magic=(int *)file_data_read(m->fi, 0, 4);
@@ -2571,6 +3208,12 @@ static int map_binfile_open(struct map_priv *m) {
             m->fi=NULL;
             return 0;
         }
+        /* only for maps whose members never change while the map is open, see attr_thread_safe */
+        if (!m->url && !m->download_enabled && !m->check_version) {
+            if (m->tile_cache_size)
+                m->tile_cache=binfile_tile_cache_new(m->tile_cache_size);
+            m->prefetch_pool=binfile_prefetch_pool_new(m);
+        }
     } else if (*magic == zip_lfh_sig_rev || *magic == zip_split_sig_rev || *magic == zip_cd_sig_rev
                || *magic == zip64_eoc_sig_rev) {
         dbg(lvl_error,"endianness mismatch for '%s'", m->filename);
@@ -2610,6 +3253,10 @@ static int map_binfile_open(struct map_priv *m) {
 
 static void map_binfile_close(struct map_priv *m) {
     int i;
+    binfile_prefetch_pool_destroy(m->prefetch_pool);
+    m->prefetch_pool=NULL;
+    binfile_tile_cache_destroy(m->tile_cache);
+    m->tile_cache=NULL;
     file_data_free(m->fi, (unsigned char *)m->index_cd);
     file_data_free(m->fi, (unsigned char *)m->eoc);
     file_data_free(m->fi, (unsigned char *)m->eoc64);
@@ -2624,6 +3271,7 @@ static void map_binfile_close(struct map_priv *m) {
 }
 
 static void map_binfile_destroy(struct map_priv *m) {
+    g_free(m->data_version);
     g_free(m->filename);
     g_free(m->url);
     g_free(m->progress);
@@ -2648,7 +3296,7 @@ static void binfile_check_version(struct map_priv *m) {
 static struct map_priv *map_new_binfile(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl) {
     struct map_priv *m;
     struct attr *data=attr_search(attrs, attr_data);
-    struct attr *check_version,*flags,*url,*download_enabled;
+    struct attr *check_version,*flags,*url,*download_enabled,*cache_size,*tile_cache_size;
     struct file_wordexp *wexp;
     char **wexp_data;
     if (! data)
@@ -2676,6 +3324,13 @@ static struct map_priv *map_new_binfile(struct map_methods *meth, struct attr **
     download_enabled = attr_search(attrs, attr_update);
     if (download_enabled)
         m->download_enabled=download_enabled->u.num;
+    cache_size=attr_search(attrs, attr_cache_size);
+    if (cache_size && cache_size->u.num > 0)
+        m->cache_size=cache_size->u.num;
+    m->tile_cache_size=BINFILE_TILE_CACHE_SIZE;
+    tile_cache_size=attr_search(attrs, attr_tile_cache_size);
+    if (tile_cache_size && tile_cache_size->u.num >= 0)
+        m->tile_cache_size=tile_cache_size->u.num;
 
     if (!map_binfile_open(m) && !m->check_version && !m->url) {
         map_binfile_destroy(m);
@@ -310,6 +310,7 @@ static void usage(void) {
     fprintf(f,"-U (--unknown-country)            : add objects with unknown country to index\n");
     fprintf(f,"-x (--index-size)                 : set maximum country index size in bytes\n");
     fprintf(f,"-z (--compression-level) <level>  : set the compression level\n");
+    fprintf(f,"-Z (--compression-method) <method>: set the compression method (deflate or zstd)\n");
     fprintf(f,"Internal options (undocumented):\n");
     fprintf(f,"-b (--binfile)\n");
     fprintf(f,"-B \n");
@@ -334,6 +335,7 @@ struct maptool_params {
     int dump;
     int o5m;
     int compression_level;
+    int compression_method;
     int protobuf;
     int dump_coordinates;
     int input;
@@ -364,6 +366,7 @@ static int parse_option(struct maptool_params *p, char **argv, int argc, int *op
         {"attr-debug-level", 1, 0, 'a'},
         {"binfile", 0, 0, 'b'},
         {"compression-level", 1, 0, 'z'},
+        {"compression-method", 1, 0, 'Z'},
 #ifdef HAVE_POSTGRESQL
         {"db", 1, 0, 'd'},
 #endif
@@ -396,7 +399,7 @@ static int parse_option(struct maptool_params *p, char **argv, int argc, int *op
 #ifdef HAVE_POSTGRESQL
                      "d:"
 #endif
-                     "e:hi:knm:p:r:s:t:T:wu:z:Ux:", long_options, option_index);
+                     "e:hi:knm:p:r:s:t:T:wu:z:Z:Ux:", long_options, option_index);
     if (c == -1)
         return 1;
     switch (c) {
@@ -532,6 +535,18 @@ static int parse_option(struct maptool_params *p, char **argv, int argc, int *op
         p->compression_level=atoi(optarg);
         break;
 #endif
+    case 'Z':
+        if (!strcmp(optarg, "deflate"))
+            p->compression_method=8;
+#ifdef HAVE_ZSTD
+        else if (!strcmp(optarg, "zstd"))
+            p->compression_method=zip_method_zstd;
+#endif
+        else {
+            fprintf(stderr,"Unsupported compression method '%s'\n", optarg);
+            return 0;
+        }
+        break;
     case '?':
     default:
         return 0;
@@ -821,6 +836,7 @@ static void maptool_assemble_map(struct maptool_params *p, char *suffix, char **
         zip_set_timestamp(zip_info, p->timestamp);
         zip_set_maxnamelen(zip_info, 14+strlen(suffix0));
         zip_set_compression_level(zip_info, p->compression_level);
+        zip_set_compression_method(zip_info, p->compression_method);
         if(!zip_open(zip_info, p->result, zipdir, zipindex)) {
             fprintf(stderr,"Fatal: Could not write output file.\n");
             exit(1);
@@ -935,6 +951,7 @@ int main(int argc, char **argv) {
 #ifdef HAVE_ZLIB
     p.compression_level=9;
 #endif
+    p.compression_method=8;
     p.start=1;
     p.end=99;
     p.input_file=stdin;
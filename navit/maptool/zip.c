@@ -24,12 +24,16 @@
 #include "maptool.h"
 #include "config.h"
 #include "zipfile.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 struct zip_info {
     int zipnum;
     int dir_size;
     long long offset;
     int compression_level;
+    int compression_method;
     int maxnamelen;
     int zip64;
     short date;
@@ -75,6 +79,45 @@ static int compress2_int(Byte *dest, uLongf *destLen, const Bytef *source, uLong
 }
 #endif
 
+/**
+ * @brief Compresses the data of a member with the compression method and level of the zip file
+ *
+ * @param info The zip file
+ * @param dest Receives the compressed data
+ * @param destlen The size of `dest`, receives the size of the compressed data
+ * @param source The data
+ * @param size The size of the data
+ *
+ * @return True on success
+ */
+static int zip_compress(struct zip_info *info, char *dest, uLongf *destlen, char *source, int size) {
+    switch (info->compression_method) {
+#ifdef HAVE_ZLIB
+    case 8: {
+        int error=compress2_int((Byte *)dest, destlen, (Bytef *)source, size, info->compression_level);
+        if (error != Z_OK) {
+            fprintf(stderr,"compress2 returned %d\n", error);
+            return 0;
+        }
+        return 1;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case zip_method_zstd: {
+        size_t ret=ZSTD_compress(dest, *destlen, source, size, info->compression_level);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr,"ZSTD_compress failed: %s\n", ZSTD_getErrorName(ret));
+            return 0;
+        }
+        *destlen=ret;
+        return 1;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
 void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size) {
     struct zip_lfh lfh = {
         0x04034b50,
@@ -120,24 +163,26 @@ void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *d
     uLongf destlen=data_size+data_size/500+12;
     char *compbuffer;
 
+#ifdef HAVE_ZSTD
+    if (zip_info->compression_method == zip_method_zstd)
+        destlen=ZSTD_compressBound(data_size);
+#endif
     compbuffer = g_malloc(destlen);
     crc=crc32(0, NULL, 0);
     crc=crc32(crc, (unsigned char *)data, data_size);
-    lfh.zipmthd=zip_info->compression_level ? 8:0;
-#ifdef HAVE_ZLIB
-    if (zip_info->compression_level) {
-        int error=compress2_int((Byte *)compbuffer, &destlen, (Bytef *)data, data_size, zip_info->compression_level);
-        if (error == Z_OK) {
-            if (destlen < data_size) {
-                data=compbuffer;
-                comp_size=destlen;
-            } else
-                lfh.zipmthd=0;
-        } else {
-            fprintf(stderr,"compress2 returned %d\n", error);
-        }
+    lfh.zipmthd=zip_info->compression_level ? zip_info->compression_method : 0;
+    if (lfh.zipmthd) {
+        if (zip_compress(zip_info, compbuffer, &destlen, data, data_size) && destlen < data_size) {
+            data=compbuffer;
+            comp_size=destlen;
+        } else
+            lfh.zipmthd=0;
+    }
+    if (lfh.zipmthd == zip_method_zstd) {
+        /* zstd members need version 6.3 of the zip specification */
+        lfh.zipver=63;
+        cd.zipcvxt=63;
     }
-#endif
     lfh.zipcrc=crc;
     lfh.zipsize=comp_size;
     lfh.zipuncmp=data_size;
@@ -262,7 +307,9 @@ int zip_write_directory(struct zip_info *info) {
 
 struct zip_info *
 zip_new(void) {
-    return g_new0(struct zip_info, 1);
+    struct zip_info *ret=g_new0(struct zip_info, 1);
+    ret->compression_method=8;
+    return ret;
 }
 
 void zip_set_zip64(struct zip_info *info, int on) {
@@ -273,6 +320,27 @@ void zip_set_compression_level(struct zip_info *info, int level) {
     info->compression_level=level;
 }
 
+/**
+ * @brief Sets the compression method for members
+ *
+ * @param info The zip file
+ * @param method 8 for deflate or `zip_method_zstd`, which is only available if maptool was built with zstd
+ *
+ * @return True if the method is supported
+ */
+int zip_set_compression_method(struct zip_info *info, int method) {
+    switch (method) {
+    case 8:
+#ifdef HAVE_ZSTD
+    case zip_method_zstd:
+#endif
+        info->compression_method=method;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 void zip_set_maxnamelen(struct zip_info *info, int max) {
     info->maxnamelen=max;
 }
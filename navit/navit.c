@@ -1287,6 +1287,144 @@ static int navit_cmd_route_remove_last_waypoint(struct navit *this, char *functi
 }
 
 
+/**
+ * @brief Calculates landmark tables for routing, see route_landmark.c
+ *
+ * @param this The navit instance
+ * @param function unused
+ * @param in Optionally the number of landmarks (default 16)
+ * @param out unused
+ * @return Always 0
+ */
+static int navit_cmd_route_build_landmarks(struct navit *this, char *function, struct attr **in,
+        struct attr ***out) {
+    int count=16;
+    if (in && in[0] && ATTR_IS_INT(in[0]->type))
+        count=in[0]->u.num;
+    if (this->route)
+        route_build_landmarks(this->route, count);
+    return 0;
+}
+
+
+/**
+ * @brief Calculates a travel time and distance matrix, see route_get_matrix()
+ *
+ * The first argument is the number of sources, followed by the coordinates of the sources and then those of the
+ * targets, in any of the forms accepted by set_destination. For n sources and m targets, n*m travel times (in tenths
+ * of seconds) are returned row by row (all targets for the first source, then for the second and so on), followed
+ * by n*m distances (in meters) in the same order. Both are -1 where the target cannot be reached.
+ *
+ * @param this The navit instance
+ * @param function unused
+ * @param in The number of sources, followed by the coordinates of sources and targets
+ * @param out The matrix as a list of integers
+ * @return Always 0
+ */
+static int navit_cmd_route_matrix(struct navit *this, char *function, struct attr **in, struct attr ***out) {
+    struct attr attr;
+    struct pcoord *pc;
+    int i,count=0,source_count,*values;
+
+    if (!this->route || !in || !in[0] || !ATTR_IS_INT(in[0]->type))
+        return 0;
+    source_count=in[0]->u.num;
+    in++;
+    for (i = 0 ; in[i] ; i++);
+    pc=g_new(struct pcoord, i);
+    while ((in=navit_get_coord(this, in, &pc[count])))
+        count++;
+    if (source_count > 0 && count > source_count) {
+        values=g_new(int, 2*source_count*(count-source_count));
+        if (route_get_matrix(this->route, pc, source_count, pc+source_count, count-source_count, values,
+                             values+source_count*(count-source_count)) && out) {
+            attr.type=attr_type_int_begin;
+            for (i = 0 ; i < 2*source_count*(count-source_count) ; i++) {
+                attr.u.num=values[i];
+                *out=attr_generic_add_attr(*out, &attr);
+            }
+        }
+        g_free(values);
+    }
+    g_free(pc);
+    return 0;
+}
+
+
+/**
+ * @brief Matches points to streets, see route_match()
+ *
+ * The first argument is 0 to match each point to its nearest street, or 1 if the points form a trace (e.g. a
+ * recorded track) which is to be matched to the streets it most likely followed. It is followed by the points, in any
+ * of the forms accepted by set_destination. One position is returned per point, unchanged where the point is not
+ * near any street.
+ *
+ * @param this The navit instance
+ * @param function unused
+ * @param in The mode, followed by the points
+ * @param out The matched positions
+ * @return Always 0
+ */
+static int navit_cmd_route_match(struct navit *this, char *function, struct attr **in, struct attr ***out) {
+    struct attr attr;
+    struct pcoord *pc;
+    int i,count=0,trace;
+
+    if (!this->route || !in || !in[0] || !ATTR_IS_INT(in[0]->type))
+        return 0;
+    trace=in[0]->u.num;
+    in++;
+    for (i = 0 ; in[i] ; i++);
+    pc=g_new(struct pcoord, 2*i);
+    while ((in=navit_get_coord(this, in, &pc[count])))
+        count++;
+    if (route_match(this->route, pc, count, trace, pc+count) >= 0 && out) {
+        attr.type=attr_position;
+        for (i = 0 ; i < count ; i++) {
+            attr.u.pcoord=&pc[count+i];
+            *out=attr_generic_add_attr(*out, &attr);
+        }
+    }
+    g_free(pc);
+    return 0;
+}
+
+
+/**
+ * @brief Calculates an isochrone and shows it on the map, see route_set_isochrone()
+ *
+ * The arguments are the travel times of the bands in seconds, optionally followed by the starting point as a
+ * coordinate string or coordinate attribute (bare numbers would be taken as travel times). Without a starting point,
+ * the isochrone starts at the vehicle position.
+ * Without any travel time, the isochrone is removed. The number of polygons is returned, or -1 on failure.
+ *
+ * @param this The navit instance
+ * @param function unused
+ * @param in The travel times, optionally followed by the starting point
+ * @param out The number of polygons
+ * @return Always 0
+ */
+static int navit_cmd_route_isochrone(struct navit *this, char *function, struct attr **in, struct attr ***out) {
+    struct attr attr;
+    struct pcoord pc;
+    int i,count,*times;
+
+    if (!this->route)
+        return 0;
+    for (count = 0 ; in && in[count] && ATTR_IS_INT(in[count]->type) ; count++);
+    times=g_new(int, count+1);
+    for (i = 0 ; i < count ; i++)
+        times[i]=in[i]->u.num;
+    attr.type=attr_type_int_begin;
+    attr.u.num=route_set_isochrone(this->route, in && navit_get_coord(this, in+count, &pc) ? &pc : NULL, times, count);
+    g_free(times);
+    if (out)
+        *out=attr_generic_add_attr(*out, &attr);
+    navit_draw(this);
+    return 0;
+}
+
+
 static int navit_cmd_set_center(struct navit *this, char *function, struct attr **in, struct attr ***out) {
     struct pcoord pc;
     int set_timeout=0;
@@ -1425,6 +1563,10 @@ static struct command_table commands[] = {
     {"set_position",command_cast(navit_cmd_set_position)},
     {"route_remove_next_waypoint",command_cast(navit_cmd_route_remove_next_waypoint)},
     {"route_remove_last_waypoint",command_cast(navit_cmd_route_remove_last_waypoint)},
+    {"route_build_landmarks",command_cast(navit_cmd_route_build_landmarks)},
+    {"route_matrix",command_cast(navit_cmd_route_matrix)},
+    {"route_match",command_cast(navit_cmd_route_match)},
+    {"route_isochrone",command_cast(navit_cmd_route_isochrone)},
     {"set_position",command_cast(navit_cmd_set_position)},
     {"announcer_toggle",command_cast(navit_cmd_announcer_toggle)},
     {"fmt_coordinates",command_cast(navit_cmd_fmt_coordinates)},
@@ -2055,7 +2197,7 @@ void navit_window_roadbook_new(struct navit *this_) {
 int navit_init(struct navit *this_) {
     struct mapset *ms;
     struct map *map;
-    int callback;
+    int callback,i;
     char *center_file;
     struct attr_iter *iter;
     struct attr *attr;
@@ -2110,6 +2252,12 @@ int navit_init(struct navit *this_) {
                 map_a.u.map=map;
                 mapset_add_attr(ms, &map_a);
             }
+            for (i = 1 ; (map=route_get_alternative_map(this_->route, i)) ; i++) {
+                struct attr map_a;
+                map_a.type=attr_map;
+                map_a.u.map=map;
+                mapset_add_attr(ms, &map_a);
+            }
             if ((map=route_get_graph_map(this_->route))) {
                 struct attr map_a,active;
                 map_a.type=attr_map;
@@ -2119,6 +2267,12 @@ int navit_init(struct navit *this_) {
                 mapset_add_attr(ms, &map_a);
                 map_set_attr(map, &active);
             }
+            if ((map=route_get_isochrone_map(this_->route))) {
+                struct attr map_a;
+                map_a.type=attr_map;
+                map_a.u.map=map;
+                mapset_add_attr(ms, &map_a);
+            }
             route_set_mapset(this_->route, ms);
             route_set_projection(this_->route, transform_get_projection(this_->trans));
         }
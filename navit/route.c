@@ -50,8 +50,11 @@
  * introduced, as it became necessary to do fast partial recalculations of the route when the traffic situation
  * changes. Navit’s LPA* implementation differs from the canonical implementation in two important ways:
  *
- * \li The heuristic is not used (or assumed to be zero), for the reasons discussed above. However, this is not set in
- * stone and can be revisited if we find using a heuristic provides a true benefit.
+ * \li By default, the heuristic is not used (or assumed to be zero), for the reasons discussed above. If the
+ * `heuristic` attribute of the route is set, a goal-directed heuristic (the straight-line distance to the current
+ * position, traveled at the highest speed found in the graph) is used, and calculation stops as soon as the cost of
+ * the current position is final, see `route_graph_set_goal()`. This pays off mostly for the first calculation of a
+ * route over a large graph.
  * \li Since the destination point may be off-road, Navit may initialize the route graph with multiple candidates for
  * the destination point, each of which will get a nonzero cost (which may still decrease if routing later determines
  * that it is cheaper to route from that candidate point to a different candidate point).
@@ -62,7 +65,10 @@
  * descriptions of these algorithms. Navit has always calculated routes from destination to start, even with Dijkstra,
  * as this made it easier to react to changes in the vehicle position (the start of the route).
  *
- * A route graph first needs to be built with `route_graph_build()`, which fetches the segments from the map. Next
+ * A route graph first needs to be built with `route_graph_build()`, which fetches the segments from the map. This is
+ * done either in slices from an idle callback or, if the `graph_thread` attribute of the route is set, on a worker
+ * thread for all maps which are thread-safe (reading several maps in parallel and merging the results), followed by
+ * the remaining maps on the main thread. Next
  * `route_graph_init()` is called to initialize the destination point candidates. Then
  * `route_graph_compute_shortest_path()` is called to assign a `value` to each node, which represents the cost of
  * traveling from this point to the destination. Each point is also assigned a “next segment” to take in order to reach
@@ -81,10 +87,12 @@
  * the route path.
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include "navit_nls.h"
 #include "glib_slice.h"
 #include "config.h"
@@ -102,7 +110,8 @@
 #include "track.h"
 #include "transform.h"
 #include "plugin.h"
-#include "fib.h"
+#include "dheap.h"
+#include "thread.h"
 #include "event.h"
 #include "callback.h"
 #include "vehicle.h"
@@ -112,6 +121,7 @@
 
 struct map_priv {
     struct route *route;
+    int alternative;            /**< 0 for the map of the route, otherwise the number of the alternative route */
 };
 
 int debug_route=0;
@@ -120,6 +130,12 @@ int debug_route=0;
 #define RSD_OFFSET(x) *((int *)route_segment_data_field_pos((x), attr_offset))
 #define RSD_SIZE_WEIGHT(x) *((struct size_weight_limit *)route_segment_data_field_pos((x), attr_vehicle_width))
 #define RSD_DANGEROUS_GOODS(x) *((int *)route_segment_data_field_pos((x), attr_vehicle_dangerous_goods))
+#define RSD_SPEED_PROFILE_ID(x) (RSD_SPEED_PROFILE(x) & 0xffff)
+#define RSD_SPEED_PROFILE_PERCENT(x) ((RSD_SPEED_PROFILE(x) >> 16) & 0xff)
+
+/** Average speed in km/h at which the time is projected at which a segment with a speed profile is reached, see
+ *  `route_graph_set_departure()` */
+#define ROUTE_SPEED_PROFILE_PROJECTION_SPEED 50
 
 
 /**
@@ -193,6 +209,19 @@ struct route_path {
     struct route_path *next;				/**< Next route path in case of intermediate destinations */
 };
 
+/** Maximum number of alternative routes */
+#define ROUTE_ALTERNATIVES_MAX 3
+
+/** Maximum cost of an alternative route, in percent above the cost of the main route */
+#define ROUTE_ALTERNATIVE_MAX_STRETCH 25
+
+/** Maximum share of the length of an alternative route which it may have in common with the main route or any other
+ *  alternative, in percent */
+#define ROUTE_ALTERNATIVE_MAX_SHARING 70
+
+/** Maximum number of via points examined when calculating alternative routes */
+#define ROUTE_ALTERNATIVE_MAX_CANDIDATES 1000
+
 /**
  * @brief A complete route
  *
@@ -218,11 +247,31 @@ struct route {
     struct vehicleprofile *vehicleprofile; /**< Routing preferences */
     int route_status;		/**< Route Status */
     int link_path;			/**< Link paths over multiple waypoints together */
+    int ch_routing;			/**< Use contraction hierarchy data from the map, if present */
+    int graph_thread;		/**< Read thread-safe maps on a worker thread when building the graph asynchronously */
+    int graph_cache;		/**< Cache route graphs on disk, see route_graph_cache.c */
+    int heuristic;			/**< Use a goal-directed heuristic (A*) when flooding the route graph */
+    struct route_landmarks *landmarks; /**< Landmark tables for the heuristic, see route_landmark.c */
+    int time_dependent;		/**< Take the speed of streets from their speed profiles, see route_speed_profile.c */
+    long departure_time;	/**< Time of departure for time-dependent routing, 0 for the current time */
+    struct route_speed_profiles *speed_profiles; /**< Speed profiles, NULL if not time-dependent or none found */
+    int alternatives;		/**< Number of alternative routes to calculate, ignored with `heuristic` */
+    int alternative_count;	/**< Number of alternative routes in `alternative_paths` */
+    struct route_path *alternative_paths[ROUTE_ALTERNATIVES_MAX]; /**< Alternative routes, see
+                                                                   *   `route_alternatives_update()` */
+    struct map *alternative_maps[ROUTE_ALTERNATIVES_MAX]; /**< The maps containing the alternative routes */
+    GList *isochrone;		/**< Polygons of the isochrone, see `route_set_isochrone()` */
+    struct map *isochrone_map;	/**< The map containing the isochrone */
+    struct route_match_index *match_index; /**< Streets indexed for map matching, see `route_match()` */
     struct pcoord pc;
     struct vehicle *v;
 };
 
-#define HASHCOORD(c) ((((c)->x +(c)->y) * 2654435761UL) & (HASH_SIZE-1))
+/** Initial number of slots in the point hash table of a route graph */
+#define ROUTE_GRAPH_HASH_MIN_SIZE 256
+
+/** Maximum number of threads reading maps in parallel when building a route graph on a worker thread */
+#define ROUTE_GRAPH_BUILD_THREADS 8
 
 /**
  * @brief Iterator to iterate through all route graph segments in a route graph point
@@ -240,15 +289,18 @@ struct attr_iter {
     union {
         GList *list;
     } u;
+    int index;                  /**< Number of maps returned so far when iterating over `attr_map` */
 };
 
 static struct route_info * route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *ms,
         struct pcoord *c);
-static void route_graph_update(struct route *this, struct callback *cb, int async);
+static void route_graph_update(struct route *this, struct callback *cb, int async, int ch);
+static int route_graph_extend_route(struct route *this, int reset, int async);
 static struct route_path *route_path_new(struct route_graph *this, struct route_path *oldpath, struct route_info *pos,
         struct route_info *dst, struct vehicleprofile *profile);
 static void route_graph_add_street(struct route_graph *this, struct item *item, struct vehicleprofile *profile);
 static void route_graph_destroy(struct route_graph *this);
+static void route_graph_build_thread_join(struct route_graph *rg);
 static void route_path_update(struct route *this, int cancel, int async);
 static int route_time_seg(struct vehicleprofile *profile, struct route_segment_data *over,
                           struct route_traffic_distortion *dist);
@@ -260,8 +312,17 @@ static struct route_graph_segment *route_graph_get_segment(struct route_graph *g
 static int route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from,
                            struct route_graph_segment *over,
                            int dir);
+static int route_value_seg_next(struct vehicleprofile *profile, struct route_graph_segment *next,
+                                struct route_graph_segment *over, int dir);
 static void route_graph_init(struct route_graph *this, struct route_info *dst, struct vehicleprofile *profile);
 static void route_graph_reset(struct route_graph *this);
+static void route_graph_set_goal(struct route_graph *this, struct route_info *goal, struct vehicleprofile *profile);
+static int route_graph_point_key(struct route_graph *this, struct route_graph_point *p);
+static int route_graph_landmark_index(struct route_graph *this, struct route_graph_point *p);
+static struct route_graph *route_graph_build_selection(struct mapset *ms, struct map_selection *sel,
+        struct callback *done_cb, int async, int threaded, int cache, struct vehicleprofile *profile);
+static void route_alternatives_update(struct route *this);
+static void route_isochrone_clear(struct route *this);
 
 
 /**
@@ -403,6 +464,51 @@ static void route_path_destroy(struct route_path *this, int recurse) {
     }
 }
 
+/**
+ * @brief Destroys the alternative routes of a route
+ *
+ * @param this The route
+ */
+static void route_alternatives_clear(struct route *this) {
+    while (this->alternative_count)
+        route_path_destroy(this->alternative_paths[--this->alternative_count], 0);
+}
+
+/**
+ * @brief Calculates the total time and length of a route path
+ *
+ * If the costs of the route graph depend on time, the speed of each segment with a speed profile is taken from the
+ * profile at the time at which the segment is reached, counting from the departure time of the graph, and stored in
+ * the segment of the path.
+ *
+ * @param this The route path
+ * @param graph The route graph from which the path was calculated
+ * @param profile The vehicle profile
+ */
+static void route_path_set_totals(struct route_path *this, struct route_graph *graph, struct vehicleprofile *profile) {
+    struct route_path_segment *seg=this->path;
+    int path_time=0,path_len=0,minute=0,seg_time,percent;
+    if (graph->speed_profiles)
+        minute=route_speed_profiles_minute(graph->departure);
+    while (seg) {
+        if (graph->speed_profiles && (seg->data->flags & AF_SPEED_PROFILE)) {
+            percent=route_speed_profiles_percent(graph->speed_profiles, RSD_SPEED_PROFILE_ID(seg->data),
+                                                 minute+path_time/600);
+            RSD_SPEED_PROFILE(seg->data)=RSD_SPEED_PROFILE_ID(seg->data) | percent << 16;
+        }
+        /* FIXME */
+        seg_time=route_time_seg(profile, seg->data, NULL);
+        if (seg_time == INT_MAX) {
+            dbg(lvl_debug,"error");
+        } else
+            path_time+=seg_time;
+        path_len+=seg->data->len;
+        seg=seg->next;
+    }
+    this->path_time=path_time;
+    this->path_len=path_len;
+}
+
 /**
  * @brief Creates a completely new route structure
  *
@@ -422,6 +528,20 @@ route_new(struct attr *parent, struct attr **attrs) {
     } else {
         this->destination_distance = 50; // Default value
     }
+    if (attr_generic_get_attr(attrs, NULL, attr_ch_routing, &dest_attr, NULL))
+        this->ch_routing = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_graph_thread, &dest_attr, NULL))
+        this->graph_thread = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_graph_cache, &dest_attr, NULL))
+        this->graph_cache = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_heuristic, &dest_attr, NULL))
+        this->heuristic = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_alternatives, &dest_attr, NULL))
+        this->alternatives = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_time_dependent, &dest_attr, NULL))
+        this->time_dependent = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_departure_time, &dest_attr, NULL))
+        this->departure_time = dest_attr.u.num;
     this->cbl2=callback_list_new();
 
     return this;
@@ -440,6 +560,13 @@ route_dup(struct route *orig) {
     navit_object_ref((struct navit_object *)this);
     this->cbl2=callback_list_new();
     this->destination_distance=orig->destination_distance;
+    this->ch_routing=orig->ch_routing;
+    this->graph_thread=orig->graph_thread;
+    this->graph_cache=orig->graph_cache;
+    this->heuristic=orig->heuristic;
+    this->alternatives=orig->alternatives;
+    this->time_dependent=orig->time_dependent;
+    this->departure_time=orig->departure_time;
     this->ms=orig->ms;
     this->flags=orig->flags;
     this->vehicleprofile=orig->vehicleprofile;
@@ -528,6 +655,10 @@ static int route_check_roundabout(struct route_graph_segment *seg, int level, in
  * @param ms The mapset to set for this route
  */
 void route_set_mapset(struct route *this, struct mapset *ms) {
+    if (this->ms != ms) {
+        route_match_index_destroy(this->match_index);
+        this->match_index=NULL;
+    }
     this->ms=ms;
 }
 
@@ -715,6 +846,9 @@ static void route_path_update_done(struct route *this, int new_graph) {
     route_status.u.num=route_status_building_path;
     route_set_attr(this, &route_status);
     prev_dst=route_previous_destination(this);
+    /* with a heuristic, the graph may not have been calculated as far as the current position */
+    route_graph_set_goal(this->graph, this->heuristic ? prev_dst : NULL, this->vehicleprofile);
+    route_graph_compute_shortest_path(this->graph, this->vehicleprofile, NULL);
     if (this->link_path) {
         this->path2=route_path_new(this->graph, NULL, prev_dst, this->current_dst, this->vehicleprofile);
         if (this->path2)
@@ -729,34 +863,27 @@ static void route_path_update_done(struct route *this, int new_graph) {
         }
     }
     if (this->path2) {
-        struct route_path_segment *seg=this->path2->path;
-        int path_time=0,path_len=0;
-        while (seg) {
-            /* FIXME */
-            int seg_time=route_time_seg(this->vehicleprofile, seg->data, NULL);
-            if (seg_time == INT_MAX) {
-                dbg(lvl_debug,"error");
-            } else
-                path_time+=seg_time;
-            path_len+=seg->data->len;
-            seg=seg->next;
-        }
-        this->path2->path_time=path_time;
-        this->path2->path_len=path_len;
+        route_path_set_totals(this->path2, this->graph, this->vehicleprofile);
         if (prev_dst != this->pos) {
             this->link_path=1;
             this->current_dst=prev_dst;
             route_graph_reset(this->graph);
+            route_graph_set_goal(this->graph, this->heuristic ? route_previous_destination(this) : NULL,
+                                 this->vehicleprofile);
             route_graph_init(this->graph, this->current_dst, this->vehicleprofile);
             route_graph_compute_shortest_path(this->graph, this->vehicleprofile, this->route_graph_flood_done_cb);
             return;
         }
+        if (!this->link_path)
+            route_alternatives_update(this);
         if (!new_graph && this->path2->updated)
             route_status.u.num=route_status_path_done_incremental;
         else
             route_status.u.num=route_status_path_done_new;
-    } else
+    } else {
+        route_alternatives_clear(this);
         route_status.u.num=route_status_not_found;
+    }
     this->link_path=0;
     route_set_attr(this, &route_status);
 }
@@ -789,6 +916,7 @@ static void route_path_update_flags(struct route *this, enum route_path_flags fl
         dbg(lvl_debug,"destroy");
         route_path_destroy(this->path2,1);
         this->path2 = NULL;
+        route_alternatives_clear(this);
         return;
     }
     if (flags & route_path_flag_cancel) {
@@ -807,13 +935,18 @@ static void route_path_update_flags(struct route *this, enum route_path_flags fl
     } else {
         route_path_destroy(this->path2,1);
         this->path2 = NULL;
+        route_alternatives_clear(this);
     }
     if (!this->graph || (!this->path2 && !(flags & route_path_flag_no_rebuild))) {
         dbg(lvl_debug,"rebuild graph %p %p",this->graph,this->path2);
         if (! this->route_graph_flood_done_cb)
             this->route_graph_flood_done_cb=callback_new_2(callback_cast(route_path_update_done), this, (long)1);
-        dbg(lvl_debug,"route_graph_update");
-        route_graph_update(this, this->route_graph_flood_done_cb, !!(flags & route_path_flag_async));
+        /* if we already have a graph, we have most likely left it, try loading just the area we have moved into */
+        if (!route_graph_extend_route(this, 0, !!(flags & route_path_flag_async))) {
+            dbg(lvl_debug,"route_graph_update");
+            route_graph_update(this, this->route_graph_flood_done_cb, !!(flags & route_path_flag_async),
+                               this->ch_routing);
+        }
     }
 }
 
@@ -1071,6 +1204,74 @@ static void route_free_selection(struct map_selection *sel) {
     }
 }
 
+/**
+ * @brief Prepends a rectangle to a list of map selections, taking order and item range from another selection
+ */
+static struct map_selection *route_selection_add_rect(struct map_selection *sel, struct map_selection *from,
+        int lu_x, int lu_y, int rl_x, int rl_y) {
+    struct map_selection *ret=g_new(struct map_selection, 1);
+    *ret=*from;
+    ret->u.c_rect.lu.x=lu_x;
+    ret->u.c_rect.lu.y=lu_y;
+    ret->u.c_rect.rl.x=rl_x;
+    ret->u.c_rect.rl.y=rl_y;
+    ret->next=sel;
+    return ret;
+}
+
+/**
+ * @brief Returns the parts of a map selection which are not covered by another one
+ *
+ * A rectangle of `sel` is only covered by rectangles of `covered` with the same or a higher order, as these return
+ * at least the same items. Rectangles which are partly covered are split into up to four rectangles around the
+ * covered part.
+ *
+ * @param sel The selection
+ * @param covered The selection to subtract
+ * @return A new selection, or NULL if `sel` is covered entirely
+ */
+static struct map_selection *route_selection_subtract(struct map_selection *sel, struct map_selection *covered) {
+    struct map_selection *ret=NULL,*parts,*next,*p,*c;
+    struct coord_rect *pr,*cr;
+
+    for ( ; sel ; sel = sel->next) {
+        parts=route_selection_add_rect(NULL, sel, sel->u.c_rect.lu.x, sel->u.c_rect.lu.y, sel->u.c_rect.rl.x,
+                                       sel->u.c_rect.rl.y);
+        for (c = covered ; c && parts ; c = c->next) {
+            cr=&c->u.c_rect;
+            if (c->order < sel->order || cr->lu.x >= cr->rl.x || cr->rl.y >= cr->lu.y)
+                continue;
+            for (p = parts, parts = NULL ; p ; p = next) {
+                next=p->next;
+                pr=&p->u.c_rect;
+                if (pr->rl.x <= cr->lu.x || pr->lu.x >= cr->rl.x || pr->lu.y <= cr->rl.y || pr->rl.y >= cr->lu.y) {
+                    p->next=parts;
+                    parts=p;
+                    continue;
+                }
+                if (pr->lu.x < cr->lu.x)
+                    parts=route_selection_add_rect(parts, p, pr->lu.x, pr->lu.y, cr->lu.x, pr->rl.y);
+                if (pr->rl.x > cr->rl.x)
+                    parts=route_selection_add_rect(parts, p, cr->rl.x, pr->lu.y, pr->rl.x, pr->rl.y);
+                if (pr->lu.y > cr->lu.y)
+                    parts=route_selection_add_rect(parts, p, MAX(pr->lu.x, cr->lu.x), pr->lu.y, MIN(pr->rl.x, cr->rl.x),
+                                                   cr->lu.y);
+                if (pr->rl.y < cr->rl.y)
+                    parts=route_selection_add_rect(parts, p, MAX(pr->lu.x, cr->lu.x), cr->rl.y, MIN(pr->rl.x, cr->rl.x),
+                                                   pr->rl.y);
+                g_free(p);
+            }
+        }
+        while (parts) {
+            next=parts->next;
+            parts->next=ret;
+            ret=parts;
+            parts=next;
+        }
+    }
+    return ret;
+}
+
 
 /* for compatibility to GFunc */
 static void route_info_free_g(struct route_info *inf, void * unused) {
@@ -1240,10 +1441,13 @@ void route_append_destination(struct route *this, struct pcoord *dst, int async)
             route_info_distances(dsti, dst->pro);
             this->destinations=g_list_append(this->destinations, dsti);
         }
+        this->current_dst=route_get_dst(this);
+        /* keep the graph and load just the area around the new waypoint if we can */
+        if (route_graph_extend_route(this, 1, async))
+            return;
         /* The graph has to be destroyed and set to NULL, otherwise route_path_update() doesn't work */
         route_graph_destroy(this->graph);
         this->graph=NULL;
-        this->current_dst=route_get_dst(this);
         route_path_update(this, 1, async);
     } else {
         route_set_destinations(this, NULL, 0, async);
@@ -1282,13 +1486,176 @@ void route_remove_waypoint(struct route *this) {
             return;
         }
         this->reached_destinations_count++;
-        route_graph_reset(this->graph);
         this->current_dst = this->destinations->data;
+        /* a graph still being built on a worker thread will be flooded for the new destination once it is done */
+        if (this->graph->thread)
+            return;
+        route_graph_reset(this->graph);
+        route_graph_set_goal(this->graph, this->heuristic ? route_previous_destination(this) : NULL,
+                             this->vehicleprofile);
         route_graph_init(this->graph, this->current_dst, this->vehicleprofile);
         route_graph_compute_shortest_path(this->graph, this->vehicleprofile, this->route_graph_flood_done_cb);
     }
 }
 
+/**
+ * @brief Returns the hash value for a coordinate pair
+ *
+ * Unlike a hash of `x + y`, this does not map all points along a diagonal to the same value.
+ */
+static inline unsigned int route_graph_hash_coord(struct coord *c) {
+    unsigned int h=((unsigned int)c->x * 2654435761U) ^ ((unsigned int)c->y * 2246822519U);
+    return h ^ (h >> 15);
+}
+
+/**
+ * @brief Finds the hash table slot for a coordinate pair
+ *
+ * @param this The route graph
+ * @param c The coordinates
+ * @return The slot, or NULL if the graph has no points at these coordinates
+ */
+static struct route_graph_hash_entry *route_graph_hash_lookup(struct route_graph *this, struct coord *c) {
+    unsigned int mask, pos, dist;
+    struct route_graph_hash_entry *e;
+
+    if (!this->hash)
+        return NULL;
+    mask=this->hash_size-1;
+    pos=route_graph_hash_coord(c) & mask;
+    for (dist = 0 ;; dist++, pos = (pos + 1) & mask) {
+        e=&this->hash[pos];
+        if (!e->p)
+            return NULL;
+        if (e->c.x == c->x && e->c.y == c->y)
+            return e;
+        /* A resident closer to its home slot than we are to ours means the key is not in the table */
+        if (((pos - route_graph_hash_coord(&e->c)) & mask) < dist)
+            return NULL;
+    }
+}
+
+/**
+ * @brief Inserts an entry for a coordinate pair which is not yet in a hash table
+ *
+ * This is Robin Hood insertion: whenever the entry being inserted is farther from its home slot than the
+ * resident entry, the two are swapped and insertion continues with the displaced entry.
+ *
+ * @param hash The slots
+ * @param size The number of slots, a power of two
+ * @param entry The entry to insert
+ */
+static void route_graph_hash_insert(struct route_graph_hash_entry *hash, int size,
+                                    struct route_graph_hash_entry entry) {
+    unsigned int mask=size-1;
+    unsigned int pos=route_graph_hash_coord(&entry.c) & mask;
+    unsigned int dist, edist;
+    struct route_graph_hash_entry tmp;
+
+    for (dist = 0 ;; dist++, pos = (pos + 1) & mask) {
+        if (!hash[pos].p) {
+            hash[pos]=entry;
+            return;
+        }
+        edist=(pos - route_graph_hash_coord(&hash[pos].c)) & mask;
+        if (edist < dist) {
+            tmp=hash[pos];
+            hash[pos]=entry;
+            entry=tmp;
+            dist=edist;
+        }
+    }
+}
+
+/**
+ * @brief Adds a new point to the hash table of a route graph, growing the table if needed
+ *
+ * If the graph already has points at the same coordinates, the new point is placed in front of them.
+ *
+ * @param this The route graph
+ * @param p The point
+ */
+static void route_graph_hash_add(struct route_graph *this, struct route_graph_point *p) {
+    struct route_graph_hash_entry *e=route_graph_hash_lookup(this, &p->c);
+    struct route_graph_hash_entry *old, entry;
+    int i, old_size;
+
+    this->hash_points++;
+    if (e) {
+        p->hash_next=e->p;
+        e->p=p;
+        return;
+    }
+    /* keep the load factor below 0.8 */
+    if ((this->hash_used + 1) * 5 > this->hash_size * 4) {
+        old=this->hash;
+        old_size=this->hash_size;
+        this->hash_size=old_size ? old_size * 2 : ROUTE_GRAPH_HASH_MIN_SIZE;
+        this->hash=g_new0(struct route_graph_hash_entry, this->hash_size);
+        for (i = 0 ; i < old_size ; i++)
+            if (old[i].p)
+                route_graph_hash_insert(this->hash, this->hash_size, old[i]);
+        g_free(old);
+    }
+    p->hash_next=NULL;
+    this->hash_used++;
+    entry.c=p->c;
+    entry.p=p;
+    route_graph_hash_insert(this->hash, this->hash_size, entry);
+}
+
+/**
+ * @brief Iterates over all points of a route graph
+ *
+ * Points are returned in no particular order, except that points sharing the same coordinates are returned one after
+ * another, newest first. The graph must not be modified while iterating.
+ *
+ * @param this The route graph
+ * @param p The point returned by the previous call, or NULL to return the first point
+ * @param slot Iterator state, its value is only meaningful to this function
+ * @return The next point, or NULL if all points have been returned
+ */
+struct route_graph_point *route_graph_next_point(struct route_graph *this, struct route_graph_point *p, int *slot) {
+    if (!p)
+        *slot=-1;
+    else if (p->hash_next)
+        return p->hash_next;
+    while (++(*slot) < this->hash_size)
+        if (this->hash[*slot].p)
+            return this->hash[*slot].p;
+    return NULL;
+}
+
+/**
+ * @brief Returns statistics for the point hash table of a route graph
+ *
+ * @param this The route graph
+ * @param stats Receives the statistics
+ */
+void route_graph_get_hash_stats(struct route_graph *this, struct route_graph_hash_stats *stats) {
+    unsigned int mask=this->hash_size-1;
+    unsigned int dist;
+    double total=0;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->size=this->hash_size;
+    stats->used=this->hash_used;
+    stats->points=this->hash_points;
+    for (i = 0 ; i < this->hash_size ; i++) {
+        if (!this->hash[i].p)
+            continue;
+        dist=(i - route_graph_hash_coord(&this->hash[i].c)) & mask;
+        total+=dist;
+        if ((int)dist > stats->max_probe)
+            stats->max_probe=dist;
+    }
+    if (this->hash_size)
+        stats->load_factor=(double)this->hash_used / this->hash_size;
+    if (this->hash_used)
+        stats->avg_probe=total / this->hash_used;
+}
+
 /**
  * @brief Gets the next route_graph_point with the specified coordinates
  *
@@ -1300,19 +1667,12 @@ void route_remove_waypoint(struct route *this) {
  */
 struct route_graph_point *route_graph_get_point_next(struct route_graph *this, struct coord *c,
         struct route_graph_point *last) {
-    struct route_graph_point *p;
-    int seen=0,hashval=HASHCOORD(c);
-    p=this->hash[hashval];
-    while (p) {
-        if (p->c.x == c->x && p->c.y == c->y) {
-            if (!last || seen)
-                return p;
-            if (p == last)
-                seen=1;
-        }
-        p=p->hash_next;
-    }
-    return NULL;
+    struct route_graph_hash_entry *e;
+
+    if (last)
+        return last->hash_next;
+    e=route_graph_hash_lookup(this, c);
+    return e ? e->p : NULL;
 }
 
 /**
@@ -1334,15 +1694,13 @@ struct route_graph_point * route_graph_get_point(struct route_graph *this, struc
  * @return The point at the specified coordinates or NULL if not found
  */
 static struct route_graph_point *route_graph_get_point_last(struct route_graph *this, struct coord *c) {
-    struct route_graph_point *p,*ret=NULL;
-    int hashval=HASHCOORD(c);
-    p=this->hash[hashval];
-    while (p) {
-        if (p->c.x == c->x && p->c.y == c->y)
-            ret=p;
-        p=p->hash_next;
-    }
-    return ret;
+    struct route_graph_hash_entry *e=route_graph_hash_lookup(this, c);
+    struct route_graph_point *p;
+
+    if (!e)
+        return NULL;
+    for (p = e->p ; p->hash_next ; p = p->hash_next);
+    return p;
 }
 
 
@@ -1356,18 +1714,16 @@ static struct route_graph_point *route_graph_get_point_last(struct route_graph *
  */
 
 static struct route_graph_point *route_graph_point_new(struct route_graph *this, struct coord *f) {
-    int hashval;
     struct route_graph_point *p;
 
-    hashval=HASHCOORD(f);
     if (debug_route)
         printf("p (0x%x,0x%x)\n", f->x, f->y);
     p=g_slice_new0(struct route_graph_point);
-    p->hash_next=this->hash[hashval];
-    this->hash[hashval]=p;
     p->value=INT_MAX;
+    p->rhs=INT_MAX;
     p->dst_val = INT_MAX;
     p->c=*f;
+    route_graph_hash_add(this, p);
     return p;
 }
 
@@ -1401,15 +1757,164 @@ struct route_graph_point * route_graph_add_point(struct route_graph *this, struc
 void route_graph_free_points(struct route_graph *this) {
     struct route_graph_point *curr,*next;
     int i;
-    for (i = 0 ; i < HASH_SIZE ; i++) {
-        curr=this->hash[i];
+    for (i = 0 ; i < this->hash_size ; i++) {
+        curr=this->hash[i].p;
+        while (curr) {
+            next=curr->hash_next;
+            if (curr < this->points || curr >= this->points + this->point_count)
+                g_slice_free(struct route_graph_point, curr);
+            curr=next;
+        }
+    }
+    g_free(this->hash);
+    this->hash=NULL;
+    this->hash_size=0;
+    this->hash_used=0;
+    this->hash_points=0;
+    g_free(this->points);
+    g_free(this->edge_offset);
+    g_free(this->edges);
+    this->points=NULL;
+    this->point_count=0;
+    this->edge_offset=NULL;
+    this->edges=NULL;
+    this->cost_profile=NULL;
+}
+
+/**
+ * @brief Returns the ID of a point in a frozen route graph
+ *
+ * @param this The route graph
+ * @param p The point
+ * @return The ID, or -1 if the graph is not frozen, or if the point was added or modified after freezing, in which
+ * case its `start` and `end` lists must be used to find its segments
+ */
+static inline int route_graph_point_id(struct route_graph *this, struct route_graph_point *p) {
+    if (p < this->points || p >= this->points + this->point_count || (p->flags & RP_CSR_STALE))
+        return -1;
+    return p - this->points;
+}
+
+/**
+ * @brief Freezes a route graph
+ *
+ * This packs all points of the route graph into a single array and creates an adjacency array (compressed sparse row
+ * layout), in which the segments of each point are stored contiguously along with the ID of the point at their other
+ * end. Flooding the graph can then iterate over the segments of a point without chasing the `start_next` and
+ * `end_next` pointers of each segment.
+ *
+ * The linked lists and the hash table remain valid, and points and segments can still be added after freezing.
+ * Points which gain segments afterwards (e.g. by adding a traffic distortion) are flagged with `RP_CSR_STALE` and
+ * their segments are taken from the linked lists from then on, as are those of points added after freezing.
+ *
+ * Freezing relocates the points of the graph, therefore it must only be done when nothing besides the graph itself
+ * holds pointers to any of its points. It is a no-op if the graph is already frozen, or if it has no heap (such as
+ * the graphs built by the traffic module, which are never flooded by LPA*) or its heap is not empty.
+ *
+ * @param this The route graph
+ */
+static void route_graph_freeze(struct route_graph *this) {
+    struct route_graph_point *curr, *next, *p;
+    struct route_graph_segment *s;
+    struct route_graph_edge *e;
+    int i, count=0, edge_count=0;
+
+    if (this->points || !this->heap || dheap_size(this->heap))
+        return;
+    count=this->hash_points;
+    if (!count)
+        return;
+    for (s = this->route_segments ; s ; s = s->next)
+        edge_count+=2;
+
+    /* Move points into the array, in hash table order, so that points at the same coordinates are contiguous */
+    this->points=g_new(struct route_graph_point, count);
+    this->point_count=count;
+    count=0;
+    for (i = 0 ; i < this->hash_size ; i++) {
+        curr=this->hash[i].p;
+        if (curr)
+            this->hash[i].p=&this->points[count];
         while (curr) {
             next=curr->hash_next;
+            p=&this->points[count++];
+            *p=*curr;
+            p->hash_next=next ? p+1 : NULL;
+            p->flags&=~RP_CSR_STALE;
+            for (s = p->start ; s ; s = s->start_next)
+                s->start=p;
+            for (s = p->end ; s ; s = s->end_next)
+                s->end=p;
             g_slice_free(struct route_graph_point, curr);
             curr=next;
         }
-        this->hash[i]=NULL;
     }
+
+    this->edge_offset=g_new(int, this->point_count+1);
+    this->edges=g_new(struct route_graph_edge, edge_count);
+    e=this->edges;
+    for (i = 0 ; i < this->point_count ; i++) {
+        p=&this->points[i];
+        this->edge_offset[i]=e-this->edges;
+        for (s = p->start ; s ; s = s->start_next, e++) {
+            e->seg=s;
+            e->other=s->end-this->points;
+            e->dir=1;
+        }
+        for (s = p->end ; s ; s = s->end_next, e++) {
+            e->seg=s;
+            e->other=s->start-this->points;
+            e->dir=-1;
+        }
+    }
+    this->edge_offset[i]=e-this->edges;
+    this->cost_profile=NULL;
+    dbg(lvl_debug,"froze %d points, %d edges", this->point_count, edge_count);
+}
+
+/**
+ * @brief Compiles the costs of all edges of a frozen route graph for a vehicle profile
+ *
+ * This evaluates the road profile lookup, maximum speed handling and access restrictions (see `route_seg_speed()`)
+ * once per edge and direction, and stores the result in the `cost` and `cost_in` members of each edge, so that
+ * flooding the graph does not have to do it again for every neighbor of every point it expands. Traffic distortions
+ * and the penalties which depend on the next segment are applied on top of these costs, see
+ * `route_graph_edge_value()`.
+ *
+ * The costs are only compiled again if the profile or any of its attributes have changed since the last call, as
+ * determined by `vehicleprofile_get_hash()`. Nothing is done if the graph is not frozen.
+ *
+ * @param this The route graph
+ * @param profile The vehicle profile
+ */
+static void route_graph_compile_costs(struct route_graph *this, struct vehicleprofile *profile) {
+    struct route_graph_edge *e, *end;
+    struct route_graph_segment *s;
+    unsigned int hash;
+
+    if (!this->edges)
+        return;
+    hash=vehicleprofile_get_hash(profile);
+    if (this->cost_profile == profile && this->cost_hash == hash)
+        return;
+    end=this->edges+this->edge_offset[this->point_count];
+    for (e = this->edges ; e < end ; e++) {
+        s=e->seg;
+        if (s->start == s->end) {
+            e->cost=INT_MAX;
+            e->cost_in=INT_MAX;
+            continue;
+        }
+        e->cost=route_value_seg_next(profile, NULL, s, 2*e->dir);
+        /* LPA* never propagates costs along other items, see route_graph_pred_update() */
+        if (s->data.item.type < route_item_first || s->data.item.type > route_item_last)
+            e->cost_in=INT_MAX;
+        else
+            e->cost_in=route_value_seg_next(profile, NULL, s, -2*e->dir);
+    }
+    this->cost_profile=profile;
+    this->cost_hash=hash;
+    dbg(lvl_debug,"compiled costs of %d edges", (int)(end-this->edges));
 }
 
 /**
@@ -1428,6 +1933,7 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
     struct route_graph_segment *s = NULL;
     int val;
 
+    route_graph_compile_costs(this, profile);
     while ((s = route_graph_get_segment(this, dst->street, s))) {
         val = route_value_seg(profile, NULL, s, -1);
         if (val != INT_MAX) {
@@ -1436,7 +1942,7 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
             s->end->dst_seg = s;
             s->end->rhs = val;
             s->end->dst_val = val;
-            s->end->el = fh_insertkey(this->heap, MIN(s->end->rhs, s->end->value), s->end);
+            dheap_update(this->heap, s->end, route_graph_point_key(this, s->end));
         }
         val = route_value_seg(profile, NULL, s, 1);
         if (val != INT_MAX) {
@@ -1445,7 +1951,7 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
             s->start->dst_seg = s;
             s->start->rhs = val;
             s->start->dst_val = val;
-            s->start->el = fh_insertkey(this->heap, MIN(s->start->rhs, s->start->value), s->start);
+            dheap_update(this->heap, s->start, route_graph_point_key(this, s->start));
         }
     }
 }
@@ -1456,11 +1962,9 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
  * This iterates through all the points in the route graph, resetting them to their initial state.
  * The `value` (cost to reach the destination via `seg`) and `dst_val` (cost to destination if this point is the last
  * in the route) members of each point are reset to`INT_MAX`, the `seg` member (cheapest way to destination) is reset
- * to `NULL` and the `el` member (pointer to element in Fibonacci heap) is also reset to `NULL`.
+ * to `NULL`.
  *
- * The Fibonacci heap is also cleared. Inconsistencies between `el` and Fibonacci heap membership are handled
- * gracefully, i.e. `el` is reset even if it is invalid, and points are removed from the heap regardless of their `el`
- * value.
+ * The heap is also cleared, which resets the `heap_idx` member of each point that was on it.
  *
  * After this method returns, the caller should call
  * {@link route_graph_init(struct route_graph *, struct route_info *, struct vehicleprofile *)} to initialize potential
@@ -1472,25 +1976,103 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
  * @param this The route graph to reset
  */
 static void route_graph_reset(struct route_graph *this) {
-    struct route_graph_point *curr;
+    struct route_graph_point *curr=NULL;
     int i;
 
-    for (i = 0 ; i < HASH_SIZE ; i++) {
-        curr=this->hash[i];
-        while (curr) {
-            curr->value=INT_MAX;
-            curr->dst_val = INT_MAX;
-            curr->rhs = INT_MAX;
-            curr->seg=NULL;
-            curr->dst_seg = NULL;
-            curr->el=NULL;
-            curr=curr->hash_next;
-        }
+    while ((curr=route_graph_next_point(this, curr, &i))) {
+        curr->value=INT_MAX;
+        curr->dst_val = INT_MAX;
+        curr->rhs = INT_MAX;
+        curr->seg=NULL;
+        curr->dst_seg = NULL;
+    }
+
+    dheap_clear(this->heap);
+}
+
+/**
+ * @brief Returns the minimum cost per unit of straight-line distance in a route graph
+ *
+ * This is based on the highest speed at which any segment in the graph can be traveled, which is the highest route
+ * weight of the vehicle profile or, if the profile enforces the maximum speed of segments, the highest maximum speed
+ * of any segment. Distances in the map projection are converted to meters at the point farthest from the equator,
+ * where the scale is largest. Finally, the result is reduced by 10% to allow for rounding in segment lengths and
+ * costs.
+ *
+ * @param this The route graph
+ * @param profile The vehicle profile
+ *
+ * @return The factor, or -1 if no road can be traveled with this profile
+ */
+static double route_graph_heuristic_factor(struct route_graph *this, struct vehicleprofile *profile) {
+    struct route_graph_segment *s;
+    int speed = vehicleprofile_get_max_route_weight(profile), y = 0;
+
+    for (s = this->route_segments; s; s = s->next) {
+        if (profile->maxspeed_handling == maxspeed_enforce && (s->data.flags & AF_SPEED_LIMIT)
+                && RSD_MAXSPEED(&s->data) > speed)
+            speed = RSD_MAXSPEED(&s->data);
+        y = MAX(y, MAX(abs(s->start->c.y), abs(s->end->c.y)));
     }
+    if (speed <= 0)
+        return -1;
+    return 36.0 * 0.9 / speed / transform_scale(y);
+}
+
+/**
+ * @brief Sets the goal towards which cost calculation is directed
+ *
+ * As the route graph is flooded from the destination, the goal is the start of the route, i.e. the current position
+ * or the previous waypoint. Once a goal is set, `route_graph_compute_shortest_path()` expands points in the order of
+ * their cost plus their heuristic (i.e. a lower bound for the cost between the point and the goal), as A* would, and
+ * stops as soon as the cost of the goal is final, rather than calculating every point in the graph. Points which
+ * are not in the direction of the goal may therefore remain unexamined, with their `value` set to `INT_MAX`.
+ *
+ * If the graph has landmark tables, the end points of the goal's street are looked up in them here. The heuristic is
+ * calculated from these and from the first position on the goal's street which is passed to this function. If the
+ * goal moves to a different street while points are left on the heap, their keys are recalculated for the new goal.
+ * As the key of a point always depends on its current `value` and `rhs` only, the state of the graph remains valid
+ * for LPA*, and the next call to `route_graph_compute_shortest_path()` continues from there.
+ *
+ * A goal remains set when the graph is reset, so this function needs to be called before `route_graph_init()`.
+ *
+ * @param this The route graph
+ * @param goal The goal, or NULL to calculate the cost of every point in the graph
+ * @param profile The vehicle profile
+ */
+static void route_graph_set_goal(struct route_graph *this, struct route_info *goal, struct vehicleprofile *profile) {
+    struct route_graph_point *p = NULL;
+    int heuristic = goal && goal->street, slot;
 
-    while (fh_extractmin(this->heap)) {
-        // no operation, just remove all items (`el` has already been reset)
+    if (heuristic == this->heuristic && (!heuristic || (item_is_equal(goal->street->item, this->heuristic_item)
+                                         && goal->street->c[0].x == this->heuristic_c0.x
+                                         && goal->street->c[0].y == this->heuristic_c0.y)))
+        return;
+    this->heuristic = heuristic;
+    if (heuristic) {
+        this->heuristic_item = goal->street->item;
+        this->heuristic_c0 = goal->street->c[0];
+        this->heuristic_c = goal->lp;
+        if (!this->heuristic_factor)
+            this->heuristic_factor = route_graph_heuristic_factor(this, profile);
+    }
+    this->heuristic_landmark_count = 0;
+    if (heuristic && this->landmarks) {
+        struct route_graph_segment *s = NULL;
+        int count = 0, ok = 1;
+        while (ok && (s = route_graph_get_segment(this, goal->street, s))) {
+            ok = count + 2 <= (int)(sizeof(this->heuristic_landmarks) / sizeof(int))
+                 && (this->heuristic_landmarks[count++] = route_graph_landmark_index(this, s->start)) >= 0
+                 && (this->heuristic_landmarks[count++] = route_graph_landmark_index(this, s->end)) >= 0;
+        }
+        if (ok)
+            this->heuristic_landmark_count = count;
     }
+    if (!dheap_size(this->heap))
+        return;
+    while ((p = route_graph_next_point(this, p, &slot)))
+        if (dheap_contains(this->heap, p))
+            dheap_update(this->heap, p, route_graph_point_key(this, p));
 }
 
 /**
@@ -1528,9 +2110,39 @@ void * route_segment_data_field_pos(struct route_segment_data *seg, enum attr_ty
             return (void*)ptr;
         ptr += sizeof(int);
     }
+    if (seg->flags & AF_SPEED_PROFILE) {
+        if (type == attr_speed_profile)
+            return (void*)ptr;
+        ptr += sizeof(int);
+    }
+    if (seg->flags & AF_SCORE) {
+        if (type == attr_score)
+            return (void*)ptr;
+        ptr += sizeof(int);
+    }
     return NULL;
 }
 
+/**
+ * @brief Returns the item which a segment represents
+ *
+ * The item has no methods, so it can be compared or used to look up the item in its map, but not be read directly.
+ *
+ * @param seg The segment
+ * @param item Receives the item
+ *
+ * @return `item`
+ */
+struct item *route_segment_data_get_item(struct route_segment_data *seg, struct item *item) {
+    item->type=seg->item.type;
+    item->id_hi=seg->item.id_hi;
+    item->id_lo=seg->item.id_lo;
+    item->map=seg->item.map;
+    item->meth=NULL;
+    item->priv_data=NULL;
+    return item;
+}
+
 /**
  * @brief Calculates the size of a route_segment_data struct with given flags
  *
@@ -1547,6 +2159,10 @@ static int route_segment_data_size(int flags) {
         ret+=sizeof(struct size_weight_limit);
     if (flags & AF_DANGEROUS_GOODS)
         ret+=sizeof(int);
+    if (flags & AF_SPEED_PROFILE)
+        ret+=sizeof(int);
+    if (flags & AF_SCORE)
+        ret+=sizeof(int);
     return ret;
 }
 
@@ -1592,9 +2208,9 @@ int route_graph_segment_is_duplicate(struct route_graph_point *start, struct rou
 void route_graph_add_segment(struct route_graph *this, struct route_graph_point *start,
                              struct route_graph_point *end, struct route_graph_segment_data *data) {
     struct route_graph_segment *s;
-    int size;
+    int size,flags=data->score ? data->flags | AF_SCORE : data->flags & ~AF_SCORE;
 
-    size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(data->flags);
+    size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(flags);
     s = g_slice_alloc0(size);
     if (!s) {
         printf("%s:Out of memory\n", __FUNCTION__);
@@ -1606,11 +2222,23 @@ void route_graph_add_segment(struct route_graph *this, struct route_graph_point
     s->end=end;
     s->end_next=end->end;
     end->end=s;
+    if (this->points) {
+        /* the graph is frozen, the adjacency arrays of both points no longer reflect their segment lists */
+        start->flags |= RP_CSR_STALE;
+        end->flags |= RP_CSR_STALE;
+    }
+    if (this->sel && this->extended) {
+        /* the graph is being extended, turn restrictions at both points must be resolved again for the new segment */
+        start->flags &= ~RP_TURN_RESTRICTION_RESOLVED;
+        end->flags &= ~RP_TURN_RESTRICTION_RESOLVED;
+    }
     dbg_assert(data->len >= 0);
     s->data.len=data->len;
-    s->data.item=*data->item;
-    s->data.flags=data->flags;
-    s->data.score = data->score;
+    s->data.item.type=data->item->type;
+    s->data.item.id_hi=data->item->id_hi;
+    s->data.item.id_lo=data->item->id_lo;
+    s->data.item.map=data->item->map;
+    s->data.flags=flags;
 
     if (data->flags & AF_SPEED_LIMIT)
         RSD_MAXSPEED(&s->data)=data->maxspeed;
@@ -1620,6 +2248,10 @@ void route_graph_add_segment(struct route_graph *this, struct route_graph_point
         RSD_SIZE_WEIGHT(&s->data)=data->size_weight;
     if (data->flags & AF_DANGEROUS_GOODS)
         RSD_DANGEROUS_GOODS(&s->data)=data->dangerous_goods;
+    if (data->flags & AF_SPEED_PROFILE)
+        RSD_SPEED_PROFILE(&s->data)=data->speed_profile;
+    if (flags & AF_SCORE)
+        RSD_SCORE(&s->data)=data->score;
 
     s->next=this->route_segments;
     this->route_segments=s;
@@ -1730,17 +2362,19 @@ static int route_path_add_item_from_graph(struct route_path *this, struct route_
     struct route_path_segment *segment=NULL;
     int i, ccnt, extra=0, ret=0;
     struct coord *c,*cd,ca[2048];
+    struct item item;
     int offset=1;
     int seg_size,seg_dat_size;
     int len=rgs->data.len;
     if (rgs->data.flags & AF_SEGMENTED)
         offset=RSD_OFFSET(&rgs->data);
+    route_segment_data_get_item(&rgs->data, &item);
 
     dbg(lvl_debug,"enter (0x%x,0x%x) dir=%d pos=%p dst=%p", rgs->data.item.id_hi, rgs->data.item.id_lo, dir, pos, dst);
     if (oldpath) {
-        segment=item_hash_lookup(oldpath->path_hash, &rgs->data.item);
+        segment=item_hash_lookup(oldpath->path_hash, &item);
         if (segment && segment->direction == dir) {
-            segment = route_extract_segment_from_path(oldpath, &rgs->data.item, offset);
+            segment = route_extract_segment_from_path(oldpath, &item, offset);
             if (segment) {
                 ret=1;
                 if (!pos)
@@ -1794,7 +2428,7 @@ static int route_path_add_item_from_graph(struct route_path *this, struct route_
             len=dst->lenpos;
         }
     } else {
-        ccnt=item_coord_get_within_range(&rgs->data.item, ca, 2047, &rgs->start->c, &rgs->end->c);
+        ccnt=item_coord_get_within_range(&item, ca, 2047, &rgs->start->c, &rgs->end->c);
         c=ca;
     }
     seg_size=sizeof(*segment) + sizeof(struct coord) * (ccnt + extra);
@@ -1830,7 +2464,7 @@ static int route_path_add_item_from_graph(struct route_path *this, struct route_
 linkold:
     segment->data->len=len;
     segment->next=NULL;
-    item_hash_insert(this->path_hash,  &rgs->data.item, segment);
+    item_hash_insert(this->path_hash, &item, segment);
 
     route_path_add_segment(this, segment);
 
@@ -1863,9 +2497,12 @@ void route_graph_free_segments(struct route_graph *this) {
 static void route_graph_destroy(struct route_graph *this) {
     if (this) {
         route_graph_build_done(this, 1);
+        /* clearing the heap writes to the points left on it */
+        dheap_destroy(this->heap);
         route_graph_free_points(this);
         route_graph_free_segments(this);
-        fh_deleteheap(this->heap);
+        g_free(this->landmark_index);
+        route_free_selection(this->extent);
         g_free(this);
     }
 }
@@ -1933,12 +2570,36 @@ static int route_seg_speed(struct vehicleprofile *profile, struct route_segment_
     return speed;
 }
 
+/**
+ * @brief Returns the time needed to travel along a segment at a given share of its speed
+ *
+ * This works like `route_time_seg()`, except that the speed is taken as `percent` of the speed returned by
+ * `route_seg_speed()`. The percentage is ignored if a traffic distortion applies, as this describes the current
+ * traffic situation better than a speed profile could.
+ *
+ * @param profile The vehicle profile (routing preferences)
+ * @param over The segment which is passed
+ * @param dist A traffic distortion if applicable, or {@code NULL}
+ * @param percent The share of the speed, in percent, 0 for the full speed
+ * @return The time needed in tenths of seconds, or {@code INT_MAX} if the segment is impassable
+ */
+static int route_time_seg_percent(struct vehicleprofile *profile, struct route_segment_data *over,
+                                  struct route_traffic_distortion *dist, int percent) {
+    int speed=route_seg_speed(profile, over, dist);
+    if (!speed)
+        return INT_MAX;
+    if (!dist && percent > 0 && percent < 100)
+        return (long long)over->len*3600/((long long)speed*percent);
+    return over->len*36/speed+(dist ? dist->delay : 0);
+}
+
 /**
  * @brief Returns the time needed to travel along a segment, or {@code INT_MAX} if the segment is impassable.
  *
  * This function returns the time needed to travel along the entire length of {@code over} in
  * tenths of seconds. Restrictions for dangerous goods, weight or size are taken into account.
  * Traffic distortions are also taken into account if a valid {@code dist} argument is given.
+ * If the segment has a speed profile, the speed is reduced as it was last set by `route_graph_set_departure()`.
  *
  * @param profile The vehicle profile (routing preferences)
  * @param over The segment which is passed
@@ -1948,10 +2609,8 @@ static int route_seg_speed(struct vehicleprofile *profile, struct route_segment_
 
 static int route_time_seg(struct vehicleprofile *profile, struct route_segment_data *over,
                           struct route_traffic_distortion *dist) {
-    int speed=route_seg_speed(profile, over, dist);
-    if (!speed)
-        return INT_MAX;
-    return over->len*36/speed+(dist ? dist->delay : 0);
+    return route_time_seg_percent(profile, over, dist,
+                                  (over->flags & AF_SPEED_PROFILE) ? RSD_SPEED_PROFILE_PERCENT(over) : 0);
 }
 
 /**
@@ -2019,50 +2678,33 @@ static int route_through_traffic_allowed(struct vehicleprofile *profile, struct
 }
 
 /**
- * @brief Returns the "cost" of traveling along segment `over` in direction `dir`
- *
- * Cost is relative to time, indicated in tenths of seconds.
+ * @brief Returns the "cost" of traveling along segment `over` in direction `dir`, followed by segment `next`
  *
- * This function considers traffic distortions as well as penalties. If the segment is impassable due to traffic
- * distortions or restrictions, `INT_MAX` is returned in order to prevent use of this segment for routing.
- *
- * If `from` is specified, it must be the point at which we leave the segment (`over->end` if `dir` is positive,
- * `over->start` if `dir` is negative); anything else will produce invalid results. If `from` is non-NULL, additional
- * checks are done on `from->seg` (the next segment to follow after `over`):
- * \li If `from->seg` equals `over` (indicating that, after traversing `over` in direction `dir`, we would immediately
- * traverse it again in the opposite direction), `INT_MAX` is returned.
- * \li If `over` loops back to itself (i.e. its `start` and `end` members are equal), `INT_MAX` is returned.
- * \li Otherwise, if `over` does not allow through traffic but `from->seg` does, the through traffic penalty of the
- * vehicle profile (`profile`) is applied.
+ * This is the part of `route_value_seg()` which does not depend on the point at which we leave `over`, only on the
+ * segment which follows it. It does not check whether `over` loops back to itself.
  *
  * @param profile The routing preferences
- * @param from The point currently being visited (or NULL), see description
+ * @param next The segment to follow after `over`, or NULL if it is not known or `over` is the last segment
  * @param over The segment we are using
- * @param dir The direction of segment which we are traveling. Positive values indicate we are traveling in the
- * direction of the segment (from `over->start` to `over->end`), negative values indicate we are traveling in the
- * opposite direction. Values of +2 or -2 cause the function to ignore traffic distortions.
+ * @param dir The direction of segment which we are traveling, see `route_value_seg()`
  *
  * @return The "cost" needed to travel along the segment
  */
-/* FIXME `from` as a name is highly misleading, find a better one */
-static int route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from,
-                           struct route_graph_segment *over,
-                           int dir) {
+static int route_value_seg_next(struct vehicleprofile *profile, struct route_graph_segment *next,
+                                struct route_graph_segment *over, int dir) {
     int ret;
     struct route_traffic_distortion dist,*distp=NULL;
     if (!dir) {
         dbg(lvl_warning, "dir is zero, assuming positive");
         dir = 1;
     }
-    if (from && (over->start == over->end))
-        return INT_MAX;
     if ((over->data.flags & (dir >= 0 ? profile->flags_forward_mask : profile->flags_reverse_mask)) != profile->flags)
         return INT_MAX;
     if (dir > 0 && (over->start->flags & RP_TURN_RESTRICTION))
         return INT_MAX;
     if (dir < 0 && (over->end->flags & RP_TURN_RESTRICTION))
         return INT_MAX;
-    if (from && from->seg == over)
+    if (next == over)
         return INT_MAX;
     if (over->data.item.type == type_traffic_distortion)
         return INT_MAX;
@@ -2074,16 +2716,102 @@ static int route_value_seg(struct vehicleprofile *profile, struct route_graph_po
     ret=route_time_seg(profile, &over->data, distp);
     if (ret == INT_MAX)
         return ret;
-    if (!route_through_traffic_allowed(profile, over) && from && from->seg
-            && route_through_traffic_allowed(profile, from->seg))
+    if (!route_through_traffic_allowed(profile, over) && next && route_through_traffic_allowed(profile, next))
         ret+=profile->through_traffic_penalty;
     return ret;
 }
 
 /**
- * @brief Whether two route graph segments match.
+ * @brief Returns the "cost" of traveling along segment `over` in direction `dir`
  *
- * Two segments match if both start and end at the exact same points. Other points are not considered.
+ * Cost is relative to time, indicated in tenths of seconds.
+ *
+ * This function considers traffic distortions as well as penalties. If the segment is impassable due to traffic
+ * distortions or restrictions, `INT_MAX` is returned in order to prevent use of this segment for routing.
+ *
+ * If `from` is specified, it must be the point at which we leave the segment (`over->end` if `dir` is positive,
+ * `over->start` if `dir` is negative); anything else will produce invalid results. If `from` is non-NULL, additional
+ * checks are done on `from->seg` (the next segment to follow after `over`):
+ * \li If `from->seg` equals `over` (indicating that, after traversing `over` in direction `dir`, we would immediately
+ * traverse it again in the opposite direction), `INT_MAX` is returned.
+ * \li If `over` loops back to itself (i.e. its `start` and `end` members are equal), `INT_MAX` is returned.
+ * \li Otherwise, if `over` does not allow through traffic but `from->seg` does, the through traffic penalty of the
+ * vehicle profile (`profile`) is applied.
+ *
+ * @param profile The routing preferences
+ * @param from The point currently being visited (or NULL), see description
+ * @param over The segment we are using
+ * @param dir The direction of segment which we are traveling. Positive values indicate we are traveling in the
+ * direction of the segment (from `over->start` to `over->end`), negative values indicate we are traveling in the
+ * opposite direction. Values of +2 or -2 cause the function to ignore traffic distortions.
+ *
+ * @return The "cost" needed to travel along the segment
+ */
+/* FIXME `from` as a name is highly misleading, find a better one */
+static int route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from,
+                           struct route_graph_segment *over,
+                           int dir) {
+    if (from && (over->start == over->end))
+        return INT_MAX;
+    return route_value_seg_next(profile, from ? from->seg : NULL, over, dir);
+}
+
+/**
+ * @brief Returns the cost of a segment without any penalties or traffic distortions
+ *
+ * This is never more than what `route_value_seg()` returns for the same segment and direction, and can therefore be
+ * used to calculate lower bounds for the cost of a route, such as landmark tables (see route_landmark.c).
+ *
+ * @param profile The routing preferences
+ * @param over The segment
+ * @param dir Positive to travel from `over->start` to `over->end`, negative for the opposite direction
+ *
+ * @return The cost, or `INT_MAX` if the segment cannot be traveled in this direction
+ */
+int route_graph_segment_base_cost(struct vehicleprofile *profile, struct route_graph_segment *over, int dir) {
+    return route_value_seg(profile, NULL, over, dir > 0 ? 2 : -2);
+}
+
+/**
+ * @brief Returns the cost of traveling along an edge of a frozen route graph
+ *
+ * This returns the same as `route_value_seg_next()` for the segment of the edge (or `INT_MAX` if the segment loops
+ * back to itself), but takes the compiled cost of the edge if it is available and applies only the checks which
+ * depend on the next segment. Segments between two points with traffic distortions are always evaluated in full, so
+ * that changes to traffic distortions take effect without compiling the costs again.
+ *
+ * @param graph The route graph
+ * @param profile The vehicle profile
+ * @param e The edge
+ * @param dir 1 to travel away from the point the edge belongs to, -1 to travel towards it
+ * @param next The segment to follow after `e->seg`, or NULL
+ *
+ * @return The cost
+ */
+static inline int route_graph_edge_value(struct route_graph *graph, struct vehicleprofile *profile,
+        struct route_graph_edge *e, int dir, struct route_graph_segment *next) {
+    struct route_graph_segment *over = e->seg;
+    int ret;
+
+    if (graph->cost_profile != profile
+            || ((over->start->flags & RP_TRAFFIC_DISTORTION) && (over->end->flags & RP_TRAFFIC_DISTORTION))) {
+        if (over->start == over->end || (dir < 0 && (over->data.item.type < route_item_first
+                                         || over->data.item.type > route_item_last)))
+            return INT_MAX;
+        return route_value_seg_next(profile, next, over, dir * e->dir);
+    }
+    ret = dir > 0 ? e->cost : e->cost_in;
+    if (ret == INT_MAX || next == over)
+        return INT_MAX;
+    if (!route_through_traffic_allowed(profile, over) && next && route_through_traffic_allowed(profile, next))
+        ret += profile->through_traffic_penalty;
+    return ret;
+}
+
+/**
+ * @brief Whether two route graph segments match.
+ *
+ * Two segments match if both start and end at the exact same points. Other points are not considered.
  *
  * @param s1 The first segment
  * @param s2 The second segment
@@ -2116,74 +2844,192 @@ static int route_value_add(int val1, int val2) {
     return val1 + val2;
 }
 
+/**
+ * @brief Returns the index of a point in the landmark tables of the route graph
+ *
+ * For frozen points, the result is kept in `landmark_index`.
+ *
+ * @param this The route graph, with `landmarks` set
+ * @param p The point
+ *
+ * @return The index, or -1 if the point has no entry in the tables
+ */
+static int route_graph_landmark_index(struct route_graph *this, struct route_graph_point *p) {
+    int id = route_graph_point_id(this, p), i, n;
+
+    if (id >= 0 && this->landmark_index && this->landmark_index[id] != -2)
+        return this->landmark_index[id];
+    /* points sharing their coordinates have no entry, see route_landmark.c */
+    if (p->hash_next || route_graph_get_point(this, &p->c) != p)
+        i = -1;
+    else
+        i = route_landmarks_lookup(this->landmarks, &p->c);
+    if (id >= 0) {
+        if (!this->landmark_index) {
+            this->landmark_index = g_new(int, this->point_count);
+            for (n = 0; n < this->point_count; n++)
+                this->landmark_index[n] = -2;
+        }
+        this->landmark_index[id] = i;
+    }
+    return i;
+}
+
+/**
+ * @brief Returns the heuristic of a point, i.e. a lower bound for the cost between the point and the goal.
+ *
+ * This is the straight-line distance between the point and the goal, multiplied by the minimum cost per unit of
+ * distance (see `route_graph_heuristic_factor()`). As no way is shorter than the straight line, this never exceeds
+ * the actual cost, and the difference between the heuristic of two neighbors never exceeds the cost of the segment
+ * between them, so the heuristic is both admissible and consistent.
+ *
+ * If landmark tables are available for the point and the goal, the bound derived from them (see
+ * route_landmark.c) is used instead where it is higher. For points which are missing from the tables (which is the
+ * case for points created by turn restrictions), only the straight-line bound is used, which may cause some points
+ * near them to be expanded more than once.
+ *
+ * @param this The route graph
+ * @param p The point
+ *
+ * @return The heuristic, 0 if no goal is set
+ */
+static int route_graph_heuristic(struct route_graph *this, struct route_graph_point *p) {
+    double dx, dy;
+
+    int ret = 0, idx, i, bound, alt = INT_MAX;
+
+    if (!this->heuristic)
+        return 0;
+    if (this->heuristic_factor > 0) {
+        dx = p->c.x - this->heuristic_c.x;
+        dy = p->c.y - this->heuristic_c.y;
+        ret = sqrt(dx * dx + dy * dy) * this->heuristic_factor;
+    }
+    if (this->heuristic_landmark_count && (idx = route_graph_landmark_index(this, p)) >= 0) {
+        /* the route may start at either end of the goal's street, so use the lowest bound */
+        for (i = 0; i < this->heuristic_landmark_count; i++) {
+            bound = route_landmarks_bound(this->landmarks, this->heuristic_landmarks[i], idx);
+            alt = MIN(alt, bound);
+        }
+        ret = MAX(ret, alt);
+    }
+    return ret;
+}
+
+/**
+ * @brief Returns the key of a point in the heap of the route graph.
+ *
+ * The key is the lower of `value` and `rhs`, plus the heuristic of the point.
+ *
+ * @param this The route graph
+ * @param p The point
+ */
+static int route_graph_point_key(struct route_graph *this, struct route_graph_point *p) {
+    return route_value_add(MIN(p->rhs, p->value), route_graph_heuristic(this, p));
+}
+
+/**
+ * @brief Lowers the lookahead value of a point in the route graph if a neighbor offers a cheaper way.
+ *
+ * @param profile The vehicle profile
+ * @param p The point to evaluate
+ * @param s A segment connecting `p` to `other`
+ * @param other The neighbor at the other end of `s`
+ * @param val The cost of traveling along `s` from `p` to `other`, as returned by `route_value_seg()` with `other` as
+ * the point at which we leave `s`
+ */
+static void route_graph_point_update_seg(struct vehicleprofile *profile, struct route_graph_point *p,
+        struct route_graph_segment *s, struct route_graph_point *other, int val) {
+    int new;
+
+    if (val != INT_MAX && other->seg && item_is_equal(s->data.item, other->seg->data.item)) {
+        if (profile->turn_around_penalty2)
+            val += profile->turn_around_penalty2;
+        else
+            val = INT_MAX;
+    }
+    if (val != INT_MAX) {
+        new = route_value_add(val, other->value);
+        if (new < p->rhs) {
+            p->rhs = new;
+            p->seg = s;
+        }
+    }
+}
+
 /**
  * @brief Updates the lookahead value of a point in the route graph and updates its heap membership.
  *
  * This recalculates the lookahead value (the `rhs` member) of point `p`, based on the `value` of each neighbor and the
- * cost to reach that neighbor. If the resulting `p->rhs` differs from `p->value`, `p` is inserted into `heap` using
- * the lower of the two as its key (if `p` is already a member of `heap`, its key is changed accordingly). If the
- * resulting `p->rhs` is equal to `p->value` and `p` is a member of `heap`, it is removed.
+ * cost to reach that neighbor. If the resulting `p->rhs` differs from `p->value`, `p` is inserted into the heap of
+ * `graph` using the lower of the two, plus the heuristic, as its key (if `p` is already a member of the heap, its key
+ * is changed accordingly). If the resulting `p->rhs` is equal to `p->value` and `p` is a member of the heap, it is removed.
+ *
+ * If the graph is frozen, neighbors are found through its adjacency array rather than the segment lists of `p`.
  *
  * This is part of a modified LPA* implementation.
  *
+ * @param graph The route graph
  * @param profile The vehicle profile to use for routing. This determines which ways are passable and how their costs
  * are calculated.
  * @param p The point to evaluate
- * @param heap The heap
  */
-static void route_graph_point_update(struct vehicleprofile *profile, struct route_graph_point * p,
-                                     struct fibheap * heap) {
+static void route_graph_point_update(struct route_graph *graph, struct vehicleprofile *profile,
+                                     struct route_graph_point * p) {
     struct route_graph_segment *s = NULL;
-    int new, val;
+    struct route_graph_point *other;
+    struct route_graph_edge *e, *end;
+    int id = route_graph_point_id(graph, p);
 
     p->rhs = p->dst_val;
     p->seg = p->dst_seg;
 
-    for (s = p->start; s; s = s->start_next) { /* Iterate over all the segments leading away from our point */
-        val = route_value_seg(profile, s->end, s, 1);
-        if (val != INT_MAX && s->end->seg && item_is_equal(s->data.item, s->end->seg->data.item)) {
-            if (profile->turn_around_penalty2)
-                val += profile->turn_around_penalty2;
-            else
-                val = INT_MAX;
-        }
-        if (val != INT_MAX) {
-            new = route_value_add(val, s->end->value);
-            if (new < p->rhs) {
-                p->rhs = new;
-                p->seg = s;
-            }
+    if (id >= 0) {
+        /* Iterate over the adjacency array, which holds the segments in the same order as the lists below */
+        end = graph->edges + graph->edge_offset[id + 1];
+        for (e = graph->edges + graph->edge_offset[id]; e < end; e++) {
+            other = &graph->points[e->other];
+            route_graph_point_update_seg(profile, p, e->seg, other,
+                                         route_graph_edge_value(graph, profile, e, 1, other->seg));
         }
+    } else {
+        for (s = p->start; s; s = s->start_next) /* Iterate over all the segments leading away from our point */
+            route_graph_point_update_seg(profile, p, s, s->end, route_value_seg(profile, s->end, s, 1));
+        for (s = p->end; s; s = s->end_next) /* Iterate over all the segments leading towards our point */
+            route_graph_point_update_seg(profile, p, s, s->start, route_value_seg(profile, s->start, s, -1));
     }
 
-    for (s = p->end; s; s = s->end_next) { /* Iterate over all the segments leading towards our point */
-        val = route_value_seg(profile, s->start, s, -1);
-        if (val != INT_MAX && s->start->seg && item_is_equal(s->data.item, s->start->seg->data.item)) {
-            if (profile->turn_around_penalty2)
-                val += profile->turn_around_penalty2;
-            else
-                val = INT_MAX;
-        }
-        if (val != INT_MAX) {
-            new = route_value_add(val, s->start->value);
-            if (new < p->rhs) {
-                p->rhs = new;
-                p->seg = s;
-            }
-        }
-    }
+    if (p->rhs != p->value)
+        /* The point is locally inconsistent, add it to the heap or change its key */
+        dheap_update(graph->heap, p, route_graph_point_key(graph, p));
+    else
+        dheap_remove(graph->heap, p);
+}
 
-    if (p->el) {
-        /* Due to a limitation of the Fibonacci heap implementation, which causes fh_replacekey() to fail if the new
-         * key is greater than the current one, we always remove the point from the heap (and, if locally inconsistent,
-         * re-add it afterwards). */
-        fh_delete(heap, p->el);
-        p->el = NULL;
-    }
+/**
+ * @brief Updates the lookahead value of a predecessor of a point in the route graph.
+ *
+ * @param graph The route graph
+ * @param profile The vehicle profile
+ * @param s A segment connecting the point to `other`
+ * @param other The point at the other end of `s`
+ * @param dir 1 if `other` is the end of `s`, -1 if it is the start
+ */
+static void route_graph_pred_update(struct route_graph *graph, struct vehicleprofile *profile,
+                                    struct route_graph_segment *s, struct route_graph_point *other, int dir) {
+    if ((s->start == s->end) || (s->data.item.type < route_item_first) || (s->data.item.type > route_item_last))
+        return;
+    if (route_value_seg(profile, NULL, s, -2 * dir) != INT_MAX)
+        route_graph_point_update(graph, profile, other);
+}
 
-    if (p->rhs != p->value)
-        /* The point is locally inconsistent, add (or re-add) it to the heap */
-        p->el = fh_insertkey(heap, MIN(p->rhs, p->value), p);
+/**
+ * @brief Returns the processor time used so far, for the statistics of route graphs
+ *
+ * @return The processor time, in milliseconds
+ */
+static double route_graph_clock(void) {
+    return (double)clock() * 1000 / CLOCKS_PER_SEC;
 }
 
 /**
@@ -2203,29 +3049,45 @@ static void route_graph_compute_shortest_path(struct route_graph * graph, struct
         struct callback *cb) {
     struct route_graph_point *p_min;
     struct route_graph_segment *s = NULL;
+    struct route_graph_edge *e, *end;
+    int id, expanded = 0;
+    double start = route_graph_clock();
 
-    while (!route_graph_is_path_computed(graph) && (p_min = fh_extractmin(graph->heap))) {
-        p_min->el = NULL;
+    while (!route_graph_is_path_computed(graph) && (p_min = dheap_extractmin(graph->heap))) {
+        expanded++;
         if (p_min->value > p_min->rhs)
             /* cost has decreased, update point value */
             p_min->value = p_min->rhs;
         else {
             /* cost has increased, re-evaluate */
             p_min->value = INT_MAX;
-            route_graph_point_update(profile, p_min, graph->heap);
+            route_graph_point_update(graph, profile, p_min);
         }
 
         /* in any case, update rhs of predecessors (nodes from which we can reach p_min via a single segment) */
-        for (s = p_min->start; s; s = s->start_next)
-            if ((s->start == s->end) || (s->data.item.type < route_item_first) || (s->data.item.type > route_item_last))
-                continue;
-            else if (route_value_seg(profile, NULL, s, -2) != INT_MAX)
-                route_graph_point_update(profile, s->end, graph->heap);
-        for (s = p_min->end; s; s = s->end_next)
-            if ((s->start == s->end) || (s->data.item.type < route_item_first) || (s->data.item.type > route_item_last))
-                continue;
-            else if (route_value_seg(profile, NULL, s, 2) != INT_MAX)
-                route_graph_point_update(profile, s->start, graph->heap);
+        id = route_graph_point_id(graph, p_min);
+        if (id >= 0 && graph->cost_profile == profile) {
+            /* the compiled costs ignore traffic distortions, just like route_graph_pred_update() */
+            end = graph->edges + graph->edge_offset[id + 1];
+            for (e = graph->edges + graph->edge_offset[id]; e < end; e++)
+                if (e->cost_in != INT_MAX)
+                    route_graph_point_update(graph, profile, &graph->points[e->other]);
+        } else if (id >= 0) {
+            end = graph->edges + graph->edge_offset[id + 1];
+            for (e = graph->edges + graph->edge_offset[id]; e < end; e++)
+                route_graph_pred_update(graph, profile, e->seg, &graph->points[e->other], e->dir);
+        } else {
+            for (s = p_min->start; s; s = s->start_next)
+                route_graph_pred_update(graph, profile, s, s->end, 1);
+            for (s = p_min->end; s; s = s->end_next)
+                route_graph_pred_update(graph, profile, s, s->start, -1);
+        }
+    }
+    graph->flood_time += route_graph_clock() - start;
+    if (expanded) {
+        graph->expanded += expanded;
+        dbg(lvl_info, "expanded %d of %d points (%d in total), %d left on heap%s", expanded, graph->hash_points,
+            graph->expanded, dheap_size(graph->heap), graph->heuristic ? " (heuristic)" : "");
     }
     if (cb)
         callback_call_0(cb);
@@ -2290,6 +3152,7 @@ static void route_graph_add_traffic_distortion(struct route_graph *this, struct
     data.len=0;
     data.offset=1;
     data.maxspeed = INT_MAX;
+    data.score = 0;
 
     item_attr_rewind(item);
     if (item_attr_get(item, attr_flags, &flags_attr))
@@ -2315,9 +3178,9 @@ static void route_graph_add_traffic_distortion(struct route_graph *this, struct
         route_graph_add_segment(this, s_pnt, e_pnt, &data);
         if (update) {
             if (!(data.flags & AF_ONEWAYREV))
-                route_graph_point_update(profile, s_pnt, this->heap);
+                route_graph_point_update(this, profile, s_pnt);
             if (!(data.flags & AF_ONEWAY))
-                route_graph_point_update(profile, e_pnt, this->heap);
+                route_graph_point_update(this, profile, e_pnt);
         }
     }
 }
@@ -2423,8 +3286,8 @@ static void route_graph_remove_traffic_distortion(struct route_graph *this, stru
 #endif
 
         /* TODO figure out if we need to update both points */
-        route_graph_point_update(profile, s_pnt, this->heap);
-        route_graph_point_update(profile, e_pnt, this->heap);
+        route_graph_point_update(this, profile, s_pnt);
+        route_graph_point_update(this, profile, e_pnt);
     }
 }
 
@@ -2451,13 +3314,26 @@ static void route_graph_change_traffic_distortion(struct route_graph *this, stru
  * @param item The item to add, must be of `type_street_turn_restriction_no` or `type_street_turn_restriction_only`
  */
 void route_graph_add_turn_restriction(struct route_graph *this, struct item *item) {
-    struct route_graph_point *pnt[4];
     struct coord c[5];
-    int i,count;
-    struct route_graph_segment_data data;
 
     item_coord_rewind(item);
-    count=item_coord_get(item, c, 5);
+    route_graph_add_turn_restriction_coords(this, item, c, item_coord_get(item, c, 5));
+}
+
+/**
+ * @brief Adds a turn restriction to the route graph from coordinates which have already been read
+ *
+ * @param this The route graph to add to
+ * @param item The turn restriction item, only its type, ID and map are used
+ * @param c The coordinates of the item
+ * @param count The number of coordinates in `c`
+ */
+void route_graph_add_turn_restriction_coords(struct route_graph *this, struct item *item, struct coord *c,
+        int count) {
+    struct route_graph_point *pnt[4];
+    int i;
+    struct route_graph_segment_data data;
+
     if (count != 3 && count != 4) {
         dbg(lvl_debug,"wrong count %d",count);
         return;
@@ -2512,6 +3388,7 @@ static void route_graph_add_street(struct route_graph *this, struct item *item,
     data.offset=1;
     data.maxspeed=-1;
     data.item=item;
+    data.score = 0;
 
     roadp = vehicleprofile_get_roadprofile(profile, item->type);
     if (!roadp) {
@@ -2559,6 +3436,11 @@ static void route_graph_add_street(struct route_graph *this, struct item *item,
             else
                 data.size_weight.axle_weight=-1;
         }
+        if (item_attr_get(item, attr_speed_profile, &attr) && attr.u.num >= 0 && attr.u.num <= 0xffff) {
+            data.flags |= AF_SPEED_PROFILE;
+            data.speed_profile = attr.u.num;
+        } else
+            data.flags &= ~AF_SPEED_PROFILE;
 
         s_pnt=route_graph_add_point(this,&l);
         if (!segmented) {
@@ -2639,24 +3521,42 @@ static struct route_graph_segment *route_graph_get_segment(struct route_graph *g
  * means that calculation of node cost has proceeded far enough to determine the cost of, and cheapest path from, the
  * start point.
  *
- * The current implementation returns true only when the heap is empty, i.e. all points have been calculated. This is
- * not optimal in terms of efficiency, as the cost of the start point and the cheapest path from there no longer
- * change during the last few cycles. Future versions may report true before the heap is completely empty, as soon as
- * the cost of the start point and the cheapest path are final. However, this needs to be considered for recalculations
- * which happen when the vehicle leaves the cheapest path: right now, any point in the route graph has its final cost
- * and cheapest path, thus no recalculation is needed if the vehicle leaves the cheapest path. In the future, however,
- * a (partial) recalculation may be needed if the vehicle deviates from the cheapest path.
+ * Without a goal, this returns true only when the heap is empty, i.e. all points have been calculated. Any point in
+ * the route graph then has its final cost and cheapest path, thus no recalculation is needed if the vehicle leaves
+ * the cheapest path.
+ *
+ * If a goal has been set with `route_graph_set_goal()`, this also returns true as soon as both end points of each
+ * segment of the goal's street are locally consistent and their keys do not exceed the lowest key on the heap. As the
+ * heuristic is consistent, the cost of these points and of every point on their cheapest path is final at that time.
+ * Other points may still be on the heap, or not have been examined at all; if the goal changes later, the caller
+ * needs to set the new goal and call `route_graph_compute_shortest_path()` again.
  *
  * @param this_ The route graph
  *
  * @return true if calculation is complete, false if not
  */
 static int route_graph_is_path_computed(struct route_graph *this_) {
-    /* TODO refine exit criterion */
-    if (!fh_min(this_->heap))
+    struct route_graph_point *start = NULL;
+    struct route_graph_segment *s;
+    int min, found = 0;
+
+    if (!dheap_min(this_->heap))
         return 1;
-    else
+    if (!this_->heuristic)
         return 0;
+    min = dheap_minkey(this_->heap);
+    while ((start = route_graph_get_point_next(this_, &this_->heuristic_c0, start))) {
+        for (s = start->start; s; s = s->start_next) {
+            if (!item_is_equal(this_->heuristic_item, s->data.item))
+                continue;
+            if (dheap_contains(this_->heap, s->start) || route_graph_point_key(this_, s->start) > min
+                    || dheap_contains(this_->heap, s->end) || route_graph_point_key(this_, s->end) > min)
+                return 0;
+            found = 1;
+        }
+    }
+    /* if the goal is not in the graph, calculate everything */
+    return found;
 }
 
 /**
@@ -2921,95 +3821,501 @@ static struct route_path *route_path_new(struct route_graph *this, struct route_
     return ret;
 }
 
-static int route_graph_build_next_map(struct route_graph *rg) {
-    do {
-        rg->m=mapset_next(rg->h, 2);
-        if (! rg->m)
-            return 0;
-        map_rect_destroy(rg->mr);
-        rg->mr=map_rect_new(rg->m, rg->sel);
-    } while (!rg->mr);
+/**
+ * @brief A point visited by a forward search from the position, see `route_forward_nodes_new()`
+ */
+struct route_forward_node {
+    int heap_idx;                       /**< Index slot for the heap */
+    int value;                          /**< Cost to reach the point from the position, `INT_MAX` if not reached */
+    struct route_graph_segment *seg;    /**< The segment over which the point is reached */
+    int first;                          /**< `seg` is a segment of the position's street */
+    int mark;                           /**< Free for use by the caller */
+};
 
-    return 1;
+/**
+ * @brief Returns the index of the node of a point in a forward search
+ *
+ * Unlike `route_graph_point_id()`, this also returns the index of points which have gained segments after freezing.
+ *
+ * @param graph The route graph
+ * @param p The point
+ *
+ * @return The index, or -1 if the point was added after freezing and therefore has no node
+ */
+static inline int route_forward_node_id(struct route_graph *graph, struct route_graph_point *p) {
+    if (p < graph->points || p >= graph->points + graph->point_count)
+        return -1;
+    return p - graph->points;
 }
 
+/**
+ * @brief Seeds a forward search with a point at one end of the position's segment
+ *
+ * @param graph The route graph
+ * @param nodes The nodes
+ * @param heap The heap
+ * @param p The point
+ * @param s The segment of the position
+ * @param val The cost to reach `p` from the position
+ */
+static void route_forward_node_seed(struct route_graph *graph, struct route_forward_node *nodes, struct dheap *heap,
+                                    struct route_graph_point *p, struct route_graph_segment *s, int val) {
+    int id = route_forward_node_id(graph, p);
+    struct route_forward_node *n;
 
-static int is_turn_allowed(struct route_graph_point *p, struct route_graph_segment *from,
-                           struct route_graph_segment *to) {
-    struct route_graph_point *prev,*next;
-    struct route_graph_segment *tmp1,*tmp2;
-    if (item_is_equal(from->data.item, to->data.item))
-        return 0;
-    if (from->start == p)
-        prev=from->end;
-    else
-        prev=from->start;
-    if (to->start == p)
-        next=to->end;
-    else
-        next=to->start;
-    tmp1=p->end;
-    while (tmp1) {
-        if (tmp1->start->c.x == prev->c.x && tmp1->start->c.y == prev->c.y &&
-                (tmp1->data.item.type == type_street_turn_restriction_no ||
-                 tmp1->data.item.type == type_street_turn_restriction_only)) {
-            tmp2=p->start;
-            dbg(lvl_debug,"found %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p",item_to_name(tmp1->data.item.type),
-                tmp1->data.item.id_hi,tmp1->data.item.id_lo,tmp1->start->c.x,tmp1->start->c.y,tmp1->end->c.x,tmp1->end->c.y,tmp1->start,
-                tmp1->end);
-            while (tmp2) {
-                dbg(lvl_debug,"compare %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p",item_to_name(tmp2->data.item.type),
-                    tmp2->data.item.id_hi,tmp2->data.item.id_lo,tmp2->start->c.x,tmp2->start->c.y,tmp2->end->c.x,tmp2->end->c.y,tmp2->start,
-                    tmp2->end);
-                if (item_is_equal(tmp1->data.item, tmp2->data.item))
-                    break;
-                tmp2=tmp2->start_next;
-            }
-            dbg(lvl_debug,"tmp2=%p",tmp2);
-            if (tmp2) {
-                dbg(lvl_debug,"%s tmp2->end=%p next=%p",item_to_name(tmp1->data.item.type),tmp2->end,next);
-            }
-            if (tmp1->data.item.type == type_street_turn_restriction_no && tmp2 && tmp2->end->c.x == next->c.x
-                    && tmp2->end->c.y == next->c.y) {
-                dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (no)",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,
-                    next->c.y);
-                return 0;
-            }
-            if (tmp1->data.item.type == type_street_turn_restriction_only && tmp2 && (tmp2->end->c.x != next->c.x
-                    || tmp2->end->c.y != next->c.y)) {
-                dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (only)",prev->c.x,prev->c.y,p->c.x,p->c.y,
-                    next->c.x,next->c.y);
-                return 0;
-            }
-        }
-        tmp1=tmp1->end_next;
+    if (id < 0)
+        return;
+    n = &nodes[id];
+    if (val < n->value) {
+        n->value = val;
+        n->seg = s;
+        n->first = 1;
+        dheap_update(heap, n, n->value);
     }
-    dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x allowed",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,
-        next->c.y);
-    return 1;
 }
 
-static void route_graph_clone_segment(struct route_graph *this, struct route_graph_segment *s,
-                                      struct route_graph_point *start,
-                                      struct route_graph_point *end, int flags) {
-    struct route_graph_segment_data data;
-    data.item=&s->data.item;
-    data.offset=1;
-    data.flags=s->data.flags|flags;
-    data.len=s->data.len+1;
-    data.maxspeed=-1;
-    data.dangerous_goods=0;
-    data.score = s->data.score;
-    if (s->data.flags & AF_SPEED_LIMIT)
-        data.maxspeed=RSD_MAXSPEED(&s->data);
-    if (s->data.flags & AF_SEGMENTED)
-        data.offset=RSD_OFFSET(&s->data);
-    dbg(lvl_debug,"cloning segment from %p (0x%x,0x%x) to %p (0x%x,0x%x)",start,start->c.x,start->c.y, end, end->c.x,
-        end->c.y);
-    route_graph_add_segment(this, start, end, &data);
+/**
+ * @brief Starts a forward search from a position over a frozen route graph
+ *
+ * The regular flood of the route graph runs backwards from the destination. Some features need the cost from the
+ * position to each point instead. This allocates the nodes for such a search, one per point of the graph, and seeds
+ * the heap with the points at both ends of the position's segment, like `route_path_new()` does.
+ * `route_forward_flood()` then runs the search.
+ *
+ * Points which were added after freezing have no node and are never reached by the search.
+ *
+ * @param graph The route graph, which must be frozen
+ * @param profile The vehicle profile
+ * @param pos The position
+ * @param heap The heap, which must have been created with the offset of `heap_idx` in `struct route_forward_node`
+ *
+ * @return The nodes, to be freed with `g_free()`
+ */
+static struct route_forward_node *route_forward_nodes_new(struct route_graph *graph, struct vehicleprofile *profile,
+        struct route_info *pos, struct dheap *heap) {
+    struct route_forward_node *nodes;
+    struct route_graph_segment *s = NULL;
+    int i, val;
+
+    nodes = g_new0(struct route_forward_node, graph->point_count);
+    for (i = 0 ; i < graph->point_count ; i++)
+        nodes[i].value = INT_MAX;
+    while ((s = route_graph_get_segment(graph, pos->street, s))) {
+        val = route_value_seg(profile, NULL, s, 2);
+        if (val != INT_MAX)
+            route_forward_node_seed(graph, nodes, heap, s->end, s, val*(100-pos->percent)/100);
+        val = route_value_seg(profile, NULL, s, -2);
+        if (val != INT_MAX)
+            route_forward_node_seed(graph, nodes, heap, s->start, s, val*pos->percent/100);
+    }
+    return nodes;
 }
 
-static void route_graph_process_restriction_segment(struct route_graph *this, struct route_graph_point *p,
+/**
+ * @brief Whether a forward search may continue from a node over a segment
+ *
+ * @param n The node
+ * @param s The segment
+ *
+ * @return True unless `s` is the segment over which `n` was reached, loops back to its start or is not a street
+ */
+static inline int route_forward_segment_usable(struct route_forward_node *n, struct route_graph_segment *s) {
+    return s != n->seg && s->start != s->end && s->data.item.type >= route_item_first
+           && s->data.item.type <= route_item_last;
+}
+
+/**
+ * @brief Updates the node at the other end of a segment during a forward search
+ *
+ * @param nodes The nodes
+ * @param heap The heap
+ * @param n The node being expanded
+ * @param s The segment leading from the point of `n` to the other point
+ * @param id The index of the node of the other point, -1 if it has none
+ * @param val The cost of traveling along `s`
+ */
+static void route_forward_node_update(struct route_forward_node *nodes, struct dheap *heap,
+                                      struct route_forward_node *n, struct route_graph_segment *s, int id, int val) {
+    struct route_forward_node *other;
+
+    if (id < 0 || val == INT_MAX)
+        return;
+    val = route_value_add(val, n->value);
+    other = &nodes[id];
+    if (val < other->value && (other->heap_idx || other->value == INT_MAX)) {
+        other->value = val;
+        other->seg = s;
+        other->first = 0;
+        dheap_update(heap, other, val);
+    }
+}
+
+/**
+ * @brief Runs a forward search started by `route_forward_nodes_new()`
+ *
+ * When this returns, the `value` of each node holds the cost to reach its point from the position, or `INT_MAX` if
+ * that cost exceeds `limit`. Costs include the same penalties as route calculation. Turning around at a point is not
+ * considered.
+ *
+ * Points which have gained segments since freezing are expanded over their segment lists, as in
+ * `route_graph_point_update()`, so that segments added by extending the graph are followed as long as they lead to
+ * a point with a node.
+ *
+ * @param graph The route graph
+ * @param profile The vehicle profile
+ * @param nodes The nodes
+ * @param heap The heap, which is empty when this returns
+ * @param limit The highest cost of interest
+ */
+static void route_forward_flood(struct route_graph *graph, struct vehicleprofile *profile,
+                                struct route_forward_node *nodes, struct dheap *heap, int limit) {
+    struct route_forward_node *n;
+    struct route_graph_edge *e, *end;
+    struct route_graph_segment *s;
+    struct route_graph_point *p;
+    int id;
+
+    while ((n = dheap_extractmin(heap))) {
+        if (n->value > limit) {
+            n->value = INT_MAX;
+            continue;
+        }
+        id = n - nodes;
+        p = &graph->points[id];
+        if (route_graph_point_id(graph, p) >= 0) {
+            end = graph->edges + graph->edge_offset[id + 1];
+            for (e = graph->edges + graph->edge_offset[id]; e < end; e++)
+                if (route_forward_segment_usable(n, e->seg))
+                    route_forward_node_update(nodes, heap, n, e->seg, e->other,
+                                              route_graph_edge_value(graph, profile, e, 1, NULL));
+        } else {
+            /* the point has gained segments since freezing, e.g. by extending the graph */
+            for (s = p->start; s; s = s->start_next)
+                if (route_forward_segment_usable(n, s))
+                    route_forward_node_update(nodes, heap, n, s, route_forward_node_id(graph, s->end),
+                                              route_value_seg_next(profile, NULL, s, 1));
+            for (s = p->end; s; s = s->end_next)
+                if (route_forward_segment_usable(n, s))
+                    route_forward_node_update(nodes, heap, n, s, route_forward_node_id(graph, s->start),
+                                              route_value_seg_next(profile, NULL, s, -1));
+        }
+    }
+}
+
+/**
+ * @brief A segment of a candidate for an alternative route, in driving order
+ */
+struct route_alternative_step {
+    struct route_graph_segment *seg;    /**< The segment */
+    int dir;                            /**< 1 to travel from `seg->start` to `seg->end`, -1 for the opposite */
+};
+
+/**
+ * @brief Finds the segments of the path from the position to the destination via a point
+ *
+ * The path consists of the way to `via` found by the forward search, followed by the way from `via` to the
+ * destination found by the regular (backward) flood of the route graph, i.e. by following the `seg` member of each
+ * point as `route_path_new()` does.
+ *
+ * @param graph The route graph
+ * @param nodes The nodes of the forward search
+ * @param via The point
+ * @param pos The position
+ * @param dst The destination
+ * @param mark A number which is stored in the `mark` member of all nodes the path visits
+ * @param steps Receives the segments of the path, must have room for one more than the number of points in the graph
+ *
+ * @return The number of segments, or 0 if the path is not valid because it visits a point twice or passes the
+ * position or destination on the way to `via`
+ */
+static int route_alternative_steps(struct route_graph *graph, struct route_forward_node *nodes,
+                                   struct route_graph_point *via, struct route_info *pos, struct route_info *dst,
+                                   int mark, struct route_alternative_step *steps) {
+    struct route_alternative_step step;
+    struct route_graph_point *p = via;
+    int i, j, id, count = 0, valid = 1;
+
+    /* way to the via point, backwards */
+    for (;;) {
+        id = route_forward_node_id(graph, p);
+        if (id < 0)
+            return 0;
+        if (nodes[id].mark == mark || count >= graph->point_count)
+            valid = 0;
+        nodes[id].mark = mark;
+        if (!valid)
+            return 0;
+        step.seg = nodes[id].seg;
+        step.dir = step.seg->end == p ? 1 : -1;
+        steps[count++] = step;
+        if (nodes[id].first)
+            break;
+        if (item_is_equal(step.seg->data.item, pos->street->item) || item_is_equal(step.seg->data.item,
+                dst->street->item))
+            return 0;
+        p = step.dir > 0 ? step.seg->start : step.seg->end;
+    }
+    for (i = 0, j = count - 1 ; i < j ; i++, j--) {
+        step = steps[i];
+        steps[i] = steps[j];
+        steps[j] = step;
+    }
+    /* way from the via point to the destination */
+    p = via;
+    while ((step.seg = p->seg)) {
+        if (step.seg == steps[count - 1].seg || count >= graph->point_count)
+            return 0;
+        step.dir = step.seg->start == p ? 1 : -1;
+        steps[count++] = step;
+        if (item_is_equal(step.seg->data.item, dst->street->item))
+            break;
+        p = step.dir > 0 ? step.seg->end : step.seg->start;
+        id = route_forward_node_id(graph, p);
+        if (id < 0)
+            return 0;
+        if (nodes[id].mark == mark)
+            valid = 0;
+        nodes[id].mark = mark;
+    }
+    return valid && step.seg ? count : 0;
+}
+
+/**
+ * @brief Creates a route path from the segments of an alternative route
+ *
+ * @param this The route
+ * @param steps The segments
+ * @param count The number of segments
+ *
+ * @return The route path
+ */
+static struct route_path *route_alternative_path_new(struct route *this, struct route_alternative_step *steps,
+        int count) {
+    struct route_path *ret = g_new0(struct route_path, 1);
+    int i, dir = this->pos->dir;
+
+    ret->in_use = 1;
+    ret->path_hash = item_hash_new();
+    if (this->pos->lenextra)
+        route_path_add_line(ret, &this->pos->c, &this->pos->lp, this->pos->lenextra);
+    for (i = 0 ; i < count ; i++)
+        route_path_add_item_from_graph(ret, NULL, steps[i].seg, steps[i].dir, i ? NULL : this->pos,
+                                       i == count - 1 ? this->current_dst : NULL);
+    /* route_path_add_item_from_graph() sets the direction of the position, which belongs to the main route */
+    this->pos->dir = dir;
+    if (this->current_dst->lenextra)
+        route_path_add_line(ret, &this->current_dst->lp, &this->current_dst->c, this->current_dst->lenextra);
+    route_path_set_totals(ret, this->graph, this->vehicleprofile);
+    return ret;
+}
+
+/**
+ * @brief A candidate via point for an alternative route
+ */
+struct route_alternative_candidate {
+    int id;                             /**< ID of the point */
+    int value;                          /**< Total cost of the route through the point */
+};
+
+static int route_alternative_candidate_cmp(const void *a, const void *b) {
+    const struct route_alternative_candidate *ca = a, *cb = b;
+    return ca->value < cb->value ? -1 : ca->value > cb->value;
+}
+
+/**
+ * @brief Calculates alternative routes from the position to the destination
+ *
+ * This uses the via-node method: the regular flood of the route graph gives the cost from every point to the
+ * destination, and a single forward search from the position gives the cost to reach every point. Each point
+ * whose total cost (the sum of both) is no more than `ROUTE_ALTERNATIVE_MAX_STRETCH` percent above the optimum is a
+ * candidate, and the route through it is taken as an alternative if no more than `ROUTE_ALTERNATIVE_MAX_SHARING`
+ * percent of its length are shared with the main route or any alternative found before. Candidates are examined in
+ * order of their total cost, skipping those which lie on the route of a candidate already examined.
+ *
+ * The costs are needed for the whole graph, so no alternatives are calculated while the graph is flooded with a
+ * heuristic, which leaves most of it unexamined. Completing that flood here would block the main loop after every
+ * update for as long as a flood without the heuristic takes, which is what the heuristic is meant to avoid.
+ *
+ * Alternatives are only calculated for the last section of the route, i.e. if there are no more waypoints between
+ * the position and the destination, and not for off-road routing.
+ *
+ * @param this The route, whose `path2` must hold the main route
+ */
+static void route_alternatives_update(struct route *this) {
+    struct route_graph *graph = this->graph;
+    struct vehicleprofile *profile = this->vehicleprofile;
+    struct route_info *pos = this->pos, *dst = this->current_dst;
+    struct route_forward_node *nodes;
+    struct route_alternative_candidate *candidates;
+    struct route_alternative_step *steps;
+    struct route_graph_point *p;
+    struct dheap *heap;
+    GHashTable *used;
+    int i, j, id, best = INT_MAX, limit, len, shared, count, candidate_count = 0, examined = 0, main_found = 0;
+
+    /* like the main route, alternatives which are being read from their map cannot be replaced */
+    for (i = 0 ; i < this->alternative_count ; i++)
+        if (this->alternative_paths[i]->in_use > 1)
+            return;
+    route_alternatives_clear(this);
+    if (!this->alternatives || !graph || !graph->points || !pos || !pos->street || !dst || !dst->street
+            || g_list_length(this->destinations) != 1 || profile->mode == 2 || graph->heuristic)
+        return;
+
+    heap = dheap_new(offsetof(struct route_forward_node, heap_idx));
+    nodes = route_forward_nodes_new(graph, profile, pos, heap);
+    for (i = 0 ; i < graph->point_count ; i++)
+        if (nodes[i].first && graph->points[i].value != INT_MAX)
+            best = MIN(best, route_value_add(nodes[i].value, graph->points[i].value));
+    limit = best == INT_MAX ? INT_MAX : route_value_add(best, best / 100 * ROUTE_ALTERNATIVE_MAX_STRETCH);
+    route_forward_flood(graph, profile, nodes, heap, limit);
+    dheap_destroy(heap);
+
+    /* candidates in order of their total cost, not turning around at the via point */
+    candidates = g_new(struct route_alternative_candidate, graph->point_count);
+    for (i = 0 ; i < graph->point_count ; i++) {
+        p = &graph->points[i];
+        if (nodes[i].value == INT_MAX || p->value == INT_MAX || p->seg == nodes[i].seg)
+            continue;
+        candidates[candidate_count].id = i;
+        candidates[candidate_count].value = route_value_add(nodes[i].value, p->value);
+        if (candidates[candidate_count].value <= limit)
+            candidate_count++;
+    }
+    qsort(candidates, candidate_count, sizeof(struct route_alternative_candidate), route_alternative_candidate_cmp);
+
+    used = g_hash_table_new(NULL, NULL);
+    steps = g_new(struct route_alternative_step, graph->point_count + 1);
+    for (i = 0 ; i < candidate_count && this->alternative_count < MIN(this->alternatives, ROUTE_ALTERNATIVES_MAX)
+            && examined < ROUTE_ALTERNATIVE_MAX_CANDIDATES ; i++) {
+        id = candidates[i].id;
+        if (nodes[id].mark)
+            continue;
+        examined++;
+        count = route_alternative_steps(graph, nodes, &graph->points[id], pos, dst, examined, steps);
+        if (!count)
+            continue;
+        for (j = 0, len = 0, shared = 0 ; j < count ; j++) {
+            len += steps[j].seg->data.len;
+            if (g_hash_table_lookup(used, steps[j].seg))
+                shared += steps[j].seg->data.len;
+        }
+        /* the first valid candidate is the main route */
+        if (main_found) {
+            if ((long long)shared * 100 > (long long)len * ROUTE_ALTERNATIVE_MAX_SHARING)
+                continue;
+            this->alternative_paths[this->alternative_count++] = route_alternative_path_new(this, steps, count);
+        }
+        main_found = 1;
+        for (j = 0 ; j < count ; j++)
+            g_hash_table_insert(used, steps[j].seg, GINT_TO_POINTER(1));
+    }
+    dbg(lvl_debug, "%d alternatives from %d of %d candidates", this->alternative_count, examined, candidate_count);
+    g_free(steps);
+    g_hash_table_destroy(used);
+    g_free(candidates);
+    g_free(nodes);
+}
+
+static int route_graph_build_next_map(struct route_graph *rg) {
+    for (;;) {
+        rg->m=mapset_next(rg->h, 2);
+        if (! rg->m)
+            return 0;
+        /* skip maps which have already been read on the worker thread or loaded from the cache */
+        if (g_list_find(rg->thread_maps, rg->m) || (rg->cache_loaded && g_list_find(rg->cache_maps, rg->m)))
+            continue;
+        map_rect_destroy(rg->mr);
+        rg->mr=map_rect_new(rg->m, rg->sel);
+        if (rg->mr)
+            return 1;
+    }
+}
+
+
+static int is_turn_allowed(struct route_graph_point *p, struct route_graph_segment *from,
+                           struct route_graph_segment *to) {
+    struct route_graph_point *prev,*next;
+    struct route_graph_segment *tmp1,*tmp2;
+    if (item_is_equal(from->data.item, to->data.item))
+        return 0;
+    if (from->start == p)
+        prev=from->end;
+    else
+        prev=from->start;
+    if (to->start == p)
+        next=to->end;
+    else
+        next=to->start;
+    tmp1=p->end;
+    while (tmp1) {
+        if (tmp1->start->c.x == prev->c.x && tmp1->start->c.y == prev->c.y &&
+                (tmp1->data.item.type == type_street_turn_restriction_no ||
+                 tmp1->data.item.type == type_street_turn_restriction_only)) {
+            tmp2=p->start;
+            dbg(lvl_debug,"found %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p",item_to_name(tmp1->data.item.type),
+                tmp1->data.item.id_hi,tmp1->data.item.id_lo,tmp1->start->c.x,tmp1->start->c.y,tmp1->end->c.x,tmp1->end->c.y,tmp1->start,
+                tmp1->end);
+            while (tmp2) {
+                dbg(lvl_debug,"compare %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p",item_to_name(tmp2->data.item.type),
+                    tmp2->data.item.id_hi,tmp2->data.item.id_lo,tmp2->start->c.x,tmp2->start->c.y,tmp2->end->c.x,tmp2->end->c.y,tmp2->start,
+                    tmp2->end);
+                if (item_is_equal(tmp1->data.item, tmp2->data.item))
+                    break;
+                tmp2=tmp2->start_next;
+            }
+            dbg(lvl_debug,"tmp2=%p",tmp2);
+            if (tmp2) {
+                dbg(lvl_debug,"%s tmp2->end=%p next=%p",item_to_name(tmp1->data.item.type),tmp2->end,next);
+            }
+            if (tmp1->data.item.type == type_street_turn_restriction_no && tmp2 && tmp2->end->c.x == next->c.x
+                    && tmp2->end->c.y == next->c.y) {
+                dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (no)",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,
+                    next->c.y);
+                return 0;
+            }
+            if (tmp1->data.item.type == type_street_turn_restriction_only && tmp2 && (tmp2->end->c.x != next->c.x
+                    || tmp2->end->c.y != next->c.y)) {
+                dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (only)",prev->c.x,prev->c.y,p->c.x,p->c.y,
+                    next->c.x,next->c.y);
+                return 0;
+            }
+        }
+        tmp1=tmp1->end_next;
+    }
+    dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x allowed",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,
+        next->c.y);
+    return 1;
+}
+
+static void route_graph_clone_segment(struct route_graph *this, struct route_graph_segment *s,
+                                      struct route_graph_point *start,
+                                      struct route_graph_point *end, int flags) {
+    struct route_graph_segment_data data;
+    struct item item;
+    data.item=route_segment_data_get_item(&s->data, &item);
+    data.offset=1;
+    data.flags=s->data.flags|flags;
+    data.len=s->data.len+1;
+    data.maxspeed=-1;
+    data.dangerous_goods=0;
+    data.score = (s->data.flags & AF_SCORE) ? RSD_SCORE(&s->data) : 0;
+    if (s->data.flags & AF_SPEED_LIMIT)
+        data.maxspeed=RSD_MAXSPEED(&s->data);
+    if (s->data.flags & AF_SEGMENTED)
+        data.offset=RSD_OFFSET(&s->data);
+    if (s->data.flags & AF_SIZE_OR_WEIGHT_LIMIT)
+        data.size_weight=RSD_SIZE_WEIGHT(&s->data);
+    if (s->data.flags & AF_DANGEROUS_GOODS)
+        data.dangerous_goods=RSD_DANGEROUS_GOODS(&s->data);
+    if (s->data.flags & AF_SPEED_PROFILE)
+        data.speed_profile=RSD_SPEED_PROFILE(&s->data);
+    dbg(lvl_debug,"cloning segment from %p (0x%x,0x%x) to %p (0x%x,0x%x)",start,start->c.x,start->c.y, end, end->c.x,
+        end->c.y);
+    route_graph_add_segment(this, start, end, &data);
+}
+
+static void route_graph_process_restriction_segment(struct route_graph *this, struct route_graph_point *p,
         struct route_graph_segment *s, int dir) {
     struct route_graph_segment *tmp;
     struct route_graph_point *pn;
@@ -3078,159 +4384,1933 @@ static void route_graph_process_restriction_point(struct route_graph *this, stru
 }
 
 static void route_graph_process_restrictions(struct route_graph *this) {
-    struct route_graph_point *curr;
+    struct route_graph_point *curr=NULL;
     int i;
     dbg(lvl_debug,"enter");
-    for (i = 0 ; i < HASH_SIZE ; i++) {
-        curr=this->hash[i];
-        while (curr) {
-            if (curr->flags & RP_TURN_RESTRICTION)
-                route_graph_process_restriction_point(this, curr);
-            curr=curr->hash_next;
+    while ((curr=route_graph_next_point(this, curr, &i))) {
+        if ((curr->flags & RP_TURN_RESTRICTION) && !(curr->flags & RP_TURN_RESTRICTION_RESOLVED))
+            route_graph_process_restriction_point(this, curr);
+    }
+}
+
+/**
+ * @brief Updates the points of a frozen route graph which have been added or have gained segments since freezing
+ *
+ * This is done after extending a graph which may already have been flooded, so that LPA* can propagate costs into the
+ * new part of the graph (and from there back into the old part) rather than starting over. New points are only
+ * inconsistent if they are next to a point whose cost is known; all others are left alone.
+ *
+ * If the new segments allow a higher speed than any of the old ones, the heuristic factor is lowered as well so that
+ * the heuristic remains admissible, and the keys of all points on the heap are recalculated.
+ *
+ * @param this The route graph
+ * @param profile The vehicle profile
+ */
+static void route_graph_update_unfrozen(struct route_graph *this, struct vehicleprofile *profile) {
+    struct route_graph_point *p=NULL;
+    double factor;
+    int slot;
+
+    if (this->heuristic_factor > 0) {
+        factor=route_graph_heuristic_factor(this, profile);
+        if (factor < this->heuristic_factor) {
+            this->heuristic_factor=factor;
+            while ((p=route_graph_next_point(this, p, &slot)))
+                if (dheap_contains(this->heap, p))
+                    dheap_update(this->heap, p, route_graph_point_key(this, p));
+        }
+    }
+    while ((p=route_graph_next_point(this, p, &slot)))
+        if (route_graph_point_id(this, p) < 0)
+            route_graph_point_update(this, profile, p);
+}
+
+/**
+ * @brief Releases all resources needed to build the route graph.
+ *
+ * If `cancel` is false, this function will start processing restrictions and ultimately call the route
+ * graph's `done_cb` callback. The selection which has been read is added to the `extent` of the graph, and if the
+ * graph has been extended, the points which have been added or have gained segments are updated for LPA*.
+ *
+ * The traffic module will always call this method with `cancel` set to true, as it does not process
+ * restrictions and has no callback. Inside the routing module, `cancel` will be true if, and only if,
+ * navigation has been aborted.
+ *
+ * @param rg Points to the route graph
+ * @param cancel True if the process was aborted before completing, false if it completed normally
+ */
+void route_graph_build_done(struct route_graph *rg, int cancel) {
+    struct route_graph_hash_stats stats;
+
+    dbg(lvl_debug,"cancel=%d",cancel);
+    if (rg->thread) {
+        thread_lock_acquire(rg->thread_lock);
+        rg->thread_cancel=1;
+        thread_lock_release(rg->thread_lock);
+        route_graph_build_thread_join(rg);
+    }
+    thread_lock_destroy(rg->thread_lock);
+    g_list_free(rg->thread_maps);
+    rg->thread_lock=NULL;
+    rg->thread_maps=NULL;
+    if (!cancel && rg->cache_key && !rg->cache_loaded)
+        route_graph_cache_save(rg);
+    g_free(rg->cache_key);
+    g_list_free(rg->cache_maps);
+    rg->cache_key=NULL;
+    rg->cache_maps=NULL;
+    if (rg->idle_ev)
+        event_remove_idle(rg->idle_ev);
+    if (rg->idle_cb)
+        callback_destroy(rg->idle_cb);
+    map_rect_destroy(rg->mr);
+    mapset_close(rg->h);
+    if (cancel)
+        route_free_selection(rg->sel);
+    else if (rg->sel) {
+        /* keep what has been read, so that the graph can be extended later */
+        struct map_selection *last=rg->sel;
+        while (last->next)
+            last=last->next;
+        last->next=rg->extent;
+        rg->extent=rg->sel;
+    }
+    rg->idle_ev=NULL;
+    rg->idle_cb=NULL;
+    rg->mr=NULL;
+    rg->h=NULL;
+    rg->sel=NULL;
+    if (! cancel) {
+        if (max_debug_level >= lvl_debug) {
+            route_graph_get_hash_stats(rg, &stats);
+            dbg(lvl_debug,"%d points at %d coordinates, %d slots (load factor %.2f), probe length avg %.2f max %d",
+                stats.points, stats.used, stats.size, stats.load_factor, stats.avg_probe, stats.max_probe);
+        }
+        route_graph_process_restrictions(rg);
+        route_graph_freeze(rg);
+        if (rg->extended)
+            route_graph_update_unfrozen(rg, rg->vehicleprofile);
+        rg->build_time=route_graph_clock()-rg->build_start;
+        if (rg->done_cb)
+            callback_call_0(rg->done_cb);
+    }
+    rg->busy=0;
+}
+
+/**
+ * @brief Adds a map item to a route graph which is being built
+ *
+ * @param rg The route graph
+ * @param item The item
+ * @param profile The vehicle profile to use
+ */
+static void route_graph_build_add_item(struct route_graph *rg, struct item *item, struct vehicleprofile *profile) {
+    if (item->type == type_traffic_distortion)
+        route_graph_add_traffic_distortion(rg, profile, item, 0);
+    else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
+        route_graph_add_turn_restriction(rg, item);
+    else
+        route_graph_add_street(rg, item, profile);
+}
+
+static void route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile) {
+    int count=1000;
+    struct item *item;
+
+    while (count > 0) {
+        for (;;) {
+            item=map_rect_get_item(rg->mr);
+            if (item)
+                break;
+            if (!route_graph_build_next_map(rg)) {
+                route_graph_build_done(rg, 0);
+                return;
+            }
+        }
+        route_graph_build_add_item(rg, item, profile);
+        count--;
+    }
+}
+
+/**
+ * @brief Shared state of the threads reading maps into per-map batches
+ */
+struct route_graph_build_job {
+    struct route_graph *rg;             /**< The route graph being built */
+    struct route_graph **batches;       /**< One partial graph per map in `rg->thread_maps`, in the same order */
+    GList *next;                        /**< The next map to read, protected by `rg->thread_lock` */
+    int next_index;                     /**< Index of `next` in `rg->thread_maps` */
+};
+
+/**
+ * @brief Checks if building a route graph has been cancelled
+ *
+ * This may be called on any thread.
+ *
+ * @param rg The route graph
+ */
+static int route_graph_build_cancelled(struct route_graph *rg) {
+    int ret;
+
+    thread_lock_acquire(rg->thread_lock);
+    ret=rg->thread_cancel;
+    thread_lock_release(rg->thread_lock);
+    return ret;
+}
+
+/**
+ * @brief Reads a single map into a new partial route graph
+ *
+ * The partial graph (batch) has its own points and segments and is later merged into the final graph by
+ * `route_graph_build_merge()`. This checks for cancellation every 1000 items.
+ *
+ * @param rg The route graph being built, which supplies the selection and vehicle profile
+ * @param m The map to read
+ *
+ * @return The batch, possibly incomplete if the build has been cancelled
+ */
+static struct route_graph *route_graph_build_batch(struct route_graph *rg, struct map *m) {
+    struct route_graph *ret=g_new0(struct route_graph, 1);
+    struct map_rect *mr;
+    struct item *item;
+    int count=0;
+
+    mr=map_rect_new(m, rg->sel);
+    if (!mr)
+        return ret;
+    while ((item=map_rect_get_item(mr))) {
+        route_graph_build_add_item(ret, item, rg->vehicleprofile);
+        if (++count % 1000 == 0 && route_graph_build_cancelled(rg))
+            break;
+    }
+    map_rect_destroy(mr);
+    dbg(lvl_debug,"%d items read from map %p", count, m);
+    return ret;
+}
+
+/**
+ * @brief Reads maps into batches until all maps of the job have been taken or the build is cancelled
+ *
+ * This is run by each thread participating in the job.
+ *
+ * @param job The job
+ */
+static void route_graph_build_worker(struct route_graph_build_job *job) {
+    struct route_graph *rg=job->rg;
+    GList *l;
+    int i;
+
+    for (;;) {
+        thread_lock_acquire(rg->thread_lock);
+        l=rg->thread_cancel ? NULL : job->next;
+        i=job->next_index;
+        if (l) {
+            job->next=g_list_next(l);
+            job->next_index++;
+        }
+        thread_lock_release(rg->thread_lock);
+        if (!l)
+            return;
+        job->batches[i]=route_graph_build_batch(rg, l->data);
+    }
+}
+
+/**
+ * @brief Merges a batch into a route graph and frees it
+ *
+ * Segments are moved rather than copied, in the order in which they were added to the batch, and attached to the
+ * points of `rg` at the same coordinates. Segments which `rg` already holds are dropped, as determined by
+ * `route_graph_segment_is_duplicate()`. Point flags are carried over, and points without segments are kept.
+ *
+ * @param rg The route graph to merge into
+ * @param batch The batch, which is freed by this function
+ */
+static void route_graph_build_merge(struct route_graph *rg, struct route_graph *batch) {
+    struct route_graph_segment *s,*next,*rev=NULL;
+    struct route_graph_point *start,*end,*p=NULL;
+    struct route_graph_segment_data data;
+    struct item item;
+    int i;
+
+    /* batch->route_segments is newest first, reverse it to merge in insertion order */
+    for (s = batch->route_segments ; s ; s = next) {
+        next=s->next;
+        s->next=rev;
+        rev=s;
+    }
+    batch->route_segments=NULL;
+    for (s = rev ; s ; s = next) {
+        next=s->next;
+        start=route_graph_add_point(rg, &s->start->c);
+        end=route_graph_add_point(rg, &s->end->c);
+        data.item=route_segment_data_get_item(&s->data, &item);
+        data.flags=s->data.flags;
+        data.offset=(s->data.flags & AF_SEGMENTED) ? RSD_OFFSET(&s->data) : 1;
+        if (route_graph_segment_is_duplicate(start, &data)) {
+            g_slice_free1(sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)
+                          +route_segment_data_size(s->data.flags), s);
+            continue;
+        }
+        s->start=start;
+        s->start_next=start->start;
+        start->start=s;
+        s->end=end;
+        s->end_next=end->end;
+        end->end=s;
+        s->next=rg->route_segments;
+        rg->route_segments=s;
+    }
+    while ((p=route_graph_next_point(batch, p, &i)))
+        route_graph_add_point(rg, &p->c)->flags |= p->flags;
+    route_graph_free_points(batch);
+    g_free(batch);
+}
+
+/**
+ * @brief Reads all maps in `rg->thread_maps` into the route graph
+ *
+ * This runs on the worker thread. Each map is read into a separate batch, using up to `ROUTE_GRAPH_BUILD_THREADS`
+ * threads (including this one). The batches are then merged into the route graph in mapset order, so the result does
+ * not depend on the number of threads or the order in which they finish.
+ *
+ * Cancellation is checked every 1000 items. When this function returns, the graph is flagged as done, no matter
+ * whether it was cancelled or not.
+ *
+ * @param rg The route graph
+ */
+static void route_graph_build_thread(struct route_graph *rg) {
+    struct route_graph_build_job job;
+    struct thread **threads;
+    int i,count=g_list_length(rg->thread_maps),thread_count=MIN(count, ROUTE_GRAPH_BUILD_THREADS);
+
+    job.rg=rg;
+    job.batches=g_new0(struct route_graph *, count);
+    job.next=rg->thread_maps;
+    job.next_index=0;
+    threads=g_new0(struct thread *, thread_count);
+    for (i = 1 ; i < thread_count ; i++)
+        threads[i]=thread_new((void (*)(void *))route_graph_build_worker, &job);
+    route_graph_build_worker(&job);
+    for (i = 1 ; i < thread_count ; i++)
+        thread_join(threads[i]);
+    g_free(threads);
+    dbg(lvl_debug,"read %d maps with up to %d threads", count, thread_count);
+    for (i = 0 ; i < count ; i++) {
+        if (!job.batches[i])
+            continue;
+        if (route_graph_build_cancelled(rg)) {
+            route_graph_free_points(job.batches[i]);
+            route_graph_free_segments(job.batches[i]);
+            g_free(job.batches[i]);
+        } else
+            route_graph_build_merge(rg, job.batches[i]);
+    }
+    g_free(job.batches);
+    thread_lock_acquire(rg->thread_lock);
+    rg->thread_done=1;
+    thread_lock_release(rg->thread_lock);
+}
+
+/**
+ * @brief Waits for the worker thread of a route graph to finish and stops polling it
+ *
+ * @param rg The route graph
+ */
+static void route_graph_build_thread_join(struct route_graph *rg) {
+    thread_join(rg->thread);
+    rg->thread=NULL;
+    if (rg->thread_ev)
+        event_remove_timeout(rg->thread_ev);
+    if (rg->thread_cb)
+        callback_destroy(rg->thread_cb);
+    rg->thread_ev=NULL;
+    rg->thread_cb=NULL;
+}
+
+/**
+ * @brief Checks if the worker thread of a route graph has finished
+ *
+ * This is called periodically on the main thread. Once the worker is done, the remaining maps (those which are not
+ * thread-safe) are read on the main thread in the usual manner, and the graph is completed.
+ *
+ * @param rg The route graph
+ */
+static void route_graph_build_thread_poll(struct route_graph *rg) {
+    int done;
+
+    thread_lock_acquire(rg->thread_lock);
+    done=rg->thread_done;
+    thread_lock_release(rg->thread_lock);
+    if (!done)
+        return;
+    route_graph_build_thread_join(rg);
+    if (route_graph_build_next_map(rg)) {
+        rg->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), rg, rg->vehicleprofile);
+        rg->idle_ev=event_add_idle(50, rg->idle_cb);
+    } else
+        route_graph_build_done(rg, 0);
+}
+
+/**
+ * @brief Starts a worker thread to read the thread-safe maps of a mapset into a route graph
+ *
+ * @param rg The route graph, with `sel` and `vehicleprofile` set
+ * @param ms The mapset
+ *
+ * @return True if a worker thread was started, false if there are no thread-safe maps or threads are not supported
+ */
+static int route_graph_build_thread_start(struct route_graph *rg, struct mapset *ms) {
+    struct mapset_handle *h=mapset_open(ms);
+    struct map *m;
+
+    while ((m=mapset_next(h, 2)))
+        if (map_is_thread_safe(m) && !(rg->cache_loaded && g_list_find(rg->cache_maps, m)))
+            rg->thread_maps=g_list_append(rg->thread_maps, m);
+    mapset_close(h);
+    if (!rg->thread_maps)
+        return 0;
+    rg->thread_lock=thread_lock_new();
+    rg->thread=thread_new((void (*)(void *))route_graph_build_thread, rg);
+    if (!rg->thread) {
+        g_list_free(rg->thread_maps);
+        rg->thread_maps=NULL;
+        return 0;
+    }
+    dbg(lvl_debug,"reading %d maps on worker thread", g_list_length(rg->thread_maps));
+    rg->thread_cb=callback_new_1(callback_cast(route_graph_build_thread_poll), rg);
+    rg->thread_ev=event_add_timeout(50, 1, rg->thread_cb);
+    return 1;
+}
+
+/**
+ * @brief Builds a new route graph from a mapset
+ *
+ * This function builds a new route graph from a map. Please note that this function does not
+ * add any routing information to the route graph - this has to be done via the route_graph_flood()
+ * function.
+ *
+ * The function does not create a graph covering the whole map, but only covering the rectangle
+ * between c1 and c2.
+ *
+ * @param ms The mapset to build the route graph from
+ * @param c The coordinates of the destination or next waypoint
+ * @param c1 Corner 1 of the rectangle to use from the map
+ * @param c2 Corner 2 of the rectangle to use from the map
+ * @param done_cb The callback which will be called when graph is complete
+ * @param threaded If `async` is true, read thread-safe maps on a worker thread, see
+ * {@link map_is_thread_safe(struct map *)}
+ * @param cache Load the data of maps with static data from the on-disk cache if possible, or else save it there once
+ * the graph is complete. The selection is enlarged to a grid for this, see route_graph_cache.c.
+ * @return The new route graph.
+ */
+// FIXME documentation does not match argument list
+static struct route_graph *route_graph_build(struct mapset *ms, struct coord *c, int count, struct callback *done_cb,
+        int async, int threaded, int cache,
+        struct vehicleprofile *profile) {
+    return route_graph_build_selection(ms, route_calc_selection(c, count, profile), done_cb, async, threaded, cache,
+                                       profile);
+}
+
+/**
+ * @brief Builds a new route graph from a mapset, for a given selection
+ *
+ * This works like `route_graph_build()`, except that the selection is passed by the caller rather than calculated
+ * from the route points.
+ *
+ * @param ms The mapset to build the route graph from
+ * @param sel The selection, which is owned by the graph from now on
+ * @param done_cb The callback which will be called when graph is complete
+ * @param async Whether to build the graph asynchronously
+ * @param threaded If `async` is true, read thread-safe maps on a worker thread
+ * @param cache Whether to use the on-disk cache
+ * @param profile The vehicle profile
+ * @return The new route graph.
+ */
+static struct route_graph *route_graph_build_selection(struct mapset *ms, struct map_selection *sel,
+        struct callback *done_cb, int async, int threaded, int cache, struct vehicleprofile *profile) {
+    struct route_graph *ret=g_new0(struct route_graph, 1);
+
+    dbg(lvl_debug,"enter");
+
+    ret->build_start=route_graph_clock();
+    ret->sel=sel;
+    if (cache) {
+        route_graph_cache_snap_selection(ret->sel);
+        ret->cache_key=route_graph_cache_key(ms, ret->sel, profile, &ret->cache_maps);
+        if (ret->cache_key)
+            ret->cache_loaded=route_graph_cache_load(ret);
+    }
+    ret->h=mapset_open(ms);
+    ret->done_cb=done_cb;
+    ret->vehicleprofile=profile;
+    ret->busy=1;
+    ret->heap = dheap_new(offsetof(struct route_graph_point, heap_idx));
+    if (async && threaded && route_graph_build_thread_start(ret, ms))
+        return ret;
+    if (route_graph_build_next_map(ret)) {
+        if (async) {
+            ret->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), ret, profile);
+            ret->idle_ev=event_add_idle(50, ret->idle_cb);
+        }
+    } else
+        route_graph_build_done(ret, 0);
+
+    return ret;
+}
+
+/**
+ * @brief Extends a complete route graph with the items of a new selection
+ *
+ * The items are read from all route-active maps in the same way as when building a graph, on the main thread, and
+ * stitched into the existing points. Segments which the graph already holds are skipped, see
+ * `route_graph_segment_is_duplicate()`. Once done, turn restrictions at the points which have been added or have
+ * gained segments are resolved, these points are updated for LPA*, and `done_cb` is called, see
+ * `route_graph_build_done()`.
+ *
+ * The costs calculated so far are kept. New points and segments are not part of the adjacency array of a frozen
+ * graph, which therefore gets less efficient with each extension.
+ *
+ * @param this The route graph, which must not be busy
+ * @param ms The mapset
+ * @param sel The selection to read, usually excluding `extent`, which is owned by the graph from now on
+ * @param done_cb The callback which will be called when the graph is complete
+ * @param async Whether to read the items asynchronously
+ */
+static void route_graph_extend(struct route_graph *this, struct mapset *ms, struct map_selection *sel,
+                               struct callback *done_cb, int async) {
+    dbg(lvl_debug,"extending graph with %d points", this->hash_points);
+    this->build_start=route_graph_clock();
+    this->sel=sel;
+    this->h=mapset_open(ms);
+    this->done_cb=done_cb;
+    this->busy=1;
+    this->extended++;
+    if (route_graph_build_next_map(this)) {
+        if (async) {
+            this->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), this, this->vehicleprofile);
+            this->idle_ev=event_add_idle(50, this->idle_cb);
+        }
+    } else
+        route_graph_build_done(this, 0);
+}
+
+/**
+ * @brief An edge of a contraction hierarchy
+ *
+ * This is the layout of the `attr_ch_edge` attribute of `type_ch_node` items, as written by maptool. Each edge is
+ * stored with the less important of the two nodes it connects, and points towards the more important one.
+ */
+struct route_ch_edge {
+    int flags;                  /**< `RCH_FORWARD` and `RCH_BACKWARD` indicate the directions in which the edge can be
+                                 *   used, `RCH_SHORTCUT` marks a shortcut */
+    int weight;                 /**< Cost of the edge, in tenths of seconds */
+    struct item_id target;      /**< The more important `type_ch_node` at the other end of the edge */
+    struct item_id middle;      /**< For shortcuts, the `type_ch_node` which was contracted to create the shortcut;
+                                 *   for regular edges, the street item which the edge represents */
+};
+
+#define RCH_FORWARD 1
+#define RCH_BACKWARD 2
+#define RCH_SHORTCUT 4
+
+/** Maximum number of nodes settled by a single contraction hierarchy query before giving up */
+#define RCH_MAX_SETTLED 1000000
+
+/**
+ * @brief A node visited during a contraction hierarchy query
+ *
+ * Arrays with two elements hold the state of the forward search (element 0, from the position) and the backward
+ * search (element 1, from the destination).
+ */
+struct route_ch_node {
+    struct item_id id;                  /**< Item ID of the `type_ch_node` in the map */
+    int value[2];                       /**< Cost from the start of each search, `INT_MAX` if not reached yet */
+    struct route_ch_node *prev[2];      /**< Node from which this node was reached in each search */
+    struct route_ch_edge edge[2];       /**< The edge over which this node was reached in each search */
+    struct item_id owner[2];            /**< The node under which `edge` is stored in the map */
+    int heap_idx[2];                    /**< Index slots for the heaps of both searches */
+    int edge_count;                     /**< Number of edges of this node, -1 if not loaded yet */
+    struct route_ch_edge *edges;        /**< Edges of this node */
+};
+
+/**
+ * @brief State of a contraction hierarchy query
+ */
+struct route_ch_query {
+    struct map *map;                    /**< The map holding both the street items and the contraction hierarchy */
+    struct map_rect *mr;                /**< A map rect used to look up items by their ID */
+    GHashTable *nodes;                  /**< All nodes visited so far, keyed by their item ID */
+    struct dheap *heap[2];              /**< Priority queues for the forward and backward search */
+    int best;                           /**< Cost of the cheapest path found so far */
+    struct route_ch_node *meet;         /**< Node at which the cheapest path found so far meets */
+    int settled;                        /**< Number of nodes settled */
+};
+
+static void route_ch_node_free(struct route_ch_node *node) {
+    g_free(node->edges);
+    g_free(node);
+}
+
+/**
+ * @brief Returns a contraction hierarchy node, loading its edges from the map if needed
+ *
+ * @param q The query
+ * @param id The item ID of the node
+ * @return The node, or NULL if the map does not contain a `type_ch_node` with the given ID
+ */
+static struct route_ch_node *route_ch_node_get(struct route_ch_query *q, struct item_id *id) {
+    struct route_ch_node *node=g_hash_table_lookup(q->nodes, id);
+    struct item *item;
+    struct attr attr;
+    int size=0;
+
+    if (node)
+        return node;
+    item=map_rect_get_item_byid(q->mr, id->id_hi, id->id_lo);
+    if (!item || item->type != type_ch_node)
+        return NULL;
+    node=g_new0(struct route_ch_node, 1);
+    node->id=*id;
+    node->value[0]=node->value[1]=INT_MAX;
+    item_attr_rewind(item);
+    while (item_attr_get(item, attr_ch_edge, &attr)) {
+        if (node->edge_count == size) {
+            size=size ? size*2 : 8;
+            node->edges=g_renew(struct route_ch_edge, node->edges, size);
+        }
+        memcpy(&node->edges[node->edge_count++], attr.u.data, sizeof(struct route_ch_edge));
+    }
+    g_hash_table_insert(q->nodes, &node->id, node);
+    return node;
+}
+
+/**
+ * @brief Finds the contraction hierarchy node at a given coordinate
+ *
+ * @param q The query
+ * @param c The coordinate, which is usually the first or last coordinate of a street
+ * @param ret Receives the ID of the node
+ * @return True if a node was found, false if not
+ */
+static int route_ch_node_at(struct route_ch_query *q, struct coord *c, struct item_id *ret) {
+    struct map_selection *sel=route_rect(18, c, c, 0, 1);
+    struct map_rect *mr;
+    struct item *item;
+    struct coord nc;
+    int found=0;
+
+    sel->range.min=type_ch_node;
+    sel->range.max=type_ch_node;
+    mr=map_rect_new(q->map, sel);
+    if (mr) {
+        while (!found && (item=map_rect_get_item(mr))) {
+            if (item->type == type_ch_node && item_coord_get(item, &nc, 1) && nc.x == c->x && nc.y == c->y) {
+                ret->id_hi=item->id_hi;
+                ret->id_lo=item->id_lo;
+                found=1;
+            }
+        }
+        map_rect_destroy(mr);
+    }
+    route_free_selection(sel);
+    return found;
+}
+
+/**
+ * @brief Lowers the cost of a node in one of the searches of a contraction hierarchy query
+ *
+ * @param q The query
+ * @param node The node
+ * @param dir 0 for the forward search, 1 for the backward search
+ * @param value The new cost, ignored if it is not lower than the current cost
+ * @param prev The node from which `node` is reached, NULL for start nodes
+ * @param owner The node under which `edge` is stored
+ * @param edge The edge over which `node` is reached, NULL for start nodes
+ */
+static void route_ch_node_relax(struct route_ch_query *q, struct route_ch_node *node, int dir, int value,
+                                struct route_ch_node *prev, struct route_ch_node *owner, struct route_ch_edge *edge) {
+    if (value >= node->value[dir])
+        return;
+    node->value[dir]=value;
+    node->prev[dir]=prev;
+    if (edge) {
+        node->edge[dir]=*edge;
+        node->owner[dir]=owner->id;
+    }
+    dheap_update(q->heap[dir], node, value);
+    if (node->value[1-dir] != INT_MAX && route_value_add(node->value[0], node->value[1]) < q->best) {
+        q->best=node->value[0]+node->value[1];
+        q->meet=node;
+    }
+}
+
+/**
+ * @brief Settles the cheapest node of one of the searches of a contraction hierarchy query
+ *
+ * Only edges leading to more important nodes are stored in the map, thus both searches only ever move upwards in the
+ * hierarchy.
+ *
+ * @param q The query
+ * @param dir 0 for the forward search, 1 for the backward search
+ */
+static void route_ch_settle(struct route_ch_query *q, int dir) {
+    struct route_ch_node *node=dheap_extractmin(q->heap[dir]),*target;
+    int i;
+
+    q->settled++;
+    for (i = 0 ; i < node->edge_count ; i++) {
+        struct route_ch_edge *edge=&node->edges[i];
+        if (!(edge->flags & (dir ? RCH_BACKWARD : RCH_FORWARD)))
+            continue;
+        target=route_ch_node_get(q, &edge->target);
+        if (target)
+            route_ch_node_relax(q, target, dir, route_value_add(node->value[dir], edge->weight), node, node, edge);
+    }
+}
+
+/**
+ * @brief Collects the street items represented by a contraction hierarchy edge
+ *
+ * Shortcuts are unpacked recursively into the two edges they replace, which are stored with the contracted node.
+ *
+ * @param q The query
+ * @param owner The ID of the node under which `edge` is stored
+ * @param edge The edge to unpack
+ * @param items Receives the IDs of all street items, as keys
+ * @param depth Recursion depth, used to guard against malformed data
+ * @return True on success, false if the edge could not be unpacked
+ */
+static int route_ch_unpack(struct route_ch_query *q, struct item_id *owner, struct route_ch_edge *edge,
+                           GHashTable *items, int depth) {
+    struct route_ch_node *middle;
+    struct route_ch_edge *first=NULL,*second=NULL;
+    struct item_id *id;
+    int i;
+
+    if (!(edge->flags & RCH_SHORTCUT)) {
+        if (!g_hash_table_lookup(items, &edge->middle)) {
+            id=g_new(struct item_id, 1);
+            *id=edge->middle;
+            g_hash_table_insert(items, id, id);
+        }
+        return 1;
+    }
+    if (depth > 64)
+        return 0;
+    middle=route_ch_node_get(q, &edge->middle);
+    if (!middle)
+        return 0;
+    for (i = 0 ; i < middle->edge_count ; i++) {
+        if (!first && item_id_equal(&middle->edges[i].target, owner))
+            first=&middle->edges[i];
+        else if (!second && item_id_equal(&middle->edges[i].target, &edge->target))
+            second=&middle->edges[i];
+    }
+    if (!first || !second)
+        return 0;
+    return route_ch_unpack(q, &middle->id, first, items, depth+1)
+           && route_ch_unpack(q, &middle->id, second, items, depth+1);
+}
+
+/**
+ * @brief Returns the estimated time to travel part of a street, as used for the start and end of a CH query
+ *
+ * @param profile The vehicle profile
+ * @param sd The street
+ * @param len The distance traveled on the street
+ * @param dir Positive to travel in the direction of the street, negative to travel against it
+ * @return The time in tenths of seconds, or `INT_MAX` if the street cannot be traveled in that direction
+ */
+static int route_ch_street_value(struct vehicleprofile *profile, struct street_data *sd, int len, int dir) {
+    struct roadprofile *roadprofile=vehicleprofile_get_roadprofile(profile, sd->item.type);
+    if ((sd->flags & (dir > 0 ? profile->flags_forward_mask : profile->flags_reverse_mask)) != profile->flags)
+        return INT_MAX;
+    if (!roadprofile || !roadprofile->route_weight)
+        return INT_MAX;
+    return len*36/roadprofile->route_weight;
+}
+
+/**
+ * @brief Seeds one of the searches of a contraction hierarchy query with both ends of a street
+ *
+ * @param q The query
+ * @param profile The vehicle profile
+ * @param ri The position (for the forward search) or destination (for the backward search)
+ * @param dir 0 for the forward search, 1 for the backward search
+ * @return True if at least one end of the street is a node of the contraction hierarchy
+ */
+static int route_ch_seed(struct route_ch_query *q, struct vehicleprofile *profile, struct route_info *ri, int dir) {
+    struct street_data *sd=ri->street;
+    struct route_ch_node *node;
+    struct item_id id;
+    int ret=0, val;
+
+    if (route_ch_node_at(q, &sd->c[0], &id) && (node=route_ch_node_get(q, &id))) {
+        /* leaving the position towards the start of the street, or reaching the destination from it */
+        val=route_ch_street_value(profile, sd, ri->lenneg, dir ? 1 : -1);
+        if (val != INT_MAX)
+            route_ch_node_relax(q, node, dir, val, NULL, NULL, NULL);
+        ret=1;
+    }
+    if (route_ch_node_at(q, &sd->c[sd->count-1], &id) && (node=route_ch_node_get(q, &id))) {
+        val=route_ch_street_value(profile, sd, ri->lenpos, dir ? -1 : 1);
+        if (val != INT_MAX)
+            route_ch_node_relax(q, node, dir, val, NULL, NULL, NULL);
+        ret=1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Runs a bidirectional contraction hierarchy query between two locations
+ *
+ * Both searches only relax edges leading upwards in the hierarchy. The query stops once neither search can
+ * produce a path cheaper than the best one found so far. The path is then unpacked into the street items it
+ * is made of.
+ *
+ * @param m The map holding the contraction hierarchy
+ * @param profile The vehicle profile
+ * @param pos The start of the route
+ * @param dst The end of the route
+ * @param items Receives the IDs of all street items on the path, as keys
+ * @return True on success, false if the map has no contraction hierarchy data for these locations or no path
+ * was found
+ */
+static int route_ch_query(struct map *m, struct vehicleprofile *profile, struct route_info *pos,
+                          struct route_info *dst, GHashTable *items) {
+    struct route_ch_query q;
+    struct route_ch_node *node;
+    int dir, ret=0;
+
+    memset(&q, 0, sizeof(q));
+    q.map=m;
+    q.best=INT_MAX;
+    q.mr=map_rect_new(m, NULL);
+    if (!q.mr)
+        return 0;
+    q.nodes=g_hash_table_new_full((GHashFunc)item_id_hash, (GEqualFunc)item_id_equal, NULL,
+                                  (GDestroyNotify)route_ch_node_free);
+    q.heap[0]=dheap_new(offsetof(struct route_ch_node, heap_idx));
+    q.heap[1]=dheap_new(offsetof(struct route_ch_node, heap_idx)+sizeof(int));
+    if (route_ch_seed(&q, profile, pos, 0) && route_ch_seed(&q, profile, dst, 1)) {
+        for (;;) {
+            int min0=dheap_minkey(q.heap[0]);
+            int min1=dheap_minkey(q.heap[1]);
+            if (min0 >= q.best && min1 >= q.best)
+                break;
+            if (q.settled > RCH_MAX_SETTLED) {
+                dbg(lvl_error,"contraction hierarchy query exceeded %d nodes, giving up", RCH_MAX_SETTLED);
+                q.meet=NULL;
+                break;
+            }
+            route_ch_settle(&q, min1 < min0);
+        }
+        dbg(lvl_debug,"settled %d nodes, cost %d", q.settled, q.best);
+        if (q.meet) {
+            ret=1;
+            for (dir = 0 ; dir < 2 && ret ; dir++) {
+                for (node = q.meet ; node->prev[dir] && ret ; node = node->prev[dir])
+                    ret=route_ch_unpack(&q, &node->owner[dir], &node->edge[dir], items, 0);
+            }
+        }
+    }
+    dheap_destroy(q.heap[0]);
+    dheap_destroy(q.heap[1]);
+    g_hash_table_destroy(q.nodes);
+    map_rect_destroy(q.mr);
+    return ret;
+}
+
+/**
+ * @brief Adds a street item to a route graph, looking it up by its ID
+ *
+ * @param this The route graph
+ * @param mr A map rect on the map holding the item
+ * @param id The item ID
+ * @param profile The vehicle profile
+ */
+static void route_graph_add_street_byid(struct route_graph *this, struct map_rect *mr, struct item_id *id,
+                                        struct vehicleprofile *profile) {
+    struct item *item=map_rect_get_item_byid(mr, id->id_hi, id->id_lo);
+    if (item)
+        route_graph_add_street(this, item, profile);
+}
+
+/**
+ * @brief Whether a flooded route graph offers a way to leave a position
+ *
+ * @param this The route graph
+ * @param ri The position
+ * @return True if at least one of the segments of the position's street leads to the destination
+ */
+static int route_graph_reaches(struct route_graph *this, struct route_info *ri) {
+    struct route_graph_segment *s=NULL;
+    while ((s=route_graph_get_segment(this, ri->street, s))) {
+        if (s->start->value != INT_MAX || s->end->value != INT_MAX)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Builds a route graph from contraction hierarchy data
+ *
+ * If the map holding the position also holds a contraction hierarchy (`type_ch_node` items, as generated by
+ * maptool), a bidirectional CH query is run for each leg of the route. The street items along the resulting paths
+ * then make up a small "corridor" graph, which is subsequently flooded with LPA* like any other route graph. This
+ * way, costs along the corridor follow the vehicle profile, and traffic distortions as well as the rest of the
+ * routing code work unchanged.
+ *
+ * The graph is returned in the same state as a graph built with `route_graph_build()` just before
+ * `route_graph_build_done()` is called, i.e. the caller needs to call the latter.
+ *
+ * @param this The route
+ * @param done_cb The callback which will be called when graph is complete
+ * @return The new route graph, or NULL if no contraction hierarchy data is available or no path was found, in
+ * which case the caller should fall back to `route_graph_build()`.
+ */
+static struct route_graph *route_graph_build_ch(struct route *this, struct callback *done_cb) {
+    struct route_graph *ret;
+    struct route_info *prev=this->pos, *dst;
+    struct map *m;
+    struct map_rect *mr;
+    GHashTable *items;
+    GHashTableIter iter;
+    struct item_id *id;
+    GList *l;
+    int ok=1;
+
+    if (!this->pos || !this->pos->street || !this->destinations)
+        return NULL;
+    m=this->pos->street->item.map;
+    items=g_hash_table_new_full((GHashFunc)item_id_hash, (GEqualFunc)item_id_equal, g_free, NULL);
+    for (l = this->destinations ; l && ok ; l = g_list_next(l)) {
+        dst=l->data;
+        ok=(dst->street && dst->street->item.map == m && route_ch_query(m, this->vehicleprofile, prev, dst, items));
+        prev=dst;
+    }
+    if (!ok || !(mr=map_rect_new(m, NULL))) {
+        dbg(lvl_debug,"no contraction hierarchy path, using regular route graph");
+        g_hash_table_destroy(items);
+        return NULL;
+    }
+
+    ret=g_new0(struct route_graph, 1);
+    ret->build_start=route_graph_clock();
+    ret->done_cb=done_cb;
+    ret->busy=1;
+    ret->ch=1;
+    ret->heap=dheap_new(offsetof(struct route_graph_point, heap_idx));
+    g_hash_table_iter_init(&iter, items);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&id, NULL))
+        route_graph_add_street_byid(ret, mr, id, this->vehicleprofile);
+    prev=this->pos;
+    for (l = this->destinations ; l ; l = g_list_next(l)) {
+        struct item_id sid;
+        dst=l->data;
+        sid.id_hi=prev->street->item.id_hi;
+        sid.id_lo=prev->street->item.id_lo;
+        route_graph_add_street_byid(ret, mr, &sid, this->vehicleprofile);
+        sid.id_hi=dst->street->item.id_hi;
+        sid.id_lo=dst->street->item.id_lo;
+        route_graph_add_street_byid(ret, mr, &sid, this->vehicleprofile);
+        prev=dst;
+    }
+    map_rect_destroy(mr);
+    g_hash_table_destroy(items);
+
+    /* Check every leg, as the vehicle profile may forbid streets which the contraction hierarchy uses */
+    prev=this->pos;
+    for (l = this->destinations ; l && ok ; l = g_list_next(l)) {
+        dst=l->data;
+        route_graph_init(ret, dst, this->vehicleprofile);
+        route_graph_compute_shortest_path(ret, this->vehicleprofile, NULL);
+        ok=route_graph_reaches(ret, prev);
+        route_graph_reset(ret);
+        prev=dst;
+    }
+    if (!ok) {
+        dbg(lvl_debug,"contraction hierarchy corridor not passable, using regular route graph");
+        ret->done_cb=NULL;
+        route_graph_destroy(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+/**
+ * @brief Sets the speeds of segments with a speed profile for a departure
+ *
+ * As the route graph is flooded backwards from the destination, the time at which a segment will be reached is not
+ * known while its cost is calculated. It is therefore projected from the straight-line distance between `origin` and
+ * the start of the segment, at `ROUTE_SPEED_PROFILE_PROJECTION_SPEED`, and the speed of the segment is taken from its
+ * profile at that time. The time of the route itself is calculated along the path, see `route_path_set_totals()`.
+ *
+ * If any speed changes, compiled costs are discarded and the graph is reset, as costs calculated before no longer
+ * apply. Without speed profiles, segments travel at their full speed.
+ *
+ * @param this The route graph, with `speed_profiles` set if costs depend on time
+ * @param origin The start of the route
+ * @param departure The time of departure, in seconds since the epoch
+ */
+static void route_graph_set_departure(struct route_graph *this, struct coord *origin, long departure) {
+    struct route_graph_segment *s;
+    int minute=0,percent,changed=0;
+
+    this->departure=departure;
+    if (this->speed_profiles)
+        minute=route_speed_profiles_minute(departure);
+    for (s = this->route_segments ; s ; s = s->next) {
+        if (!(s->data.flags & AF_SPEED_PROFILE))
+            continue;
+        percent=0;
+        if (this->speed_profiles)
+            percent=route_speed_profiles_percent(this->speed_profiles, RSD_SPEED_PROFILE_ID(&s->data),
+                                                 minute+transform_distance(projection_mg, origin, &s->start->c)*60
+                                                 /(ROUTE_SPEED_PROFILE_PROJECTION_SPEED*1000));
+        if (percent != RSD_SPEED_PROFILE_PERCENT(&s->data)) {
+            RSD_SPEED_PROFILE(&s->data)=RSD_SPEED_PROFILE_ID(&s->data) | percent << 16;
+            changed=1;
+        }
+    }
+    if (changed) {
+        this->cost_profile=NULL;
+        route_graph_reset(this);
+    }
+}
+
+static void route_graph_update_done(struct route *this, struct callback *cb) {
+    this->graph->landmarks = this->heuristic ? this->landmarks : NULL;
+    this->graph->speed_profiles = this->time_dependent ? this->speed_profiles : NULL;
+    route_graph_set_departure(this->graph, &this->pos->c, this->departure_time ? this->departure_time : time(NULL));
+    route_graph_set_goal(this->graph, this->heuristic ? route_previous_destination(this) : NULL, this->vehicleprofile);
+    route_graph_init(this->graph, this->current_dst, this->vehicleprofile);
+    route_graph_compute_shortest_path(this->graph, this->vehicleprofile, cb);
+}
+
+/**
+ * @brief Updates the route graph
+ *
+ * This updates the route graph after settings in the route have changed. It also
+ * adds routing information afterwards by calling route_graph_flood().
+ *
+ * @param this The route to update the graph for
+ * @param cb The callback function to call when the route graph update is complete (used only in asynchronous mode)
+ * @param async Set to nonzero in order to update the route graph asynchronously
+ * @param ch Set to nonzero to try building the graph from contraction hierarchy data first, see
+ * {@link route_graph_build_ch(struct route *, struct callback *)}
+ */
+static void route_graph_update(struct route *this, struct callback *cb, int async, int ch) {
+    struct attr route_status;
+    struct coord *c=g_alloca(sizeof(struct coord)*(1+g_list_length(this->destinations)));
+    int i=0;
+    GList *tmp;
+
+    route_status.type=attr_route_status;
+    route_graph_destroy(this->graph);
+    this->graph=NULL;
+    if (this->landmarks && (!this->heuristic
+                            || !route_landmarks_is_current(this->landmarks, this->ms, this->vehicleprofile))) {
+        route_landmarks_destroy(this->landmarks);
+        this->landmarks=NULL;
+    }
+    if (this->heuristic && !this->landmarks)
+        this->landmarks=route_landmarks_load(this->ms, this->vehicleprofile);
+    if (this->speed_profiles && (!this->time_dependent
+                                 || !route_speed_profiles_is_current(this->speed_profiles, this->ms))) {
+        route_speed_profiles_destroy(this->speed_profiles);
+        this->speed_profiles=NULL;
+    }
+    if (this->time_dependent && !this->speed_profiles)
+        this->speed_profiles=route_speed_profiles_load(this->ms);
+    callback_destroy(this->route_graph_done_cb);
+    this->route_graph_done_cb=callback_new_2(callback_cast(route_graph_update_done), this, cb);
+    route_status.u.num=route_status_building_graph;
+    route_set_attr(this, &route_status);
+    c[i++]=this->pos->c;
+    tmp=this->destinations;
+    while (tmp) {
+        struct route_info *dst=tmp->data;
+        c[i++]=dst->c;
+        tmp=g_list_next(tmp);
+    }
+    if (ch) {
+        this->graph=route_graph_build_ch(this, this->route_graph_done_cb);
+        if (this->graph) {
+            /* Assign the graph before completing it, as the callback operates on this->graph */
+            route_graph_build_done(this->graph, 0);
+            return;
+        }
+    }
+    this->graph=route_graph_build(this->ms, c, i, this->route_graph_done_cb, async, this->graph_thread,
+                                  this->graph_cache, this->vehicleprofile);
+    if (! async) {
+        while (this->graph->busy)
+            route_graph_build_idle(this->graph, this->vehicleprofile);
+    }
+}
+
+/** Maximum number of times a route graph is extended before it is built again from scratch */
+#define ROUTE_GRAPH_EXTEND_MAX 8
+
+/**
+ * @brief Extends the route graph to cover the current position and all destinations
+ *
+ * This is used instead of `route_graph_update()` when the vehicle has left the area covered by the route graph or a
+ * waypoint has been added. Only the parts of the selection for the current route points which have not been read
+ * before are loaded, see `route_graph_extend()`.
+ *
+ * If `reset` is false, the costs calculated so far are kept and LPA* only needs to repair them, which is the case if
+ * the destination is still the same. Otherwise the graph is reset and flooded again for the current destination.
+ *
+ * If the graph already covers the whole selection, e.g. for a waypoint within it, nothing is read. The graph is reset
+ * and flooded again right away, regardless of `reset`.
+ *
+ * @param this The route
+ * @param reset Whether to reset the graph and discard the route path
+ * @param async Whether to extend the graph asynchronously
+ *
+ * @return True if the graph is being extended or has been flooded again, false if it needs to be built from scratch
+ * because it cannot be extended (e.g. it is still being built, was built from contraction hierarchy data or has
+ * already been extended `ROUTE_GRAPH_EXTEND_MAX` times)
+ */
+static int route_graph_extend_route(struct route *this, int reset, int async) {
+    struct attr route_status;
+    struct map_selection *sel, *ext;
+
+    if (!this->graph || this->graph->busy || !this->graph->extent || this->graph->extended >= ROUTE_GRAPH_EXTEND_MAX
+            || !this->pos || !this->destinations)
+        return 0;
+    sel=route_get_selection(this);
+    ext=route_selection_subtract(sel, this->graph->extent);
+    route_free_selection(sel);
+    if (reset || !ext) {
+        route_path_destroy(this->path2,1);
+        this->path2=NULL;
+        route_alternatives_clear(this);
+        route_graph_reset(this->graph);
+    }
+    if (! this->route_graph_flood_done_cb)
+        this->route_graph_flood_done_cb=callback_new_2(callback_cast(route_path_update_done), this, (long)1);
+    if (!ext) {
+        /* nothing new to read, the map data of the graph is reused as it is */
+        route_graph_update_done(this, this->route_graph_flood_done_cb);
+        return 1;
+    }
+    callback_destroy(this->route_graph_done_cb);
+    this->route_graph_done_cb=callback_new_2(callback_cast(route_graph_update_done), this,
+                               this->route_graph_flood_done_cb);
+    route_status.type=attr_route_status;
+    route_status.u.num=route_status_building_graph;
+    route_set_attr(this, &route_status);
+    route_graph_extend(this->graph, this->ms, ext, this->route_graph_done_cb, async);
+    if (! async) {
+        while (this->graph->busy)
+            route_graph_build_idle(this->graph, this->vehicleprofile);
+    }
+    return 1;
+}
+
+/**
+ * @brief Calculates landmark tables for the mapset and vehicle profile of the route
+ *
+ * This builds a route graph covering the whole mapset and saves the landmark tables calculated from it next to the
+ * first map file of the mapset, see route_landmark.c. It may take a long time and a lot of memory for large maps, and
+ * is meant to be run once after installing a new map.
+ *
+ * The tables are used by routes with the `heuristic` attribute set, starting with the next route graph they build.
+ *
+ * @param this_ The route
+ * @param count The number of landmarks
+ *
+ * @return True on success, false on failure
+ */
+int route_build_landmarks(struct route *this_, int count) {
+    struct coord lu, rl;
+    struct route_graph *graph;
+    int ret;
+
+    if (!this_->ms || !this_->vehicleprofile)
+        return 0;
+    lu.x = -0x1400000;
+    lu.y = 0x1400000;
+    rl.x = 0x1400000;
+    rl.y = -0x1400000;
+    graph = route_graph_build_selection(this_->ms, route_rect_add(NULL, 18, &lu, &rl, 0, 0), NULL, 0, 0, 0,
+                                        this_->vehicleprofile);
+    while (graph->busy)
+        route_graph_build_idle(graph, this_->vehicleprofile);
+    ret = route_landmarks_save(graph, this_->ms, this_->vehicleprofile, count);
+    route_graph_destroy(graph);
+    return ret;
+}
+
+/** Maximum number of threads calculating a travel time matrix */
+#define ROUTE_MATRIX_THREADS 8
+
+/**
+ * @brief A point visited by the backward search for one target of a travel time matrix
+ *
+ * Each thread has its own array of these, indexed by point ID, so that the route graph itself is only read.
+ */
+struct route_matrix_node {
+    int heap_idx;                       /**< Index slot for the heap */
+    int value;                          /**< Cost to reach the target, `INT_MAX` if not reached yet */
+    int len;                            /**< Length of the cheapest way to the target, in meters */
+    struct route_graph_segment *seg;    /**< The segment to follow towards the target */
+};
+
+/**
+ * @brief Shared state of the threads calculating a travel time matrix
+ */
+struct route_matrix_job {
+    struct route_graph *graph;          /**< The frozen route graph covering all sources and targets */
+    struct vehicleprofile *profile;     /**< The vehicle profile */
+    struct route_info **sources;        /**< The sources, NULL for those which are not near any street */
+    int source_count;                   /**< Number of elements in `sources` */
+    struct route_info **targets;        /**< The targets, NULL for those which are not near any street */
+    int target_count;                   /**< Number of elements in `targets` */
+    char *needed;                       /**< For each point ID, whether the point is an end point of a source street */
+    int needed_count;                   /**< Number of points flagged in `needed` */
+    int *times;                         /**< Result, see `route_get_matrix()` */
+    int *distances;                     /**< Result, see `route_get_matrix()` */
+    struct thread_lock *lock;           /**< Protects `next` */
+    int next;                           /**< The next target to process */
+};
+
+/**
+ * @brief Seeds the backward search with an end point of the target street
+ *
+ * @param job The job
+ * @param nodes The nodes of the search
+ * @param heap The heap of the search
+ * @param s A segment of the target street
+ * @param p `s->start` or `s->end`
+ * @param val The cost from `p` to the target
+ * @param len The length from `p` to the target
+ */
+static void route_matrix_seed(struct route_matrix_job *job, struct route_matrix_node *nodes, struct dheap *heap,
+                              struct route_graph_segment *s, struct route_graph_point *p, int val, int len) {
+    int id = route_graph_point_id(job->graph, p);
+
+    if (id < 0 || val >= nodes[id].value)
+        return;
+    nodes[id].value = val;
+    nodes[id].len = len;
+    nodes[id].seg = s;
+    dheap_update(heap, &nodes[id], val);
+}
+
+/**
+ * @brief Calculates the cost and length from a source to the target of the last search
+ *
+ * This chooses the cheaper direction on the source street in the same way as `route_path_new()`.
+ *
+ * @param job The job
+ * @param nodes The nodes of the search
+ * @param pos The source
+ * @param len Receives the length in meters, including the distance between the source and its street
+ *
+ * @return The cost, `INT_MAX` if the target cannot be reached from the source
+ */
+static int route_matrix_source_value(struct route_matrix_job *job, struct route_matrix_node *nodes,
+                                     struct route_info *pos, int *len) {
+    struct route_graph_segment *s = NULL;
+    struct route_matrix_node *n;
+    int val, start, end, ret = INT_MAX;
+
+    while ((s = route_graph_get_segment(job->graph, pos->street, s))) {
+        start = route_graph_point_id(job->graph, s->start);
+        end = route_graph_point_id(job->graph, s->end);
+        if (start < 0 || end < 0)
+            continue;
+        n = &nodes[end];
+        val = route_value_seg(job->profile, NULL, s, 2);
+        if (val != INT_MAX && n->value != INT_MAX && n->value + val*(100-pos->percent)/100 < ret) {
+            ret = n->value + val*(100-pos->percent)/100;
+            *len = n->len + s->data.len*(100-pos->percent)/100;
+        }
+        n = &nodes[start];
+        val = route_value_seg(job->profile, NULL, s, -2);
+        if (val != INT_MAX && n->value != INT_MAX && n->value + val*pos->percent/100 < ret) {
+            ret = n->value + val*pos->percent/100;
+            *len = n->len + s->data.len*pos->percent/100;
+        }
+    }
+    if (ret != INT_MAX)
+        *len += pos->lenextra;
+    return ret;
+}
+
+/**
+ * @brief Runs the backward search for one target of a travel time matrix and stores its column of the result
+ *
+ * This is a Dijkstra search from the target over the adjacency array of the frozen graph, using the same costs as
+ * `route_graph_compute_shortest_path()`, including the through traffic and turn around penalties, which depend on the
+ * next segment towards the target. It stops as soon as all end points of the source streets have been settled.
+ *
+ * @param job The job
+ * @param nodes The nodes of the search, one per point of the graph
+ * @param heap The heap of the search
+ * @param t The index of the target
+ */
+static void route_matrix_target(struct route_matrix_job *job, struct route_matrix_node *nodes, struct dheap *heap,
+                                int t) {
+    struct route_graph *graph = job->graph;
+    struct route_info *dst = job->targets[t];
+    struct route_graph_segment *s = NULL;
+    struct route_graph_edge *e, *end;
+    struct route_matrix_node *n, *other;
+    int i, id, val, len = 0, settled = 0;
+
+    if (dst) {
+        for (i = 0 ; i < graph->point_count ; i++) {
+            nodes[i].value = INT_MAX;
+            nodes[i].seg = NULL;
+        }
+        dheap_clear(heap);
+        while ((s = route_graph_get_segment(graph, dst->street, s))) {
+            val = route_value_seg(job->profile, NULL, s, -1);
+            if (val != INT_MAX)
+                route_matrix_seed(job, nodes, heap, s, s->end, val*(100-dst->percent)/100,
+                                  s->data.len*(100-dst->percent)/100);
+            val = route_value_seg(job->profile, NULL, s, 1);
+            if (val != INT_MAX)
+                route_matrix_seed(job, nodes, heap, s, s->start, val*dst->percent/100, s->data.len*dst->percent/100);
+        }
+        while (settled < job->needed_count && (n = dheap_extractmin(heap))) {
+            id = n - nodes;
+            if (job->needed[id])
+                settled++;
+            end = graph->edges + graph->edge_offset[id + 1];
+            for (e = graph->edges + graph->edge_offset[id]; e < end; e++) {
+                /* travel from the other point to this one */
+                val = route_graph_edge_value(graph, job->profile, e, -1, n->seg);
+                if (val != INT_MAX && n->seg && item_is_equal(e->seg->data.item, n->seg->data.item)) {
+                    if (job->profile->turn_around_penalty2)
+                        val += job->profile->turn_around_penalty2;
+                    else
+                        val = INT_MAX;
+                }
+                if (val == INT_MAX)
+                    continue;
+                val = route_value_add(val, n->value);
+                other = &nodes[e->other];
+                if (val < other->value && (other->heap_idx || other->value == INT_MAX)) {
+                    other->value = val;
+                    other->len = n->len + e->seg->data.len;
+                    other->seg = e->seg;
+                    dheap_update(heap, other, val);
+                }
+            }
+        }
+    }
+    for (i = 0 ; i < job->source_count ; i++) {
+        val = INT_MAX;
+        if (dst && job->sources[i])
+            val = route_matrix_source_value(job, nodes, job->sources[i], &len);
+        if (job->times)
+            job->times[i * job->target_count + t] = val == INT_MAX ? -1 : val;
+        if (job->distances)
+            job->distances[i * job->target_count + t] = val == INT_MAX ? -1 : len + dst->lenextra;
+    }
+}
+
+/**
+ * @brief Processes targets of a travel time matrix until all have been taken
+ *
+ * This is run by each thread participating in the job.
+ *
+ * @param job The job
+ */
+static void route_matrix_worker(struct route_matrix_job *job) {
+    struct route_matrix_node *nodes = g_new0(struct route_matrix_node, job->graph->point_count);
+    struct dheap *heap = dheap_new(offsetof(struct route_matrix_node, heap_idx));
+    int t;
+
+    for (;;) {
+        thread_lock_acquire(job->lock);
+        t = job->next;
+        if (t < job->target_count)
+            job->next++;
+        thread_lock_release(job->lock);
+        if (t >= job->target_count)
+            break;
+        route_matrix_target(job, nodes, heap, t);
+    }
+    dheap_destroy(heap);
+    g_free(nodes);
+}
+
+/**
+ * @brief Calculates the travel times and distances between several sources and several targets
+ *
+ * This builds a single route graph covering all sources and targets, then runs one backward search per target over
+ * it, using up to `ROUTE_MATRIX_THREADS` threads (including the calling one). It does not touch the route graph,
+ * destinations or path of the route itself. The calculation is done synchronously and may take a while for many
+ * or distant points.
+ *
+ * Results are stored row by row, i.e. the value for source `i` and target `j` is at index
+ * `i * target_count + j`. Times are in tenths of seconds and include the same penalties as route calculation,
+ * distances are in meters. Both are -1 where the target cannot be reached from the source, or where either point is
+ * not near any street.
+ *
+ * @param this_ The route, which provides the mapset and vehicle profile
+ * @param sources The sources
+ * @param source_count The number of sources
+ * @param targets The targets
+ * @param target_count The number of targets
+ * @param times Receives `source_count * target_count` travel times, can be NULL
+ * @param distances Receives `source_count * target_count` distances, can be NULL
+ *
+ * @return True on success, false if the route has no mapset or vehicle profile, or no graph could be built
+ */
+int route_get_matrix(struct route *this_, struct pcoord *sources, int source_count, struct pcoord *targets,
+                     int target_count, int *times, int *distances) {
+    struct route_matrix_job job;
+    struct route_graph_segment *s;
+    struct thread **threads;
+    struct coord *c;
+    int i, id, count = 0, thread_count = MIN(target_count, ROUTE_MATRIX_THREADS), ret = 0;
+
+    if (!this_->ms || !this_->vehicleprofile || source_count <= 0 || target_count <= 0)
+        return 0;
+    memset(&job, 0, sizeof(job));
+    job.profile = this_->vehicleprofile;
+    job.source_count = source_count;
+    job.target_count = target_count;
+    job.sources = g_new0(struct route_info *, source_count);
+    job.targets = g_new0(struct route_info *, target_count);
+    job.times = times;
+    job.distances = distances;
+    c = g_new(struct coord, source_count + target_count);
+    for (i = 0 ; i < source_count ; i++) {
+        job.sources[i] = route_find_nearest_street(job.profile, this_->ms, &sources[i]);
+        if (job.sources[i])
+            c[count++] = job.sources[i]->c;
+    }
+    for (i = 0 ; i < target_count ; i++) {
+        job.targets[i] = route_find_nearest_street(job.profile, this_->ms, &targets[i]);
+        if (job.targets[i])
+            c[count++] = job.targets[i]->c;
+    }
+    if (count) {
+        job.graph = route_graph_build(this_->ms, c, count, NULL, 0, 0, 0, job.profile);
+        while (job.graph->busy)
+            route_graph_build_idle(job.graph, job.profile);
+        route_graph_compile_costs(job.graph, job.profile);
+    }
+    g_free(c);
+    if (job.graph && job.graph->points) {
+        job.needed = g_new0(char, job.graph->point_count);
+        for (i = 0 ; i < source_count ; i++) {
+            for (s = NULL ; job.sources[i] && (s = route_graph_get_segment(job.graph, job.sources[i]->street, s)) ;) {
+                id = route_graph_point_id(job.graph, s->start);
+                if (id >= 0 && !job.needed[id]) {
+                    job.needed[id] = 1;
+                    job.needed_count++;
+                }
+                id = route_graph_point_id(job.graph, s->end);
+                if (id >= 0 && !job.needed[id]) {
+                    job.needed[id] = 1;
+                    job.needed_count++;
+                }
+            }
+        }
+        job.lock = thread_lock_new();
+        threads = g_new0(struct thread *, thread_count);
+        for (i = 1 ; i < thread_count ; i++)
+            threads[i] = thread_new((void (*)(void *))route_matrix_worker, &job);
+        route_matrix_worker(&job);
+        for (i = 1 ; i < thread_count ; i++)
+            thread_join(threads[i]);
+        g_free(threads);
+        thread_lock_destroy(job.lock);
+        g_free(job.needed);
+        dbg(lvl_debug, "%dx%d matrix calculated on %d points with up to %d threads", source_count, target_count,
+            job.graph->point_count, thread_count);
+        ret = 1;
+    } else
+        dbg(lvl_error, "no route graph for matrix");
+    if (job.graph)
+        route_graph_destroy(job.graph);
+    for (i = 0 ; i < source_count ; i++)
+        if (job.sources[i])
+            route_info_free(job.sources[i]);
+    for (i = 0 ; i < target_count ; i++)
+        if (job.targets[i])
+            route_info_free(job.targets[i]);
+    g_free(job.sources);
+    g_free(job.targets);
+    return ret;
+}
+
+/** Size of the cells of the grid on which isochrones are traced, in map units (roughly meters) */
+#define ROUTE_ISOCHRONE_CELL 250
+
+/** Maximum number of cells of that grid along either axis, cells are enlarged for larger areas */
+#define ROUTE_ISOCHRONE_GRID_MAX 1000
+
+/**
+ * @brief A polygon of an isochrone
+ */
+struct route_isochrone_polygon {
+    int time;                           /**< Travel time of the band to which the polygon belongs, in tenths of
+                                         *   seconds */
+    int count;                          /**< Number of coordinates */
+    struct coord c[0];                  /**< The coordinates, counterclockwise */
+};
+
+/**
+ * @brief The grid on which an isochrone is traced
+ */
+struct route_isochrone_grid {
+    struct coord origin;                /**< Lower left corner of the grid */
+    int cell;                           /**< Size of a cell, in map units */
+    int width;                          /**< Number of cells along the x axis */
+    int height;                         /**< Number of cells along the y axis */
+    int *times;                         /**< Travel time to each cell, row by row from the bottom, `INT_MAX` if the
+                                         *   cell cannot be reached */
+    int *labels;                        /**< Number of the area of each cell, 0 if none, used while tracing */
+};
+
+static void route_isochrone_clear(struct route *this) {
+    GList *l;
+    for (l = this->isochrone ; l ; l = g_list_next(l))
+        g_free(l->data);
+    g_list_free(this->isochrone);
+    this->isochrone = NULL;
+}
+
+static int route_isochrone_band_cmp(const void *a, const void *b) {
+    const int *ia = a, *ib = b;
+    return *ia > *ib ? -1 : *ia < *ib;
+}
+
+static void route_isochrone_grid_mark(struct route_isochrone_grid *grid, struct coord *c, int time) {
+    int x = (c->x - grid->origin.x) / grid->cell, y = (c->y - grid->origin.y) / grid->cell;
+    int *t;
+
+    if (x < 0 || y < 0 || x >= grid->width || y >= grid->height)
+        return;
+    t = &grid->times[y * grid->width + x];
+    if (time < *t)
+        *t = time;
+}
+
+/**
+ * @brief Marks the cells along a segment which can be reached within the travel time limit
+ *
+ * @param grid The grid
+ * @param a The coordinate at which the segment is entered
+ * @param b The coordinate at which the segment is left
+ * @param time The travel time to `a`
+ * @param cost The cost of driving from `a` to `b`
+ * @param limit The travel time limit
+ */
+static void route_isochrone_grid_segment(struct route_isochrone_grid *grid, struct coord *a, struct coord *b,
+        int time, int cost, int limit) {
+    struct coord c;
+    int i, t, steps = MAX(abs(b->x - a->x), abs(b->y - a->y)) * 2 / grid->cell + 1;
+
+    for (i = 0 ; i <= steps ; i++) {
+        t = time + (int)((long long)cost * i / steps);
+        if (t > limit)
+            break;
+        c.x = a->x + (int)((long long)(b->x - a->x) * i / steps);
+        c.y = a->y + (int)((long long)(b->y - a->y) * i / steps);
+        route_isochrone_grid_mark(grid, &c, t);
+    }
+}
+
+/**
+ * @brief Extends the reachable cells of the grid by one cell in each direction
+ *
+ * Streets are only marked in the cells they pass through. This closes the gaps between neighboring streets, so
+ * that the polygons cover the area served by the streets rather than following each one.
+ *
+ * @param grid The grid
+ */
+static void route_isochrone_grid_dilate(struct route_isochrone_grid *grid) {
+    int *times = g_new(int, grid->width * grid->height);
+    int x, y, dx, dy, t;
+
+    for (y = 0 ; y < grid->height ; y++) {
+        for (x = 0 ; x < grid->width ; x++) {
+            t = INT_MAX;
+            for (dy = MAX(y - 1, 0) ; dy <= MIN(y + 1, grid->height - 1) ; dy++)
+                for (dx = MAX(x - 1, 0) ; dx <= MIN(x + 1, grid->width - 1) ; dx++)
+                    t = MIN(t, grid->times[dy * grid->width + dx]);
+            times[y * grid->width + x] = t;
+        }
+    }
+    g_free(grid->times);
+    grid->times = times;
+}
+
+/**
+ * @brief Labels all cells of an area
+ *
+ * An area consists of the cells which can be reached within the travel time of a band and which are connected
+ * through their edges (not just their corners).
+ *
+ * @param grid The grid
+ * @param start Index of a cell of the area
+ * @param time The travel time of the band
+ * @param label The number of the area
+ * @param stack Room for the indexes of all cells of the grid
+ */
+static void route_isochrone_grid_label(struct route_isochrone_grid *grid, int start, int time, int label,
+                                       int *stack) {
+    int i, id, n[4], count = 0;
+
+    grid->labels[start] = label;
+    stack[count++] = start;
+    while (count) {
+        id = stack[--count];
+        n[0] = id % grid->width ? id - 1 : -1;
+        n[1] = (id + 1) % grid->width ? id + 1 : -1;
+        n[2] = id - grid->width;
+        n[3] = id + grid->width < grid->width * grid->height ? id + grid->width : -1;
+        for (i = 0 ; i < 4 ; i++) {
+            if (n[i] >= 0 && !grid->labels[n[i]] && grid->times[n[i]] <= time) {
+                grid->labels[n[i]] = label;
+                stack[count++] = n[i];
+            }
+        }
+    }
+}
+
+static int route_isochrone_grid_inside(struct route_isochrone_grid *grid, int x, int y, int label) {
+    return x >= 0 && y >= 0 && x < grid->width && y < grid->height && grid->labels[y * grid->width + x] == label;
+}
+
+/**
+ * @brief Traces the outline of an area
+ *
+ * The outline runs along the edges of the cells, keeping the area on the left, and starts at the lower left corner
+ * of `start`, which must be the leftmost cell in the lowest row of the area. Holes in the area are not traced, so the
+ * polygon covers them.
+ *
+ * @param grid The grid
+ * @param start Index of the first cell of the area
+ * @param label The number of the area
+ * @param time The travel time of the band, stored in the polygon
+ *
+ * @return The polygon, to be freed with `g_free()`
+ */
+static struct route_isochrone_polygon *route_isochrone_grid_trace(struct route_isochrone_grid *grid, int start,
+        int label, int time) {
+    /* directions counterclockwise, and the offsets of the cells ahead on the left and on the right */
+    static const int dx[4] = {1, 0, -1, 0}, dy[4] = {0, 1, 0, -1};
+    static const int lx[4] = {0, -1, -1, 0}, ly[4] = {0, 0, -1, -1};
+    static const int rx[4] = {0, 0, -1, -1}, ry[4] = {-1, 0, 0, -1};
+    struct route_isochrone_polygon *ret;
+    struct coord *c;
+    int x0 = start % grid->width, y0 = start / grid->width, x = x0, y = y0, dir = 0, next, count = 0, size = 16;
+
+    c = g_new(struct coord, size);
+    c[count].x = grid->origin.x + x0 * grid->cell;
+    c[count++].y = grid->origin.y + y0 * grid->cell;
+    do {
+        x += dx[dir];
+        y += dy[dir];
+        if (!route_isochrone_grid_inside(grid, x + lx[dir], y + ly[dir], label))
+            next = (dir + 1) % 4;
+        else if (route_isochrone_grid_inside(grid, x + rx[dir], y + ry[dir], label))
+            next = (dir + 3) % 4;
+        else
+            next = dir;
+        if (next != dir && (x != x0 || y != y0)) {
+            if (count == size) {
+                size *= 2;
+                c = g_renew(struct coord, c, size);
+            }
+            c[count].x = grid->origin.x + x * grid->cell;
+            c[count++].y = grid->origin.y + y * grid->cell;
+        }
+        dir = next;
+    } while (x != x0 || y != y0);
+    ret = g_malloc(sizeof(*ret) + count * sizeof(struct coord));
+    ret->time = time;
+    ret->count = count;
+    memcpy(ret->c, c, count * sizeof(struct coord));
+    g_free(c);
+    return ret;
+}
+
+/**
+ * @brief Traces the polygons of an isochrone over a frozen route graph
+ *
+ * This runs a single forward search over the graph up to the highest travel time, and marks the streets reached on a
+ * grid of `ROUTE_ISOCHRONE_CELL` map units. The grid is then traced once per band. Each connected area of a band
+ * becomes one polygon. Streets are taken as straight lines between the points of the route graph. Holes, i.e.
+ * areas which cannot be reached but are surrounded by areas which can, are filled.
+ *
+ * @param graph The route graph
+ * @param profile The vehicle profile
+ * @param pos The starting point
+ * @param bands The travel times of the bands, in tenths of seconds, from the highest to the lowest
+ * @param count The number of bands
+ *
+ * @return The polygons, from the largest band to the smallest
+ */
+static GList *route_isochrone_polygons(struct route_graph *graph, struct vehicleprofile *profile,
+                                       struct route_info *pos, int *bands, int count) {
+    struct route_forward_node *nodes;
+    struct route_isochrone_grid grid;
+    struct route_graph_edge *e, *end;
+    struct coord_rect r;
+    struct dheap *heap;
+    GList *ret = NULL;
+    int *stack, i, b, label, val, size, limit = bands[0];
+
+    heap = dheap_new(offsetof(struct route_forward_node, heap_idx));
+    nodes = route_forward_nodes_new(graph, profile, pos, heap);
+    route_forward_flood(graph, profile, nodes, heap, limit);
+    dheap_destroy(heap);
+
+    /* the grid covers all segments leaving a point which has been reached */
+    r.lu = r.rl = pos->lp;
+    for (i = 0 ; i < graph->point_count ; i++) {
+        if (nodes[i].value == INT_MAX)
+            continue;
+        end = graph->edges + graph->edge_offset[i + 1];
+        for (e = graph->edges + graph->edge_offset[i] ; e < end ; e++)
+            coord_rect_extend(&r, &graph->points[e->other].c);
+    }
+    size = MAX(r.rl.x - r.lu.x, r.lu.y - r.rl.y);
+    grid.cell = ROUTE_ISOCHRONE_CELL;
+    if (size / grid.cell > ROUTE_ISOCHRONE_GRID_MAX - 5)
+        grid.cell = size / (ROUTE_ISOCHRONE_GRID_MAX - 5) + 1;
+    /* leave room for the dilation and one empty cell on each side */
+    grid.origin.x = r.lu.x - 2 * grid.cell;
+    grid.origin.y = r.rl.y - 2 * grid.cell;
+    grid.width = (r.rl.x - r.lu.x) / grid.cell + 5;
+    grid.height = (r.lu.y - r.rl.y) / grid.cell + 5;
+    grid.times = g_new(int, grid.width * grid.height);
+    for (i = 0 ; i < grid.width * grid.height ; i++)
+        grid.times[i] = INT_MAX;
+    route_isochrone_grid_mark(&grid, &pos->lp, 0);
+    for (i = 0 ; i < graph->point_count ; i++) {
+        if (nodes[i].value == INT_MAX)
+            continue;
+        if (nodes[i].first)
+            route_isochrone_grid_segment(&grid, &pos->lp, &graph->points[i].c, 0, nodes[i].value, limit);
+        end = graph->edges + graph->edge_offset[i + 1];
+        for (e = graph->edges + graph->edge_offset[i] ; e < end ; e++) {
+            if (e->seg->data.item.type < route_item_first || e->seg->data.item.type > route_item_last)
+                continue;
+            val = route_graph_edge_value(graph, profile, e, 1, NULL);
+            if (val != INT_MAX)
+                route_isochrone_grid_segment(&grid, &graph->points[i].c, &graph->points[e->other].c, nodes[i].value,
+                                             val, limit);
         }
     }
+    g_free(nodes);
+    route_isochrone_grid_dilate(&grid);
+
+    grid.labels = g_new(int, grid.width * grid.height);
+    stack = g_new(int, grid.width * grid.height);
+    for (b = 0 ; b < count ; b++) {
+        memset(grid.labels, 0, grid.width * grid.height * sizeof(int));
+        label = 0;
+        for (i = 0 ; i < grid.width * grid.height ; i++) {
+            if (grid.labels[i] || grid.times[i] > bands[b])
+                continue;
+            route_isochrone_grid_label(&grid, i, bands[b], ++label, stack);
+            ret = g_list_prepend(ret, route_isochrone_grid_trace(&grid, i, label, bands[b]));
+        }
+    }
+    dbg(lvl_debug, "%d isochrone polygons on a %dx%d grid of %d", g_list_length(ret), grid.width, grid.height,
+        grid.cell);
+    g_free(stack);
+    g_free(grid.labels);
+    g_free(grid.times);
+    return g_list_reverse(ret);
 }
 
 /**
- * @brief Releases all resources needed to build the route graph.
+ * @brief Calculates an isochrone, i.e. the areas which can be reached within given travel times
  *
- * If `cancel` is false, this function will start processing restrictions and ultimately call the route
- * graph's `done_cb` callback.
+ * This builds a route graph around the starting point, large enough to hold everything which can be reached at the
+ * highest speed of the vehicle profile, and traces the isochrone over it with `route_isochrone_polygons()`. All bands
+ * come from a single search over the graph.
  *
- * The traffic module will always call this method with `cancel` set to true, as it does not process
- * restrictions and has no callback. Inside the routing module, `cancel` will be true if, and only if,
- * navigation has been aborted.
+ * The polygons are available from the map returned by `route_get_isochrone_map()`, from the largest band to the
+ * smallest, and through `route_get_isochrone_polygon()`. They replace those of any earlier call. The route graph,
+ * destinations and path of the route itself are not touched. The calculation is done synchronously.
  *
- * @param rg Points to the route graph
- * @param cancel True if the process was aborted before completing, false if it completed normally
+ * @param this_ The route, which provides the mapset and vehicle profile
+ * @param center The starting point, or NULL to start from the position of the route
+ * @param times The travel times of the bands, in seconds
+ * @param count The number of bands, 0 to just remove the isochrone
+ *
+ * @return The number of polygons, or -1 if the starting point is not near any street or no graph could be built
  */
-void route_graph_build_done(struct route_graph *rg, int cancel) {
-    dbg(lvl_debug,"cancel=%d",cancel);
-    if (rg->idle_ev)
-        event_remove_idle(rg->idle_ev);
-    if (rg->idle_cb)
-        callback_destroy(rg->idle_cb);
-    map_rect_destroy(rg->mr);
-    mapset_close(rg->h);
-    route_free_selection(rg->sel);
-    rg->idle_ev=NULL;
-    rg->idle_cb=NULL;
-    rg->mr=NULL;
-    rg->h=NULL;
-    rg->sel=NULL;
-    if (! cancel) {
-        route_graph_process_restrictions(rg);
-        if (rg->done_cb)
-            callback_call_0(rg->done_cb);
-    }
-    rg->busy=0;
+int route_set_isochrone(struct route *this_, struct pcoord *center, int *times, int count) {
+    struct vehicleprofile *profile = this_->vehicleprofile;
+    struct route_info *pos, *found = NULL;
+    struct route_graph *graph;
+    int *bands, i, radius, ret = -1;
+
+    route_isochrone_clear(this_);
+    if (count <= 0)
+        return 0;
+    if (!this_->ms || !profile)
+        return -1;
+    if (center)
+        pos = found = route_find_nearest_street(profile, this_->ms, center);
+    else
+        pos = this_->pos && this_->pos->street ? this_->pos : NULL;
+    if (!pos)
+        return -1;
+    bands = g_new(int, count);
+    for (i = 0 ; i < count ; i++)
+        bands[i] = MAX(times[i], 0) * 10;
+    qsort(bands, count, sizeof(int), route_isochrone_band_cmp);
+    radius = (double)bands[0] * vehicleprofile_get_max_route_weight(profile) / 36 * transform_scale(pos->c.y);
+    graph = route_graph_build_selection(this_->ms, route_rect_add(NULL, 18, &pos->c, &pos->c, 0, radius), NULL, 0, 0,
+                                        0, profile);
+    while (graph->busy)
+        route_graph_build_idle(graph, profile);
+    if (graph->points) {
+        route_graph_compile_costs(graph, profile);
+        this_->isochrone = route_isochrone_polygons(graph, profile, pos, bands, count);
+        ret = g_list_length(this_->isochrone);
+    } else
+        dbg(lvl_error, "no route graph for isochrone");
+    route_graph_destroy(graph);
+    route_info_free(found);
+    g_free(bands);
+    return ret;
 }
 
-static void route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile) {
-    int count=1000;
-    struct item *item;
+/**
+ * @brief Returns a polygon of the isochrone, see `route_set_isochrone()`
+ *
+ * @param this_ The route
+ * @param n The number of the polygon, starting at 0
+ * @param time Receives the travel time of the band to which the polygon belongs, in tenths of seconds, can be NULL
+ * @param count Receives the number of coordinates
+ *
+ * @return The coordinates, which remain valid until the isochrone changes, or NULL if `n` is out of range
+ */
+struct coord *route_get_isochrone_polygon(struct route *this_, int n, int *time, int *count) {
+    struct route_isochrone_polygon *polygon = g_list_nth_data(this_->isochrone, n);
 
-    while (count > 0) {
-        for (;;) {
-            item=map_rect_get_item(rg->mr);
-            if (item)
-                break;
-            if (!route_graph_build_next_map(rg)) {
-                route_graph_build_done(rg, 0);
-                return;
-            }
-        }
-        if (item->type == type_traffic_distortion)
-            route_graph_add_traffic_distortion(rg, profile, item, 0);
-        else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
-            route_graph_add_turn_restriction(rg, item);
-        else
-            route_graph_add_street(rg, item, profile);
-        count--;
-    }
+    if (!polygon)
+        return NULL;
+    if (time)
+        *time = polygon->time;
+    *count = polygon->count;
+    return polygon->c;
 }
 
+/** Maximum distance of a street from a point matched to it, in map units, as in `route_find_nearest_street()` */
+#define ROUTE_MATCH_MAX_DIST 1000
+
+/** Margin added around the points when reading streets for map matching, in map units, so that the index can be
+ *  reused for nearby points */
+#define ROUTE_MATCH_MARGIN 5000
+
 /**
- * @brief Builds a new route graph from a mapset
+ * @brief Matches points to streets
  *
- * This function builds a new route graph from a map. Please note that this function does not
- * add any routing information to the route graph - this has to be done via the route_graph_flood()
- * function.
+ * The streets around the points are read once into an index, see route_match.c, which is kept and reused as long as
+ * later points lie within the area it covers. In particular, `tracking_update()` takes its candidate streets from
+ * the index when it covers the current position, see `route_get_match_streets()`.
  *
- * The function does not create a graph covering the whole map, but only covering the rectangle
- * between c1 and c2.
+ * @param this_ The route, which provides the mapset and vehicle profile
+ * @param pc The points
+ * @param count The number of points
+ * @param trace False to match each point to its nearest street, true if the points form a trace, e.g. a recorded
+ *        track, which is to be matched to the streets it most likely followed
+ * @param out Receives the matched points, in the projection of the corresponding points of `pc`. Points which
+ *        could not be matched are copied unchanged.
  *
- * @param ms The mapset to build the route graph from
- * @param c The coordinates of the destination or next waypoint
- * @param c1 Corner 1 of the rectangle to use from the map
- * @param c2 Corner 2 of the rectangle to use from the map
- * @param done_cb The callback which will be called when graph is complete
- * @return The new route graph.
+ * @return The number of points which could be matched, -1 if the route has no mapset
  */
-// FIXME documentation does not match argument list
-static struct route_graph *route_graph_build(struct mapset *ms, struct coord *c, int count, struct callback *done_cb,
-        int async,
-        struct vehicleprofile *profile) {
-    struct route_graph *ret=g_new0(struct route_graph, 1);
-
-    dbg(lvl_debug,"enter");
+int route_match(struct route *this_, struct pcoord *pc, int count, int trace, struct pcoord *out) {
+    struct route_match_result *results;
+    struct coord_rect r;
+    struct coord_geo g;
+    struct coord *c;
+    int i, ret;
 
-    ret->sel=route_calc_selection(c, count, profile);
-    ret->h=mapset_open(ms);
-    ret->done_cb=done_cb;
-    ret->busy=1;
-    ret->heap = fh_makekeyheap();
-    if (route_graph_build_next_map(ret)) {
-        if (async) {
-            ret->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), ret, profile);
-            ret->idle_ev=event_add_idle(50, ret->idle_cb);
+    if (!this_->ms)
+        return -1;
+    if (count <= 0)
+        return 0;
+    c = g_new(struct coord, count);
+    for (i = 0 ; i < count ; i++) {
+        c[i].x = pc[i].x;
+        c[i].y = pc[i].y;
+        if (pc[i].pro != projection_mg) {
+            transform_to_geo(pc[i].pro, &c[i], &g);
+            transform_from_geo(projection_mg, &g, &c[i]);
         }
-    } else
-        route_graph_build_done(ret, 0);
-
+    }
+    r.lu = r.rl = c[0];
+    for (i = 1 ; i < count ; i++)
+        coord_rect_extend(&r, &c[i]);
+    r.lu.x -= ROUTE_MATCH_MAX_DIST;
+    r.lu.y += ROUTE_MATCH_MAX_DIST;
+    r.rl.x += ROUTE_MATCH_MAX_DIST;
+    r.rl.y -= ROUTE_MATCH_MAX_DIST;
+    if (!this_->match_index || !route_match_index_covers(this_->match_index, &r)) {
+        route_match_index_destroy(this_->match_index);
+        r.lu.x -= ROUTE_MATCH_MARGIN;
+        r.lu.y += ROUTE_MATCH_MARGIN;
+        r.rl.x += ROUTE_MATCH_MARGIN;
+        r.rl.y -= ROUTE_MATCH_MARGIN;
+        this_->match_index = route_match_index_new(this_->ms, &r);
+    }
+    results = g_new(struct route_match_result, count);
+    if (trace)
+        ret = route_match_trace(this_->match_index, this_->vehicleprofile, c, count, ROUTE_MATCH_MAX_DIST, results);
+    else
+        ret = route_match_snap(this_->match_index, this_->vehicleprofile, c, count, ROUTE_MATCH_MAX_DIST, results);
+    for (i = 0 ; i < count ; i++) {
+        out[i] = pc[i];
+        if (!results[i].street)
+            continue;
+        c[i] = results[i].lp;
+        if (pc[i].pro != projection_mg) {
+            transform_to_geo(projection_mg, &c[i], &g);
+            transform_from_geo(pc[i].pro, &g, &c[i]);
+        }
+        out[i].x = c[i].x;
+        out[i].y = c[i].y;
+    }
+    g_free(results);
+    g_free(c);
     return ret;
 }
 
-static void route_graph_update_done(struct route *this, struct callback *cb) {
-    route_graph_init(this->graph, this->current_dst, this->vehicleprofile);
-    route_graph_compute_shortest_path(this->graph, this->vehicleprofile, cb);
-}
-
 /**
- * @brief Updates the route graph
+ * @brief Returns the streets near a point from the map matching index of a route
  *
- * This updates the route graph after settings in the route have changed. It also
- * adds routing information afterwards by calling route_graph_flood().
+ * @param this_ The route
+ * @param c The point, in `projection_mg`
+ * @param max_dist The distance around `c` along either axis in which to look for streets, in map units
+ * @param count Receives the number of streets
  *
- * @param this The route to update the graph for
- * @param cb The callback function to call when the route graph update is complete (used only in asynchronous mode)
- * @param async Set to nonzero in order to update the route graph asynchronously
+ * @return The streets, which remain valid until the next call of `route_match()` or until the route is destroyed.
+ * The array itself must be freed with `g_free()`. NULL if no index has been built or it does not cover the area.
  */
-static void route_graph_update(struct route *this, struct callback *cb, int async) {
-    struct attr route_status;
-    struct coord *c=g_alloca(sizeof(struct coord)*(1+g_list_length(this->destinations)));
-    int i=0;
-    GList *tmp;
+struct street_data **route_get_match_streets(struct route *this_, struct coord *c, int max_dist, int *count) {
+    struct coord_rect r;
 
-    route_status.type=attr_route_status;
-    route_graph_destroy(this->graph);
-    this->graph=NULL;
-    callback_destroy(this->route_graph_done_cb);
-    this->route_graph_done_cb=callback_new_2(callback_cast(route_graph_update_done), this, cb);
-    route_status.u.num=route_status_building_graph;
-    route_set_attr(this, &route_status);
-    c[i++]=this->pos->c;
-    tmp=this->destinations;
-    while (tmp) {
-        struct route_info *dst=tmp->data;
-        c[i++]=dst->c;
-        tmp=g_list_next(tmp);
-    }
-    this->graph=route_graph_build(this->ms, c, i, this->route_graph_done_cb, async, this->vehicleprofile);
-    if (! async) {
-        while (this->graph->busy)
-            route_graph_build_idle(this->graph, this->vehicleprofile);
-    }
+    if (!this_->match_index)
+        return NULL;
+    r.lu.x = c->x - max_dist;
+    r.lu.y = c->y + max_dist;
+    r.rl.x = c->x + max_dist;
+    r.rl.y = c->y - max_dist;
+    if (!route_match_index_covers(this_->match_index, &r))
+        return NULL;
+    return route_match_index_get_streets(this_->match_index, c, max_dist, count);
 }
 
 /**
@@ -3431,6 +6511,7 @@ struct map_rect_priv {
     int pos;
     struct map_priv *mpriv;     /**< The map to which this map rect refers */
     struct item item;           /**< The current item, i.e. the last item returned by the `map_rect_get_item` method */
+    struct item street_item;    /**< The street which the current item represents, see `attr_street_item` */
     unsigned int last_coord;
     struct route_path *path;
     struct route_path_segment *seg,*seg_next;
@@ -3442,6 +6523,7 @@ struct map_rect_priv {
     struct route_graph_point_iterator it;
     /* Pointer to current waypoint element of route->destinations */
     GList *dest;
+    GList *polygon;             /**< Current element of the isochrone of the route */
 };
 
 static void rm_coord_rewind(void *priv_data) {
@@ -3458,7 +6540,8 @@ static int rm_attr_get(void *priv_data, enum attr_type attr_type, struct attr *a
     struct map_rect_priv *mr = priv_data;
     struct route_path_segment *seg=mr->seg;
     struct route *route=mr->mpriv->route;
-    if (mr->item.type != type_street_route && mr->item.type != type_waypoint && mr->item.type != type_route_end)
+    if (mr->item.type != type_street_route && mr->item.type != type_waypoint && mr->item.type != type_route_end
+            && mr->item.type != type_street_route_alternative)
         return 0;
     attr->type=attr_type;
     switch (attr_type) {
@@ -3480,7 +6563,7 @@ static int rm_attr_get(void *priv_data, enum attr_type attr_type, struct attr *a
     case attr_street_item:
         mr->attr_next=attr_direction;
         if (seg && seg->data->item.map)
-            attr->u.item=&seg->data->item;
+            attr->u.item=route_segment_data_get_item(seg->data, &mr->street_item);
         else
             return 0;
         return 1;
@@ -3520,6 +6603,16 @@ static int rm_attr_get(void *priv_data, enum attr_type attr_type, struct attr *a
         else
             return 0;
         return 1;
+    case attr_destination_time:
+        if (!mr->mpriv->alternative || !mr->path)
+            return 0;
+        attr->u.num=mr->path->path_time;
+        return 1;
+    case attr_destination_length:
+        if (!mr->mpriv->alternative || !mr->path)
+            return 0;
+        attr->u.num=mr->path->path_len;
+        return 1;
     case attr_label:
         mr->attr_next=attr_none;
         if(mr->item.type==type_waypoint || mr->item.type == type_route_end) {
@@ -3649,7 +6742,7 @@ static int rp_attr_get(void *priv_data, enum attr_type attr_type, struct attr *a
         if (mr->item.type != type_rg_segment)
             return 0;
         if (seg && seg->data.item.map)
-            attr->u.item=&seg->data.item;
+            attr->u.item=route_segment_data_get_item(&seg->data, &mr->street_item);
         else
             return 0;
         return 1;
@@ -3798,8 +6891,12 @@ static struct map_rect_priv *rm_rect_new(struct map_priv *priv, struct map_selec
     mr->item.priv_data = mr;
     mr->item.type = type_none;
     mr->item.meth = &methods_route_item;
-    if (priv->route->path2) {
+    if (priv->alternative)
+        mr->path=priv->alternative <= priv->route->alternative_count ?
+                 priv->route->alternative_paths[priv->alternative-1] : NULL;
+    else
         mr->path=priv->route->path2;
+    if (mr->path) {
         mr->seg_next=mr->path->path;
         mr->path->in_use++;
     } else
@@ -3825,7 +6922,7 @@ static struct map_rect_priv *rp_rect_new(struct map_priv *priv, struct map_selec
     struct map_rect_priv * mr;
 
     dbg(lvl_debug,"enter");
-    if (! priv->route->graph)
+    if (! priv->route->graph || priv->route->graph->thread)
         return NULL;
     mr=g_new0(struct map_rect_priv, 1);
     mr->mpriv = priv;
@@ -3878,17 +6975,7 @@ static struct item *rp_get_item(struct map_rect_priv *mr) {
                 p = NULL;
             }
         } else {
-            if (!p) {
-                mr->hash_bucket=0;
-                p = r->graph->hash[0];
-            } else
-                p=p->hash_next;
-            while (!p) {
-                mr->hash_bucket++;
-                if (mr->hash_bucket >= HASH_SIZE)
-                    break;
-                p = r->graph->hash[mr->hash_bucket];
-            }
+            p = route_graph_next_point(r->graph, p, &mr->hash_bucket);
         }
         if (p) {
             mr->point = p;
@@ -3932,10 +7019,32 @@ static struct item *rp_get_item_byid(struct map_rect_priv *mr, int id_hi, int id
 }
 
 
+/**
+ * @brief Returns the next item from the map of an alternative route
+ *
+ * Unlike the map of the route, this map only contains the segments, as items of `type_street_route_alternative`.
+ *
+ * @param mr The map rect
+ * @return The item, or NULL if there are no more segments
+ */
+static struct item *rm_get_item_alternative(struct map_rect_priv *mr) {
+    mr->seg=mr->seg_next;
+    if (!mr->seg)
+        return NULL;
+    mr->seg_next=mr->seg->next;
+    mr->item.type=type_street_route_alternative;
+    mr->last_coord=0;
+    item_id_from_ptr(&mr->item,mr->seg);
+    rm_attr_rewind(mr);
+    return &mr->item;
+}
+
 static struct item *rm_get_item(struct map_rect_priv *mr) {
     struct route *route=mr->mpriv->route;
     void *id=0;
 
+    if (mr->mpriv->alternative)
+        return rm_get_item_alternative(mr);
     switch (mr->item.type) {
     case type_none:
         if (route->pos && route->pos->street_direction && route->pos->street_direction != route->pos->dir)
@@ -4007,6 +7116,82 @@ static struct item *rm_get_item_byid(struct map_rect_priv *mr, int id_hi, int id
     return ret;
 }
 
+static void riso_attr_rewind(void *priv_data) {
+    struct map_rect_priv *mr = priv_data;
+    mr->attr_next = attr_time;
+}
+
+static int riso_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr) {
+    struct map_rect_priv *mr = priv_data;
+    struct route_isochrone_polygon *polygon = mr->polygon->data;
+
+    if (attr_type == attr_any) {
+        if (mr->attr_next != attr_time)
+            return 0;
+        mr->attr_next = attr_none;
+        attr_type = attr_time;
+    }
+    attr->type = attr_type;
+    switch (attr_type) {
+    case attr_time:
+        attr->u.num = polygon->time;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Returns the coordinates of an isochrone polygon, repeating the first one at the end to close it
+ */
+static int riso_coord_get(void *priv_data, struct coord *c, int count) {
+    struct map_rect_priv *mr = priv_data;
+    struct route_isochrone_polygon *polygon = mr->polygon->data;
+    int rc = 0;
+
+    while (rc < count && mr->last_coord <= polygon->count)
+        c[rc++] = polygon->c[mr->last_coord++ % polygon->count];
+    return rc;
+}
+
+static struct item_methods methods_isochrone_item = {
+    rm_coord_rewind,
+    riso_coord_get,
+    riso_attr_rewind,
+    riso_attr_get,
+};
+
+static struct map_rect_priv *riso_rect_new(struct map_priv *priv, struct map_selection *sel) {
+    struct map_rect_priv *mr;
+
+    mr = g_new0(struct map_rect_priv, 1);
+    mr->mpriv = priv;
+    mr->item.priv_data = mr;
+    mr->item.type = type_poly_isochrone;
+    mr->item.meth = &methods_isochrone_item;
+    return mr;
+}
+
+static struct item *riso_get_item(struct map_rect_priv *mr) {
+    mr->polygon = mr->item.id_lo ? g_list_next(mr->polygon) : mr->mpriv->route->isochrone;
+    if (!mr->polygon)
+        return NULL;
+    mr->item.id_lo++;
+    mr->last_coord = 0;
+    riso_attr_rewind(mr);
+    return &mr->item;
+}
+
+static struct item *riso_get_item_byid(struct map_rect_priv *mr, int id_hi, int id_lo) {
+    struct item *ret;
+
+    mr->item.id_lo = 0;
+    do {
+        ret = riso_get_item(mr);
+    } while (ret && ret->id_lo != id_lo);
+    return ret;
+}
+
 static struct map_methods route_meth = {
     projection_mg,
     "utf-8",
@@ -4033,34 +7218,54 @@ static struct map_methods route_graph_meth = {
     NULL,
 };
 
-static struct map_priv *route_map_new_helper(struct map_methods *meth, struct attr **attrs, int graph) {
+static struct map_methods route_isochrone_meth = {
+    projection_mg,
+    "utf-8",
+    rm_destroy,
+    riso_rect_new,
+    rm_rect_destroy,
+    riso_get_item,
+    riso_get_item_byid,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static struct map_priv *route_map_new_helper(struct map_methods *meth, struct attr **attrs,
+        struct map_methods *type_meth) {
     struct map_priv *ret;
-    struct attr *route_attr;
+    struct attr *route_attr,*alternative_attr;
 
     route_attr=attr_search(attrs, attr_route);
     if (! route_attr)
         return NULL;
     ret=g_new0(struct map_priv, 1);
-    if (graph)
-        *meth=route_graph_meth;
-    else
-        *meth=route_meth;
+    *meth=*type_meth;
     ret->route=route_attr->u.route;
+    alternative_attr=attr_search(attrs, attr_alternative);
+    if (type_meth == &route_meth && alternative_attr)
+        ret->alternative=alternative_attr->u.num;
 
     return ret;
 }
 
 static struct map_priv *route_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl) {
-    return route_map_new_helper(meth, attrs, 0);
+    return route_map_new_helper(meth, attrs, &route_meth);
 }
 
 static struct map_priv *route_graph_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl) {
-    return route_map_new_helper(meth, attrs, 1);
+    return route_map_new_helper(meth, attrs, &route_graph_meth);
+}
+
+static struct map_priv *route_isochrone_map_new(struct map_methods *meth, struct attr **attrs,
+        struct callback_list *cbl) {
+    return route_map_new_helper(meth, attrs, &route_isochrone_meth);
 }
 
-static struct map *route_get_map_helper(struct route *this_, struct map **map, char *type, char *description) {
-    struct attr *attrs[5];
-    struct attr a_type,navigation,data,a_description;
+static struct map *route_get_map_helper(struct route *this_, struct map **map, char *type, char *description,
+                                        int alternative) {
+    struct attr *attrs[6];
+    struct attr a_type,navigation,data,a_description,a_alternative;
     a_type.type=attr_type;
     a_type.u.str=type;
     navigation.type=attr_route;
@@ -4075,6 +7280,12 @@ static struct map *route_get_map_helper(struct route *this_, struct map **map, c
     attrs[2]=&data;
     attrs[3]=&a_description;
     attrs[4]=NULL;
+    if (alternative) {
+        a_alternative.type=attr_alternative;
+        a_alternative.u.num=alternative;
+        attrs[4]=&a_alternative;
+        attrs[5]=NULL;
+    }
 
     if (! *map) {
         *map=map_new(NULL, attrs);
@@ -4091,7 +7302,7 @@ static struct map *route_get_map_helper(struct route *this_, struct map **map, c
  * @param item The item to add, must be of {@code type_traffic_distortion}
  */
 void route_add_traffic_distortion(struct route *this_, struct item *item) {
-    if (route_has_graph(this_))
+    if (route_has_graph(this_) && !this_->graph->thread)
         route_graph_add_traffic_distortion(this_->graph, this_->vehicleprofile, item, 1);
 }
 
@@ -4104,7 +7315,7 @@ void route_add_traffic_distortion(struct route *this_, struct item *item) {
  * @param item The item to change, must be of {@code type_traffic_distortion}
  */
 void route_change_traffic_distortion(struct route *this_, struct item *item) {
-    if (route_has_graph(this_))
+    if (route_has_graph(this_) && !this_->graph->thread)
         route_graph_change_traffic_distortion(this_->graph, this_->vehicleprofile, item);
 }
 
@@ -4120,7 +7331,29 @@ void route_change_traffic_distortion(struct route *this_, struct item *item) {
  */
 struct map *
 route_get_map(struct route *this_) {
-    return route_get_map_helper(this_, &this_->map, "route","Route");
+    return route_get_map_helper(this_, &this_->map, "route","Route", 0);
+}
+
+
+/**
+ * @brief Returns a map containing an alternative route
+ *
+ * The map is empty unless the `alternatives` attribute of the route is at least `n` and that many alternative routes
+ * were found. No alternative routes are calculated while the `heuristic` attribute is set. The map holds the
+ * segments of the alternative route as items of `type_street_route_alternative`, which also have the
+ * `destination_time` and `destination_length` attributes of the whole alternative route.
+ *
+ * @important Do not map_destroy() this!
+ *
+ * @param this_ The route to get the map of
+ * @param n The number of the alternative route, starting at 1
+ * @return The map, or NULL if `n` is out of range
+ */
+struct map *
+route_get_alternative_map(struct route *this_, int n) {
+    if (n < 1 || n > ROUTE_ALTERNATIVES_MAX)
+        return NULL;
+    return route_get_map_helper(this_, &this_->alternative_maps[n-1], "route", "Alternative Route", n);
 }
 
 
@@ -4136,7 +7369,24 @@ route_get_map(struct route *this_) {
  */
 struct map *
 route_get_graph_map(struct route *this_) {
-    return route_get_map_helper(this_, &this_->graph_map, "route_graph","Route Graph");
+    return route_get_map_helper(this_, &this_->graph_map, "route_graph","Route Graph", 0);
+}
+
+
+/**
+ * @brief Returns a map containing the isochrone
+ *
+ * The map holds the polygons calculated by `route_set_isochrone()` as items of `type_poly_isochrone`, which have
+ * the travel time of their band (in tenths of seconds) as their `time` attribute.
+ *
+ * @important Do not map_destroy() this!
+ *
+ * @param this_ The route to get the map of
+ * @return The map
+ */
+struct map *
+route_get_isochrone_map(struct route *this_) {
+    return route_get_map_helper(this_, &this_->isochrone_map, "route_isochrone", "Isochrone", 0);
 }
 
 
@@ -4174,7 +7424,7 @@ int route_has_graph(struct route *this_) {
  * @param item The item to remove, must be of {@code type_traffic_distortion}
  */
 void route_remove_traffic_distortion(struct route *this_, struct item *item) {
-    if (route_has_graph(this_))
+    if (route_has_graph(this_) && !this_->graph->thread)
         route_graph_remove_traffic_distortion(this_->graph, this_->vehicleprofile, item);
 }
 
@@ -4194,6 +7444,34 @@ int route_set_attr(struct route *this_, struct attr *attr) {
     case attr_position:
         route_set_position_flags(this_, attr->u.pcoord, route_path_flag_async);
         return 1;
+    case attr_ch_routing:
+        attr_updated = (this_->ch_routing != !!attr->u.num);
+        this_->ch_routing = !!attr->u.num;
+        break;
+    case attr_graph_thread:
+        attr_updated = (this_->graph_thread != !!attr->u.num);
+        this_->graph_thread = !!attr->u.num;
+        break;
+    case attr_graph_cache:
+        attr_updated = (this_->graph_cache != !!attr->u.num);
+        this_->graph_cache = !!attr->u.num;
+        break;
+    case attr_heuristic:
+        attr_updated = (this_->heuristic != !!attr->u.num);
+        this_->heuristic = !!attr->u.num;
+        break;
+    case attr_alternatives:
+        attr_updated = (this_->alternatives != attr->u.num);
+        this_->alternatives = attr->u.num;
+        break;
+    case attr_time_dependent:
+        attr_updated = (this_->time_dependent != !!attr->u.num);
+        this_->time_dependent = !!attr->u.num;
+        break;
+    case attr_departure_time:
+        attr_updated = (this_->departure_time != attr->u.num);
+        this_->departure_time = attr->u.num;
+        break;
     case attr_position_test:
         return route_set_position_flags(this_, attr->u.pcoord, route_path_flag_no_rebuild);
     case attr_vehicle:
@@ -4249,7 +7527,13 @@ int route_get_attr(struct route *this_, enum attr_type type, struct attr *attr,
     int ret=1;
     switch (type) {
     case attr_map:
-        attr->u.map=route_get_map(this_);
+        /* with an iterator, the maps of the alternative routes follow the map of the route */
+        if (iter && iter->index)
+            attr->u.map=iter->index <= this_->alternative_count ? route_get_alternative_map(this_, iter->index) : NULL;
+        else
+            attr->u.map=route_get_map(this_);
+        if (iter)
+            iter->index++;
         ret=(attr->u.map != NULL);
         break;
     case attr_destination:
@@ -4287,6 +7571,27 @@ int route_get_attr(struct route *this_, enum attr_type type, struct attr *attr,
     case attr_route_status:
         attr->u.num=this_->route_status;
         break;
+    case attr_ch_routing:
+        attr->u.num=this_->ch_routing;
+        break;
+    case attr_graph_thread:
+        attr->u.num=this_->graph_thread;
+        break;
+    case attr_graph_cache:
+        attr->u.num=this_->graph_cache;
+        break;
+    case attr_heuristic:
+        attr->u.num=this_->heuristic;
+        break;
+    case attr_alternatives:
+        attr->u.num=this_->alternatives;
+        break;
+    case attr_time_dependent:
+        attr->u.num=this_->time_dependent;
+        break;
+    case attr_departure_time:
+        attr->u.num=this_->departure_time;
+        break;
     case attr_destination_time:
         if (this_->path2 && (this_->route_status == route_status_path_done_new
                              || this_->route_status == route_status_path_done_incremental)) {
@@ -4331,16 +7636,26 @@ void route_attr_iter_destroy(struct attr_iter *iter) {
 void route_init(void) {
     plugin_register_category_map("route", route_map_new);
     plugin_register_category_map("route_graph", route_graph_map_new);
+    plugin_register_category_map("route_isochrone", route_isochrone_map_new);
 }
 
 void route_destroy(struct route *this_) {
+    int i;
     this_->refcount++; /* avoid recursion */
     route_path_destroy(this_->path2,1);
+    route_alternatives_clear(this_);
+    for (i = 0 ; i < ROUTE_ALTERNATIVES_MAX ; i++)
+        map_destroy(this_->alternative_maps[i]);
+    route_isochrone_clear(this_);
+    map_destroy(this_->isochrone_map);
     route_graph_destroy(this_->graph);
     route_clear_destinations(this_);
     route_info_free(this_->pos);
     map_destroy(this_->map);
     map_destroy(this_->graph_map);
+    route_landmarks_destroy(this_->landmarks);
+    route_speed_profiles_destroy(this_->speed_profiles);
+    route_match_index_destroy(this_->match_index);
     g_free(this_);
 }
 
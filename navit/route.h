@@ -118,6 +118,8 @@ void route_info_free(struct route_info *inf);
 struct street_data *route_info_street(struct route_info *rinf);
 struct map *route_get_map(struct route *this_);
 struct map *route_get_graph_map(struct route *this_);
+struct map *route_get_alternative_map(struct route *this_, int n);
+struct map *route_get_isochrone_map(struct route *this_);
 enum route_path_flags route_get_flags(struct route *this_);
 int route_has_graph(struct route *this_);
 void route_set_projection(struct route *this_, enum projection pro);
@@ -130,6 +132,13 @@ void route_attr_iter_destroy(struct attr_iter *iter);
 int route_get_attr(struct route *this_, enum attr_type type, struct attr *attr, struct attr_iter *iter);
 void route_init(void);
 void route_destroy(struct route *this_);
+int route_build_landmarks(struct route *this_, int count);
+int route_get_matrix(struct route *this_, struct pcoord *sources, int source_count, struct pcoord *targets,
+                     int target_count, int *times, int *distances);
+int route_set_isochrone(struct route *this_, struct pcoord *center, int *times, int count);
+struct coord *route_get_isochrone_polygon(struct route *this_, int n, int *time, int *count);
+int route_match(struct route *this_, struct pcoord *pc, int count, int trace, struct pcoord *out);
+struct street_data **route_get_match_streets(struct route *this_, struct coord *c, int max_dist, int *count);
 /* end of prototypes */
 #ifdef __cplusplus
 }
@@ -0,0 +1,269 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Runs route calculations without a GUI and reports their cost
+ *
+ * The mapset and one vehicle profile are taken from a navit.xml. They are loaded through a small generated config
+ * which includes just these (and the plugins) from the given file, so no GUI or graphics are started. For each
+ * query, the position is set to the origin and the destination is set synchronously with `route_set_destinations()`.
+ * One line of CSV is written per query, with the number of points of the route graph, the processor time taken to
+ * build it, to flood it and in total (in milliseconds), the number of points expanded, the length (in meters) and
+ * time (in seconds) of the route, and the peak memory use of the process so far (in kilobytes, where available).
+ *
+ * Queries are read from a file (or standard input), one per line, as the longitude and latitude of the origin
+ * followed by those of the destination, in decimal degrees, separated by blanks or commas. Empty lines and lines
+ * starting with `#` are ignored.
+ *
+ * Usage: route_benchmark [-c navit.xml] [-p profile] [-a attr=value]... [-d level] [queries]
+ *
+ * `-a` sets an attribute of the route, e.g. `-a heuristic=1`, so that routing options can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+#include "config.h"
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "config_.h"
+#include "item.h"
+#include "coord.h"
+#include "attr.h"
+#include "atom.h"
+#include "main.h"
+#include "debug.h"
+#include "event.h"
+#include "event_glib.h"
+#include "xmlconfig.h"
+#include "file.h"
+#include "mapset.h"
+#include "navit.h"
+#include "projection.h"
+#include "route.h"
+#include "route_protected.h"
+#include "transform.h"
+#include "vehicleprofile.h"
+
+#ifndef USE_PLUGINS
+extern void builtin_init(void);
+#endif /* USE_PLUGINS*/
+
+static void bench_usage(void) {
+    fprintf(stderr, "usage: route_benchmark [-c navit.xml] [-p profile] [-a attr=value]... [-d level] [queries]\n");
+}
+
+static double bench_clock(void) {
+    return (double)clock() * 1000 / CLOCKS_PER_SEC;
+}
+
+static long bench_maxrss(void) {
+#ifndef _WIN32
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage))
+        return usage.ru_maxrss;
+#endif
+    return -1;
+}
+
+/**
+ * @brief Loads the mapset and a vehicle profile from a navit.xml without starting a GUI
+ *
+ * @param config_file The navit.xml
+ * @param profile The name of the vehicle profile
+ *
+ * @return True on success
+ */
+static int bench_config_load(char *config_file, char *profile) {
+    char tmpname[]="route_benchmark_XXXXXX", cwd[4096], *path;
+    xmlerror *error=NULL;
+    FILE *f;
+    int fd,ret;
+
+    if (config_file[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+        path=g_strdup(config_file);
+    else
+        path=g_strdup_printf("%s/%s", cwd, config_file);
+    fd=mkstemp(tmpname);
+    if (fd == -1 || !(f=fdopen(fd, "w"))) {
+        fprintf(stderr, "route_benchmark: cannot create a temporary file in the current directory\n");
+        g_free(path);
+        return 0;
+    }
+    fprintf(f, "<config xmlns:xi=\"http://www.w3.org/2001/XInclude\">\n"
+            "<xi:include href=\"%s\" xpointer=\"xpointer(/config/plugins)\"/>\n"
+            "<navit flags=\"3\">\n"
+            "<xi:include href=\"%s\" xpointer=\"xpointer(/config/navit/mapset)\"/>\n"
+            "<xi:include href=\"%s\" xpointer=\"xpointer(/config/navit/vehicleprofile[@name='%s'])\"/>\n"
+            "</navit>\n"
+            "</config>\n", path, path, path, profile);
+    fclose(f);
+    ret=config_load(tmpname, &error);
+    if (!ret)
+        fprintf(stderr, "route_benchmark: error parsing %s: %s\n", config_file, error ? error->message : "");
+    unlink(tmpname);
+    g_free(path);
+    return ret;
+}
+
+/**
+ * @brief Parses a query
+ *
+ * @param line The line of the query file
+ * @param geo Receives the origin and destination
+ *
+ * @return True if the line holds a query
+ */
+static int bench_query_parse(char *line, struct coord_geo *geo) {
+    char *c;
+
+    for (c = line ; *c ; c++)
+        if (*c == ',' || *c == ';')
+            *c=' ';
+    if (line[strspn(line, " \t")] == '#')
+        return 0;
+    return sscanf(line, "%lf %lf %lf %lf", &geo[0].lng, &geo[0].lat, &geo[1].lng, &geo[1].lat) == 4;
+}
+
+int main(int argc, char **argv) {
+    char *config_file="navit.xml", *profile="car", *value, line[1024];
+    struct attr navit, mapset, vehicleprofile, route_status, length, duration, **attrs=NULL, *attr;
+    struct pcoord pc[2];
+    struct coord_geo geo[2];
+    struct route *route;
+    struct route_graph *graph;
+    struct attr_iter *iter;
+    FILE *queries=stdin;
+    double start, total;
+    int opt, i, found, query=0;
+
+#ifdef HAVE_GLIB
+    event_glib_init();
+#else
+    _g_slice_thread_init_nomessage();
+#endif
+    atom_init();
+    main_init(argv[0]);
+    debug_init(argv[0]);
+    file_init();
+#ifndef USE_PLUGINS
+    builtin_init();
+#endif
+    route_init();
+#ifdef HAVE_GLIB
+    event_request_system("glib", "route_benchmark");
+#endif
+
+    while ((opt = getopt(argc, argv, "a:c:d:hp:")) != -1) {
+        switch (opt) {
+        case 'a':
+            value=strchr(optarg, '=');
+            if (value)
+                *value++='\0';
+            attr=value ? attr_new_from_text(optarg, value) : NULL;
+            if (!attr) {
+                fprintf(stderr, "route_benchmark: invalid attribute '%s'\n", optarg);
+                return 1;
+            }
+            attrs=attr_generic_add_attr(attrs, attr);
+            attr_free(attr);
+            break;
+        case 'c':
+            config_file=optarg;
+            break;
+        case 'd':
+            debug_set_global_level(atoi(optarg), 1);
+            break;
+        case 'p':
+            profile=optarg;
+            break;
+        default:
+            bench_usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc && !(queries=fopen(argv[optind], "r"))) {
+        fprintf(stderr, "route_benchmark: cannot open %s\n", argv[optind]);
+        return 1;
+    }
+    if (!bench_config_load(config_file, profile) || !config_get_attr(config, attr_navit, &navit, NULL)
+            || !navit_get_attr(navit.u.navit, attr_mapset, &mapset, NULL)) {
+        fprintf(stderr, "route_benchmark: no mapset found in %s\n", config_file);
+        return 1;
+    }
+    /* Without an iterator, the active profile is returned, which is only chosen in navit_init() */
+    iter=navit_attr_iter_new(NULL);
+    found=navit_get_attr(navit.u.navit, attr_vehicleprofile, &vehicleprofile, iter);
+    navit_attr_iter_destroy(iter);
+    if (!found) {
+        fprintf(stderr, "route_benchmark: no vehicle profile '%s' found in %s\n", profile, config_file);
+        return 1;
+    }
+
+    route=route_new(NULL, attrs);
+    for (i = 0 ; attrs && attrs[i] ; i++)
+        route_set_attr(route, attrs[i]);
+    route_set_mapset(route, mapset.u.mapset);
+    route_set_profile(route, vehicleprofile.u.vehicleprofile);
+
+    printf("query,status,graph_points,build_ms,flood_ms,total_ms,expanded,length_m,time_s,maxrss_kb\n");
+    while (fgets(line, sizeof(line), queries)) {
+        if (!bench_query_parse(line, geo))
+            continue;
+        query++;
+        for (i = 0 ; i < 2 ; i++) {
+            struct coord c;
+            transform_from_geo(projection_mg, &geo[i], &c);
+            pc[i].pro=projection_mg;
+            pc[i].x=c.x;
+            pc[i].y=c.y;
+        }
+        route_set_destinations(route, NULL, 0, 0);
+        start=bench_clock();
+        route_set_position(route, &pc[0]);
+        route_set_destinations(route, &pc[1], 1, 0);
+        total=bench_clock()-start;
+        graph=route_get_graph(route);
+        if (!route_get_attr(route, attr_route_status, &route_status, NULL))
+            route_status.u.num=route_status_no_destination;
+        if ((route_status.u.num != route_status_path_done_new
+                && route_status.u.num != route_status_path_done_incremental)
+                || !route_get_attr(route, attr_destination_length, &length, NULL)
+                || !route_get_attr(route, attr_destination_time, &duration, NULL))
+            length.u.num=duration.u.num=-1;
+        printf("%d,%d,%d,%.3f,%.3f,%.3f,%d,%ld,%.1f,%ld\n", query, (int)route_status.u.num,
+               graph ? graph->point_count : 0, graph ? graph->build_time : 0, graph ? graph->flood_time : 0, total,
+               graph ? graph->expanded : 0, (long)length.u.num, duration.u.num < 0 ? -1 : duration.u.num / 10.0,
+               bench_maxrss());
+        fflush(stdout);
+    }
+    if (queries != stdin)
+        fclose(queries);
+    route_destroy(route);
+    attr_list_free(attrs);
+    return 0;
+}
@@ -0,0 +1,457 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief On-disk cache for route graphs
+ *
+ * Building a route graph means reading and decoding every street in the selection, which is repeated each time a
+ * route is calculated from scratch. This module saves the part of a route graph which was read from maps with
+ * static data to a file in the user data directory, and loads it back when a graph for the same selection is
+ * built again, so that only the remaining maps (such as the traffic map) need to be read.
+ *
+ * A cache file is identified by a key made up of:
+ * <ul>
+ * <li>the map selection, after snapping it to a grid with `route_graph_cache_snap_selection()` so that small movements
+ * of the vehicle result in the same selection,</li>
+ * <li>the `data_version` attribute of all route-active maps which report one (maps which do not, such as the traffic
+ * map, are never cached and always read from scratch), and</li>
+ * <li>the hash of the vehicle profile.</li>
+ * </ul>
+ *
+ * The file consists of a header, the key, an array of points and an array of segments, all of them in native byte
+ * order. It is memory-mapped when loading. Maps are referenced by their position among the cached maps in the
+ * mapset, items by their IDs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "mapset.h"
+#include "file.h"
+#include "navit.h"
+#include "xmlconfig.h"
+#include "vehicleprofile.h"
+#include "route_protected.h"
+
+/** Identifies a route graph cache file */
+#define ROUTE_GRAPH_CACHE_MAGIC "NRGC"
+
+/** Format version, to be increased whenever the file layout changes */
+#define ROUTE_GRAPH_CACHE_VERSION 2
+
+/** Maximum number of cache files to keep, the oldest files are removed first */
+#define ROUTE_GRAPH_CACHE_MAX_FILES 16
+
+/**
+ * @brief Header of a route graph cache file
+ */
+struct route_graph_cache_header {
+    char magic[4];              /**< `ROUTE_GRAPH_CACHE_MAGIC` */
+    int byte_order;             /**< 0x01020304 in native byte order */
+    int version;                /**< `ROUTE_GRAPH_CACHE_VERSION` */
+    int key_size;               /**< Size of the key which follows the header, including padding */
+    int point_count;            /**< Number of points */
+    int segment_count;          /**< Number of segments */
+};
+
+/**
+ * @brief A point in a route graph cache file
+ */
+struct route_graph_cache_point {
+    struct coord c;             /**< Coordinates of the point */
+    int flags;                  /**< Flags of the point */
+};
+
+/**
+ * @brief A segment in a route graph cache file
+ */
+struct route_graph_cache_segment {
+    int start;                  /**< Index of the start point */
+    int end;                    /**< Index of the end point */
+    int type;                   /**< Item type */
+    int id_hi;                  /**< High part of the item ID */
+    int id_lo;                  /**< Low part of the item ID */
+    int map;                    /**< Index of the item's map among the cached maps */
+    int flags;                  /**< Segment flags */
+    int len;                    /**< Length of the segment */
+    int score;                  /**< Score of the segment */
+    int maxspeed;               /**< Speed limit, if `AF_SPEED_LIMIT` is set */
+    int offset;                 /**< Offset within the item, if `AF_SEGMENTED` is set */
+    struct size_weight_limit size_weight; /**< Size and weight limits, if `AF_SIZE_OR_WEIGHT_LIMIT` is set */
+    int dangerous_goods;        /**< Dangerous goods restrictions, if `AF_DANGEROUS_GOODS` is set */
+    int speed_profile;          /**< Number of the speed profile, if `AF_SPEED_PROFILE` is set */
+};
+
+/**
+ * @brief Rounds down to a multiple of a power of two, also for negative numbers
+ */
+static int route_graph_cache_floor(int val, int grid) {
+    return val & ~(grid-1);
+}
+
+/**
+ * @brief Rounds up to a multiple of a power of two, also for negative numbers
+ */
+static int route_graph_cache_ceil(int val, int grid) {
+    return route_graph_cache_floor(val+grid-1, grid);
+}
+
+/**
+ * @brief Enlarges the rectangles of a map selection so that they are aligned to a grid
+ *
+ * For each rectangle, the grid size is the largest power of two not exceeding a quarter of the rectangle's larger
+ * side. The rectangles therefore grow by less than half of their size, and the snapped selection stays the same while
+ * the route points move within a grid cell.
+ *
+ * @param sel The selection, which is modified in place
+ */
+void route_graph_cache_snap_selection(struct map_selection *sel) {
+    int extent,grid;
+
+    for ( ; sel ; sel = sel->next) {
+        extent=MAX(sel->u.c_rect.rl.x-sel->u.c_rect.lu.x, sel->u.c_rect.lu.y-sel->u.c_rect.rl.y)/4;
+        for (grid = 1 ; grid*2 <= extent && grid < (1 << 24) ; grid*=2);
+        sel->u.c_rect.lu.x=route_graph_cache_floor(sel->u.c_rect.lu.x, grid);
+        sel->u.c_rect.lu.y=route_graph_cache_ceil(sel->u.c_rect.lu.y, grid);
+        sel->u.c_rect.rl.x=route_graph_cache_ceil(sel->u.c_rect.rl.x, grid);
+        sel->u.c_rect.rl.y=route_graph_cache_floor(sel->u.c_rect.rl.y, grid);
+    }
+}
+
+/**
+ * @brief Appends a string to a cache key and frees it
+ */
+static void route_graph_cache_key_append(char **key, char *str) {
+    char *ret=g_strconcat(*key, str, NULL);
+    g_free(*key);
+    g_free(str);
+    *key=ret;
+}
+
+/**
+ * @brief Builds the cache key for a route graph
+ *
+ * @param ms The mapset from which the graph is built
+ * @param sel The (snapped) selection of the graph
+ * @param profile The vehicle profile
+ * @param maps Receives the list of maps whose data can be cached, in mapset order, to be freed by the caller
+ *
+ * @return The key, to be freed by the caller, or NULL if none of the maps can be cached
+ */
+char *route_graph_cache_key(struct mapset *ms, struct map_selection *sel, struct vehicleprofile *profile,
+                            GList **maps) {
+    struct mapset_handle *h=mapset_open(ms);
+    struct map *m;
+    struct attr attr;
+    char *key=g_strdup_printf("profile=%08x\n", vehicleprofile_get_hash(profile));
+
+    *maps=NULL;
+    while ((m=mapset_next(h, 2))) {
+        if (map_get_attr(m, attr_data_version, &attr, NULL)) {
+            route_graph_cache_key_append(&key, g_strdup_printf("map=%s\n", attr.u.str));
+            *maps=g_list_append(*maps, m);
+        }
+    }
+    mapset_close(h);
+    if (!*maps) {
+        g_free(key);
+        return NULL;
+    }
+    for ( ; sel ; sel = sel->next)
+        route_graph_cache_key_append(&key, g_strdup_printf("sel=%d:0x%x,0x%x-0x%x,0x%x\n", sel->order,
+                                     sel->u.c_rect.lu.x, sel->u.c_rect.lu.y, sel->u.c_rect.rl.x, sel->u.c_rect.rl.y));
+    return key;
+}
+
+/**
+ * @brief Returns the directory holding the cache files
+ *
+ * @param create Whether to create the directory if it does not exist
+ *
+ * @return The directory, or NULL if there is no user data directory
+ */
+static char *route_graph_cache_dir(int create) {
+    char *dir=navit_get_user_data_directory(create);
+    char *ret;
+
+    if (!dir)
+        return NULL;
+    ret=g_strjoin(NULL, dir, "/routegraph", NULL);
+    if (create)
+        file_mkdir(ret, 0);
+    return ret;
+}
+
+/**
+ * @brief Returns the name of the cache file for a key
+ */
+static char *route_graph_cache_filename(char *dir, char *key) {
+    unsigned int hash=2166136261U;
+    char *c;
+
+    /* FNV-1a; collisions are detected by comparing the full key stored in the file */
+    for (c = key ; *c ; c++)
+        hash=(hash ^ (unsigned char)*c) * 16777619U;
+    return g_strdup_printf("%s/%08x.rgc", dir, hash);
+}
+
+/**
+ * @brief Removes the oldest cache files if there are more than `ROUTE_GRAPH_CACHE_MAX_FILES`
+ */
+static void route_graph_cache_trim(char *dir) {
+    void *d=file_opendir(dir);
+    char *name,*path,*oldest=NULL;
+    time_t oldest_mtime=0;
+    struct stat st;
+    int count=0,len;
+
+    if (!d)
+        return;
+    while ((name=file_readdir(d))) {
+        len=strlen(name);
+        if (len < 4 || strcmp(name+len-4, ".rgc"))
+            continue;
+        path=g_strdup_printf("%s/%s", dir, name);
+        if (stat(path, &st)) {
+            g_free(path);
+            continue;
+        }
+        count++;
+        if (!oldest || st.st_mtime < oldest_mtime) {
+            g_free(oldest);
+            oldest=path;
+            oldest_mtime=st.st_mtime;
+        } else
+            g_free(path);
+    }
+    file_closedir(d);
+    if (count > ROUTE_GRAPH_CACHE_MAX_FILES) {
+        dbg(lvl_debug,"removing %s", oldest);
+        unlink(oldest);
+    }
+    g_free(oldest);
+}
+
+/**
+ * @brief Loads the cached part of a route graph
+ *
+ * The points and segments from the cache file for `rg->cache_key` are added to `rg`, which must not have been frozen.
+ *
+ * @param rg The route graph, with `cache_key` and `cache_maps` set
+ *
+ * @return True if the graph was loaded, false if there is no valid cache file
+ */
+int route_graph_cache_load(struct route_graph *rg) {
+    char *dir=route_graph_cache_dir(0);
+    char *filename;
+    struct file *f;
+    struct route_graph_cache_header *header;
+    struct route_graph_cache_point *cp;
+    struct route_graph_cache_segment *cs;
+    struct route_graph_point **points;
+    struct route_graph_segment_data data;
+    struct item item;
+    int i,key_size=strlen(rg->cache_key)/4*4+4;
+
+    if (!dir)
+        return 0;
+    filename=route_graph_cache_filename(dir, rg->cache_key);
+    g_free(dir);
+    f=file_create(filename, NULL);
+    if (!f) {
+        dbg(lvl_debug,"no cache file %s", filename);
+        g_free(filename);
+        return 0;
+    }
+    if (f->size < sizeof(*header)+key_size || !file_mmap(f)) {
+        file_destroy(f);
+        g_free(filename);
+        return 0;
+    }
+    header=(struct route_graph_cache_header *)f->begin;
+    if (memcmp(header->magic, ROUTE_GRAPH_CACHE_MAGIC, 4) || header->byte_order != 0x01020304
+            || header->version != ROUTE_GRAPH_CACHE_VERSION || header->key_size != key_size
+            || strcmp((char *)(header+1), rg->cache_key) || header->point_count < 0 || header->segment_count < 0
+            || f->size != sizeof(*header)+key_size+(long long)header->point_count*sizeof(*cp)
+            +(long long)header->segment_count*sizeof(*cs)) {
+        dbg(lvl_warning,"ignoring invalid or mismatching cache file %s", filename);
+        file_destroy(f);
+        g_free(filename);
+        return 0;
+    }
+    cp=(struct route_graph_cache_point *)(f->begin+sizeof(*header)+key_size);
+    cs=(struct route_graph_cache_segment *)(cp+header->point_count);
+    points=g_new(struct route_graph_point *, header->point_count);
+    for (i = 0 ; i < header->point_count ; i++) {
+        points[i]=route_graph_add_point(rg, &cp[i].c);
+        points[i]->flags |= cp[i].flags;
+    }
+    memset(&item, 0, sizeof(item));
+    data.item=&item;
+    for (i = 0 ; i < header->segment_count ; i++, cs++) {
+        if (cs->start < 0 || cs->start >= header->point_count || cs->end < 0 || cs->end >= header->point_count
+                || !(item.map=g_list_nth_data(rg->cache_maps, cs->map)))
+            continue;
+        item.type=cs->type;
+        item.id_hi=cs->id_hi;
+        item.id_lo=cs->id_lo;
+        data.flags=cs->flags;
+        data.len=cs->len;
+        data.score=cs->score;
+        data.maxspeed=cs->maxspeed;
+        data.offset=cs->offset;
+        data.size_weight=cs->size_weight;
+        data.dangerous_goods=cs->dangerous_goods;
+        data.speed_profile=cs->speed_profile;
+        route_graph_add_segment(rg, points[cs->start], points[cs->end], &data);
+    }
+    dbg(lvl_debug,"loaded %d points and %d segments from %s", header->point_count, header->segment_count, filename);
+    g_free(points);
+    file_destroy(f);
+    g_free(filename);
+    return 1;
+}
+
+/**
+ * @brief Saves the cacheable part of a route graph
+ *
+ * Only segments of items from `rg->cache_maps` are saved, along with their end points. Of the point flags, only
+ * `RP_TURN_RESTRICTION` is kept; all other flags are either derived later or come from non-cached maps.
+ *
+ * This must be called after all maps have been read, but before the graph is frozen.
+ *
+ * @param rg The route graph, with `cache_key` and `cache_maps` set
+ *
+ * @return True on success, false on failure
+ */
+int route_graph_cache_save(struct route_graph *rg) {
+    struct route_graph_cache_header header;
+    struct route_graph_cache_point cp;
+    struct route_graph_cache_segment cs;
+    struct route_graph_segment *s,**segs;
+    struct route_graph_point **points;
+    GHashTable *ids;
+    char *dir,*filename,*tmpname,*key;
+    FILE *out;
+    int i,count=0,ok,key_len=strlen(rg->cache_key);
+
+    dir=route_graph_cache_dir(1);
+    if (!dir)
+        return 0;
+    for (s = rg->route_segments ; s ; s = s->next)
+        if (g_list_find(rg->cache_maps, s->data.item.map))
+            count++;
+    /* route_segments is newest first, save in insertion order */
+    segs=g_new(struct route_graph_segment *, count);
+    i=count;
+    for (s = rg->route_segments ; s ; s = s->next)
+        if (g_list_find(rg->cache_maps, s->data.item.map))
+            segs[--i]=s;
+    ids=g_hash_table_new(NULL, NULL);
+    points=g_new(struct route_graph_point *, count*2);
+    memcpy(header.magic, ROUTE_GRAPH_CACHE_MAGIC, 4);
+    header.byte_order=0x01020304;
+    header.version=ROUTE_GRAPH_CACHE_VERSION;
+    header.key_size=key_len/4*4+4;
+    header.point_count=0;
+    header.segment_count=count;
+    for (i = 0 ; i < count ; i++) {
+        if (!g_hash_table_lookup(ids, segs[i]->start)) {
+            points[header.point_count++]=segs[i]->start;
+            g_hash_table_insert(ids, segs[i]->start, GINT_TO_POINTER(header.point_count));
+        }
+        if (!g_hash_table_lookup(ids, segs[i]->end)) {
+            points[header.point_count++]=segs[i]->end;
+            g_hash_table_insert(ids, segs[i]->end, GINT_TO_POINTER(header.point_count));
+        }
+    }
+
+    filename=route_graph_cache_filename(dir, rg->cache_key);
+    tmpname=g_strdup_printf("%s.tmp", filename);
+    out=fopen(tmpname, "wb");
+    ok=(out != NULL);
+    if (ok) {
+        key=g_malloc0(header.key_size);
+        memcpy(key, rg->cache_key, key_len);
+        ok=fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(key, header.key_size, 1, out) == 1;
+        g_free(key);
+        for (i = 0 ; ok && i < header.point_count ; i++) {
+            cp.c=points[i]->c;
+            cp.flags=points[i]->flags & RP_TURN_RESTRICTION;
+            ok=fwrite(&cp, sizeof(cp), 1, out) == 1;
+        }
+        for (i = 0 ; ok && i < count ; i++) {
+            s=segs[i];
+            memset(&cs, 0, sizeof(cs));
+            cs.start=GPOINTER_TO_INT(g_hash_table_lookup(ids, s->start))-1;
+            cs.end=GPOINTER_TO_INT(g_hash_table_lookup(ids, s->end))-1;
+            cs.type=s->data.item.type;
+            cs.id_hi=s->data.item.id_hi;
+            cs.id_lo=s->data.item.id_lo;
+            cs.map=g_list_index(rg->cache_maps, s->data.item.map);
+            cs.flags=s->data.flags;
+            cs.len=s->data.len;
+            cs.score=(s->data.flags & AF_SCORE) ? RSD_SCORE(&s->data) : 0;
+            cs.maxspeed=-1;
+            if (s->data.flags & AF_SPEED_LIMIT)
+                cs.maxspeed=RSD_MAXSPEED(&s->data);
+            cs.offset=1;
+            if (s->data.flags & AF_SEGMENTED)
+                cs.offset=*(int *)route_segment_data_field_pos(&s->data, attr_offset);
+            if (s->data.flags & AF_SIZE_OR_WEIGHT_LIMIT)
+                cs.size_weight=*(struct size_weight_limit *)route_segment_data_field_pos(&s->data, attr_vehicle_width);
+            if (s->data.flags & AF_DANGEROUS_GOODS)
+                cs.dangerous_goods=*(int *)route_segment_data_field_pos(&s->data, attr_vehicle_dangerous_goods);
+            cs.speed_profile=0;
+            if (s->data.flags & AF_SPEED_PROFILE)
+                cs.speed_profile=RSD_SPEED_PROFILE(&s->data) & 0xffff;
+            ok=fwrite(&cs, sizeof(cs), 1, out) == 1;
+        }
+        if (fclose(out))
+            ok=0;
+        if (ok) {
+            /* rename() does not replace existing files on all platforms */
+            unlink(filename);
+            ok=!rename(tmpname, filename);
+        }
+        if (!ok)
+            unlink(tmpname);
+    }
+    if (ok) {
+        dbg(lvl_debug,"saved %d points and %d segments to %s", header.point_count, count, filename);
+        route_graph_cache_trim(dir);
+    } else
+        dbg(lvl_error,"failed to write route graph cache file %s", filename);
+    g_hash_table_destroy(ids);
+    g_free(points);
+    g_free(segs);
+    g_free(tmpname);
+    g_free(filename);
+    g_free(dir);
+    return ok;
+}
@@ -0,0 +1,427 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Landmark distance tables for the routing heuristic (ALT)
+ *
+ * ALT ("A*, landmarks, triangle inequality") tightens the lower bound which the heuristic of route.c gives for the
+ * cost between two points. For a few landmarks L, the cost from L to every point and from every point to L is
+ * calculated in advance. As no route can be cheaper than the cheapest one, the cost from a to b is at least
+ * d(L,b) - d(L,a) and at least d(a,L) - d(b,L), for each landmark L.
+ *
+ * The tables are calculated offline, over a route graph covering the whole mapset, by `route_landmarks_save()`,
+ * which is run through the `route_build_landmarks` command. Costs are calculated without any penalties or traffic
+ * distortions, which can only make a route more expensive, so the bounds remain valid when these apply.
+ *
+ * The tables are stored next to the first map file of the mapset, with `.landmarks` appended to its name. The file
+ * holds the same key as a route graph cache file without a selection (see `route_graph_cache_key()`), i.e. the data
+ * version of every map and the hash of the vehicle profile, so that tables for a different map version or profile
+ * are ignored. After the header and the key follow the coordinates of all points, sorted by x and y, and then the
+ * costs for each point: first from each landmark to the point, then from the point to each landmark, with `INT_MAX`
+ * if there is no route. Points which share their coordinates with another point (as happens with turn restrictions)
+ * are left out, as there is no way to tell them apart. The file is memory-mapped when loading.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "mapset.h"
+#include "file.h"
+#include "dheap.h"
+#include "xmlconfig.h"
+#include "vehicleprofile.h"
+#include "route_protected.h"
+
+/** Identifies a landmark file */
+#define ROUTE_LANDMARKS_MAGIC "NRLM"
+
+/** Format version, to be increased whenever the file layout changes */
+#define ROUTE_LANDMARKS_VERSION 1
+
+/** Maximum number of landmarks */
+#define ROUTE_LANDMARKS_MAX 64
+
+/**
+ * @brief Header of a landmark file
+ */
+struct route_landmarks_header {
+    char magic[4];              /**< `ROUTE_LANDMARKS_MAGIC` */
+    int byte_order;             /**< 0x01020304 in native byte order */
+    int version;                /**< `ROUTE_LANDMARKS_VERSION` */
+    int key_size;               /**< Size of the key which follows the header, including padding */
+    int count;                  /**< Number of landmarks */
+    int point_count;            /**< Number of points */
+};
+
+/**
+ * @brief Loaded landmark tables
+ */
+struct route_landmarks {
+    struct file *file;          /**< The memory-mapped file */
+    char *key;                  /**< The key of the tables */
+    int count;                  /**< Number of landmarks */
+    int point_count;            /**< Number of points */
+    struct coord *c;            /**< Coordinates of the points, sorted by x and y */
+    int *dist;                  /**< Costs, `2 * count` for each point, see file description */
+};
+
+/**
+ * @brief A point while calculating landmark tables
+ */
+struct route_landmarks_node {
+    int heap_idx;               /**< Index slot for the heap */
+    int dist;                   /**< Cost from or to the current landmark */
+};
+
+/**
+ * @brief Builds the key and returns the file name for the landmark tables of a mapset
+ *
+ * @param ms The mapset
+ * @param profile The vehicle profile
+ * @param key Receives the key, to be freed by the caller
+ *
+ * @return The file name, to be freed by the caller, or NULL if the mapset has no map with static data
+ */
+static char *route_landmarks_filename(struct mapset *ms, struct vehicleprofile *profile, char **key) {
+    struct file_wordexp *wexp;
+    struct attr data;
+    GList *maps;
+    char *ret=NULL;
+
+    *key=route_graph_cache_key(ms, NULL, profile, &maps);
+    if (!*key)
+        return NULL;
+    if (map_get_attr(maps->data, attr_data, &data, NULL)) {
+        wexp=file_wordexp_new(data.u.str);
+        if (file_wordexp_get_count(wexp) > 0)
+            ret=g_strconcat(file_wordexp_get_array(wexp)[0], ".landmarks", NULL);
+        file_wordexp_destroy(wexp);
+    }
+    g_list_free(maps);
+    if (!ret) {
+        g_free(*key);
+        *key=NULL;
+    }
+    return ret;
+}
+
+/**
+ * @brief Loads the landmark tables for a mapset
+ *
+ * @param ms The mapset
+ * @param profile The vehicle profile
+ *
+ * @return The tables, or NULL if there are no tables for the current version of the maps and the profile
+ */
+struct route_landmarks *route_landmarks_load(struct mapset *ms, struct vehicleprofile *profile) {
+    struct route_landmarks *ret;
+    struct route_landmarks_header *header;
+    struct file *f;
+    char *key,*filename=route_landmarks_filename(ms, profile, &key);
+    int key_size;
+
+    if (!filename)
+        return NULL;
+    key_size=strlen(key)/4*4+4;
+    f=file_create(filename, NULL);
+    if (!f || f->size < sizeof(*header)+key_size || !file_mmap(f)) {
+        dbg(lvl_debug,"no landmarks in %s", filename);
+        if (f)
+            file_destroy(f);
+        g_free(filename);
+        g_free(key);
+        return NULL;
+    }
+    header=(struct route_landmarks_header *)f->begin;
+    if (memcmp(header->magic, ROUTE_LANDMARKS_MAGIC, 4) || header->byte_order != 0x01020304
+            || header->version != ROUTE_LANDMARKS_VERSION || header->key_size != key_size
+            || strcmp((char *)(header+1), key) || header->count <= 0 || header->count > ROUTE_LANDMARKS_MAX
+            || header->point_count < 0 || f->size != sizeof(*header)+key_size
+            +(long long)header->point_count*(sizeof(struct coord)+2*header->count*sizeof(int))) {
+        dbg(lvl_warning,"ignoring invalid or outdated landmarks in %s", filename);
+        file_destroy(f);
+        g_free(filename);
+        g_free(key);
+        return NULL;
+    }
+    ret=g_new0(struct route_landmarks, 1);
+    ret->file=f;
+    ret->key=key;
+    ret->count=header->count;
+    ret->point_count=header->point_count;
+    ret->c=(struct coord *)(f->begin+sizeof(*header)+key_size);
+    ret->dist=(int *)(ret->c+ret->point_count);
+    dbg(lvl_debug,"loaded %d landmarks for %d points from %s", ret->count, ret->point_count, filename);
+    g_free(filename);
+    return ret;
+}
+
+/**
+ * @brief Whether landmark tables are still valid for a mapset
+ *
+ * @param this The tables
+ * @param ms The mapset
+ * @param profile The vehicle profile
+ *
+ * @return True if the maps and the profile have not changed since the tables were calculated
+ */
+int route_landmarks_is_current(struct route_landmarks *this, struct mapset *ms, struct vehicleprofile *profile) {
+    GList *maps;
+    char *key=route_graph_cache_key(ms, NULL, profile, &maps);
+    int ret=key && !strcmp(key, this->key);
+
+    g_list_free(maps);
+    g_free(key);
+    return ret;
+}
+
+/**
+ * @brief Frees landmark tables
+ *
+ * @param this The tables, can be NULL
+ */
+void route_landmarks_destroy(struct route_landmarks *this) {
+    if (!this)
+        return;
+    file_destroy(this->file);
+    g_free(this->key);
+    g_free(this);
+}
+
+/**
+ * @brief Compares two coordinates by x, then y
+ */
+static int route_landmarks_coord_cmp(const void *a, const void *b) {
+    const struct coord *ca=a, *cb=b;
+    if (ca->x != cb->x)
+        return ca->x < cb->x ? -1 : 1;
+    if (ca->y != cb->y)
+        return ca->y < cb->y ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Returns the index of a point in landmark tables
+ *
+ * @param this The tables
+ * @param c The coordinates of the point
+ *
+ * @return The index, or -1 if the tables have no entry for the point
+ */
+int route_landmarks_lookup(struct route_landmarks *this, struct coord *c) {
+    struct coord *found=bsearch(c, this->c, this->point_count, sizeof(struct coord), route_landmarks_coord_cmp);
+    return found ? found-this->c : -1;
+}
+
+/**
+ * @brief Returns a lower bound for the cost of the cheapest route between two points
+ *
+ * @param this The tables
+ * @param from The index of the start point, as returned by `route_landmarks_lookup()`
+ * @param to The index of the end point
+ *
+ * @return The lower bound, which is 0 if nothing is known
+ */
+int route_landmarks_bound(struct route_landmarks *this, int from, int to) {
+    int *dfrom=this->dist+(long long)from*2*this->count;
+    int *dto=this->dist+(long long)to*2*this->count;
+    int i,ret=0;
+
+    for (i = 0 ; i < this->count ; i++) {
+        /* d(L,to) <= d(L,from) + d(from,to) */
+        if (dfrom[i] != INT_MAX && dto[i] != INT_MAX && dto[i]-dfrom[i] > ret)
+            ret=dto[i]-dfrom[i];
+        /* d(from,L) <= d(from,to) + d(to,L) */
+        if (dfrom[this->count+i] != INT_MAX && dto[this->count+i] != INT_MAX
+                && dfrom[this->count+i]-dto[this->count+i] > ret)
+            ret=dfrom[this->count+i]-dto[this->count+i];
+    }
+    return ret;
+}
+
+/**
+ * @brief Calculates the cost from or to a landmark for every point of a frozen route graph
+ *
+ * This is a plain Dijkstra search over the adjacency array of the graph, using
+ * `route_graph_segment_base_cost()`.
+ *
+ * @param rg The route graph
+ * @param profile The vehicle profile
+ * @param nodes One node per point of the graph, receiving the costs
+ * @param landmark The ID of the landmark
+ * @param reverse False to calculate the cost from the landmark to each point, true for the cost from each point to
+ * the landmark
+ */
+static void route_landmarks_flood(struct route_graph *rg, struct vehicleprofile *profile,
+                                  struct route_landmarks_node *nodes, int landmark, int reverse) {
+    struct dheap *heap=dheap_new(offsetof(struct route_landmarks_node, heap_idx));
+    struct route_landmarks_node *n;
+    struct route_graph_edge *e,*end;
+    int i,id,val;
+
+    for (i = 0 ; i < rg->point_count ; i++)
+        nodes[i].dist=INT_MAX;
+    nodes[landmark].dist=0;
+    dheap_update(heap, &nodes[landmark], 0);
+    while ((n=dheap_extractmin(heap))) {
+        id=n-nodes;
+        end=rg->edges+rg->edge_offset[id+1];
+        for (e = rg->edges+rg->edge_offset[id] ; e < end ; e++) {
+            val=route_graph_segment_base_cost(profile, e->seg, reverse ? -e->dir : e->dir);
+            if (val == INT_MAX || n->dist+val >= nodes[e->other].dist)
+                continue;
+            nodes[e->other].dist=n->dist+val;
+            dheap_update(heap, &nodes[e->other], nodes[e->other].dist);
+        }
+    }
+    dheap_destroy(heap);
+}
+
+/**
+ * @brief Calculates landmark tables and saves them next to the first map file of the mapset
+ *
+ * Landmarks are chosen far apart from each other: the first one is the point farthest from a point in the middle of
+ * the graph, each further one is the point whose cost from the closest landmark chosen so far is highest.
+ *
+ * @param rg A frozen route graph covering the whole mapset
+ * @param ms The mapset
+ * @param profile The vehicle profile
+ * @param count The number of landmarks
+ *
+ * @return True on success, false on failure
+ */
+int route_landmarks_save(struct route_graph *rg, struct mapset *ms, struct vehicleprofile *profile, int count) {
+    struct route_landmarks_header header;
+    struct route_landmarks_node *nodes;
+    struct route_graph_point *p;
+    struct coord *coords;
+    int *dist,*min,*order;
+    char *key,*filename,*tmpname;
+    int i,j,n,landmark,ok,key_size,requested;
+    FILE *f;
+
+    if (!rg->points || !rg->point_count) {
+        dbg(lvl_error,"no route graph to calculate landmarks from");
+        return 0;
+    }
+    filename=route_landmarks_filename(ms, profile, &key);
+    if (!filename) {
+        dbg(lvl_error,"mapset has no map file to store landmarks with");
+        return 0;
+    }
+    count=requested=MAX(1, MIN(count, ROUTE_LANDMARKS_MAX));
+    nodes=g_new(struct route_landmarks_node, rg->point_count);
+    dist=g_new(int, (long long)rg->point_count*2*requested);
+    min=g_new(int, rg->point_count);
+
+    /* Only points with unique coordinates go into the tables, sorted for lookup */
+    order=g_new(int, rg->point_count);
+    for (i = 0, n = 0 ; i < rg->point_count ; i++) {
+        p=&rg->points[i];
+        if (route_graph_get_point(rg, &p->c) == p && !p->hash_next)
+            order[n++]=i;
+    }
+    coords=g_new(struct coord, n);
+    for (i = 0 ; i < n ; i++)
+        coords[i]=rg->points[order[i]].c;
+    qsort(coords, n, sizeof(struct coord), route_landmarks_coord_cmp);
+    for (i = 0 ; i < n ; i++)
+        order[i]=route_graph_get_point(rg, &coords[i])-rg->points;
+
+    route_landmarks_flood(rg, profile, nodes, rg->point_count/2, 0);
+    for (i = 0 ; i < rg->point_count ; i++)
+        min[i]=nodes[i].dist;
+    for (j = 0 ; j < count ; j++) {
+        landmark=-1;
+        for (i = 0 ; i < rg->point_count ; i++)
+            if (min[i] != INT_MAX && min[i] > 0 && (landmark < 0 || min[i] > min[landmark]))
+                landmark=i;
+        if (landmark < 0) {
+            count=j;
+            break;
+        }
+        dbg(lvl_info,"landmark %d at 0x%x,0x%x", j, rg->points[landmark].c.x, rg->points[landmark].c.y);
+        route_landmarks_flood(rg, profile, nodes, landmark, 0);
+        for (i = 0 ; i < rg->point_count ; i++) {
+            if (j == 0 || (nodes[i].dist < min[i] && nodes[i].dist != INT_MAX))
+                min[i]=nodes[i].dist;
+        }
+        for (i = 0 ; i < n ; i++)
+            dist[(long long)i*2*requested+j]=nodes[order[i]].dist;
+        route_landmarks_flood(rg, profile, nodes, landmark, 1);
+        for (i = 0 ; i < n ; i++)
+            dist[(long long)i*2*requested+requested+j]=nodes[order[i]].dist;
+    }
+    if (count < requested) {
+        /* no further landmark could be found, close the gaps in the table */
+        for (i = 0 ; i < n ; i++) {
+            memmove(dist+(long long)i*2*count, dist+(long long)i*2*requested, count*sizeof(int));
+            memmove(dist+(long long)i*2*count+count, dist+(long long)i*2*requested+requested, count*sizeof(int));
+        }
+    }
+    g_free(nodes);
+    g_free(min);
+    g_free(order);
+
+    memcpy(header.magic, ROUTE_LANDMARKS_MAGIC, 4);
+    header.byte_order=0x01020304;
+    header.version=ROUTE_LANDMARKS_VERSION;
+    header.key_size=key_size=strlen(key)/4*4+4;
+    header.count=count;
+    header.point_count=n;
+    tmpname=g_strconcat(filename, ".tmp", NULL);
+    f=count ? fopen(tmpname, "wb") : NULL;
+    ok=f != NULL;
+    if (ok) {
+        char *padded=g_malloc0(key_size);
+        strcpy(padded, key);
+        ok=fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(padded, key_size, 1, f) == 1
+           && fwrite(coords, sizeof(struct coord), n, f) == n
+           && fwrite(dist, sizeof(int)*2*count, n, f) == n;
+        g_free(padded);
+        ok=!fclose(f) && ok;
+        if (ok) {
+            unlink(filename);
+            ok=!rename(tmpname, filename);
+        }
+        if (!ok)
+            unlink(tmpname);
+    }
+    if (ok) {
+        dbg(lvl_info,"saved %d landmarks for %d points to %s", count, n, filename);
+    } else {
+        dbg(lvl_error,"failed to save landmarks to %s", filename);
+    }
+    g_free(tmpname);
+    g_free(filename);
+    g_free(key);
+    g_free(coords);
+    g_free(dist);
+    return ok;
+}
@@ -0,0 +1,800 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Matching of many positions to streets
+ *
+ * `route_find_nearest_street()` queries the maps for every single position, which is fine for a position and a few
+ * destinations but slow for thousands of points. A match index reads the streets of an area once and keeps them in
+ * a grid of cells, each listing the street segments which pass through it, so that the nearest street of a point is
+ * found by looking at a few cells only. Points are then matched independently on several threads.
+ *
+ * Points which belong to a trace, e.g. a recorded track, can also be matched as a whole, with a hidden Markov model:
+ * for each point, the nearest streets are candidates, more likely the closer they are. Between two consecutive
+ * points, a transition is more likely the closer the distance along the streets is to the distance between the
+ * points. The most likely sequence of candidates is found with the Viterbi algorithm, which keeps a trace on the
+ * streets it actually follows where it passes close to others. Distances along the streets are found by a search
+ * over the network formed by the end points of the streets, which respects one-way streets and the access flags of
+ * the vehicle profile.
+ *
+ * All coordinates of the index are in `projection_mg`.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <glib.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "mapset.h"
+#include "xmlconfig.h"
+#include "projection.h"
+#include "transform.h"
+#include "route.h"
+#include "route_protected.h"
+#include "vehicleprofile.h"
+#include "dheap.h"
+#include "thread.h"
+
+/** Size of the cells of the index, in map units (roughly meters) */
+#define ROUTE_MATCH_CELL 256
+
+/** Maximum number of threads matching points */
+#define ROUTE_MATCH_THREADS 8
+
+/** Number of points a thread takes at once */
+#define ROUTE_MATCH_CHUNK 64
+
+/** Maximum number of candidate streets per point of a trace */
+#define ROUTE_MATCH_CANDIDATES 8
+
+/** Standard deviation of the error of positions in a trace, in meters */
+#define ROUTE_MATCH_SIGMA 10.0
+
+/** Scale of the difference between the distance along the streets and the distance between two points of a trace,
+ *  in meters, at which a transition becomes less likely by a factor of e */
+#define ROUTE_MATCH_BETA 20.0
+
+/** The distance along the streets between two points of a trace may be this many times their distance at most */
+#define ROUTE_MATCH_DETOUR 4
+
+/**
+ * @brief A street of a match index
+ */
+struct route_match_street {
+    struct street_data *sd;     /**< The street, with its coordinates in `projection_mg` */
+    int node[2];                /**< The nodes at the first and the last coordinate */
+    int len;                    /**< Length of the street, in meters */
+    double *offset;             /**< For each coordinate, its distance from the first one along the street, in
+                                 *   meters */
+};
+
+/**
+ * @brief An entry of the grid of a match index, i.e. a segment of a street passing through a cell
+ */
+struct route_match_entry {
+    int x;                      /**< Column of the cell */
+    int y;                      /**< Row of the cell */
+    int street;                 /**< Index of the street */
+    int pos;                    /**< Index of the segment within the street */
+};
+
+/**
+ * @brief A match index
+ */
+struct route_match_index {
+    struct coord_rect r;                /**< The area covered by the index */
+    int street_count;                   /**< Number of elements in `streets` */
+    struct route_match_street *streets; /**< The streets */
+    int entry_count;                    /**< Number of elements in `entries` */
+    struct route_match_entry *entries;  /**< The grid, sorted by column and row */
+    int node_count;                     /**< Number of nodes, i.e. distinct end points of streets */
+    int *node_first;                    /**< For each node, the first element of `node_streets` which belongs to it,
+                                         *   with one more element marking the end of the last node */
+    int *node_streets;                  /**< The streets starting or ending at each node */
+};
+
+/**
+ * @brief A candidate street for a point
+ */
+struct route_match_candidate {
+    int street;                 /**< Index of the street */
+    int pos;                    /**< Index of the segment containing `lp` */
+    struct coord lp;            /**< The nearest position on the street */
+    int dist_sq;                /**< Squared distance of `lp` from the point, in map units */
+    int at;                     /**< Distance of `lp` from the first coordinate of the street, in meters */
+};
+
+/**
+ * @brief A node visited by the search for distances along the streets
+ */
+struct route_match_node {
+    int heap_idx;               /**< Index slot for the heap */
+    int dist;                   /**< Distance from the start, `INT_MAX` if not reached yet */
+};
+
+static int route_match_cell(int v) {
+    return v >= 0 ? v / ROUTE_MATCH_CELL : -((ROUTE_MATCH_CELL - 1 - v) / ROUTE_MATCH_CELL);
+}
+
+static int route_match_entry_compare(const void *a, const void *b) {
+    const struct route_match_entry *ea = a, *eb = b;
+
+    if (ea->x != eb->x)
+        return ea->x < eb->x ? -1 : 1;
+    if (ea->y != eb->y)
+        return ea->y < eb->y ? -1 : 1;
+    return 0;
+}
+
+static int route_match_int_compare(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief Whether a street may be used in a direction
+ *
+ * @param profile The vehicle profile, NULL to allow all streets in both directions
+ * @param flags The flags of the street
+ * @param dir 1 for the direction of its coordinates, -1 for the opposite one, 0 for either
+ */
+static int route_match_allowed(struct vehicleprofile *profile, int flags, int dir) {
+    if (!profile)
+        return 1;
+    if (dir >= 0 && (flags & profile->flags_forward_mask) == profile->flags)
+        return 1;
+    if (dir <= 0 && (flags & profile->flags_reverse_mask) == profile->flags)
+        return 1;
+    return 0;
+}
+
+static guint route_match_coord_hash(gconstpointer key) {
+    const struct coord *c = key;
+
+    return c->x ^ (c->y * 31);
+}
+
+static gboolean route_match_coord_equal(gconstpointer a, gconstpointer b) {
+    const struct coord *ca = a, *cb = b;
+
+    return ca->x == cb->x && ca->y == cb->y;
+}
+
+/**
+ * @brief Returns the node at a coordinate, adding it if needed
+ *
+ * @param nodes The nodes so far, by coordinate
+ * @param c The coordinate, which must remain valid as long as `nodes` exists
+ * @param count The number of nodes so far
+ */
+static int route_match_node(GHashTable *nodes, struct coord *c, int *count) {
+    gpointer id = g_hash_table_lookup(nodes, c);
+
+    if (id)
+        return GPOINTER_TO_INT(id) - 1;
+    g_hash_table_insert(nodes, c, GINT_TO_POINTER(*count + 1));
+    return (*count)++;
+}
+
+/**
+ * @brief Reads the streets of an area and indexes them
+ *
+ * @param ms The mapset
+ * @param r The area, in `projection_mg`
+ *
+ * @return The index
+ */
+struct route_match_index *route_match_index_new(struct mapset *ms, struct coord_rect *r) {
+    struct route_match_index *this = g_new0(struct route_match_index, 1);
+    struct route_match_street *s;
+    struct route_match_entry e;
+    struct map_selection sel;
+    struct mapset_handle *h;
+    struct map_rect *mr;
+    struct item_hash *seen = item_hash_new();
+    struct street_data *sd;
+    struct item *item;
+    struct coord_geo g;
+    struct coord c[2];
+    struct street_data **streets = NULL;
+    struct map *m;
+    GHashTable *nodes;
+    int i, j, x, y, pro, *fill, size = 0, entries_size = 0;
+
+    this->r = *r;
+    memset(&sel, 0, sizeof(sel));
+    sel.order = 18;
+    sel.range.min = route_item_first;
+    sel.range.max = route_item_last;
+    h = mapset_open(ms);
+    while ((m = mapset_next(h, 2))) {
+        pro = map_projection(m);
+        c[0] = r->lu;
+        c[1] = r->rl;
+        if (pro != projection_mg) {
+            for (i = 0 ; i < 2 ; i++) {
+                transform_to_geo(projection_mg, &c[i], &g);
+                transform_from_geo(pro, &g, &c[i]);
+            }
+        }
+        sel.u.c_rect.lu = c[0];
+        sel.u.c_rect.rl = c[1];
+        mr = map_rect_new(m, &sel);
+        if (!mr)
+            continue;
+        while ((item = map_rect_get_item(mr))) {
+            if (!item_get_default_flags(item->type) || item_hash_lookup(seen, item))
+                continue;
+            item_hash_insert(seen, item, item);
+            sd = street_get_data(item);
+            if (!sd)
+                continue;
+            if (sd->count < 2) {
+                street_data_free(sd);
+                continue;
+            }
+            if (pro != projection_mg) {
+                for (i = 0 ; i < sd->count ; i++) {
+                    transform_to_geo(pro, &sd->c[i], &g);
+                    transform_from_geo(projection_mg, &g, &sd->c[i]);
+                }
+            }
+            if (this->street_count == size) {
+                size = size ? 2 * size : 256;
+                streets = g_renew(struct street_data *, streets, size);
+            }
+            streets[this->street_count++] = sd;
+        }
+        map_rect_destroy(mr);
+    }
+    mapset_close(h);
+    item_hash_destroy(seen);
+
+    this->streets = g_new0(struct route_match_street, this->street_count);
+    nodes = g_hash_table_new(route_match_coord_hash, route_match_coord_equal);
+    for (i = 0 ; i < this->street_count ; i++) {
+        s = &this->streets[i];
+        s->sd = streets[i];
+        s->node[0] = route_match_node(nodes, &s->sd->c[0], &this->node_count);
+        s->node[1] = route_match_node(nodes, &s->sd->c[s->sd->count - 1], &this->node_count);
+        s->offset = g_new(double, s->sd->count);
+        s->offset[0] = 0;
+        e.street = i;
+        for (j = 0 ; j < s->sd->count - 1 ; j++) {
+            s->offset[j + 1] = s->offset[j] + transform_distance(projection_mg, &s->sd->c[j], &s->sd->c[j + 1]);
+            e.pos = j;
+            for (x = route_match_cell(MIN(s->sd->c[j].x, s->sd->c[j + 1].x)) ;
+                    x <= route_match_cell(MAX(s->sd->c[j].x, s->sd->c[j + 1].x)) ; x++) {
+                for (y = route_match_cell(MIN(s->sd->c[j].y, s->sd->c[j + 1].y)) ;
+                        y <= route_match_cell(MAX(s->sd->c[j].y, s->sd->c[j + 1].y)) ; y++) {
+                    if (this->entry_count == entries_size) {
+                        entries_size = entries_size ? 2 * entries_size : 1024;
+                        this->entries = g_renew(struct route_match_entry, this->entries, entries_size);
+                    }
+                    e.x = x;
+                    e.y = y;
+                    this->entries[this->entry_count++] = e;
+                }
+            }
+        }
+        s->len = (int)(s->offset[s->sd->count - 1] + 0.5);
+    }
+    g_hash_table_destroy(nodes);
+    g_free(streets);
+    qsort(this->entries, this->entry_count, sizeof(*this->entries), route_match_entry_compare);
+
+    this->node_first = g_new0(int, this->node_count + 1);
+    this->node_streets = g_new(int, 2 * this->street_count);
+    for (i = 0 ; i < this->street_count ; i++) {
+        this->node_first[this->streets[i].node[0] + 1]++;
+        this->node_first[this->streets[i].node[1] + 1]++;
+    }
+    for (i = 0 ; i < this->node_count ; i++)
+        this->node_first[i + 1] += this->node_first[i];
+    fill = g_memdup(this->node_first, this->node_count * sizeof(int));
+    for (i = 0 ; i < this->street_count ; i++) {
+        this->node_streets[fill[this->streets[i].node[0]]++] = i;
+        this->node_streets[fill[this->streets[i].node[1]]++] = i;
+    }
+    g_free(fill);
+    dbg(lvl_debug, "indexed %d streets with %d nodes in %d entries", this->street_count, this->node_count,
+        this->entry_count);
+    return this;
+}
+
+/**
+ * @brief Frees a match index
+ *
+ * @param this The index, can be NULL
+ */
+void route_match_index_destroy(struct route_match_index *this) {
+    int i;
+
+    if (!this)
+        return;
+    for (i = 0 ; i < this->street_count ; i++) {
+        street_data_free(this->streets[i].sd);
+        g_free(this->streets[i].offset);
+    }
+    g_free(this->streets);
+    g_free(this->entries);
+    g_free(this->node_first);
+    g_free(this->node_streets);
+    g_free(this);
+}
+
+/**
+ * @brief Whether a match index covers an area
+ *
+ * @param this The index
+ * @param r The area, in `projection_mg`
+ *
+ * @return True if the area lies completely within the area read into the index
+ */
+int route_match_index_covers(struct route_match_index *this, struct coord_rect *r) {
+    return r->lu.x >= this->r.lu.x && r->rl.x <= this->r.rl.x && r->rl.y >= this->r.rl.y && r->lu.y <= this->r.lu.y;
+}
+
+/**
+ * @brief Returns the first entry of a cell
+ *
+ * @return The index of the first entry, or `entry_count` if the cell is empty
+ */
+static int route_match_cell_first(struct route_match_index *this, int x, int y) {
+    struct route_match_entry key;
+    int lo = 0, hi = this->entry_count, mid;
+
+    key.x = x;
+    key.y = y;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (route_match_entry_compare(&this->entries[mid], &key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < this->entry_count && route_match_entry_compare(&this->entries[lo], &key))
+        return this->entry_count;
+    return lo;
+}
+
+/**
+ * @brief Adds a segment to the candidates of a point, if it is closer than those found so far
+ *
+ * Candidates are kept sorted by distance, with at most one per street.
+ */
+static void route_match_consider(struct route_match_index *this, struct route_match_entry *e, struct coord *c,
+                                 int max_dist_sq, struct route_match_candidate *cands, int *count, int size) {
+    struct route_match_candidate cand;
+    struct street_data *sd = this->streets[e->street].sd;
+    int i;
+
+    cand.dist_sq = transform_distance_line_sq(&sd->c[e->pos], &sd->c[e->pos + 1], c, &cand.lp);
+    if (cand.dist_sq > max_dist_sq || (*count == size && cand.dist_sq >= cands[size - 1].dist_sq))
+        return;
+    for (i = 0 ; i < *count ; i++)
+        if (cands[i].street == e->street)
+            break;
+    if (i < *count) {
+        if (cand.dist_sq >= cands[i].dist_sq)
+            return;
+    } else if (*count < size)
+        (*count)++;
+    else
+        i = size - 1;
+    cand.street = e->street;
+    cand.pos = e->pos;
+    while (i > 0 && cands[i - 1].dist_sq > cand.dist_sq) {
+        cands[i] = cands[i - 1];
+        i--;
+    }
+    cands[i] = cand;
+}
+
+/**
+ * @brief Finds the nearest streets of a point
+ *
+ * Cells are searched in rings around the cell of the point, until the nearest streets found are closer than any
+ * street in the next ring could be.
+ *
+ * @param this The index
+ * @param profile The vehicle profile, streets it may not use in either direction are ignored
+ * @param c The point
+ * @param max_dist The maximum distance of a street, in map units
+ * @param cands Receives the candidates, sorted by distance
+ * @param size The maximum number of candidates
+ *
+ * @return The number of candidates found
+ */
+static int route_match_lookup(struct route_match_index *this, struct vehicleprofile *profile, struct coord *c,
+                              int max_dist, struct route_match_candidate *cands, int size) {
+    struct route_match_entry *e;
+    struct route_match_street *s;
+    int cx = route_match_cell(c->x), cy = route_match_cell(c->y), rings = max_dist / ROUTE_MATCH_CELL + 1;
+    int max_dist_sq = max_dist * max_dist, count = 0, r, x, y, i;
+    double inner;
+
+    for (r = 0 ; r <= rings ; r++) {
+        for (x = cx - r ; x <= cx + r ; x++) {
+            for (y = cy - r ; y <= cy + r ; y += (x == cx - r || x == cx + r) ? 1 : 2 * r) {
+                for (i = route_match_cell_first(this, x, y) ; i < this->entry_count ; i++) {
+                    e = &this->entries[i];
+                    if (e->x != x || e->y != y)
+                        break;
+                    s = &this->streets[e->street];
+                    if (route_match_allowed(profile, s->sd->flags, 0))
+                        route_match_consider(this, e, c, max_dist_sq, cands, &count, size);
+                }
+                if (!r)
+                    break;
+            }
+        }
+        inner = (double)r * ROUTE_MATCH_CELL;
+        if (count == size && cands[size - 1].dist_sq <= inner * inner)
+            break;
+    }
+    for (i = 0 ; i < count ; i++) {
+        s = &this->streets[cands[i].street];
+        cands[i].at = (int)(s->offset[cands[i].pos]
+                            + transform_distance(projection_mg, &s->sd->c[cands[i].pos], &cands[i].lp) + 0.5);
+    }
+    return count;
+}
+
+static void route_match_set_result(struct route_match_index *this, struct route_match_candidate *cand,
+                                   struct coord *c, struct route_match_result *result) {
+    result->street = this->streets[cand->street].sd;
+    result->pos = cand->pos;
+    result->lp = cand->lp;
+    result->dist = (int)(sqrt(cand->dist_sq) / transform_scale(c->y) + 0.5);
+}
+
+/**
+ * @brief Returns the streets near a point
+ *
+ * @param this The index
+ * @param c The point
+ * @param max_dist The maximum distance of the bounding box of a segment of the street from `c` along either axis,
+ *        in map units
+ * @param count Receives the number of streets
+ *
+ * @return The streets, owned by the index. The array itself must be freed by the caller with `g_free()`.
+ */
+struct street_data **route_match_index_get_streets(struct route_match_index *this, struct coord *c, int max_dist,
+        int *count) {
+    struct street_data **ret;
+    struct street_data *sd;
+    struct route_match_entry *e;
+    int x, y, i, last = -1, *ids = NULL, found = 0, size = 0;
+
+    for (x = route_match_cell(c->x - max_dist) ; x <= route_match_cell(c->x + max_dist) ; x++) {
+        for (y = route_match_cell(c->y - max_dist) ; y <= route_match_cell(c->y + max_dist) ; y++) {
+            for (i = route_match_cell_first(this, x, y) ; i < this->entry_count ; i++) {
+                e = &this->entries[i];
+                if (e->x != x || e->y != y)
+                    break;
+                sd = this->streets[e->street].sd;
+                if (MAX(sd->c[e->pos].x, sd->c[e->pos + 1].x) >= c->x - max_dist
+                        && MIN(sd->c[e->pos].x, sd->c[e->pos + 1].x) <= c->x + max_dist
+                        && MAX(sd->c[e->pos].y, sd->c[e->pos + 1].y) >= c->y - max_dist
+                        && MIN(sd->c[e->pos].y, sd->c[e->pos + 1].y) <= c->y + max_dist)
+                {
+                    if (found == size) {
+                        size = size ? 2 * size : 64;
+                        ids = g_renew(int, ids, size);
+                    }
+                    ids[found++] = e->street;
+                }
+            }
+        }
+    }
+    qsort(ids, found, sizeof(int), route_match_int_compare);
+    ret = g_new(struct street_data *, found);
+    *count = 0;
+    for (i = 0 ; i < found ; i++) {
+        if (ids[i] != last)
+            ret[(*count)++] = this->streets[ids[i]].sd;
+        last = ids[i];
+    }
+    g_free(ids);
+    return ret;
+}
+
+/**
+ * @brief Shared state of the threads matching points
+ */
+struct route_match_job {
+    struct route_match_index *index;        /**< The index */
+    struct vehicleprofile *profile;         /**< The vehicle profile */
+    struct coord *c;                        /**< The points */
+    int count;                              /**< Number of points */
+    int max_dist;                           /**< Maximum distance of a street, in map units */
+    struct route_match_result *results;     /**< The results */
+    struct thread_lock *lock;               /**< Protects `next` */
+    int next;                               /**< The next point to match */
+};
+
+/**
+ * @brief Matches points until all have been taken
+ *
+ * This is run by each thread participating in the job.
+ *
+ * @param job The job
+ */
+static void route_match_worker(struct route_match_job *job) {
+    struct route_match_candidate cand;
+    int i, start, end;
+
+    for (;;) {
+        thread_lock_acquire(job->lock);
+        start = job->next;
+        end = MIN(start + ROUTE_MATCH_CHUNK, job->count);
+        job->next = end;
+        thread_lock_release(job->lock);
+        if (start >= end)
+            break;
+        for (i = start ; i < end ; i++) {
+            if (route_match_lookup(job->index, job->profile, &job->c[i], job->max_dist, &cand, 1))
+                route_match_set_result(job->index, &cand, &job->c[i], &job->results[i]);
+            else
+                memset(&job->results[i], 0, sizeof(job->results[i]));
+        }
+    }
+}
+
+/**
+ * @brief Matches points to their nearest streets
+ *
+ * Points are matched independently, using up to `ROUTE_MATCH_THREADS` threads (including the calling one).
+ *
+ * @param this The index
+ * @param profile The vehicle profile, streets it may not use in either direction are ignored, can be NULL
+ * @param c The points, in `projection_mg`
+ * @param count The number of points
+ * @param max_dist The maximum distance of a street from a point, in map units
+ * @param results Receives one result per point
+ *
+ * @return The number of points which could be matched
+ */
+int route_match_snap(struct route_match_index *this, struct vehicleprofile *profile, struct coord *c, int count,
+                     int max_dist, struct route_match_result *results) {
+    struct route_match_job job;
+    struct thread **threads;
+    int i, ret = 0, thread_count = MIN((count + ROUTE_MATCH_CHUNK - 1) / ROUTE_MATCH_CHUNK, ROUTE_MATCH_THREADS);
+
+    memset(&job, 0, sizeof(job));
+    job.index = this;
+    job.profile = profile;
+    job.c = c;
+    job.count = count;
+    job.max_dist = max_dist;
+    job.results = results;
+    job.lock = thread_lock_new();
+    threads = g_new0(struct thread *, MAX(thread_count, 1));
+    for (i = 1 ; i < thread_count ; i++)
+        threads[i] = thread_new((void (*)(void *))route_match_worker, &job);
+    route_match_worker(&job);
+    for (i = 1 ; i < thread_count ; i++)
+        thread_join(threads[i]);
+    g_free(threads);
+    thread_lock_destroy(job.lock);
+    for (i = 0 ; i < count ; i++)
+        if (results[i].street)
+            ret++;
+    dbg(lvl_debug, "matched %d of %d points with up to %d threads", ret, count, thread_count);
+    return ret;
+}
+
+/**
+ * @brief Lowers the distance of a node during the search for distances along the streets
+ *
+ * @param nodes The nodes of the search
+ * @param heap The heap of the search
+ * @param touched The nodes reached so far
+ * @param touched_count The number of elements in `touched`
+ * @param id The node
+ * @param dist The distance at which it can be reached, in meters
+ */
+static void route_match_reach(struct route_match_node *nodes, struct dheap *heap, int *touched, int *touched_count,
+                              int id, int dist) {
+    if (dist >= nodes[id].dist)
+        return;
+    if (nodes[id].dist == INT_MAX)
+        touched[(*touched_count)++] = id;
+    nodes[id].dist = dist;
+    dheap_update(heap, &nodes[id], dist);
+}
+
+/**
+ * @brief Finds the distances along the streets from one candidate to those of the next point of a trace
+ *
+ * @param this The index
+ * @param profile The vehicle profile, can be NULL
+ * @param nodes The nodes of the search, all unreached, and left so
+ * @param heap The heap of the search, empty, and left so
+ * @param touched Used to remember the nodes reached, room for one element per node
+ * @param from The candidate to start from
+ * @param to The candidates of the next point
+ * @param count Number of elements in `to`
+ * @param limit The maximum distance, in meters
+ * @param dist Receives the distance to each of `to`, `INT_MAX` if it cannot be reached within `limit`
+ */
+static void route_match_distances(struct route_match_index *this, struct vehicleprofile *profile,
+                                  struct route_match_node *nodes, struct dheap *heap, int *touched,
+                                  struct route_match_candidate *from, struct route_match_candidate *to, int count,
+                                  int limit, int *dist) {
+    struct route_match_street *s = &this->streets[from->street], *t;
+    struct route_match_node *n;
+    int i, j, id, touched_count = 0;
+
+    if (route_match_allowed(profile, s->sd->flags, 1))
+        route_match_reach(nodes, heap, touched, &touched_count, s->node[1], s->len - from->at);
+    if (route_match_allowed(profile, s->sd->flags, -1))
+        route_match_reach(nodes, heap, touched, &touched_count, s->node[0], from->at);
+    while (dheap_size(heap) && dheap_minkey(heap) <= limit) {
+        n = dheap_extractmin(heap);
+        id = n - nodes;
+        for (i = this->node_first[id] ; i < this->node_first[id + 1] ; i++) {
+            t = &this->streets[this->node_streets[i]];
+            for (j = 0 ; j < 2 ; j++) {
+                if (t->node[j] == id && route_match_allowed(profile, t->sd->flags, j ? -1 : 1))
+                    route_match_reach(nodes, heap, touched, &touched_count, t->node[1 - j], n->dist + t->len);
+            }
+        }
+    }
+    for (i = 0 ; i < count ; i++) {
+        t = &this->streets[to[i].street];
+        dist[i] = INT_MAX;
+        if (to[i].street == from->street && route_match_allowed(profile, t->sd->flags, to[i].at >= from->at ? 1 : -1))
+            dist[i] = abs(to[i].at - from->at);
+        if (route_match_allowed(profile, t->sd->flags, 1) && nodes[t->node[0]].dist != INT_MAX)
+            dist[i] = MIN(dist[i], nodes[t->node[0]].dist + to[i].at);
+        if (route_match_allowed(profile, t->sd->flags, -1) && nodes[t->node[1]].dist != INT_MAX)
+            dist[i] = MIN(dist[i], nodes[t->node[1]].dist + t->len - to[i].at);
+        if (dist[i] > limit)
+            dist[i] = INT_MAX;
+    }
+    dheap_clear(heap);
+    for (i = 0 ; i < touched_count ; i++)
+        nodes[touched[i]].dist = INT_MAX;
+}
+
+/**
+ * @brief Stores the most likely candidates of a chain of points of a trace
+ *
+ * @param this The index
+ * @param c The points of the trace
+ * @param cands The candidates of each point
+ * @param score The score of each candidate
+ * @param back For each candidate, the candidate of the point before from which it is most likely reached
+ * @param ncands The number of candidates of each point
+ * @param first The first point of the chain
+ * @param last The last point of the chain
+ * @param results Receives the results
+ */
+static void route_match_backtrack(struct route_match_index *this, struct coord *c,
+                                  struct route_match_candidate *cands, double *score, int *back, int *ncands,
+                                  int first, int last, struct route_match_result *results) {
+    int i, k, best = 0;
+
+    for (k = 1 ; k < ncands[last] ; k++)
+        if (score[last * ROUTE_MATCH_CANDIDATES + k] > score[last * ROUTE_MATCH_CANDIDATES + best])
+            best = k;
+    for (i = last ; i >= first && best >= 0 ; i--) {
+        route_match_set_result(this, &cands[i * ROUTE_MATCH_CANDIDATES + best], &c[i], &results[i]);
+        best = back[i * ROUTE_MATCH_CANDIDATES + best];
+    }
+}
+
+/**
+ * @brief Matches the points of a trace to the streets it most likely followed
+ *
+ * Where a point is not near any street, or no candidate of a point can be reached from those of the point before,
+ * the trace is split and the parts are matched independently.
+ *
+ * @param this The index
+ * @param profile The vehicle profile, which determines the streets which may be followed in each direction, can be
+ *        NULL
+ * @param c The points of the trace, in order, in `projection_mg`
+ * @param count The number of points
+ * @param max_dist The maximum distance of a street from a point, in map units
+ * @param results Receives one result per point
+ *
+ * @return The number of points which could be matched
+ */
+int route_match_trace(struct route_match_index *this, struct vehicleprofile *profile, struct coord *c, int count,
+                      int max_dist, struct route_match_result *results) {
+    struct route_match_candidate *cands = g_new(struct route_match_candidate, count * ROUTE_MATCH_CANDIDATES);
+    struct route_match_candidate *prev, *curr;
+    struct route_match_node *nodes = g_new(struct route_match_node, MAX(this->node_count, 1));
+    struct dheap *heap = dheap_new(offsetof(struct route_match_node, heap_idx));
+    int *touched = g_new(int, MAX(this->node_count, 1));
+    double *score = g_new(double, count * ROUTE_MATCH_CANDIDATES), *sprev, *scurr;
+    double emission[ROUTE_MATCH_CANDIDATES], beeline, value;
+    int *back = g_new(int, count * ROUTE_MATCH_CANDIDATES), *ncands = g_new0(int, count);
+    int dist[ROUTE_MATCH_CANDIDATES], i, j, k, reached, first = -1, limit, ret = 0;
+
+    for (i = 0 ; i < this->node_count ; i++) {
+        nodes[i].heap_idx = 0;
+        nodes[i].dist = INT_MAX;
+    }
+    memset(results, 0, count * sizeof(*results));
+    for (i = 0 ; i < count ; i++) {
+        curr = &cands[i * ROUTE_MATCH_CANDIDATES];
+        scurr = &score[i * ROUTE_MATCH_CANDIDATES];
+        ncands[i] = route_match_lookup(this, profile, &c[i], max_dist, curr, ROUTE_MATCH_CANDIDATES);
+        for (k = 0 ; k < ncands[i] ; k++) {
+            value = sqrt(curr[k].dist_sq) / transform_scale(c[i].y) / ROUTE_MATCH_SIGMA;
+            emission[k] = -0.5 * value * value;
+            scurr[k] = -INFINITY;
+            back[i * ROUTE_MATCH_CANDIDATES + k] = -1;
+        }
+        reached = 0;
+        if (first >= 0 && ncands[i]) {
+            prev = &cands[(i - 1) * ROUTE_MATCH_CANDIDATES];
+            sprev = &score[(i - 1) * ROUTE_MATCH_CANDIDATES];
+            beeline = transform_distance(projection_mg, &c[i - 1], &c[i]);
+            limit = (int)(beeline * ROUTE_MATCH_DETOUR + 2 * max_dist / transform_scale(c[i].y));
+            for (j = 0 ; j < ncands[i - 1] ; j++) {
+                if (sprev[j] == -INFINITY)
+                    continue;
+                route_match_distances(this, profile, nodes, heap, touched, &prev[j], curr, ncands[i], limit, dist);
+                for (k = 0 ; k < ncands[i] ; k++) {
+                    if (dist[k] == INT_MAX)
+                        continue;
+                    value = sprev[j] + emission[k] - fabs(dist[k] - beeline) / ROUTE_MATCH_BETA;
+                    if (value > scurr[k]) {
+                        scurr[k] = value;
+                        back[i * ROUTE_MATCH_CANDIDATES + k] = j;
+                        reached = 1;
+                    }
+                }
+            }
+        }
+        if (first >= 0 && !reached) {
+            route_match_backtrack(this, c, cands, score, back, ncands, first, i - 1, results);
+            first = -1;
+        }
+        if (ncands[i] && first < 0) {
+            for (k = 0 ; k < ncands[i] ; k++)
+                scurr[k] = emission[k];
+            first = i;
+        }
+    }
+    if (first >= 0)
+        route_match_backtrack(this, c, cands, score, back, ncands, first, count - 1, results);
+    for (i = 0 ; i < count ; i++)
+        if (results[i].street)
+            ret++;
+    dbg(lvl_debug, "matched %d of %d points of a trace", ret, count);
+    dheap_destroy(heap);
+    g_free(touched);
+    g_free(nodes);
+    g_free(cands);
+    g_free(score);
+    g_free(back);
+    g_free(ncands);
+    return ret;
+}
@@ -38,8 +38,11 @@ extern "C" {
 #define RP_TRAFFIC_DISTORTION 1
 #define RP_TURN_RESTRICTION 2
 #define RP_TURN_RESTRICTION_RESOLVED 4
+#define RP_CSR_STALE 8
 
 #define RSD_MAXSPEED(x) *((int *)route_segment_data_field_pos((x), attr_maxspeed))
+#define RSD_SPEED_PROFILE(x) *((int *)route_segment_data_field_pos((x), attr_speed_profile))
+#define RSD_SCORE(x) *((int *)route_segment_data_field_pos((x), attr_score))
 
 /**
  * @brief A point in the route graph
@@ -48,15 +51,14 @@ extern "C" {
  * but there are also points which don't do that (e.g. at the end of a dead-end).
  */
 struct route_graph_point {
-	struct route_graph_point *hash_next; /**< Pointer to a chained hashlist of all route_graph_points with this hash */
+	struct route_graph_point *hash_next; /**< Pointer to the next (older) route_graph_point with the same coordinates */
 	struct route_graph_segment *start;   /**< Pointer to a list of segments of which this point is the start. The links
 	                                      *  of this linked-list are in route_graph_segment->start_next.*/
 	struct route_graph_segment *end;     /**< Pointer to a list of segments of which this pointer is the end. The links
 	                                      *  of this linked-list are in route_graph_segment->end_next. */
 	struct route_graph_segment *seg;     /**< Pointer to the segment one should use to reach the destination at
 	                                      *  least costs */
-	struct fibheap_el *el;				 /**< When this point is put on a Fibonacci heap, this is a pointer
-	                                      *  to this point's heap element */
+	int heap_idx;                        /**< Index slot for the heap, nonzero while this point is on a heap */
 	int value;                           /**< The cost at which one can reach the destination from this point on.
 	                                      *  {@code INT_MAX} indicates that the destination is unreachable from this
 	                                      *  point, or that this point has not yet been examined. */
@@ -70,21 +72,44 @@ struct route_graph_point {
 	int flags;                           /**< Flags for this point (e.g. traffic distortion) */
 };
 
+/**
+ * @brief The item which a segment represents
+ *
+ * This holds the fields of `struct item` which identify an item, but not its methods and private data, which are
+ * only valid while the map rectangle from which the item was obtained is open, and which would take up as much
+ * memory again. The fields have the same names as in `struct item`, so that `item_is_equal()` can compare both.
+ * Use `route_segment_data_get_item()` where a `struct item` is needed.
+ */
+struct route_segment_item {
+	enum item_type type;                 /**< Type of the item */
+	int id_hi;                           /**< First part of the ID of the item */
+	int id_lo;                           /**< Second part of the ID of the item */
+	struct map *map;                     /**< The map to which the item belongs */
+};
+
 /**
  * @brief A segment in the route graph or path
  *
  * This is a segment in the route graph or path. A segment represents a driveable way.
+ *
+ * Only the fields which are needed for every segment are part of this struct. Fields which most segments do not
+ * need follow it, see below, so that a segment of the route graph takes as little memory as possible.
  */
 struct route_segment_data {
-	struct item item;                    /**< The item (e.g. street) that this segment represents. */
+	struct route_segment_item item;      /**< The item (e.g. street) that this segment represents. */
 	int flags;                           /**< Flags e.g. for access, restrictions, segmentation or roundabouts. */
 	int len;                             /**< Length of this segment, in meters */
-	int score;                           /**< Used by the traffic module to give preference to some
-	                                      *   segments over others */
 	/*NOTE: After a segment, various fields may follow, depending on what flags are set. Order of fields:
 				1.) maxspeed			Maximum allowed speed on this segment. Present if AF_SPEED_LIMIT is set.
 				2.) offset				If the item is segmented (i.e. represented by more than one segment), this
 										indicates the position of this segment in the item. Present if AF_SEGMENTED is set.
+				3.) size_weight			Size and weight limits. Present if AF_SIZE_OR_WEIGHT_LIMIT is set.
+				4.) dangerous_goods		Restrictions for dangerous goods. Present if AF_DANGEROUS_GOODS is set.
+				5.) speed_profile		Number of the speed profile in the lower 16 bits, and the speed in percent
+										which applies at the time the segment is expected to be reached in the
+										next 8 bits (0 if not yet known). Present if AF_SPEED_PROFILE is set.
+				6.) score				Used by the traffic module to give preference to some segments over
+										others. Present if AF_SCORE is set, otherwise the score is 0.
 	 */
 };
 
@@ -113,6 +138,7 @@ struct route_graph_segment_data {
 	                                       *   -1 if not known */
 	struct size_weight_limit size_weight; /**< Size and weight limits for this segment */
 	int dangerous_goods;
+	int speed_profile;                    /**< Number of the speed profile, see route_speed_profile.c */
 	int score;                            /**< Used by the traffic module to give preference to some
 	                                       *   segments over others */
 };
@@ -133,6 +159,44 @@ struct route_graph_segment {
 	struct route_segment_data data;			/**< The segment data */
 };
 
+/**
+ * @brief A slot in the point hash table of a route graph
+ */
+struct route_graph_hash_entry {
+	struct coord c;                      /**< Coordinates of the points in this slot */
+	struct route_graph_point *p;         /**< The newest point at `c`, older ones are chained through `hash_next`;
+	                                      *   NULL if the slot is empty */
+};
+
+/**
+ * @brief Statistics for the point hash table of a route graph
+ */
+struct route_graph_hash_stats {
+	int size;                            /**< Number of slots */
+	int used;                            /**< Number of occupied slots, i.e. distinct coordinates */
+	int points;                          /**< Number of points, including those sharing coordinates */
+	double load_factor;                  /**< Ratio of occupied slots to all slots */
+	double avg_probe;                    /**< Average probe length, 0 if every point sits in its home slot */
+	int max_probe;                       /**< Maximum probe length */
+};
+
+/**
+ * @brief An entry in the adjacency array of a frozen route graph
+ *
+ * The edges of each point are stored contiguously: first the segments starting at the point, then the segments ending
+ * at it, each in the same order as in the point's `start` and `end` lists.
+ */
+struct route_graph_edge {
+	struct route_graph_segment *seg;     /**< The segment */
+	int other;                           /**< ID of the point at the other end of the segment */
+	int dir;                             /**< 1 if the point is the start of `seg`, -1 if it is the end */
+	int cost;                            /**< Cost of traveling along `seg` away from the point, without traffic
+	                                      *   distortions or penalties which depend on the next segment, `INT_MAX`
+	                                      *   if impassable, see `route_graph_compile_costs()` */
+	int cost_in;                         /**< Likewise for traveling along `seg` towards the point, also `INT_MAX`
+	                                      *   if `seg` is not a street item */
+};
+
 /**
  * @brief A complete route graph
  *
@@ -142,6 +206,9 @@ struct route_graph_segment {
 struct route_graph {
 	int busy;                                   /**< The graph is being built */
 	struct map_selection *sel;                  /**< The rectangle selection for the graph */
+	struct map_selection *extent;               /**< The selections which have been read into the graph so far, see
+	                                             *   `route_graph_extend()` */
+	int extended;                               /**< Number of times the graph has been extended */
 	struct mapset_handle *h;                    /**< Handle to the mapset */
 	struct map *m;                              /**< Pointer to the currently active map */
 	struct map_rect *mr;                        /**< Pointer to the currently active map rectangle */
@@ -151,13 +218,78 @@ struct route_graph {
 	struct event_idle *idle_ev;                 /**< The pointer to the idle event */
 	struct route_graph_segment *route_segments; /**< Pointer to the first route_graph_segment in the linked list of all segments */
 	struct route_graph_segment *avoid_seg;
-	struct fibheap *heap;                       /**< Priority queue for points to be expanded */
-#define HASH_SIZE 8192
-	struct route_graph_point *hash[HASH_SIZE];  /**< A hashtable containing all route_graph_points in this graph */
+	struct dheap *heap;                         /**< Priority queue for points to be expanded */
+	int ch;                                     /**< The graph only holds a corridor found with contraction hierarchy data */
+	struct route_graph_point *points;           /**< For a frozen graph, all points which existed at the time of
+	                                             *   freezing, indexed by their ID */
+	int point_count;                            /**< Number of elements in `points` */
+	int *edge_offset;                           /**< For each point ID, the index of its first edge in `edges`, followed
+	                                             *   by the total number of edges */
+	struct route_graph_edge *edges;             /**< Edges of all points in `points` */
+	struct vehicleprofile *cost_profile;        /**< The vehicle profile for which the costs in `edges` were compiled,
+	                                             *   NULL if they have not been compiled */
+	unsigned int cost_hash;                     /**< Hash of `cost_profile` at the time the costs were compiled */
+	struct route_graph_hash_entry *hash;        /**< Open-addressing (Robin Hood) hash table of all points, keyed by
+	                                             *   their coordinates */
+	int hash_size;                              /**< Number of slots in `hash`, always a power of two */
+	int hash_used;                              /**< Number of occupied slots in `hash` */
+	int hash_points;                            /**< Number of points in `hash`, including those sharing coordinates */
+	struct thread *thread;                      /**< Worker thread reading `thread_maps`, NULL if not running. While
+	                                             *   it is set, the graph must not be accessed from the main thread. */
+	struct thread_lock *thread_lock;            /**< Protects `thread_cancel` and `thread_done` */
+	int thread_cancel;                          /**< Set by the main thread to tell the worker thread to stop */
+	int thread_done;                            /**< Set by the worker thread when it has finished */
+	GList *thread_maps;                         /**< Maps which are read on the worker thread */
+	struct callback *thread_cb;                 /**< Callback which polls the worker thread */
+	struct event_timeout *thread_ev;            /**< The timeout event which calls `thread_cb` */
+	char *cache_key;                            /**< Key of the on-disk cache for this graph, NULL if not cached */
+	GList *cache_maps;                          /**< Maps whose data is covered by the on-disk cache */
+	int cache_loaded;                           /**< The data from `cache_maps` was loaded from the cache */
+	int heuristic;                              /**< A goal is set and LPA* uses a heuristic, see
+	                                             *   `route_graph_set_goal()` */
+	struct item heuristic_item;                 /**< The street of the goal */
+	struct coord heuristic_c0;                  /**< The first coordinate of `heuristic_item` */
+	struct coord heuristic_c;                   /**< The coordinates from which the heuristic is calculated */
+	double heuristic_factor;                    /**< Minimum cost per unit of straight-line distance in this graph,
+	                                             *   0 if not yet calculated, negative if unknown */
+	int expanded;                               /**< Number of points expanded by LPA* in this graph so far */
+	double build_start;                         /**< Processor time at which building the graph started, see
+	                                             *   `route_graph_clock()` */
+	double build_time;                          /**< Processor time taken to build the graph, in milliseconds */
+	double flood_time;                          /**< Processor time spent by LPA* on this graph so far, in
+	                                             *   milliseconds */
+	struct route_landmarks *landmarks;          /**< Landmark tables for the heuristic, NULL if none (not owned by
+	                                             *   the graph) */
+	int *landmark_index;                        /**< For a frozen graph, the index of each point in `landmarks`, -1 if
+	                                             *   it has none, -2 if not yet looked up */
+	int heuristic_landmarks[8];                 /**< Indices of the end points of the goal's street in `landmarks` */
+	int heuristic_landmark_count;               /**< Number of valid elements in `heuristic_landmarks`, 0 if landmarks
+	                                             *   are not used for the current goal */
+	struct route_speed_profiles *speed_profiles; /**< Speed profiles for time-dependent costs, NULL if costs do not
+	                                             *   depend on time (not owned by the graph) */
+	long departure;                             /**< Time of departure for time-dependent costs, in seconds since
+	                                             *   the epoch, see `route_graph_set_departure()` */
+};
+
+/**
+ * @brief The street to which a point was matched, see route_match.c
+ */
+struct route_match_result {
+	struct street_data *street;         /**< The street, owned by the match index, NULL if the point could not be
+	                                     *   matched */
+	int pos;                            /**< Index of the segment of `street` which contains `lp` */
+	struct coord lp;                    /**< The matched position on the street */
+	int dist;                           /**< Distance of `lp` from the point, in meters */
 };
 
 
 /* prototypes */
+struct mapset;
+struct map_selection;
+struct vehicleprofile;
+struct route_landmarks;
+struct route_speed_profiles;
+struct route_match_index;
 struct route_graph * route_get_graph(struct route *this_);
 struct map_selection * route_get_selection(struct route * this_);
 void route_add_traffic_distortion(struct route *this_, struct item *item);
@@ -165,10 +297,14 @@ void route_remove_traffic_distortion(struct route *this_, struct item *item);
 void route_change_traffic_distortion(struct route *this_, struct item *item);
 struct route_graph_point * route_graph_add_point(struct route_graph *this, struct coord *f);
 void route_graph_add_turn_restriction(struct route_graph *this, struct item *item);
+void route_graph_add_turn_restriction_coords(struct route_graph *this, struct item *item, struct coord *c,
+		int count);
 void route_graph_free_points(struct route_graph *this);
 struct route_graph_point *route_graph_get_point(struct route_graph *this, struct coord *c);
 struct route_graph_point *route_graph_get_point_next(struct route_graph *this, struct coord *c,
         struct route_graph_point *last);
+struct route_graph_point *route_graph_next_point(struct route_graph *this, struct route_graph_point *p, int *slot);
+void route_graph_get_hash_stats(struct route_graph *this, struct route_graph_hash_stats *stats);
 void route_graph_add_segment(struct route_graph *this, struct route_graph_point *start,
 		struct route_graph_point *end, struct route_graph_segment_data *data);
 int route_graph_segment_is_duplicate(struct route_graph_point *start, struct route_graph_segment_data *data);
@@ -176,6 +312,33 @@ void route_graph_free_segments(struct route_graph *this);
 void route_graph_build_done(struct route_graph *rg, int cancel);
 void route_recalculate_partial(struct route *this_);
 void * route_segment_data_field_pos(struct route_segment_data *seg, enum attr_type type);
+struct item *route_segment_data_get_item(struct route_segment_data *seg, struct item *item);
+void route_graph_cache_snap_selection(struct map_selection *sel);
+char *route_graph_cache_key(struct mapset *ms, struct map_selection *sel, struct vehicleprofile *profile,
+                            GList **maps);
+int route_graph_cache_load(struct route_graph *rg);
+int route_graph_cache_save(struct route_graph *rg);
+int route_graph_segment_base_cost(struct vehicleprofile *profile, struct route_graph_segment *over, int dir);
+struct route_landmarks *route_landmarks_load(struct mapset *ms, struct vehicleprofile *profile);
+int route_landmarks_is_current(struct route_landmarks *this, struct mapset *ms, struct vehicleprofile *profile);
+void route_landmarks_destroy(struct route_landmarks *this);
+int route_landmarks_lookup(struct route_landmarks *this, struct coord *c);
+int route_landmarks_bound(struct route_landmarks *this, int from, int to);
+int route_landmarks_save(struct route_graph *rg, struct mapset *ms, struct vehicleprofile *profile, int count);
+struct route_speed_profiles *route_speed_profiles_load(struct mapset *ms);
+int route_speed_profiles_is_current(struct route_speed_profiles *this, struct mapset *ms);
+void route_speed_profiles_destroy(struct route_speed_profiles *this);
+int route_speed_profiles_minute(long t);
+int route_speed_profiles_percent(struct route_speed_profiles *this, int id, int minute);
+struct route_match_index *route_match_index_new(struct mapset *ms, struct coord_rect *r);
+void route_match_index_destroy(struct route_match_index *this);
+int route_match_index_covers(struct route_match_index *this, struct coord_rect *r);
+struct street_data **route_match_index_get_streets(struct route_match_index *this, struct coord *c, int max_dist,
+        int *count);
+int route_match_snap(struct route_match_index *this, struct vehicleprofile *profile, struct coord *c, int count,
+                     int max_dist, struct route_match_result *results);
+int route_match_trace(struct route_match_index *this, struct vehicleprofile *profile, struct coord *c, int count,
+                      int max_dist, struct route_match_result *results);
 /* end of prototypes */
 #ifdef __cplusplus
 }
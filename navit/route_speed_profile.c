@@ -0,0 +1,256 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Speed profiles by time of week for time-dependent routing
+ *
+ * A speed profile describes how fast traffic flows on a street over the course of a week, as a percentage of the
+ * speed which the vehicle profile assumes for the street. Streets refer to a profile by its number, through the
+ * `speed_profile` attribute of their item. The profiles themselves are shared by all streets and stored once, so a
+ * street with a profile only takes four more bytes in the route graph (see `AF_SPEED_PROFILE`).
+ *
+ * The profiles are read from a text file next to the first map file of the mapset, with `.speeds` appended to its
+ * name. Each line holds the number of a profile (0 to 65535), followed by its percentages for consecutive,
+ * equally long intervals of the week, starting on Monday at midnight local time, e.g. 168 values for one per hour.
+ * Values are separated by blanks, empty lines and lines starting with `#` are ignored. Percentages are limited to
+ * 1 to 100: the speed of the vehicle profile is taken as the speed at which traffic flows freely, so the heuristic
+ * and the landmark tables of the router, which are based on that speed, remain valid lower bounds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "mapset.h"
+#include "file.h"
+#include "route_protected.h"
+
+/** Number of minutes in a week */
+#define ROUTE_SPEED_PROFILE_WEEK (7*24*60)
+
+/** Maximum number of a speed profile */
+#define ROUTE_SPEED_PROFILE_MAX_ID 0xffff
+
+/** Maximum length of a line in a speed profile file */
+#define ROUTE_SPEED_PROFILE_MAX_LINE 65536
+
+/**
+ * @brief A speed profile
+ */
+struct route_speed_profile {
+    int count;                  /**< Number of intervals */
+    unsigned char percent[0];   /**< Percentage of the free-flow speed for each interval */
+};
+
+/**
+ * @brief Loaded speed profiles
+ */
+struct route_speed_profiles {
+    char *filename;                         /**< The file the profiles were read from */
+    int size;                               /**< Number of elements in `profiles` */
+    struct route_speed_profile **profiles;  /**< The profiles, indexed by their number, NULL for unused numbers */
+};
+
+/**
+ * @brief Returns the file name for the speed profiles of a mapset
+ *
+ * @param ms The mapset
+ *
+ * @return The file name, to be freed by the caller, or NULL if no map of the mapset has a file name
+ */
+static char *route_speed_profiles_filename(struct mapset *ms) {
+    struct mapset_handle *msh;
+    struct file_wordexp *wexp;
+    struct map *m;
+    struct attr data;
+    char *ret=NULL;
+
+    msh=mapset_open(ms);
+    while (!ret && (m=mapset_next(msh, 1))) {
+        if (!map_get_attr(m, attr_data, &data, NULL))
+            continue;
+        wexp=file_wordexp_new(data.u.str);
+        if (file_wordexp_get_count(wexp) > 0)
+            ret=g_strconcat(file_wordexp_get_array(wexp)[0], ".speeds", NULL);
+        file_wordexp_destroy(wexp);
+    }
+    mapset_close(msh);
+    return ret;
+}
+
+/**
+ * @brief Parses one line of a speed profile file and adds the profile to `this`
+ *
+ * @param this The profiles
+ * @param line The line
+ *
+ * @return True if the line is valid, empty or a comment
+ */
+static int route_speed_profiles_parse(struct route_speed_profiles *this, char *line) {
+    struct route_speed_profile *profile;
+    unsigned char percent[ROUTE_SPEED_PROFILE_WEEK];
+    char *end;
+    long id,val;
+    int count=0;
+
+    line+=strspn(line, " \t\r\n");
+    if (!*line || *line == '#')
+        return 1;
+    id=strtol(line, &end, 10);
+    if (end == line || id < 0 || id > ROUTE_SPEED_PROFILE_MAX_ID)
+        return 0;
+    for (line = end ; ; line = end) {
+        val=strtol(line, &end, 10);
+        if (end == line)
+            break;
+        if (count == ROUTE_SPEED_PROFILE_WEEK)
+            return 0;
+        percent[count++]=val < 1 ? 1 : (val > 100 ? 100 : val);
+    }
+    if (!count || line[strspn(line, " \t\r\n")])
+        return 0;
+    if (id >= this->size) {
+        this->profiles=g_renew(struct route_speed_profile *, this->profiles, id+1);
+        memset(this->profiles+this->size, 0, (id+1-this->size)*sizeof(*this->profiles));
+        this->size=id+1;
+    }
+    profile=g_malloc(sizeof(*profile)+count);
+    profile->count=count;
+    memcpy(profile->percent, percent, count);
+    g_free(this->profiles[id]);
+    this->profiles[id]=profile;
+    return 1;
+}
+
+/**
+ * @brief Loads the speed profiles for a mapset
+ *
+ * @param ms The mapset
+ *
+ * @return The profiles, or NULL if there is no valid speed profile file for the mapset
+ */
+struct route_speed_profiles *route_speed_profiles_load(struct mapset *ms) {
+    struct route_speed_profiles *ret;
+    char *line,*filename=route_speed_profiles_filename(ms);
+    FILE *f;
+    int lineno=0;
+
+    if (!filename)
+        return NULL;
+    f=fopen(filename, "r");
+    if (!f) {
+        dbg(lvl_debug,"no speed profiles in %s", filename);
+        g_free(filename);
+        return NULL;
+    }
+    ret=g_new0(struct route_speed_profiles, 1);
+    ret->filename=filename;
+    line=g_malloc(ROUTE_SPEED_PROFILE_MAX_LINE);
+    while (fgets(line, ROUTE_SPEED_PROFILE_MAX_LINE, f)) {
+        lineno++;
+        if (!route_speed_profiles_parse(ret, line)) {
+            dbg(lvl_error,"%s:%d: invalid speed profile", filename, lineno);
+            route_speed_profiles_destroy(ret);
+            ret=NULL;
+            break;
+        }
+    }
+    fclose(f);
+    g_free(line);
+    if (ret)
+        dbg(lvl_debug,"loaded speed profiles up to %d from %s", ret->size-1, filename);
+    return ret;
+}
+
+/**
+ * @brief Whether speed profiles belong to a mapset
+ *
+ * @param this The profiles
+ * @param ms The mapset
+ *
+ * @return True if the profiles were read from the file which belongs to `ms`
+ */
+int route_speed_profiles_is_current(struct route_speed_profiles *this, struct mapset *ms) {
+    char *filename=route_speed_profiles_filename(ms);
+    int ret=filename && !strcmp(filename, this->filename);
+
+    g_free(filename);
+    return ret;
+}
+
+/**
+ * @brief Frees speed profiles
+ *
+ * @param this The profiles, can be NULL
+ */
+void route_speed_profiles_destroy(struct route_speed_profiles *this) {
+    int i;
+
+    if (!this)
+        return;
+    for (i = 0 ; i < this->size ; i++)
+        g_free(this->profiles[i]);
+    g_free(this->profiles);
+    g_free(this->filename);
+    g_free(this);
+}
+
+/**
+ * @brief Returns the minute of the week for a point in time
+ *
+ * @param t The time, in seconds since the epoch
+ *
+ * @return The number of minutes since Monday, midnight local time
+ */
+int route_speed_profiles_minute(long t) {
+    time_t tt=t;
+    struct tm *tm=localtime(&tt);
+
+    if (!tm)
+        return 0;
+    return ((tm->tm_wday+6)%7*24+tm->tm_hour)*60+tm->tm_min;
+}
+
+/**
+ * @brief Returns the speed of a profile at a given time
+ *
+ * @param this The profiles, can be NULL
+ * @param id The number of the profile
+ * @param minute The minute of the week, see `route_speed_profiles_minute()`, may exceed the length of a week
+ *
+ * @return The speed in percent of the free-flow speed, 100 if the profile does not exist
+ */
+int route_speed_profiles_percent(struct route_speed_profiles *this, int id, int minute) {
+    struct route_speed_profile *profile;
+
+    if (!this || id < 0 || id >= this->size || !(profile=this->profiles[id]))
+        return 100;
+    minute%=ROUTE_SPEED_PROFILE_WEEK;
+    if (minute < 0)
+        minute+=ROUTE_SPEED_PROFILE_WEEK;
+    return profile->percent[minute*profile->count/ROUTE_SPEED_PROFILE_WEEK];
+}
@@ -53,4 +53,8 @@ char* g_convert               (const char  *str,
 
 #define g_thread_supported() TRUE
 
+/* Sets up the locks of the slice allocator, to be called by programs using the internal glib before any thread is
+ * started */
+void _g_slice_thread_init_nomessage(void);
+
 #define g_assert(expr) dbg_assert (expr)
@@ -0,0 +1,222 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Minimal worker thread and lock abstraction
+ *
+ * Navit runs almost everything on the main thread, driven by the event loop. This module is meant for the few tasks
+ * which can be done in the background without touching any state shared with the main thread, other than through
+ * the locks provided here. Results are handed back to the main thread by the caller, e.g. through a timeout event.
+ */
+
+#include <glib.h>
+#include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "debug.h"
+#include "thread.h"
+
+/**
+ * @brief A worker thread
+ */
+struct thread {
+#ifdef HAVE_PTHREAD
+    pthread_t id;               /**< The thread ID */
+#endif
+    void (*func)(void *data);   /**< The function run by the thread */
+    void *data;                 /**< Argument passed to `func` */
+};
+
+/**
+ * @brief A lock (mutex)
+ */
+struct thread_lock {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;      /**< The underlying mutex */
+#else
+    int dummy;
+#endif
+};
+
+/**
+ * @brief A condition variable, used together with a lock
+ */
+struct thread_cond {
+#ifdef HAVE_PTHREAD
+    pthread_cond_t cond;        /**< The underlying condition variable */
+#else
+    int dummy;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+static void *thread_main(void *data) {
+    struct thread *this_=data;
+    this_->func(this_->data);
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Starts a new thread
+ *
+ * @param func The function to run on the new thread
+ * @param data The argument to pass to `func`
+ *
+ * @return The thread, which must eventually be passed to `thread_join()`, or NULL if threads are not supported or
+ * the thread could not be created. In that case `func` has not been called.
+ */
+struct thread *thread_new(void (*func)(void *data), void *data) {
+#ifdef HAVE_PTHREAD
+    struct thread *ret=g_new0(struct thread, 1);
+    ret->func=func;
+    ret->data=data;
+    if (pthread_create(&ret->id, NULL, thread_main, ret)) {
+        dbg(lvl_error,"failed to create thread");
+        g_free(ret);
+        return NULL;
+    }
+    return ret;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Waits for a thread to finish and frees it
+ *
+ * @param this_ The thread, can be NULL
+ */
+void thread_join(struct thread *this_) {
+    if (!this_)
+        return;
+#ifdef HAVE_PTHREAD
+    pthread_join(this_->id, NULL);
+#endif
+    g_free(this_);
+}
+
+/**
+ * @brief Creates a new lock
+ *
+ * @return The lock. Without thread support, this is still a valid object, but locking it does nothing.
+ */
+struct thread_lock *thread_lock_new(void) {
+    struct thread_lock *ret=g_new0(struct thread_lock, 1);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&ret->mutex, NULL);
+#endif
+    return ret;
+}
+
+/**
+ * @brief Destroys a lock
+ *
+ * @param this_ The lock, which must not be held by any thread, can be NULL
+ */
+void thread_lock_destroy(struct thread_lock *this_) {
+    if (!this_)
+        return;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&this_->mutex);
+#endif
+    g_free(this_);
+}
+
+/**
+ * @brief Acquires a lock, waiting for another thread to release it if needed
+ *
+ * Locks are not recursive: a thread must not acquire a lock it already holds.
+ *
+ * @param this_ The lock, can be NULL (in which case nothing happens)
+ */
+void thread_lock_acquire(struct thread_lock *this_) {
+#ifdef HAVE_PTHREAD
+    if (this_)
+        pthread_mutex_lock(&this_->mutex);
+#endif
+}
+
+/**
+ * @brief Releases a lock
+ *
+ * @param this_ The lock, can be NULL (in which case nothing happens)
+ */
+void thread_lock_release(struct thread_lock *this_) {
+#ifdef HAVE_PTHREAD
+    if (this_)
+        pthread_mutex_unlock(&this_->mutex);
+#endif
+}
+
+/**
+ * @brief Creates a new condition variable
+ *
+ * @return The condition variable. Without thread support, this is still a valid object, but waiting on it returns
+ * immediately.
+ */
+struct thread_cond *thread_cond_new(void) {
+    struct thread_cond *ret=g_new0(struct thread_cond, 1);
+#ifdef HAVE_PTHREAD
+    pthread_cond_init(&ret->cond, NULL);
+#endif
+    return ret;
+}
+
+/**
+ * @brief Destroys a condition variable
+ *
+ * @param this_ The condition variable, which no thread may be waiting on, can be NULL
+ */
+void thread_cond_destroy(struct thread_cond *this_) {
+    if (!this_)
+        return;
+#ifdef HAVE_PTHREAD
+    pthread_cond_destroy(&this_->cond);
+#endif
+    g_free(this_);
+}
+
+/**
+ * @brief Waits until a condition variable is signaled
+ *
+ * The lock is released while waiting and acquired again before returning. As wakeups may be spurious, callers must
+ * check their condition again after this function returns.
+ *
+ * @param this_ The condition variable
+ * @param lock The lock protecting the condition, which the calling thread must hold
+ */
+void thread_cond_wait(struct thread_cond *this_, struct thread_lock *lock) {
+#ifdef HAVE_PTHREAD
+    pthread_cond_wait(&this_->cond, &lock->mutex);
+#endif
+}
+
+/**
+ * @brief Wakes up all threads waiting on a condition variable
+ *
+ * @param this_ The condition variable
+ */
+void thread_cond_broadcast(struct thread_cond *this_) {
+#ifdef HAVE_PTHREAD
+    pthread_cond_broadcast(&this_->cond);
+#endif
+}
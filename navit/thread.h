@@ -0,0 +1,56 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Minimal worker thread and lock abstraction
+ *
+ * On platforms without thread support, `thread_new()` returns NULL and the lock functions do nothing, so callers
+ * must be prepared to do the work on the main thread instead.
+ */
+
+#ifndef NAVIT_THREAD_H
+#define NAVIT_THREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct thread;
+struct thread_lock;
+struct thread_cond;
+
+/* prototypes */
+struct thread *thread_new(void (*func)(void *data), void *data);
+void thread_join(struct thread *this_);
+struct thread_lock *thread_lock_new(void);
+void thread_lock_destroy(struct thread_lock *this_);
+void thread_lock_acquire(struct thread_lock *this_);
+void thread_lock_release(struct thread_lock *this_);
+struct thread_cond *thread_cond_new(void);
+void thread_cond_destroy(struct thread_cond *this_);
+void thread_cond_wait(struct thread_cond *this_, struct thread_lock *lock);
+void thread_cond_broadcast(struct thread_cond *this_);
+/* end of prototypes */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -447,10 +447,26 @@ static void tracking_doupdate_lines(struct tracking *tr, struct coord *pc, enum
     struct item *item;
     struct street_data *street;
     struct tracking_line *tl;
+    struct street_data **streets;
     struct coord_geo g;
     struct coord cc;
+    int i,count;
 
     dbg(lvl_debug,"enter");
+    if (pro == projection_mg && tr->rt && (streets=route_get_match_streets(tr->rt, pc, max_dist, &count))) {
+        /* The streets around the position have already been read for map matching */
+        for (i = 0 ; i < count ; i++) {
+            street=street_data_dup(streets[i]);
+            tl=g_malloc(sizeof(struct tracking_line)+(street->count-1)*sizeof(int));
+            tl->street=street;
+            tracking_get_angles(tl);
+            tl->next=tr->lines;
+            tr->lines=tl;
+        }
+        g_free(streets);
+        dbg(lvl_debug, "exit, %d streets from the map matching index", count);
+        return;
+    }
     h=mapset_open(tr->ms);
     while ((m=mapset_next(h,2))) {
         cc.x = pc->x;
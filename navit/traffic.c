@@ -25,6 +25,7 @@
  * Traffic distortions are used by Navit to route around traffic problems.
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
@@ -47,7 +48,8 @@
 #include "xmlconfig.h"
 #include "traffic.h"
 #include "plugin.h"
-#include "fib.h"
+#include "dheap.h"
+#include "thread.h"
 #include "event.h"
 #include "callback.h"
 #include "vehicleprofile.h"
@@ -92,6 +94,21 @@
 /** Time slice for idle loops, in milliseconds */
 #define TIME_SLICE 40
 
+/** Number of threads matching the locations of traffic messages to the map in the background */
+#define TRAFFIC_MATCH_THREADS 8
+
+/** Maximum number of queued messages whose locations are being matched ahead of processing them at any time */
+#define TRAFFIC_MATCH_BATCH 64
+
+/** Interval at which the idle loop checks for matching results while it waits for them, in milliseconds */
+#define TRAFFIC_MATCH_POLL_INTERVAL 50
+
+/** Size of the tiles in the segment cache, in map coordinates (about 16 km for Mercator) */
+#define TRAFFIC_SEGMENT_CACHE_TILE_SIZE 16384
+
+/** Maximum memory used by tiles in the segment cache which are not in use, in bytes */
+#define TRAFFIC_SEGMENT_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
 /** Default value assumed for access flags if we cannot get flags for the item, nor for the item type */
 int item_default_flags_value = AF_ALL;
 
@@ -105,6 +122,8 @@ struct traffic_shared_priv {
     struct mapset *ms;          /**< The mapset used for routing */
     struct route *rt;           /**< The route to notify of traffic changes */
     struct map *map;            /**< The traffic map, in which traffic distortions are stored */
+    struct traffic_segment_cache *cache; /**< Road segments read from the maps for location matching */
+    struct traffic_match_pool *pool; /**< Threads matching message locations in the background, NULL until used */
 };
 
 /**
@@ -122,6 +141,8 @@ struct traffic {
     struct event_timeout * timeout; /**< The timeout event that triggers the loop function */
     struct callback *idle_cb;    /**< Idle callback to process new messages */
     struct event_idle *idle_ev;  /**< The pointer to the idle event */
+    struct event_timeout *wait_ev; /**< Timeout which calls `idle_cb` instead of `idle_ev` while the message at the
+                                    *   head of the queue is being matched in the background */
 };
 
 struct traffic_location_priv {
@@ -134,6 +155,96 @@ struct traffic_location_priv {
 
 struct traffic_message_priv {
     struct item **items;        /**< The items for this message in the traffic map */
+    GList *matched;             /**< Segments matched ahead of time by `traffic_match_messages()`, which have not
+                                 *   been added to the traffic map yet */
+    int is_matched;             /**< 0 if the location has not been matched ahead of time, -1 while it is being
+                                 *   matched in the background, else 1 if matching failed and 2 if it succeeded */
+};
+
+/**
+ * @brief A segment matched to a traffic location, which has not been added to the traffic map yet.
+ */
+struct traffic_matched_segment {
+    int id_hi;                  /**< The high part of the ID of the map item the segment belongs to */
+    int id_lo;                  /**< The low part of the ID of the map item the segment belongs to */
+    int flags;                  /**< The flags for the traffic map item */
+    int speed;                  /**< The maximum speed for the segment (`INT_MAX` if none given) */
+    int delay;                  /**< The delay for the segment, in tenths of seconds (0 for none) */
+    int count;                  /**< The number of coordinates */
+    struct coord c[0];          /**< The coordinates */
+};
+
+/**
+ * @brief Worker threads matching the locations of traffic messages to the map in the background.
+ *
+ * The pool is created on first use and kept for the lifetime of the traffic module. While a message is in `pending`
+ * or being matched, its `is_matched` member is -1 and its `is_matched` and `matched` members may only be accessed
+ * while holding `lock`. Once `is_matched` has changed to a different value, the message belongs to the main thread
+ * again.
+ */
+struct traffic_match_pool {
+    struct thread **threads;    /**< The worker threads */
+    int thread_count;           /**< The number of elements in `threads` */
+    struct thread_lock *lock;   /**< Protects all members below, see above */
+    struct thread_cond *cond;   /**< Signaled when messages are added to `pending` */
+    GList *pending;             /**< Messages waiting to be matched, in the order in which they were submitted */
+    int busy;                   /**< Messages submitted whose matching has not finished yet */
+    GList *maps;                /**< The maps to use for matching, a copy of the list returned by
+                                 *   `traffic_segment_cache_check_maps()` when messages were last submitted */
+    struct traffic_segment_cache *cache; /**< The segment cache to use for matching */
+};
+
+/**
+ * @brief A routable item or turn restriction, as read from a map by the segment cache.
+ */
+struct traffic_segment_cache_item {
+    struct item item;           /**< Type, ID and map of the item (there are no methods to read it) */
+    struct coord_rect r;        /**< The bounding box of the item */
+    int flags;                  /**< The access flags of the item, or the default flags for its type */
+    int maxspeed;               /**< The speed limit of the item, -1 if none */
+    char *name;                 /**< The street name, NULL if none */
+    char *name_systematic;      /**< The systematic street name (road reference), NULL if none */
+    int count;                  /**< The number of coordinates */
+    struct coord *c;            /**< The coordinates */
+    unsigned char *is_node;     /**< For each coordinate, whether it ends a segment of a segmented item */
+};
+
+/**
+ * @brief The items of one map in one tile of the segment cache.
+ *
+ * Tiles are read-only once they have been loaded and can be used by several threads at once.
+ */
+struct traffic_segment_cache_tile {
+    struct map *m;              /**< The map the items were read from */
+    int order;                  /**< The map order for which the items were read */
+    int x, y;                   /**< The position of the tile, in tile units */
+    int refcount;               /**< References held by users of the tile, plus one while it is in the cache */
+    int size;                   /**< The memory used by the tile, in bytes */
+    int count;                  /**< The number of items */
+    struct traffic_segment_cache_item *items; /**< The items overlapping the tile */
+    GList *lru;                 /**< The entry of the tile in the LRU list of the cache */
+};
+
+/**
+ * @brief A cache of road segments read from the maps for traffic location matching.
+ *
+ * Matching a location requires a route graph of all roads around it. Many locations cover the same roads, so rather
+ * than reading the map again for each of them, the routable items are read once per tile of
+ * `TRAFFIC_SEGMENT_CACHE_TILE_SIZE` map units and shared by all matches. Tiles are kept across processing passes
+ * until the maps they were read from change, see `traffic_segment_cache_check_maps()`. They are reference-counted;
+ * the least recently used tiles are dropped when the cache exceeds its size limit.
+ */
+struct traffic_segment_cache {
+    GHashTable *tiles;          /**< The tiles in the cache, key and value are the tile */
+    GList *lru;                 /**< The tiles in the cache, most recently used first */
+    struct thread_lock *lock;   /**< Protects all members, but not the contents of tiles */
+    int max_size;               /**< The maximum memory used by the tiles in the cache, in bytes */
+    int size;                   /**< The memory currently used by the tiles in the cache, in bytes */
+    int hits;                   /**< Tiles found in the cache since the last flush */
+    int misses;                 /**< Tiles read from the map since the last flush */
+    int evictions;              /**< Tiles dropped to keep the cache within its size limit since the last flush */
+    GList *maps;                /**< The maps of the mapset when the cache was last checked, see
+                                 *   `traffic_segment_cache_check_maps()` */
 };
 
 /**
@@ -294,14 +405,20 @@ static int tm_attr_get(void *priv_data, enum attr_type attr_type, struct attr *a
 static int tm_type_set(void *priv_data, enum item_type type);
 static struct map_selection * traffic_location_get_rect(struct traffic_location * this_, enum projection projection);
 static struct route_graph * traffic_location_get_route_graph(struct traffic_location * this_,
-        struct mapset * ms);
-static int traffic_location_match_attributes(struct traffic_location * this_, struct item *item);
-static int traffic_message_add_segments(struct traffic_message * this_, struct mapset * ms, struct seg_data * data,
+        GList * maps, struct traffic_segment_cache * cache);
+static int traffic_location_match_attributes(struct traffic_location * this_,
+        struct traffic_segment_cache_item *cached);
+static int traffic_message_match_segments(struct traffic_message * this_, GList * maps,
+        struct traffic_segment_cache * cache, struct seg_data * data, GList ** segments);
+static void traffic_message_apply_segments(struct traffic_message * this_, struct seg_data * data, GList * segments,
+        struct map *map, struct route * route);
+static int traffic_message_add_segments(struct traffic_message * this_, struct mapset * ms,
+                                        struct traffic_segment_cache * cache, struct seg_data * data,
                                         struct map *map, struct route * route);
 static int traffic_message_restore_segments(struct traffic_message * this_, struct mapset * ms,
         struct map *map, struct route * route);
 static void traffic_location_populate_route_graph(struct traffic_location * this_, struct route_graph * rg,
-        struct mapset * ms);
+        GList * maps, struct traffic_segment_cache * cache);
 static void traffic_location_set_enclosing_rect(struct traffic_location * this_, struct coord_geo ** coords);
 static void traffic_dump_messages_to_xml(struct traffic_shared_priv * shared);
 static void traffic_loop(struct traffic * this_);
@@ -981,7 +1098,8 @@ static struct map_rect_priv * tm_rect_new(struct map_priv *priv, struct map_sele
                         /* if cache restore yielded no items, expand from scratch */
                         if (message->priv->items == NULL) {
                             data = traffic_message_parse_events(message);
-                            traffic_message_add_segments(message, priv->shared->ms, data, priv->shared->map, priv->shared->rt);
+                            traffic_message_add_segments(message, priv->shared->ms, priv->shared->cache, data,
+                                                         priv->shared->map, priv->shared->rt);
                             g_free(data);
                         }
                         dirty = 1;
@@ -1278,14 +1396,15 @@ static int traffic_event_is_valid(struct traffic_event * this_) {
  * for any item supplied.
  *
  * @param this_ The location
- * @param item The map item
+ * @param cached The map item, as read by the segment cache
  *
  * @return The score, as a percentage value
  */
-static int traffic_location_match_attributes(struct traffic_location * this_, struct item *item) {
+static int traffic_location_match_attributes(struct traffic_location * this_,
+        struct traffic_segment_cache_item *cached) {
+    struct item *item = &cached->item;
     int score = 0;
     int maxscore = 0;
-    struct attr attr;
 
     /* road type */
     if ((this_->road_type != type_line_unspecified)) {
@@ -1379,16 +1498,17 @@ static int traffic_location_match_attributes(struct traffic_location * this_, st
     /* road_ref */
     if (this_->road_ref) {
         maxscore += 400;
-        if (item_attr_get(item, attr_street_name_systematic, &attr))
-            score += (400 * (MAX_MISMATCH - compare_name_systematic(this_->road_ref, attr.u.str))) / MAX_MISMATCH;
+        if (cached->name_systematic)
+            score += (400 * (MAX_MISMATCH - compare_name_systematic(this_->road_ref, cached->name_systematic)))
+                     / MAX_MISMATCH;
     }
 
     /* road_name */
     if (this_->road_name) {
         maxscore += 200;
-        if (item_attr_get(item, attr_street_name, &attr)) {
+        if (cached->name) {
             // TODO crude comparison in need of refinement
-            if (!strcmp(this_->road_name, attr.u.str))
+            if (!strcmp(this_->road_name, cached->name))
                 score += 200;
         }
     }
@@ -1705,6 +1825,8 @@ static int traffic_point_match_segment_attributes(struct traffic_point * this_,
  * @return The cost of the segment
  */
 static int traffic_route_get_seg_cost(struct route_graph_segment *over, struct seg_data * data, int dir) {
+    int score;
+
     if (over->data.flags & (dir >= 0 ? AF_ONEWAYREV : AF_ONEWAY))
         return INT_MAX;
     if (dir > 0 && (over->start->flags & RP_TURN_RESTRICTION))
@@ -1717,7 +1839,8 @@ static int traffic_route_get_seg_cost(struct route_graph_segment *over, struct s
     if (!(over->data.flags & data->flags & AF_ALL))
         return INT_MAX;
 
-    return over->data.len * (100 - over->data.score) * (PENALTY_SEGMENT_MATCH - 1) / 100 + over->data.len;
+    score = (over->data.flags & AF_SCORE) ? RSD_SCORE(&over->data) : 0;
+    return over->data.len * (100 - score) * (PENALTY_SEGMENT_MATCH - 1) / 100 + over->data.len;
 }
 
 /**
@@ -1891,21 +2014,377 @@ static struct map_rect * traffic_location_open_map_rect(struct traffic_location
 }
 
 /**
- * @brief Populates a route graph.
+ * @brief Hash function for tiles of the segment cache.
+ */
+static guint traffic_segment_cache_tile_hash(gconstpointer key) {
+    const struct traffic_segment_cache_tile * tile = key;
+    return GPOINTER_TO_UINT(tile->m) ^ (guint) tile->order ^ ((guint) tile->x * 65599) ^ ((guint) tile->y * 31);
+}
+
+/**
+ * @brief Comparison function for tiles of the segment cache.
+ */
+static gboolean traffic_segment_cache_tile_equal(gconstpointer a, gconstpointer b) {
+    const struct traffic_segment_cache_tile * ta = a, * tb = b;
+    return (ta->m == tb->m) && (ta->order == tb->order) && (ta->x == tb->x) && (ta->y == tb->y);
+}
+
+/**
+ * @brief Returns the position of the tile of the segment cache which holds a map coordinate.
  *
- * This adds all routable segments in the enclosing rectangle of the location (plus a safety margin) to
- * the route graph.
+ * This rounds towards negative infinity, so that tiles on either side of 0 do not overlap.
+ *
+ * @param c The x or y coordinate
+ *
+ * @return The x or y position of the tile, in tile units
+ */
+static inline int traffic_segment_cache_tile_pos(int c) {
+    if (c >= 0)
+        return c / TRAFFIC_SEGMENT_CACHE_TILE_SIZE;
+    return -1 - (-1 - c) / TRAFFIC_SEGMENT_CACHE_TILE_SIZE;
+}
+
+/**
+ * @brief Creates a new segment cache.
+ *
+ * @param max_size The maximum memory used by the tiles held by the cache, in bytes
+ *
+ * @return The cache
+ */
+static struct traffic_segment_cache * traffic_segment_cache_new(int max_size) {
+    struct traffic_segment_cache * ret = g_new0(struct traffic_segment_cache, 1);
+
+    ret->tiles = g_hash_table_new(traffic_segment_cache_tile_hash, traffic_segment_cache_tile_equal);
+    ret->lock = thread_lock_new();
+    ret->max_size = max_size;
+    return ret;
+}
+
+/**
+ * @brief Reads the routable items and turn restrictions of a tile from its map.
+ *
+ * Items are read with the order of the tile. Only items whose bounding box overlaps the tile are kept.
+ *
+ * @param this_ The tile, with its map, order and position set
+ */
+static void traffic_segment_cache_tile_load(struct traffic_segment_cache_tile * this_) {
+    struct map_selection sel;
+    struct map_rect * mr;
+    struct item * item;
+    struct attr attr;
+
+    /* The current item in the tile */
+    struct traffic_segment_cache_item * cached;
+
+    /* Buffers for the coordinates of the current item, and their size */
+    struct coord * c = NULL;
+    unsigned char * is_node = NULL;
+    int size = 0;
+
+    /* Number of coordinates of the current item, and whether the next one ends a segment */
+    int count, node;
+
+    /* Number of elements allocated for items */
+    int allocated = 0;
+
+    int i;
+
+    sel.next = NULL;
+    sel.order = this_->order;
+    sel.range.min = route_item_first;
+    sel.range.max = route_item_last;
+    sel.u.c_rect.lu.x = this_->x * TRAFFIC_SEGMENT_CACHE_TILE_SIZE;
+    sel.u.c_rect.lu.y = this_->y * TRAFFIC_SEGMENT_CACHE_TILE_SIZE + (TRAFFIC_SEGMENT_CACHE_TILE_SIZE - 1);
+    sel.u.c_rect.rl.x = this_->x * TRAFFIC_SEGMENT_CACHE_TILE_SIZE + (TRAFFIC_SEGMENT_CACHE_TILE_SIZE - 1);
+    sel.u.c_rect.rl.y = this_->y * TRAFFIC_SEGMENT_CACHE_TILE_SIZE;
+    this_->size = sizeof(*this_);
+
+    mr = map_rect_new(this_->m, &sel);
+    if (!mr)
+        return;
+    while ((item = map_rect_get_item(mr))) {
+        if ((item->type != type_street_turn_restriction_no) && (item->type != type_street_turn_restriction_only)
+                && ((item->type < route_item_first) || (item->type > route_item_last)
+                    || !item_get_default_flags(item->type)))
+            continue;
+
+        item_coord_rewind(item);
+        for (count = 0, node = 0; ; count++) {
+            if (count == size) {
+                size = size ? size * 2 : 64;
+                c = g_renew(struct coord, c, size);
+                is_node = g_renew(unsigned char, is_node, size);
+            }
+            if (count)
+                node = item_coord_is_node(item);
+            if (!item_coord_get(item, &c[count], 1))
+                break;
+            is_node[count] = node;
+        }
+        if (!count)
+            continue;
+
+        if (this_->count == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            this_->items = g_renew(struct traffic_segment_cache_item, this_->items, allocated);
+        }
+        cached = &this_->items[this_->count];
+        memset(cached, 0, sizeof(*cached));
+        cached->r.lu = cached->r.rl = c[0];
+        for (i = 1; i < count; i++)
+            coord_rect_extend(&cached->r, &c[i]);
+        if (!coord_rect_overlap(&cached->r, &sel.u.c_rect))
+            continue;
+
+        cached->item.type = item->type;
+        cached->item.id_hi = item->id_hi;
+        cached->item.id_lo = item->id_lo;
+        cached->item.map = item->map;
+        cached->maxspeed = -1;
+        if ((item->type != type_street_turn_restriction_no) && (item->type != type_street_turn_restriction_only)) {
+            if (item_attr_get(item, attr_street_name_systematic, &attr))
+                cached->name_systematic = g_strdup(attr.u.str);
+            if (item_attr_get(item, attr_street_name, &attr))
+                cached->name = g_strdup(attr.u.str);
+            if (item_attr_get(item, attr_flags, &attr))
+                cached->flags = attr.u.num;
+            else
+                cached->flags = *item_get_default_flags(item->type);
+            if ((cached->flags & AF_SPEED_LIMIT) && (item_attr_get(item, attr_maxspeed, &attr)))
+                cached->maxspeed = attr.u.num;
+        }
+        cached->count = count;
+        cached->c = g_new(struct coord, count);
+        memcpy(cached->c, c, count * sizeof(*c));
+        cached->is_node = g_new(unsigned char, count);
+        memcpy(cached->is_node, is_node, count);
+        this_->size += sizeof(*cached) + count * (sizeof(*c) + 1);
+        if (cached->name_systematic)
+            this_->size += strlen(cached->name_systematic) + 1;
+        if (cached->name)
+            this_->size += strlen(cached->name) + 1;
+        this_->count++;
+    }
+    map_rect_destroy(mr);
+    g_free(c);
+    g_free(is_node);
+    if (this_->count < allocated)
+        this_->items = g_renew(struct traffic_segment_cache_item, this_->items, this_->count);
+}
+
+/**
+ * @brief Drops a reference to a tile of the segment cache, freeing the tile when the last one is gone.
+ *
+ * The caller must hold the lock of the cache.
+ *
+ * @param this_ The tile
+ */
+static void traffic_segment_cache_tile_unref(struct traffic_segment_cache_tile * this_) {
+    int i;
+
+    if (--this_->refcount)
+        return;
+    for (i = 0; i < this_->count; i++) {
+        g_free(this_->items[i].name);
+        g_free(this_->items[i].name_systematic);
+        g_free(this_->items[i].c);
+        g_free(this_->items[i].is_node);
+    }
+    g_free(this_->items);
+    g_free(this_);
+}
+
+/**
+ * @brief Drops the least recently used tiles from the segment cache until it uses no more than a given amount of
+ * memory.
+ *
+ * Tiles which are still in use are freed when they are released. The caller must hold the lock of the cache.
  *
+ * @param this_ The cache
+ * @param max_size The maximum memory to be used by the tiles held by the cache, in bytes
+ */
+static void traffic_segment_cache_trim(struct traffic_segment_cache * this_, int max_size) {
+    GList * last;
+    struct traffic_segment_cache_tile * tile;
+
+    while (this_->lru && (this_->size > max_size)) {
+        last = g_list_last(this_->lru);
+        tile = (struct traffic_segment_cache_tile *) last->data;
+        this_->lru = g_list_delete_link(this_->lru, last);
+        g_hash_table_remove(this_->tiles, tile);
+        this_->size -= tile->size;
+        if (max_size)
+            this_->evictions++;
+        traffic_segment_cache_tile_unref(tile);
+    }
+}
+
+/**
+ * @brief Returns a tile from the segment cache, reading it from the map if it is not in the cache.
+ *
+ * This function is thread-safe, provided the map is. The tile must be released with
+ * `traffic_segment_cache_release()` when it is no longer needed.
+ *
+ * @param this_ The cache
+ * @param m The map
+ * @param order The map order
+ * @param x The horizontal position of the tile, see `traffic_segment_cache_tile_pos()`
+ * @param y The vertical position of the tile, see `traffic_segment_cache_tile_pos()`
+ *
+ * @return The tile
+ */
+static struct traffic_segment_cache_tile * traffic_segment_cache_get(struct traffic_segment_cache * this_,
+        struct map * m, int order, int x, int y) {
+    struct traffic_segment_cache_tile key, * ret, * cached;
+
+    key.m = m;
+    key.order = order;
+    key.x = x;
+    key.y = y;
+    thread_lock_acquire(this_->lock);
+    ret = g_hash_table_lookup(this_->tiles, &key);
+    if (ret) {
+        this_->hits++;
+        ret->refcount++;
+        this_->lru = g_list_remove_link(this_->lru, ret->lru);
+        this_->lru = g_list_concat(ret->lru, this_->lru);
+        thread_lock_release(this_->lock);
+        return ret;
+    }
+    this_->misses++;
+    thread_lock_release(this_->lock);
+
+    /* read the tile without holding the lock, so other threads can use the cache in the meantime */
+    ret = g_new0(struct traffic_segment_cache_tile, 1);
+    ret->m = m;
+    ret->order = order;
+    ret->x = x;
+    ret->y = y;
+    ret->refcount = 1;
+    traffic_segment_cache_tile_load(ret);
+
+    thread_lock_acquire(this_->lock);
+    cached = g_hash_table_lookup(this_->tiles, &key);
+    if (cached) {
+        /* another thread has read the same tile in the meantime */
+        cached->refcount++;
+        traffic_segment_cache_tile_unref(ret);
+        ret = cached;
+    } else {
+        ret->refcount++;
+        g_hash_table_insert(this_->tiles, ret, ret);
+        this_->lru = g_list_prepend(this_->lru, ret);
+        ret->lru = this_->lru;
+        this_->size += ret->size;
+        traffic_segment_cache_trim(this_, this_->max_size);
+    }
+    thread_lock_release(this_->lock);
+    return ret;
+}
+
+/**
+ * @brief Releases a tile obtained from `traffic_segment_cache_get()`.
+ *
+ * @param this_ The cache
+ * @param tile The tile
+ */
+static void traffic_segment_cache_release(struct traffic_segment_cache * this_,
+        struct traffic_segment_cache_tile * tile) {
+    thread_lock_acquire(this_->lock);
+    traffic_segment_cache_tile_unref(tile);
+    thread_lock_release(this_->lock);
+}
+
+/**
+ * @brief Logs and resets the statistics of the segment cache at the end of a processing pass.
+ *
+ * @param this_ The cache
+ */
+static void traffic_segment_cache_log_stats(struct traffic_segment_cache * this_) {
+    thread_lock_acquire(this_->lock);
+    if (this_->hits || this_->misses)
+        dbg(lvl_debug, "segment cache: %d tiles (%d bytes), %d hits, %d misses, %d evictions",
+            g_hash_table_size(this_->tiles), this_->size, this_->hits, this_->misses, this_->evictions);
+    this_->hits = 0;
+    this_->misses = 0;
+    this_->evictions = 0;
+    thread_lock_release(this_->lock);
+}
+
+/**
+ * @brief Empties the segment cache.
+ *
+ * Tiles which are still in use remain valid until they are released.
+ *
+ * @param this_ The cache
+ */
+static void traffic_segment_cache_flush(struct traffic_segment_cache * this_) {
+    thread_lock_acquire(this_->lock);
+    traffic_segment_cache_trim(this_, 0);
+    g_list_free(this_->maps);
+    this_->maps = NULL;
+    thread_lock_release(this_->lock);
+}
+
+/**
+ * @brief Empties the segment cache if the maps of the mapset have changed since it was last checked.
+ *
+ * Tiles are kept as long as the same maps are active, so that they can be reused by later processing passes. This
+ * must be called on the main thread before the cache is used, as maps are only added, removed or (de)activated there.
+ *
+ * The maps are returned so that locations can be matched without going through the mapset, which may change while
+ * they are being matched on worker threads.
+ *
+ * @param this_ The cache
+ * @param ms The mapset
+ *
+ * @return The route-active maps of the mapset other than the traffic map, in mapset order. The list belongs to the
+ * cache and is only valid until the next call, so worker threads need to be given a copy.
+ */
+static GList * traffic_segment_cache_check_maps(struct traffic_segment_cache * this_, struct mapset * ms) {
+    struct mapset_handle * h;
+    struct map * m;
+    struct attr attr;
+    GList * maps = NULL, * a, * b;
+
+    if (ms) {
+        h = mapset_open(ms);
+        while ((m = mapset_next(h, 2)))
+            if (!map_get_attr(m, attr_traffic, &attr, NULL))
+                maps = g_list_prepend(maps, m);
+        mapset_close(h);
+        maps = g_list_reverse(maps);
+    }
+    a = maps;
+    b = this_->maps;
+    while (a && b && (a->data == b->data)) {
+        a = g_list_next(a);
+        b = g_list_next(b);
+    }
+    if (!a && !b) {
+        g_list_free(maps);
+        return this_->maps;
+    }
+    if (this_->maps)
+        dbg(lvl_debug, "maps have changed, flushing segment cache");
+    traffic_segment_cache_flush(this_);
+    this_->maps = maps;
+    return maps;
+}
+
+/**
+ * @brief Adds an item from the segment cache to the route graph for a traffic location.
+ *
+ * Roads more than one level below the road type of the location are skipped.
+ *
+ * @param this_ The traffic location
  * @param rg The route graph
- * @param ms The mapset to read the ramps from
+ * @param cached The item
  */
-static void traffic_location_populate_route_graph(struct traffic_location * this_, struct route_graph * rg,
-        struct mapset * ms) {
+static void traffic_location_add_cached_item(struct traffic_location * this_, struct route_graph * rg,
+        struct traffic_segment_cache_item * cached) {
     /* The item being processed */
-    struct item *item;
-
-    /* Mercator coordinates of current and previous point */
-    struct coord c, l;
+    struct item *item = &cached->item;
 
     /* Data for the route graph segment */
     struct route_graph_segment_data data;
@@ -1920,119 +2399,116 @@ static void traffic_location_populate_route_graph(struct traffic_location * this
     /* Whether the current item is segmented */
     int segmented;
 
-    /* Default flags assumed for the current item type */
-    int *default_flags;
-
-    /* Holds an attribute retrieved from the current item */
-    struct attr attr;
-
     /* Start and end point of the current way or segment */
     struct route_graph_point *s_pnt, *e_pnt;
 
-    traffic_location_set_enclosing_rect(this_, NULL);
+    int i;
 
-    rg->h = mapset_open(ms);
+    if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only) {
+        route_graph_add_turn_restriction_coords(rg, item, cached->c, cached->count);
+        return;
+    }
 
-    while ((rg->m = mapset_next(rg->h, 2))) {
-        /* Skip traffic map (identified by the `attr_traffic` attribute) */
-        if (map_get_attr(rg->m, attr_traffic, &attr, NULL))
-            continue;
-        if (!traffic_location_open_map_rect(this_, rg))
-            continue;
-        while ((item = map_rect_get_item(rg->mr))) {
-            if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
-                route_graph_add_turn_restriction(rg, item);
-            else if ((item->type < route_item_first) || (item->type > route_item_last))
-                continue;
-            /* If road class is motorway, trunk or primary, ignore roads more than one level below */
-            if ((this_->road_type == type_highway_land) || (this_->road_type == type_highway_city)) {
-                if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
-                        (item->type != type_street_n_lanes) && (item->type != type_ramp))
-                    continue;
-            } else if (this_->road_type == type_street_n_lanes) {
-                if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
-                        (item->type != type_street_n_lanes) && (item->type != type_ramp) &&
-                        (item->type != type_street_4_land) && (item->type != type_street_4_city))
-                    continue;
-            } else if ((this_->road_type == type_street_4_land) || (this_->road_type == type_street_4_city)) {
-                if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
-                        (item->type != type_street_n_lanes) && (item->type != type_ramp) &&
-                        (item->type != type_street_4_land) && (item->type != type_street_4_city) &&
-                        (item->type != type_street_3_land) && (item->type != type_street_3_city))
-                    continue;
-            }
-            if (item_get_default_flags(item->type)) {
-
-                item_coord_rewind(item);
-                if (item_coord_get(item, &l, 1)) {
-                    data.score = traffic_location_match_attributes(this_, item);
-                    data.flags=0;
-                    data.offset=1;
-                    data.maxspeed=-1;
-                    data.item=item;
-                    len = 0;
-                    segmented = 0;
-
-                    if (!(default_flags = item_get_default_flags(item->type)))
-                        default_flags = &item_default_flags_value;
-                    if (item_attr_get(item, attr_flags, &attr)) {
-                        data.flags = attr.u.num;
-                        segmented = (data.flags & AF_SEGMENTED);
-                    } else
-                        data.flags = *default_flags;
+    /* If road class is motorway, trunk or primary, ignore roads more than one level below */
+    if ((this_->road_type == type_highway_land) || (this_->road_type == type_highway_city)) {
+        if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
+                (item->type != type_street_n_lanes) && (item->type != type_ramp))
+            return;
+    } else if (this_->road_type == type_street_n_lanes) {
+        if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
+                (item->type != type_street_n_lanes) && (item->type != type_ramp) &&
+                (item->type != type_street_4_land) && (item->type != type_street_4_city))
+            return;
+    } else if ((this_->road_type == type_street_4_land) || (this_->road_type == type_street_4_city)) {
+        if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
+                (item->type != type_street_n_lanes) && (item->type != type_ramp) &&
+                (item->type != type_street_4_land) && (item->type != type_street_4_city) &&
+                (item->type != type_street_3_land) && (item->type != type_street_3_city))
+            return;
+    }
 
-                    if ((data.flags & AF_SPEED_LIMIT) && (item_attr_get(item, attr_maxspeed, &attr)))
-                        data.maxspeed = attr.u.num;
+    data.score = traffic_location_match_attributes(this_, cached);
+    data.flags = cached->flags;
+    data.offset = 1;
+    data.maxspeed = cached->maxspeed;
+    data.item = item;
+    len = 0;
+    segmented = (data.flags & AF_SEGMENTED);
+
+    /* clear flags we're not copying here */
+    data.flags &= ~(AF_DANGEROUS_GOODS | AF_SIZE_OR_WEIGHT_LIMIT | AF_SPEED_PROFILE);
+
+    s_pnt = route_graph_add_point(rg, &cached->c[0]);
+    for (i = 1; i < cached->count; i++) {
+        len += transform_distance(map_projection(item->map), &cached->c[i - 1], &cached->c[i]);
+        if (segmented && cached->is_node[i]) {
+            e_pnt = route_graph_add_point(rg, &cached->c[i]);
+            data.len = len;
+            if (!route_graph_segment_is_duplicate(s_pnt, &data))
+                route_graph_add_segment(rg, s_pnt, e_pnt, &data);
+            data.offset++;
+            s_pnt = e_pnt;
+            len = 0;
+        }
+    }
+    e_pnt = route_graph_add_point(rg, &cached->c[cached->count - 1]);
+    dbg_assert(len >= 0);
+    data.len = len;
+    if (!route_graph_segment_is_duplicate(s_pnt, &data))
+        route_graph_add_segment(rg, s_pnt, e_pnt, &data);
+}
 
-                    /* clear flags we're not copying here */
-                    data.flags &= ~(AF_DANGEROUS_GOODS | AF_SIZE_OR_WEIGHT_LIMIT);
+/**
+ * @brief Populates a route graph.
+ *
+ * This adds all routable segments in the enclosing rectangle of the location (plus a safety margin) to
+ * the route graph. Segments are taken from the segment cache, which reads them from the maps as needed.
+ *
+ * @param this_ The traffic location
+ * @param rg The route graph
+ * @param maps The maps to read the ramps from, see `traffic_segment_cache_check_maps()`
+ * @param cache The segment cache
+ */
+static void traffic_location_populate_route_graph(struct traffic_location * this_, struct route_graph * rg,
+        GList * maps, struct traffic_segment_cache * cache) {
+    /* Iterator over the maps */
+    GList * map_iter;
 
-                    s_pnt = route_graph_add_point(rg, &l);
+    /* The selection for the location, and its rectangle */
+    struct coord_rect * r;
 
-                    if (!segmented) {
-                        while (item_coord_get(item, &c, 1)) {
-                            len += transform_distance(map_projection(item->map), &l, &c);
-                            l = c;
-                        }
-                        e_pnt = route_graph_add_point(rg, &l);
-                        dbg_assert(len >= 0);
-                        data.len = len;
-                        if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                            route_graph_add_segment(rg, s_pnt, e_pnt, &data);
-                    } else {
-                        int isseg, rc;
-                        int sc = 0;
-                        do {
-                            isseg = item_coord_is_node(item);
-                            rc = item_coord_get(item, &c, 1);
-                            if (rc) {
-                                len += transform_distance(map_projection(item->map), &l, &c);
-                                l = c;
-                                if (isseg) {
-                                    e_pnt = route_graph_add_point(rg, &l);
-                                    data.len = len;
-                                    if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                                        route_graph_add_segment(rg, s_pnt, e_pnt, &data);
-                                    data.offset++;
-                                    s_pnt = route_graph_add_point(rg, &l);
-                                    len = 0;
-                                }
-                            }
-                        } while(rc);
-                        e_pnt = route_graph_add_point(rg, &l);
-                        dbg_assert(len >= 0);
-                        sc++;
-                        data.len = len;
-                        if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                            route_graph_add_segment(rg, s_pnt, e_pnt, &data);
-                    }
+    /* The current tile */
+    struct traffic_segment_cache_tile * tile;
+
+    /* The current item */
+    struct traffic_segment_cache_item * cached;
+
+    int x, y, i;
+
+    traffic_location_set_enclosing_rect(this_, NULL);
+
+    for (map_iter = maps; map_iter; map_iter = g_list_next(map_iter)) {
+        rg->m = (struct map *) map_iter->data;
+        rg->sel = traffic_location_get_rect(this_, map_projection(rg->m));
+        if (!rg->sel)
+            continue;
+        r = &rg->sel->u.c_rect;
+        for (y = traffic_segment_cache_tile_pos(r->rl.y); y <= traffic_segment_cache_tile_pos(r->lu.y); y++)
+            for (x = traffic_segment_cache_tile_pos(r->lu.x); x <= traffic_segment_cache_tile_pos(r->rl.x); x++) {
+                tile = traffic_segment_cache_get(cache, rg->m, rg->sel->order, x, y);
+                for (i = 0; i < tile->count; i++) {
+                    cached = &tile->items[i];
+                    /* Items spanning several tiles are only added from the first of them within the selection */
+                    if (!coord_rect_overlap(&cached->r, r)
+                            || (traffic_segment_cache_tile_pos(MAX(cached->r.lu.x, r->lu.x)) != x)
+                            || (traffic_segment_cache_tile_pos(MAX(cached->r.rl.y, r->rl.y)) != y))
+                        continue;
+                    traffic_location_add_cached_item(this_, rg, cached);
                 }
+                traffic_segment_cache_release(cache, tile);
             }
-        }
         map_selection_destroy(rg->sel);
         rg->sel = NULL;
-        map_rect_destroy(rg->mr);
-        rg->mr = NULL;
     }
     route_graph_build_done(rg, 0);
 }
@@ -2044,13 +2520,14 @@ static void traffic_location_populate_route_graph(struct traffic_location * this
  * affected by a traffic message.
  *
  * @param this_ The location to match to the map
- * @param ms The mapset to use for the route graph
+ * @param maps The maps to use for the route graph, see `traffic_segment_cache_check_maps()`
+ * @param cache The segment cache
  *
  * @return A route graph. The caller is responsible for destroying the route graph and all related data
  * when it is no longer needed.
  */
 static struct route_graph * traffic_location_get_route_graph(struct traffic_location * this_,
-        struct mapset * ms) {
+        GList * maps, struct traffic_segment_cache * cache) {
     struct route_graph *rg;
 
     traffic_location_set_enclosing_rect(this_, NULL);
@@ -2061,7 +2538,7 @@ static struct route_graph * traffic_location_get_route_graph(struct traffic_loca
     rg->busy = 1;
 
     /* build the route graph */
-    traffic_location_populate_route_graph(this_, rg, ms);
+    traffic_location_populate_route_graph(this_, rg, maps, cache);
 
     return rg;
 }
@@ -2180,7 +2657,7 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
     GList * existing = NULL;
 
     /* This heap will hold all points with "temporarily" calculated costs */
-    struct fibheap *heap;
+    struct dheap *heap;
 
     /* Cost of the start position */
     int start_value;
@@ -2215,41 +2692,36 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
     }
 
     /* prime the route graph */
-    heap = fh_makekeyheap();
+    heap = dheap_new(offsetof(struct route_graph_point, heap_idx));
 
     start_value = PENALTY_OFFROAD * transform_distance(projection_mg, c_start, c_dst);
     ret = NULL;
 
     dbg(lvl_debug, "start flooding route graph, start_value=%d", start_value);
 
-    for (i = 0; i < HASH_SIZE; i++) {
-        p = rg->hash[i];
-        while (p) {
-            if (!g_list_find(existing, p)) {
-                if (!(p->flags & RP_TURN_RESTRICTION)) {
-                    p->value = PENALTY_OFFROAD * transform_distance(projection_mg, &p->c, c_dst);
-                    p->el = fh_insertkey(heap, p->value, p);
-                } else {
-                    /* ignore points which are part of turn restrictions */
-                    p->value = INT_MAX;
-                    p->el = NULL;
-                }
-                p->seg = NULL;
+    p = NULL;
+    while ((p = route_graph_next_point(rg, p, &i))) {
+        if (!g_list_find(existing, p)) {
+            if (!(p->flags & RP_TURN_RESTRICTION)) {
+                p->value = PENALTY_OFFROAD * transform_distance(projection_mg, &p->c, c_dst);
+                dheap_update(heap, p, p->value);
+            } else {
+                /* ignore points which are part of turn restrictions */
+                p->value = INT_MAX;
             }
-            p = p->hash_next;
+            p->seg = NULL;
         }
     }
 
     /* flood the route graph */
     for (;;) {
-        p = fh_extractmin(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
+        p = dheap_extractmin(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
         if (!p) /* There are no more points with temporarily calculated costs, Dijkstra has finished */
             break;
 
         dbg(lvl_debug, "p=%p, value=%d", p, p->value);
 
         min = p->value;
-        p->el = NULL; /* This point is permanently calculated now, we've taken it out of the heap */
         s = p->start;
         while (s) { /* Iterating all the segments leading away from our point to update the points at their ends */
             val = traffic_route_get_seg_cost(s, data, -1);
@@ -2261,11 +2733,7 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
                 if (new < s->end->value) { /* We've found a less costly way to reach the end of s, update it */
                     s->end->value = new;
                     s->end->seg = s;
-                    if (!s->end->el) {
-                        s->end->el = fh_insertkey(heap, new, s->end);
-                    } else {
-                        fh_replacekey(heap, s->end->el, new);
-                    }
+                    dheap_update(heap, s->end, new);
                     new += PENALTY_OFFROAD * transform_distance(projection_mg, &s->end->c, c_start);
                     if (new < start_value) { /* We've found a less costly way from the start point, update */
                         start_value = new;
@@ -2286,11 +2754,7 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
                 if (new < s->start->value) {
                     s->start->value = new;
                     s->start->seg = s;
-                    if (!s->start->el) {
-                        s->start->el = fh_insertkey(heap, new, s->start);
-                    } else {
-                        fh_replacekey(heap, s->start->el, new);
-                    }
+                    dheap_update(heap, s->start, new);
                     new += PENALTY_OFFROAD * transform_distance(projection_mg, &s->start->c, c_start);
                     if (new < start_value) {
                         start_value = new;
@@ -2302,7 +2766,7 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
         }
     }
 
-    fh_deleteheap(heap);
+    dheap_destroy(heap);
     g_list_free(existing);
     return ret;
 }
@@ -2563,12 +3027,12 @@ static struct traffic_point * traffic_location_get_point(struct traffic_location
  * @param rg The route graph
  * @param start The first point of the path
  * @param match_start True to evaluate for the start point of a route, false for the end point
- * @param ms The mapset to read the items from
+ * @param maps The maps to read the items from, see `traffic_segment_cache_check_maps()`
  *
  * @return A score from 0 (worst) to 100 (best).
  */
 static int traffic_location_get_point_match(struct traffic_location * this_, struct route_graph_point * p, int point,
-        struct route_graph * rg, struct route_graph_point * start, int match_start, struct mapset * ms) {
+        struct route_graph * rg, struct route_graph_point * start, int match_start, GList * maps) {
     int ret = 0;
 
     /* The point from the location to match */
@@ -2605,19 +3069,19 @@ static int traffic_location_get_point_match(struct traffic_location * this_, str
  * @param rg The route graph
  * @param start The first point of the path
  * @param match_start True to evaluate for the start point of a route, false for the end point
- * @param ms The mapset to read the items from
+ * @param maps The maps to read the items from, see `traffic_segment_cache_check_maps()`
  *
  * @return The matched points as a `GList`. The `data` member of each item points to a `struct point_data` for the point.
  */
 static GList * traffic_location_get_matching_points(struct traffic_location * this_, int point,
-        struct route_graph * rg, struct route_graph_point * start, int match_start, struct mapset * ms) {
+        struct route_graph * rg, struct route_graph_point * start, int match_start, GList * maps) {
     GList * ret = NULL;
 
     /* The point from the location to match */
     struct traffic_point * trpoint = NULL;
 
-    /* Map attribute (currently not evaluated) */
-    struct attr attr;
+    /* Iterator over the maps */
+    GList * map_iter;
 
     /* The item being processed */
     struct item *item;
@@ -2641,12 +3105,8 @@ static GList * traffic_location_get_matching_points(struct traffic_location * th
 
     traffic_location_set_enclosing_rect(this_, NULL);
 
-    rg->h = mapset_open(ms);
-
-    while ((rg->m = mapset_next(rg->h, 2))) {
-        /* Skip traffic map (identified by the `attr_traffic` attribute) */
-        if (map_get_attr(rg->m, attr_traffic, &attr, NULL))
-            continue;
+    for (map_iter = maps; map_iter; map_iter = g_list_next(map_iter)) {
+        rg->m = (struct map *) map_iter->data;
         if (!traffic_location_open_map_rect(this_, rg))
             continue;
         while ((item = map_rect_get_item(rg->mr))) {
@@ -2848,23 +3308,27 @@ static int traffic_get_item_delay(int delay, int item_len, int len) {
 }
 
 /**
- * @brief Generates segments affected by a traffic message.
+ * @brief Matches the location of a traffic message to map segments.
  *
  * This translates the approximate coordinates in the `from`, `at`, `to`, `via` and `not_via` members of
  * the location to one or more map segments, using both the raw coordinates and the auxiliary information
- * contained in the location. Each segment is stored in the map, if not already present, and a link is
- * stored with the message.
+ * contained in the location.
+ *
+ * This function only reads from the maps of the mapset (skipping the traffic map) and modifies nothing but the
+ * message, so it can be run for different messages on worker threads, provided all maps are thread-safe. The
+ * segments are added to the traffic map by `traffic_message_apply_segments()`.
  *
  * @param this_ The traffic message
- * @param ms The mapset to use for matching
- * @param data Data for the segments added to the map
- * @param map The traffic map
- * @param route The route affected by the changes
+ * @param maps The maps to use for matching, see `traffic_segment_cache_check_maps()`
+ * @param cache The segment cache to use for matching
+ * @param data Data for the segments
+ * @param segments Receives a list of `struct traffic_matched_segment`, in the order in which they were found,
+ * which may be incomplete if there was a failure
  *
  * @return `true` if the locations were matched successfully, `false` if there was a failure.
  */
-static int traffic_message_add_segments(struct traffic_message * this_, struct mapset * ms, struct seg_data * data,
-                                        struct map *map, struct route * route) {
+static int traffic_message_match_segments(struct traffic_message * this_, GList * maps,
+        struct traffic_segment_cache * cache, struct seg_data * data, GList ** segments) {
     int i;
 
     struct coord_geo * coords[] = {NULL, NULL, NULL};
@@ -2895,35 +3359,20 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
     /* Coordinate count for matched segment */
     int ccnt;
 
-    /* Coordinates of matched segment and pointer into it, order as read from map */
-    struct coord *c, ca[2048];
-
-    /* Coordinates of matched segment, sorted */
-    struct coord *cd, *cs;
-
-    /* Speed for the current segment */
-    int speed;
+    /* Coordinates of matched segment, order as read from map */
+    struct coord ca[2048];
 
-    /* Delay for the current segment */
-    int delay;
+    /* The current matched segment */
+    struct traffic_matched_segment * matched;
 
-    /* Number of new segments and existing segments */
-    int count = 0, prev_count;
+    /* Number of segments */
+    int count = 0;
 
     /* Length of location */
     int len;
 
-    /* The message's previous list of items */
-    struct item ** prev_items;
-
-    /* The next item in the message's list of items */
-    struct item ** next_item;
-
-    /* Flags for the next item to add */
-    int flags;
-
-    /* The last item added */
-    struct item * item;
+    /* The item of the current segment */
+    struct item seg_item;
 
     /* Projected coordinates of start and end points of the actual location
      * (if at is set, both point to the same coordinates) */
@@ -2984,7 +3433,7 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
         return 0;
 
     dbg(lvl_debug, "*****checkpoint ADD-3");
-    rg = traffic_location_get_route_graph(this_->location, ms);
+    rg = traffic_location_get_route_graph(this_->location, maps, cache);
 
     /* transform coordinates */
     c_from = (endpoints & 4) ? pcoords[0] : pcoords[1];
@@ -3054,11 +3503,11 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
             dbg(lvl_debug, "*****checkpoint ADD-4.2.1");
             /* tweak end point */
             if (this_->location->at)
-                points = traffic_location_get_matching_points(this_->location, 1, rg, p_start, 0, ms);
+                points = traffic_location_get_matching_points(this_->location, 1, rg, p_start, 0, maps);
             else if (dir > 0)
-                points = traffic_location_get_matching_points(this_->location, 2, rg, p_start, 0, ms);
+                points = traffic_location_get_matching_points(this_->location, 2, rg, p_start, 0, maps);
             else
-                points = traffic_location_get_matching_points(this_->location, 0, rg, p_start, 0, ms);
+                points = traffic_location_get_matching_points(this_->location, 0, rg, p_start, 0, maps);
             if (!p_start) {
                 dbg(lvl_error, "end point not found on map");
                 for (points_iter = points; points_iter; points_iter = g_list_next(points_iter))
@@ -3102,7 +3551,7 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
                 if (route_graph_point_is_endpoint_candidate(p_iter, s_prev)) {
                     score = traffic_location_get_point_match(this_->location, p_iter,
                             this_->location->at ? 1 : (dir > 0) ? 2 : 0,
-                            rg, p_start, 0, ms);
+                            rg, p_start, 0, maps);
                     pd = NULL;
                     for (points_iter = points; points_iter && (score < 100); points_iter = g_list_next(points_iter)) {
                         pd = (struct point_data *) points_iter->data;
@@ -3135,11 +3584,11 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
             dbg(lvl_debug, "*****checkpoint ADD-4.2.5");
             /* tweak start point */
             if (this_->location->at)
-                points = traffic_location_get_matching_points(this_->location, 1, rg, p_start, 1, ms);
+                points = traffic_location_get_matching_points(this_->location, 1, rg, p_start, 1, maps);
             else if (dir > 0)
-                points = traffic_location_get_matching_points(this_->location, 0, rg, p_start, 1, ms);
+                points = traffic_location_get_matching_points(this_->location, 0, rg, p_start, 1, maps);
             else
-                points = traffic_location_get_matching_points(this_->location, 2, rg, p_start, 1, ms);
+                points = traffic_location_get_matching_points(this_->location, 2, rg, p_start, 1, maps);
             s_prev = NULL;
             minval = INT_MAX;
             p_from = NULL;
@@ -3164,7 +3613,7 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
                 if (route_graph_point_is_endpoint_candidate(p_iter, s_prev)) {
                     score = traffic_location_get_point_match(this_->location, p_iter,
                             this_->location->at ? 1 : (dir > 0) ? 0 : 2,
-                            rg, p_start, 1, ms);
+                            rg, p_start, 1, maps);
                     pd = NULL;
                     for (points_iter = points; points_iter && (score < 100); points_iter = g_list_next(points_iter)) {
                         pd = (struct point_data *) points_iter->data;
@@ -3264,7 +3713,6 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
             dbg(lvl_error, "no segments");
 
         /* count segments and calculate length */
-        prev_count = count;
         count = 0;
         len = 0;
         dbg(lvl_debug, "*****checkpoint ADD-4.4");
@@ -3286,55 +3734,34 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
         s = p_start ? p_start->seg : NULL;
         p_iter = p_start;
 
-        if (this_->priv->items) {
-            prev_items = this_->priv->items;
-            this_->priv->items = g_new0(struct item *, count + prev_count + 1);
-            memcpy(this_->priv->items, prev_items, sizeof(struct item *) * prev_count);
-            next_item = this_->priv->items + prev_count;
-            g_free(prev_items);
-        } else {
-            this_->priv->items = g_new0(struct item *, count + 1);
-            next_item = this_->priv->items;
-        }
-
         dbg(lvl_debug, "*****checkpoint ADD-4.6 (loop start)");
         while (s) {
-            ccnt = item_coord_get_within_range(&s->data.item, ca, 2047, &s->start->c, &s->end->c);
-            c = ca;
-            cs = g_new0(struct coord, ccnt);
-            cd = cs;
+            route_segment_data_get_item(&s->data, &seg_item);
+            ccnt = item_coord_get_within_range(&seg_item, ca, 2047, &s->start->c, &s->end->c);
+            matched = g_malloc(sizeof(struct traffic_matched_segment) + ccnt * sizeof(struct coord));
+            matched->id_hi = s->data.item.id_hi;
+            matched->id_lo = s->data.item.id_lo;
+            matched->count = ccnt;
+            memcpy(matched->c, ca, ccnt * sizeof(struct coord));
 
-            speed = traffic_get_item_speed(&(s->data.item), data,
-                                           (s->data.flags & AF_SPEED_LIMIT) ? RSD_MAXSPEED(&s->data) : INT_MAX);
+            matched->speed = traffic_get_item_speed(&seg_item, data, (s->data.flags & AF_SPEED_LIMIT)
+                                                    ? RSD_MAXSPEED(&s->data) : INT_MAX);
 
-            delay = traffic_get_item_delay(data->delay, s->data.len, len);
-
-            for (i = 0; i < ccnt; i++) {
-                *cd++ = *c++;
-            }
+            matched->delay = traffic_get_item_delay(data->delay, s->data.len, len);
 
             if (s->start == p_iter) {
                 /* forward direction */
                 p_iter = s->end;
-                flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
-                        | (data->dir == location_dir_one ? AF_ONEWAY : 0);
+                matched->flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
+                                 | (data->dir == location_dir_one ? AF_ONEWAY : 0);
             } else {
                 /* backward direction */
                 p_iter = s->start;
-                flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
-                        | (data->dir == location_dir_one ? AF_ONEWAYREV : 0);
+                matched->flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
+                                 | (data->dir == location_dir_one ? AF_ONEWAYREV : 0);
             }
 
-
-            item = tm_add_item(map, type_traffic_distortion, s->data.item.id_hi, s->data.item.id_lo, flags, data->attrs, cs, ccnt,
-                               this_->id);
-
-            tm_item_add_message_data(item, this_->id, speed, delay, data->attrs, route);
-
-            g_free(cs);
-
-            *next_item = tm_item_ref(item);
-            next_item++;
+            *segments = g_list_append(*segments, matched);
 
             s = p_iter->seg;
         }
@@ -3358,6 +3785,102 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
     return 1;
 }
 
+/**
+ * @brief Adds segments matched to the location of a traffic message to the traffic map.
+ *
+ * Each segment is stored in the map, if not already present, and a link is stored with the message. This must
+ * be done on the main thread.
+ *
+ * @param this_ The traffic message
+ * @param data Data for the segments added to the map
+ * @param segments The segments, as returned by `traffic_message_match_segments()`, which are freed
+ * @param map The traffic map
+ * @param route The route affected by the changes
+ */
+static void traffic_message_apply_segments(struct traffic_message * this_, struct seg_data * data, GList * segments,
+        struct map *map, struct route * route) {
+    /* The current matched segment */
+    struct traffic_matched_segment * matched;
+
+    /* Iterator over segments */
+    GList * iter;
+
+    /* Number of existing items */
+    int prev_count = 0;
+
+    /* The message's previous list of items */
+    struct item ** prev_items;
+
+    /* The next item in the message's list of items */
+    struct item ** next_item;
+
+    /* The last item added */
+    struct item * item;
+
+    if (this_->priv->items) {
+        prev_items = this_->priv->items;
+        while (prev_items[prev_count])
+            prev_count++;
+        this_->priv->items = g_new0(struct item *, g_list_length(segments) + prev_count + 1);
+        memcpy(this_->priv->items, prev_items, sizeof(struct item *) * prev_count);
+        g_free(prev_items);
+    } else
+        this_->priv->items = g_new0(struct item *, g_list_length(segments) + 1);
+    next_item = this_->priv->items + prev_count;
+
+    for (iter = segments; iter; iter = g_list_next(iter)) {
+        matched = (struct traffic_matched_segment *) iter->data;
+        item = tm_add_item(map, type_traffic_distortion, matched->id_hi, matched->id_lo, matched->flags, data->attrs,
+                           matched->c, matched->count, this_->id);
+
+        tm_item_add_message_data(item, this_->id, matched->speed, matched->delay, data->attrs, route);
+
+        *next_item = tm_item_ref(item);
+        next_item++;
+        g_free(matched);
+    }
+    g_list_free(segments);
+}
+
+/**
+ * @brief Generates segments affected by a traffic message.
+ *
+ * This matches the location to map segments with `traffic_message_match_segments()`, unless this has already been
+ * done ahead of time by `traffic_match_messages()`, and adds them to the map with
+ * `traffic_message_apply_segments()`.
+ *
+ * @param this_ The traffic message
+ * @param ms The mapset to use for matching
+ * @param cache The segment cache to use for matching
+ * @param data Data for the segments added to the map
+ * @param map The traffic map
+ * @param route The route affected by the changes
+ *
+ * @return `true` if the locations were matched successfully, `false` if there was a failure.
+ */
+static int traffic_message_add_segments(struct traffic_message * this_, struct mapset * ms,
+                                        struct traffic_segment_cache * cache, struct seg_data * data,
+                                        struct map *map, struct route * route) {
+    /* Segments matched to the location */
+    GList * segments = NULL;
+
+    /* Return value */
+    int ret;
+
+    if (this_->priv->is_matched) {
+        segments = this_->priv->matched;
+        ret = (this_->priv->is_matched == 2);
+        this_->priv->matched = NULL;
+        this_->priv->is_matched = 0;
+    } else {
+        ret = traffic_message_match_segments(this_, traffic_segment_cache_check_maps(cache, ms), cache, data,
+                                             &segments);
+    }
+    if (ret || segments)
+        traffic_message_apply_segments(this_, data, segments, map, route);
+    return ret;
+}
+
 /**
  * @brief Restores segments associated with a traffic message from cached data.
  *
@@ -4163,6 +4686,7 @@ static void traffic_set_shared(struct traffic *this_) {
 
     if (!this_->shared) {
         this_->shared = g_new0(struct traffic_shared_priv, 1);
+        this_->shared->cache = traffic_segment_cache_new(TRAFFIC_SEGMENT_CACHE_MAX_SIZE);
     }
 }
 
@@ -4301,6 +4825,252 @@ static void traffic_dump_messages_to_xml(struct traffic_shared_priv * shared) {
     } /* if (traffic_filename) */
 }
 
+/**
+ * @brief Discards segments matched to the location of a traffic message ahead of time.
+ *
+ * @param this_ The traffic message
+ */
+static void traffic_message_discard_matched(struct traffic_message * this_) {
+    GList * iter;
+
+    for (iter = this_->priv->matched; iter; iter = g_list_next(iter))
+        g_free(iter->data);
+    g_list_free(this_->priv->matched);
+    this_->priv->matched = NULL;
+    this_->priv->is_matched = 0;
+}
+
+/**
+ * @brief Matches the locations of traffic messages submitted to the pool to the map.
+ *
+ * This is run by each worker thread of the pool and does not return.
+ *
+ * @param pool The pool
+ */
+static void traffic_match_worker(struct traffic_match_pool * pool) {
+    /* Current message */
+    struct traffic_message * message;
+
+    /* Attributes for traffic distortions generated from the current traffic message */
+    struct seg_data * data;
+
+    /* Maps and segment cache to match the current message with */
+    GList * maps;
+    struct traffic_segment_cache * cache;
+
+    /* Segments matched to the current message */
+    GList * matched;
+
+    int is_matched;
+
+    for (;;) {
+        thread_lock_acquire(pool->lock);
+        while (!pool->pending)
+            thread_cond_wait(pool->cond, pool->lock);
+        message = (struct traffic_message *) pool->pending->data;
+        pool->pending = g_list_delete_link(pool->pending, pool->pending);
+        /* the main thread may replace the list while the message is being matched */
+        maps = g_list_copy(pool->maps);
+        cache = pool->cache;
+        thread_lock_release(pool->lock);
+
+        matched = NULL;
+        data = traffic_message_parse_events(message);
+        is_matched = traffic_message_match_segments(message, maps, cache, data, &matched) ? 2 : 1;
+        g_free(data);
+        g_list_free(maps);
+
+        thread_lock_acquire(pool->lock);
+        message->priv->matched = matched;
+        message->priv->is_matched = is_matched;
+        pool->busy--;
+        thread_lock_release(pool->lock);
+    }
+}
+
+/**
+ * @brief Creates the pool of threads matching the locations of traffic messages in the background.
+ *
+ * @return The pool, or NULL if no thread could be started
+ */
+static struct traffic_match_pool * traffic_match_pool_new(void) {
+    struct traffic_match_pool * ret = g_new0(struct traffic_match_pool, 1);
+    struct thread * thread;
+    int i;
+
+    ret->lock = thread_lock_new();
+    ret->cond = thread_cond_new();
+    ret->threads = g_new0(struct thread *, TRAFFIC_MATCH_THREADS);
+    for (i = 0; i < TRAFFIC_MATCH_THREADS; i++) {
+        if (!(thread = thread_new((void (*)(void *))traffic_match_worker, ret)))
+            break;
+        ret->threads[ret->thread_count++] = thread;
+    }
+    if (!ret->thread_count) {
+        g_free(ret->threads);
+        thread_cond_destroy(ret->cond);
+        thread_lock_destroy(ret->lock);
+        g_free(ret);
+        return NULL;
+    }
+    dbg(lvl_debug, "started %d threads for matching traffic locations", ret->thread_count);
+    return ret;
+}
+
+/**
+ * @brief Whether the location of a traffic message is currently being matched in the background.
+ *
+ * @param pool The pool, can be NULL
+ * @param message The message
+ *
+ * @return True if the message has been submitted to the pool and matching has not finished yet
+ */
+static int traffic_match_pool_is_busy(struct traffic_match_pool * pool, struct traffic_message * message) {
+    int ret;
+
+    if (!pool)
+        return 0;
+    thread_lock_acquire(pool->lock);
+    ret = (message->priv->is_matched < 0);
+    thread_lock_release(pool->lock);
+    return ret;
+}
+
+/**
+ * @brief Submits the locations of queued traffic messages for matching to the map in the background.
+ *
+ * Matching a location builds and floods a route graph of its own, which makes it by far the most expensive part of
+ * processing a message. As the locations of different messages are matched independently of each other, this
+ * hands those of the messages at the head of the queue to a pool of `TRAFFIC_MATCH_THREADS` threads, keeping up to
+ * `TRAFFIC_MATCH_BATCH` of them in progress. It returns without waiting for the results; the segments found are
+ * kept with each message and added to the traffic map and the route by `traffic_message_add_segments()`, on the
+ * main thread, as `traffic_process_messages_int()` gets to the message. Segments of a message which turns out not to
+ * need them (because it can reuse those of a message it replaces) are discarded.
+ *
+ * Only messages whose location would be matched immediately are considered, i.e. those which are not cancellations,
+ * have not expired, have no cached segments to restore and whose location is within the map selection of the route.
+ * Nothing is done unless all maps of the mapset (other than the traffic map) are thread-safe, see
+ * `map_is_thread_safe()`.
+ *
+ * @param this_ The traffic instance
+ */
+static void traffic_match_messages(struct traffic * this_) {
+    /* The pool of worker threads */
+    struct traffic_match_pool * pool;
+
+    /* Current message */
+    struct traffic_message * message;
+
+    /* Iterator over messages */
+    GList * msg_iter;
+
+    /* The maps to match with, and iterator */
+    GList * maps, * map_iter;
+
+    /* Holds queried attributes */
+    struct attr attr;
+
+    /* Map selections for the location and the route, and iterator */
+    struct map_selection * loc_ms, * rt_ms, * ms_iter;
+
+    /* Number of messages submitted */
+    int count = 0;
+
+    if (!this_->shared->message_queue || !this_->shared->ms || !this_->shared->rt
+            || !route_get_attr(this_->shared->rt, attr_route_status, &attr, NULL)
+            || !route_get_pos(this_->shared->rt) || !(attr.u.num & route_status_destination_set))
+        return;
+
+    maps = traffic_segment_cache_check_maps(this_->shared->cache, this_->shared->ms);
+    for (map_iter = maps; map_iter; map_iter = g_list_next(map_iter))
+        if (!map_is_thread_safe((struct map *) map_iter->data))
+            break;
+    if (map_iter) {
+        dbg(lvl_debug, "not all maps are thread-safe, matching locations one at a time");
+        return;
+    }
+
+    if (!this_->shared->pool) {
+        /* the table of default flags is set up on first use, which must not happen on several threads at once */
+        item_get_default_flags(type_none);
+        if (!(this_->shared->pool = traffic_match_pool_new()))
+            return;
+    }
+    pool = this_->shared->pool;
+
+    rt_ms = route_get_selection(this_->shared->rt);
+    thread_lock_acquire(pool->lock);
+    g_list_free(pool->maps);
+    pool->maps = g_list_copy(maps);
+    pool->cache = this_->shared->cache;
+    for (msg_iter = this_->shared->message_queue; msg_iter && (pool->busy < TRAFFIC_MATCH_BATCH);
+            msg_iter = g_list_next(msg_iter)) {
+        message = (struct traffic_message *) msg_iter->data;
+        if (message->is_cancellation || (message->expiration_time < time(NULL)) || message->priv->is_matched
+                || message->priv->items || message->location->priv->txt_data)
+            continue;
+        traffic_location_set_enclosing_rect(message->location, NULL);
+        loc_ms = traffic_location_get_rect(message->location, traffic_map_meth.pro);
+        for (ms_iter = rt_ms; ms_iter; ms_iter = ms_iter->next)
+            if (coord_rect_overlap(&(loc_ms->u.c_rect), &(ms_iter->u.c_rect)))
+                break;
+        map_selection_destroy(loc_ms);
+        if (ms_iter) {
+            message->priv->is_matched = -1;
+            pool->pending = g_list_append(pool->pending, message);
+            pool->busy++;
+            count++;
+        }
+    }
+    if (count)
+        thread_cond_broadcast(pool->cond);
+    thread_lock_release(pool->lock);
+    map_selection_destroy(rt_ms);
+
+    if (count)
+        dbg(lvl_debug, "submitted %d location(s) for matching on %d threads", count, pool->thread_count);
+}
+
+/**
+ * @brief Switches the idle loop of a traffic instance between running as an idle event and polling.
+ *
+ * While the message at the head of the queue is being matched in the background, there is nothing to do on the main
+ * thread but wait, so rather than spinning in the idle loop, `idle_cb` is called every
+ * `TRAFFIC_MATCH_POLL_INTERVAL` milliseconds until the results are in.
+ *
+ * @param this_ The traffic instance, whose `idle_cb` must be set
+ * @param wait Whether to poll for matching results (true) or run as an idle event (false)
+ */
+static void traffic_idle_wait(struct traffic * this_, int wait) {
+    if (wait && !this_->wait_ev) {
+        if (this_->idle_ev)
+            event_remove_idle(this_->idle_ev);
+        this_->idle_ev = NULL;
+        this_->wait_ev = event_add_timeout(TRAFFIC_MATCH_POLL_INTERVAL, 1, this_->idle_cb);
+    } else if (!wait && this_->wait_ev) {
+        event_remove_timeout(this_->wait_ev);
+        this_->wait_ev = NULL;
+        this_->idle_ev = event_add_idle(50, this_->idle_cb);
+    }
+}
+
+/**
+ * @brief Removes the idle loop of a traffic instance.
+ *
+ * @param this_ The traffic instance
+ */
+static void traffic_idle_remove(struct traffic * this_) {
+    if (this_->idle_ev)
+        event_remove_idle(this_->idle_ev);
+    if (this_->wait_ev)
+        event_remove_timeout(this_->wait_ev);
+    if (this_->idle_cb)
+        callback_destroy(this_->idle_cb);
+    this_->idle_ev = NULL;
+    this_->wait_ev = NULL;
+    this_->idle_cb = NULL;
+}
+
 /**
  * @brief Processes new traffic messages.
  *
@@ -4368,13 +5138,23 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
     /* Time elapsed since start */
     double msec = 0;
 
+    /* Whether the message at the head of the queue is still being matched in the background */
+    int waiting = 0;
+
     if (this_->shared->message_queue)
         dbg(lvl_debug, "*****enter, %d messages in queue", g_list_length(this_->shared->message_queue));
 
+    traffic_match_messages(this_);
+
     gettimeofday(&start, NULL);
     for (; this_->shared->message_queue && (msec < TIME_SLICE);
             this_->shared->message_queue = g_list_remove(this_->shared->message_queue, message)) {
         message = (struct traffic_message *) this_->shared->message_queue->data;
+        if (traffic_match_pool_is_busy(this_->shared->pool, message)) {
+            /* messages must be processed in order, come back when the results are in */
+            waiting = 1;
+            break;
+        }
         i++;
         if (message->expiration_time < time(NULL)) {
             dbg(lvl_debug, "message is no longer valid, ignoring");
@@ -4410,6 +5190,7 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
 
                 if (swap_candidate) {
                     dbg(lvl_debug, "*****checkpoint PROCESS-4, swap candidate found");
+                    traffic_message_discard_matched(message);
                     /* reuse location and segments if we are replacing a matching message */
                     swap_location = message->location;
                     swap_items = message->priv->items;
@@ -4445,8 +5226,8 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
                                  */
                                 if (!message->priv->items) {
                                     /* TODO do this in an idle loop, not here */
-                                    traffic_message_add_segments(message, this_->shared->ms, data,
-                                                                 this_->shared->map, this_->shared->rt);
+                                    traffic_message_add_segments(message, this_->shared->ms, this_->shared->cache,
+                                                                 data, this_->shared->map, this_->shared->rt);
                                     break;
                                     map_selection_destroy(loc_ms);
                                     map_selection_destroy(rt_ms);
@@ -4496,17 +5277,14 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
 
     if (this_->shared->message_queue) {
         /* if we're in the middle of the queue, trigger a redraw (if needed) and exit */
+        if (this_->idle_cb)
+            traffic_idle_wait(this_, waiting);
         if ((ret & MESSAGE_UPDATE_SEGMENTS) && (navit_get_ready(this_->navit) == 3))
             navit_draw_async(this_->navit, 1);
         return ret;
     } else {
         /* last pass, remove our idle event and callback */
-        if (this_->idle_ev)
-            event_remove_idle(this_->idle_ev);
-        if (this_->idle_cb)
-            callback_destroy(this_->idle_cb);
-        this_->idle_ev = NULL;
-        this_->idle_cb = NULL;
+        traffic_idle_remove(this_);
     }
 
     if (flags & PROCESS_MESSAGES_PURGE_EXPIRED) {
@@ -4543,6 +5321,8 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
         traffic_dump_messages_to_xml(this_->shared);
     }
 
+    traffic_segment_cache_log_stats(this_->shared->cache);
+
     /* TODO see comment on route_recalculate_partial about thread-safety */
     route_recalculate_partial(this_->shared->rt);
 
@@ -4570,10 +5350,7 @@ static void traffic_loop(struct traffic * this_) {
 
     /* make sure traffic_process_messages_int runs at least once to ensure purging of expired messages */
     if (this_->shared->message_queue) {
-        if (this_->idle_ev)
-            event_remove_idle(this_->idle_ev);
-        if (this_->idle_cb)
-            callback_destroy(this_->idle_cb);
+        traffic_idle_remove(this_);
         this_->idle_cb = callback_new_2(callback_cast(traffic_process_messages_int),
                                         this_, PROCESS_MESSAGES_PURGE_EXPIRED);
         this_->idle_ev = event_add_idle(50, this_->idle_cb);
@@ -5706,6 +6483,7 @@ void traffic_message_destroy(struct traffic_message * this_) {
             *items = tm_item_unref(*items);
         g_free(this_->priv->items);
     }
+    traffic_message_discard_matched(this_);
     g_free(this_->priv);
     g_free(this_);
 }
@@ -5815,7 +6593,7 @@ struct map * traffic_get_map(struct traffic *this_) {
                 if (!this_->idle_cb)
                     this_->idle_cb = callback_new_2(callback_cast(traffic_process_messages_int),
                                                     this_, PROCESS_MESSAGES_NO_DUMP_STORE);
-                if (!this_->idle_ev)
+                if (!this_->idle_ev && !this_->wait_ev)
                     this_->idle_ev = event_add_idle(50, this_->idle_cb);
             }
         }
@@ -5902,7 +6680,8 @@ struct traffic_message ** traffic_get_stored_messages(struct traffic *this_) {
         message = (struct traffic_message *) msgiter->data;
         if (message->priv->items == NULL) {
             data = traffic_message_parse_events(message);
-            traffic_message_add_segments(message, this_->shared->ms, data, this_->shared->map, this_->shared->rt);
+            traffic_message_add_segments(message, this_->shared->ms, this_->shared->cache, data,
+                                         this_->shared->map, this_->shared->rt);
             g_free(data);
         }
     }
@@ -5921,10 +6700,7 @@ void traffic_process_messages(struct traffic * this_, struct traffic_message **
     for (cur_msg = messages; cur_msg && *cur_msg; cur_msg++)
         this_->shared->message_queue = g_list_append(this_->shared->message_queue, *cur_msg);
     if (this_->shared->message_queue) {
-        if (this_->idle_ev)
-            event_remove_idle(this_->idle_ev);
-        if (this_->idle_cb)
-            callback_destroy(this_->idle_cb);
+        traffic_idle_remove(this_);
         this_->idle_cb = callback_new_2(callback_cast(traffic_process_messages_int), this_, 0);
         this_->idle_ev = event_add_idle(50, this_->idle_cb);
     }
@@ -5932,6 +6708,7 @@ void traffic_process_messages(struct traffic * this_, struct traffic_message **
 
 void traffic_set_mapset(struct traffic *this_, struct mapset *ms) {
     this_->shared->ms = ms;
+    traffic_segment_cache_flush(this_->shared->cache);
 }
 
 void traffic_set_route(struct traffic *this_, struct route *rt) {
@@ -276,6 +276,94 @@ char *vehicleprofile_get_name(struct vehicleprofile *this_) {
     return this_->name;
 }
 
+/**
+ * @brief Mixes a value into a hash
+ */
+static unsigned int vehicleprofile_hash_int(unsigned int hash, int val) {
+    return (hash ^ (unsigned int)val) * 16777619U;
+}
+
+/**
+ * @brief Mixes a string into a hash
+ */
+static unsigned int vehicleprofile_hash_str(unsigned int hash, char *str) {
+    if (str)
+        while (*str)
+            hash=vehicleprofile_hash_int(hash, (unsigned char)*str++);
+    return vehicleprofile_hash_int(hash, 0);
+}
+
+/**
+ * @brief Adds the hash of a road profile to the sum pointed to by `user_data`
+ */
+static void vehicleprofile_hash_roadprofile(gpointer key, gpointer value, gpointer user_data) {
+    struct roadprofile *rp=value;
+    unsigned int hash=2166136261U;
+    hash=vehicleprofile_hash_int(hash, GPOINTER_TO_INT(key));
+    hash=vehicleprofile_hash_int(hash, rp->speed);
+    hash=vehicleprofile_hash_int(hash, rp->route_weight);
+    hash=vehicleprofile_hash_int(hash, rp->maxspeed);
+    /* the hash table has no defined order, so combine the entries in a way which does not depend on it */
+    *(unsigned int *)user_data+=hash;
+}
+
+/**
+ * @brief Returns a hash of the vehicle profile
+ *
+ * The hash covers all settings of the profile, including its road profiles, and is the same across program runs for
+ * identical settings. It can be used to detect whether data derived from the profile, such as a cached route graph,
+ * is still valid.
+ *
+ * @param this_ The vehicle profile
+ */
+unsigned int vehicleprofile_get_hash(struct vehicleprofile *this_) {
+    unsigned int hash=2166136261U,roads=0;
+
+    hash=vehicleprofile_hash_int(hash, this_->mode);
+    hash=vehicleprofile_hash_int(hash, this_->flags_forward_mask);
+    hash=vehicleprofile_hash_int(hash, this_->flags_reverse_mask);
+    hash=vehicleprofile_hash_int(hash, this_->flags);
+    hash=vehicleprofile_hash_int(hash, this_->maxspeed_handling);
+    hash=vehicleprofile_hash_str(hash, this_->name);
+    hash=vehicleprofile_hash_str(hash, this_->route_depth);
+    hash=vehicleprofile_hash_int(hash, this_->width);
+    hash=vehicleprofile_hash_int(hash, this_->height);
+    hash=vehicleprofile_hash_int(hash, this_->length);
+    hash=vehicleprofile_hash_int(hash, this_->weight);
+    hash=vehicleprofile_hash_int(hash, this_->axle_weight);
+    hash=vehicleprofile_hash_int(hash, this_->dangerous_goods);
+    hash=vehicleprofile_hash_int(hash, this_->through_traffic_penalty);
+    hash=vehicleprofile_hash_int(hash, this_->turn_around_penalty);
+    hash=vehicleprofile_hash_int(hash, this_->turn_around_penalty2);
+    if (this_->roadprofile_hash)
+        g_hash_table_foreach(this_->roadprofile_hash, vehicleprofile_hash_roadprofile, &roads);
+    return vehicleprofile_hash_int(hash, roads);
+}
+
+/**
+ * @brief Raises the maximum pointed to by `user_data` to the route weight of a road profile
+ */
+static void vehicleprofile_max_route_weight(gpointer key, gpointer value, gpointer user_data) {
+    struct roadprofile *rp=value;
+    if (rp->route_weight > *(int *)user_data)
+        *(int *)user_data=rp->route_weight;
+}
+
+/**
+ * @brief Returns the highest route weight (i.e. the speed assumed for routing) of all road profiles
+ *
+ * Unless the profile enforces the maximum speed of segments, no segment can be traveled faster than this.
+ *
+ * @param this_ The vehicle profile
+ * @return The highest route weight in km/h, or 0 if the profile has no road profiles
+ */
+int vehicleprofile_get_max_route_weight(struct vehicleprofile *this_) {
+    int ret=0;
+    if (this_->roadprofile_hash)
+        g_hash_table_foreach(this_->roadprofile_hash, vehicleprofile_max_route_weight, &ret);
+    return ret;
+}
+
 static int vehicleprofile_init(struct vehicleprofile *this_) {
     vehicleprofile_update(this_);
     return 0;
@@ -66,6 +66,8 @@ struct roadprofile * vehicleprofile_get_roadprofile(struct vehicleprofile *this_
 
 //! Returns the vehicle profile's name.
 char * vehicleprofile_get_name(struct vehicleprofile *this_);
+unsigned int vehicleprofile_get_hash(struct vehicleprofile *this_);
+int vehicleprofile_get_max_route_weight(struct vehicleprofile *this_);
 #ifdef __cplusplus
 }
 #endif
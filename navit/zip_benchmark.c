@@ -0,0 +1,279 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Reports the size of the members of a binfile map and how fast they are decoded
+ *
+ * The central directory of the map is read and every member is decoded through
+ * `file_data_read_compressed_uncached()`, the same function binfile uses for tiles, so the result reflects the
+ * compression methods this binary supports (deflate, and zstd if built with `HAVE_ZSTD`). Members are decoded the
+ * given number of rounds. For each compression method found, one line is written with the number of members, their
+ * compressed and uncompressed size (in bytes), the compression ratio, the processor time taken to decode them (in
+ * milliseconds) and the decoding speed (in MB of uncompressed data per second). Stored members are not timed. A
+ * checksum of the uncompressed data follows, which must be the same for maps written from the same data with
+ * different methods or levels. If a member cannot be decoded, e.g. because the method is not supported, nothing is
+ * reported and the exit status is 1.
+ *
+ * Usage: zip_benchmark [-r rounds] [-d level] map.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+#include "config.h"
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+#include "debug.h"
+#include "file.h"
+#include "zipfile.h"
+#include "endianess.h"
+
+/** Largest compression method number counted separately, others are counted as the last one */
+#define BENCH_METHODS 128
+
+/**
+ * @brief Statistics for the members of the map which use one compression method
+ */
+struct bench_method {
+    int count;                  /**< Number of members */
+    long long size;             /**< Compressed size, in bytes */
+    long long size_uncomp;      /**< Uncompressed size, in bytes */
+    double msec;                /**< Processor time taken to decode the members in all rounds */
+};
+
+static void bench_usage(void) {
+    fprintf(stderr, "usage: zip_benchmark [-r rounds] [-d level] map.bin\n");
+}
+
+static double bench_clock(void) {
+    return (double)clock() * 1000 / CLOCKS_PER_SEC;
+}
+
+static const char *bench_method_name(int method) {
+    switch (method) {
+    case 0:
+        return "stored";
+    case 8:
+        return "deflate";
+    case zip_method_zstd:
+        return "zstd";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * @brief Finds the central directory of a zip file
+ *
+ * @param fi The file
+ * @param offset Receives the offset of the central directory
+ * @param count Receives the number of members
+ *
+ * @return True on success
+ */
+static int bench_find_cd(struct file *fi, long long *offset, long long *count) {
+    struct zip_eoc *eoc;
+    struct zip64_eocl *eocl;
+    struct zip64_eoc *eoc64;
+    long long size=file_size(fi);
+    int ret=0;
+
+    if (size < sizeof(*eoc))
+        return 0;
+    eoc=(struct zip_eoc *)file_data_read(fi, size-sizeof(*eoc), sizeof(*eoc));
+    if (!eoc)
+        return 0;
+    if (le32_to_cpu(eoc->zipesig) == zip_eoc_sig) {
+        *offset=le32_to_cpu(eoc->zipeofst);
+        *count=le16_to_cpu(eoc->zipecenn);
+        ret=1;
+        if (*offset == zip_size_64bit_placeholder && size >= sizeof(*eoc)+sizeof(*eocl)) {
+            ret=0;
+            eocl=(struct zip64_eocl *)file_data_read(fi, size-sizeof(*eoc)-sizeof(*eocl), sizeof(*eocl));
+            if (eocl && le32_to_cpu(eocl->zip64lsig) == zip64_eocl_sig) {
+                eoc64=(struct zip64_eoc *)file_data_read(fi, eocl->zip64lofst, sizeof(*eoc64));
+                if (eoc64 && le32_to_cpu(eoc64->zip64esig) == zip64_eoc_sig) {
+                    *offset=eoc64->zip64eofst;
+                    *count=eoc64->zip64ecenn;
+                    ret=1;
+                }
+                file_data_free(fi, (unsigned char *)eoc64);
+            }
+            file_data_free(fi, (unsigned char *)eocl);
+        }
+    }
+    file_data_free(fi, (unsigned char *)eoc);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    struct bench_method methods[BENCH_METHODS];
+    struct zip_cd *cd;
+    struct zip_cd_ext *ext;
+    struct zip_lfh *lfh;
+    struct file *fi;
+    long long cd_offset, count, i, *offsets;
+    int *sizes, *sizes_uncomp, *method_ids;
+    unsigned char *data;
+    unsigned long long checksum=0;
+    long long total_size=0, total_size_uncomp=0, decoded_size_uncomp=0;
+    double start, total_msec=0;
+    int opt, rounds=10, round, members=0, method, j, cd_size, failed=0;
+
+    _g_slice_thread_init_nomessage();
+    debug_init(argv[0]);
+    file_init();
+
+    while ((opt = getopt(argc, argv, "d:hr:")) != -1) {
+        switch (opt) {
+        case 'd':
+            debug_set_global_level(atoi(optarg), 1);
+            break;
+        case 'r':
+            rounds=atoi(optarg);
+            break;
+        default:
+            bench_usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc-1 || rounds < 1) {
+        bench_usage();
+        return 1;
+    }
+
+    fi=file_create(argv[optind], NULL);
+    if (!fi) {
+        fprintf(stderr, "zip_benchmark: cannot open '%s'\n", argv[optind]);
+        return 1;
+    }
+    file_mmap(fi);
+    if (!bench_find_cd(fi, &cd_offset, &count)) {
+        fprintf(stderr, "zip_benchmark: '%s' is not a zip file\n", argv[optind]);
+        file_destroy(fi);
+        return 1;
+    }
+
+    /* collect the members first, so that only decoding is timed */
+    offsets=g_new(long long, count);
+    sizes=g_new(int, count);
+    sizes_uncomp=g_new(int, count);
+    method_ids=g_new(int, count);
+    for (i = 0 ; i < count ; i++) {
+        cd=(struct zip_cd *)file_data_read(fi, cd_offset, sizeof(*cd));
+        if (!cd || le32_to_cpu(cd->zipcensig) != zip_cd_sig) {
+            file_data_free(fi, (unsigned char *)cd);
+            break;
+        }
+        cd_size=sizeof(*cd)+le16_to_cpu(cd->zipcfnl)+le16_to_cpu(cd->zipcxtl)+le16_to_cpu(cd->zipccml);
+        file_data_free(fi, (unsigned char *)cd);
+        cd=(struct zip_cd *)file_data_read(fi, cd_offset, cd_size);
+        if (!cd)
+            break;
+        offsets[members]=le32_to_cpu(cd->zipofst);
+        if (offsets[members] == zip_size_64bit_placeholder && le16_to_cpu(cd->zipcxtl) == sizeof(*ext)) {
+            ext=(struct zip_cd_ext *)((unsigned char *)cd+sizeof(*cd)+le16_to_cpu(cd->zipcfnl));
+            if (le16_to_cpu(ext->tag) == zip_extra_header_id_zip64)
+                offsets[members]=ext->zipofst;
+        }
+        sizes[members]=le32_to_cpu(cd->zipcsiz);
+        sizes_uncomp[members]=le32_to_cpu(cd->zipcunc);
+        method_ids[members]=le16_to_cpu(cd->zipcmthd);
+        file_data_free(fi, (unsigned char *)cd);
+        cd_offset+=cd_size;
+        lfh=(struct zip_lfh *)file_data_read(fi, offsets[members], sizeof(*lfh));
+        if (!lfh || le32_to_cpu(lfh->ziplocsig) != zip_lfh_sig) {
+            file_data_free(fi, (unsigned char *)lfh);
+            continue;
+        }
+        offsets[members]+=sizeof(*lfh)+le16_to_cpu(lfh->zipfnln)+le16_to_cpu(lfh->zipxtraln);
+        file_data_free(fi, (unsigned char *)lfh);
+        members++;
+    }
+    if (i < count)
+        fprintf(stderr, "zip_benchmark: central directory ends after %lld of %lld members\n", i, count);
+
+    memset(methods, 0, sizeof(methods));
+    for (j = 0 ; j < members ; j++) {
+        method=MIN(method_ids[j], BENCH_METHODS-1);
+        methods[method].count++;
+        methods[method].size+=sizes[j];
+        methods[method].size_uncomp+=sizes_uncomp[j];
+    }
+
+    for (round = 0 ; round < rounds && !failed ; round++) {
+        for (j = 0 ; j < members && !failed ; j++) {
+            if (!method_ids[j]) {
+                /* stored members only count towards the checksum */
+                if (!round && (data=file_data_read(fi, offsets[j], sizes_uncomp[j]))) {
+                    for (i = 0 ; i < sizes_uncomp[j] ; i++)
+                        checksum=checksum*31+data[i];
+                    file_data_free(fi, data);
+                }
+                continue;
+            }
+            start=bench_clock();
+            data=file_data_read_compressed_uncached(fi, offsets[j], sizes[j], sizes_uncomp[j], method_ids[j]);
+            methods[MIN(method_ids[j], BENCH_METHODS-1)].msec+=bench_clock()-start;
+            if (!data) {
+                fprintf(stderr, "zip_benchmark: cannot decode member %d (%s)\n", j, bench_method_name(method_ids[j]));
+                failed=1;
+                continue;
+            }
+            if (!round)
+                for (i = 0 ; i < sizes_uncomp[j] ; i++)
+                    checksum=checksum*31+data[i];
+            g_free(data);
+        }
+    }
+
+    if (!failed) {
+        printf("method,members,size,size_uncomp,ratio,msec,mb_per_sec\n");
+        for (method = 0 ; method < BENCH_METHODS ; method++) {
+            if (!methods[method].count)
+                continue;
+            total_size+=methods[method].size;
+            total_size_uncomp+=methods[method].size_uncomp;
+            total_msec+=methods[method].msec;
+            if (method)
+                decoded_size_uncomp+=methods[method].size_uncomp;
+            printf("%s,%d,%lld,%lld,%.3f,%.1f,%.1f\n", bench_method_name(method), methods[method].count,
+                   methods[method].size, methods[method].size_uncomp,
+                   methods[method].size_uncomp ? (double)methods[method].size/methods[method].size_uncomp : 0,
+                   methods[method].msec,
+                   methods[method].msec > 0 ? methods[method].size_uncomp*rounds/(methods[method].msec*1000) : 0);
+        }
+        printf("total,%d,%lld,%lld,%.3f,%.1f,%.1f\n", members, total_size, total_size_uncomp,
+               total_size_uncomp ? (double)total_size/total_size_uncomp : 0, total_msec,
+               total_msec > 0 ? decoded_size_uncomp*rounds/(total_msec*1000) : 0);
+        printf("file size %lld, checksum %llx\n", file_size(fi), checksum);
+    }
+
+    g_free(offsets);
+    g_free(sizes);
+    g_free(sizes_uncomp);
+    g_free(method_ids);
+    file_destroy(fi);
+    return failed;
+}
@@ -41,6 +41,9 @@ struct zip_split {
 #define zip_lfh_sig 0x04034b50
 #define zip_lfh_sig_rev 0x504b0304
 
+/** Compression method for members compressed with Zstandard, as assigned by the ZIP specification */
+#define zip_method_zstd 93
+
 
 //! ZIP local file header structure.
 